@@ -0,0 +1,1077 @@
+#include "BCnCodec.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <thread>
+
+namespace
+{
+	// DXGI_FORMAT values, spelled out so this file does not need dxgiformat.h.
+	const uint32_t DxgiBC1Unorm = 71;
+	const uint32_t DxgiBC1UnormSrgb = 72;
+	const uint32_t DxgiBC3Unorm = 77;
+	const uint32_t DxgiBC3UnormSrgb = 78;
+	const uint32_t DxgiBC5Unorm = 83;
+	const uint32_t DxgiBC7Unorm = 98;
+	const uint32_t DxgiBC7UnormSrgb = 99;
+
+	// One 4x4 block as floats, always four channels so the fitting code is shared.
+	typedef float TexelBlock[16][4];
+
+	inline int Clamp(int v, int lo, int hi)
+	{
+		return v < lo ? lo : (v > hi ? hi : v);
+	}
+
+	inline int RoundToInt(float v)
+	{
+		return (int)std::floor(v + 0.5f);
+	}
+
+	inline float ClampUnorm8(float v)
+	{
+		return v < 0.0f ? 0.0f : (v > 255.0f ? 255.0f : v);
+	}
+
+	//--------------------------------------------------------------------------
+	// Endpoint fitting shared by every encoder.
+	//--------------------------------------------------------------------------
+
+	// Endpoints spanning the selected texels along their principal axis, or the
+	// bounding box corners when pca is false.
+	void FitLine(const TexelBlock px, const bool* use, int channels, bool pca, float e0[4], float e1[4])
+	{
+		float mean[4] = {};
+		float mn[4], mx[4];
+		for(int c = 0; c < 4; ++c)
+		{
+			mn[c] = 255.0f;
+			mx[c] = 0.0f;
+			e0[c] = e1[c] = 0.0f;
+		}
+
+		int n = 0;
+		for(int i = 0; i < 16; ++i)
+		{
+			if(!use[i])
+				continue;
+			++n;
+			for(int c = 0; c < channels; ++c)
+			{
+				mean[c] += px[i][c];
+				mn[c] = std::min(mn[c], px[i][c]);
+				mx[c] = std::max(mx[c], px[i][c]);
+			}
+		}
+		if(n == 0)
+			return;
+
+		if(!pca)
+		{
+			// Inset the box a little; quantization error otherwise always
+			// pushes the interpolated colors outwards.
+			for(int c = 0; c < channels; ++c)
+			{
+				float inset = (mx[c] - mn[c]) / 32.0f;
+				e0[c] = mn[c] + inset;
+				e1[c] = mx[c] - inset;
+			}
+			return;
+		}
+
+		float cov[4][4] = {};
+		for(int c = 0; c < channels; ++c)
+			mean[c] /= (float)n;
+		for(int i = 0; i < 16; ++i)
+		{
+			if(!use[i])
+				continue;
+			float d[4];
+			for(int c = 0; c < channels; ++c)
+				d[c] = px[i][c] - mean[c];
+			for(int r = 0; r < channels; ++r)
+				for(int c = r; c < channels; ++c)
+					cov[r][c] += d[r] * d[c];
+		}
+		for(int r = 0; r < channels; ++r)
+			for(int c = 0; c < r; ++c)
+				cov[r][c] = cov[c][r];
+
+		// Power iteration, seeded with the box diagonal.
+		float axis[4] = {};
+		for(int c = 0; c < channels; ++c)
+			axis[c] = mx[c] - mn[c];
+		for(int iter = 0; iter < 8; ++iter)
+		{
+			float next[4] = {};
+			float largest = 0.0f;
+			for(int r = 0; r < channels; ++r)
+			{
+				for(int c = 0; c < channels; ++c)
+					next[r] += cov[r][c] * axis[c];
+				largest = std::max(largest, std::fabs(next[r]));
+			}
+			if(largest <= 0.0f)
+				break;
+			for(int c = 0; c < channels; ++c)
+				axis[c] = next[c] / largest;
+		}
+
+		float len2 = 0.0f;
+		for(int c = 0; c < channels; ++c)
+			len2 += axis[c] * axis[c];
+		if(len2 <= 1e-8f)
+		{
+			for(int c = 0; c < channels; ++c)
+				e0[c] = e1[c] = mean[c];
+			return;
+		}
+
+		float tmin = std::numeric_limits<float>::max();
+		float tmax = -tmin;
+		for(int i = 0; i < 16; ++i)
+		{
+			if(!use[i])
+				continue;
+			float t = 0.0f;
+			for(int c = 0; c < channels; ++c)
+				t += (px[i][c] - mean[c]) * axis[c];
+			tmin = std::min(tmin, t);
+			tmax = std::max(tmax, t);
+		}
+		for(int c = 0; c < channels; ++c)
+		{
+			e0[c] = ClampUnorm8(mean[c] + axis[c] * tmin / len2);
+			e1[c] = ClampUnorm8(mean[c] + axis[c] * tmax / len2);
+		}
+	}
+
+	// Least squares endpoints for fixed interpolation weights; w[i] is the
+	// weight of e1 for texel i.  Returns false when the system is singular.
+	bool SolveEndpoints(const TexelBlock px, const float* w, const bool* use, int channels, float e0[4], float e1[4])
+	{
+		float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+		float ax[4] = {}, bx[4] = {};
+		for(int i = 0; i < 16; ++i)
+		{
+			if(!use[i])
+				continue;
+			float b = w[i];
+			float a = 1.0f - b;
+			aa += a * a;
+			ab += a * b;
+			bb += b * b;
+			for(int c = 0; c < channels; ++c)
+			{
+				ax[c] += a * px[i][c];
+				bx[c] += b * px[i][c];
+			}
+		}
+
+		float det = aa * bb - ab * ab;
+		if(std::fabs(det) < 1e-6f)
+			return false;
+
+		float inv = 1.0f / det;
+		for(int c = 0; c < channels; ++c)
+		{
+			e0[c] = ClampUnorm8((ax[c] * bb - bx[c] * ab) * inv);
+			e1[c] = ClampUnorm8((bx[c] * aa - ax[c] * ab) * inv);
+		}
+		return true;
+	}
+
+	// Picks the nearest palette entry for every selected texel, returns the total squared error.
+	float SelectIndices(const TexelBlock px, const bool* use, const int pal[][4], int count,
+		int firstChannel, int channels, uint8_t* indices)
+	{
+		float total = 0.0f;
+		for(int i = 0; i < 16; ++i)
+		{
+			if(!use[i])
+				continue;
+			float best = std::numeric_limits<float>::max();
+			for(int k = 0; k < count; ++k)
+			{
+				float err = 0.0f;
+				for(int c = firstChannel; c < firstChannel + channels; ++c)
+				{
+					float d = px[i][c] - (float)pal[k][c];
+					err += d * d;
+				}
+				if(err < best)
+				{
+					best = err;
+					indices[i] = (uint8_t)k;
+				}
+			}
+			total += best;
+		}
+		return total;
+	}
+
+	//--------------------------------------------------------------------------
+	// BC1
+	//--------------------------------------------------------------------------
+
+	inline uint16_t Pack565(const float c[4])
+	{
+		int r = Clamp(RoundToInt(c[0] * 31.0f / 255.0f), 0, 31);
+		int g = Clamp(RoundToInt(c[1] * 63.0f / 255.0f), 0, 63);
+		int b = Clamp(RoundToInt(c[2] * 31.0f / 255.0f), 0, 31);
+		return (uint16_t)((r << 11) | (g << 5) | b);
+	}
+
+	inline void Unpack565(uint16_t v, int c[4])
+	{
+		int r = (v >> 11) & 31;
+		int g = (v >> 5) & 63;
+		int b = v & 31;
+		c[0] = (r << 3) | (r >> 2);
+		c[1] = (g << 2) | (g >> 4);
+		c[2] = (b << 3) | (b >> 2);
+		c[3] = 255;
+	}
+
+	// Four color mode when c0 > c1, otherwise three colors plus transparent black.
+	// The color half of a BC3 block is always four color.
+	void BC1Palette(uint16_t c0, uint16_t c1, bool fourColor, int pal[4][4])
+	{
+		fourColor |= c0 > c1;
+		Unpack565(c0, pal[0]);
+		Unpack565(c1, pal[1]);
+		for(int c = 0; c < 3; ++c)
+		{
+			if(fourColor)
+			{
+				pal[2][c] = (2 * pal[0][c] + pal[1][c] + 1) / 3;
+				pal[3][c] = (pal[0][c] + 2 * pal[1][c] + 1) / 3;
+			}
+			else
+			{
+				pal[2][c] = (pal[0][c] + pal[1][c] + 1) / 2;
+				pal[3][c] = 0;
+			}
+		}
+		pal[2][3] = 255;
+		pal[3][3] = fourColor ? 255 : 0;
+	}
+
+	struct BC1Candidate
+	{
+		uint16_t C0 = 0;
+		uint16_t C1 = 0;
+		uint8_t Indices[16] = {};
+		float Error = std::numeric_limits<float>::max();
+	};
+
+	BC1Candidate EvaluateBC1(const TexelBlock px, const bool* use, uint16_t a, uint16_t b, bool threeColor)
+	{
+		BC1Candidate cand;
+		cand.C0 = threeColor ? std::min(a, b) : std::max(a, b);
+		cand.C1 = threeColor ? std::max(a, b) : std::min(a, b);
+
+		int pal[4][4];
+		BC1Palette(cand.C0, cand.C1, false, pal);
+		int count = (cand.C0 > cand.C1) ? 4 : 3;
+		for(int i = 0; i < 16; ++i)
+			cand.Indices[i] = 3;
+		cand.Error = SelectIndices(px, use, pal, count, 0, 3, cand.Indices);
+		return cand;
+	}
+
+	// punchThrough is false for the color half of BC3, which also rules out three color mode.
+	void EncodeBC1(const uint8_t* texels, uint8_t* out, BCQuality quality, bool punchThrough)
+	{
+		TexelBlock px;
+		bool use[16];
+		bool anyTransparent = false;
+		bool anyOpaque = false;
+		for(int i = 0; i < 16; ++i)
+		{
+			for(int c = 0; c < 4; ++c)
+				px[i][c] = texels[i * 4 + c];
+			use[i] = !(punchThrough && texels[i * 4 + 3] < 128);
+			anyTransparent |= !use[i];
+			anyOpaque |= use[i];
+		}
+
+		BC1Candidate best;
+		if(!anyOpaque)
+		{
+			// c0 == c1 selects three color mode, index 3 is transparent black.
+			best.C0 = best.C1 = 0;
+			std::fill(best.Indices, best.Indices + 16, (uint8_t)3);
+		}
+		else
+		{
+			float e0[4], e1[4];
+			FitLine(px, use, 3, quality != BCQuality::Fast, e0, e1);
+			best = EvaluateBC1(px, use, Pack565(e0), Pack565(e1), anyTransparent);
+			if(punchThrough && !anyTransparent && quality == BCQuality::High)
+			{
+				BC1Candidate three = EvaluateBC1(px, use, Pack565(e0), Pack565(e1), true);
+				if(three.Error < best.Error)
+					best = three;
+			}
+
+			const int passes = quality == BCQuality::Fast ? 0 : (quality == BCQuality::Normal ? 1 : 3);
+			for(int pass = 0; pass < passes && best.Error > 0.0f; ++pass)
+			{
+				const bool threeColor = punchThrough && best.C0 <= best.C1;
+				static const float w4[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+				static const float w3[4] = { 0.0f, 1.0f, 0.5f, 0.0f };
+				float w[16];
+				for(int i = 0; i < 16; ++i)
+					w[i] = (threeColor ? w3 : w4)[best.Indices[i]];
+
+				if(!SolveEndpoints(px, w, use, 3, e0, e1))
+					break;
+				BC1Candidate cand = EvaluateBC1(px, use, Pack565(e0), Pack565(e1), threeColor);
+				if(cand.Error >= best.Error)
+					break;
+				best = cand;
+			}
+		}
+
+		out[0] = (uint8_t)(best.C0 & 0xFF);
+		out[1] = (uint8_t)(best.C0 >> 8);
+		out[2] = (uint8_t)(best.C1 & 0xFF);
+		out[3] = (uint8_t)(best.C1 >> 8);
+		uint32_t bits = 0;
+		for(int i = 0; i < 16; ++i)
+			bits |= (uint32_t)best.Indices[i] << (i * 2);
+		memcpy(out + 4, &bits, 4);
+	}
+
+	void DecodeBC1(const uint8_t* block, uint8_t* texels, bool fourColor)
+	{
+		uint16_t c0 = (uint16_t)(block[0] | (block[1] << 8));
+		uint16_t c1 = (uint16_t)(block[2] | (block[3] << 8));
+		int pal[4][4];
+		BC1Palette(c0, c1, fourColor, pal);
+
+		uint32_t bits;
+		memcpy(&bits, block + 4, 4);
+		for(int i = 0; i < 16; ++i)
+		{
+			const int* p = pal[(bits >> (i * 2)) & 3];
+			for(int c = 0; c < 4; ++c)
+				texels[i * 4 + c] = (uint8_t)p[c];
+		}
+	}
+
+	//--------------------------------------------------------------------------
+	// BC4, one channel; used for BC3 alpha and both BC5 channels.
+	//--------------------------------------------------------------------------
+
+	// Eight interpolated values when a0 > a1, otherwise six plus 0 and 255.
+	void BC4Palette(int a0, int a1, int pal[8])
+	{
+		pal[0] = a0;
+		pal[1] = a1;
+		if(a0 > a1)
+		{
+			for(int i = 1; i < 7; ++i)
+				pal[i + 1] = ((7 - i) * a0 + i * a1 + 3) / 7;
+		}
+		else
+		{
+			for(int i = 1; i < 5; ++i)
+				pal[i + 1] = ((5 - i) * a0 + i * a1 + 2) / 5;
+			pal[6] = 0;
+			pal[7] = 255;
+		}
+	}
+
+	int EvaluateBC4(const int* v, int a0, int a1, uint8_t* indices)
+	{
+		int pal[8];
+		BC4Palette(a0, a1, pal);
+		int total = 0;
+		for(int i = 0; i < 16; ++i)
+		{
+			int best = std::numeric_limits<int>::max();
+			for(int k = 0; k < 8; ++k)
+			{
+				int d = v[i] - pal[k];
+				if(d * d < best)
+				{
+					best = d * d;
+					indices[i] = (uint8_t)k;
+				}
+			}
+			total += best;
+		}
+		return total;
+	}
+
+	// src points at the channel of texel 0, texels are stride bytes apart.
+	void EncodeBC4(const uint8_t* src, int stride, uint8_t* out, BCQuality quality)
+	{
+		int v[16];
+		int mn = 255, mx = 0;
+		for(int i = 0; i < 16; ++i)
+		{
+			v[i] = src[i * stride];
+			mn = std::min(mn, v[i]);
+			mx = std::max(mx, v[i]);
+		}
+
+		int bestA0 = mx, bestA1 = mn;
+		uint8_t bestIdx[16], idx[16];
+		int bestErr = EvaluateBC4(v, mx, mn, bestIdx);
+
+		// Pulling the endpoints in usually lands the interpolated values closer.
+		const int range = quality == BCQuality::Fast ? 0 : (quality == BCQuality::Normal ? 2 : 5);
+		for(int d0 = 0; d0 <= range && bestErr > 0; ++d0)
+		{
+			for(int d1 = 0; d1 <= range; ++d1)
+			{
+				int a0 = mx - d0, a1 = mn + d1;
+				if(a0 <= a1 || (d0 == 0 && d1 == 0))
+					continue;
+				int err = EvaluateBC4(v, a0, a1, idx);
+				if(err < bestErr)
+				{
+					bestErr = err;
+					bestA0 = a0;
+					bestA1 = a1;
+					memcpy(bestIdx, idx, 16);
+				}
+			}
+		}
+
+		// Six value mode represents 0 and 255 exactly and spends the rest on the others.
+		if(quality == BCQuality::High && bestErr > 0)
+		{
+			int lo = 255, hi = 0;
+			for(int i = 0; i < 16; ++i)
+			{
+				if(v[i] != 0 && v[i] != 255)
+				{
+					lo = std::min(lo, v[i]);
+					hi = std::max(hi, v[i]);
+				}
+			}
+			if(lo > hi)
+				lo = hi = 0;
+			int err = EvaluateBC4(v, lo, hi, idx);
+			if(err < bestErr)
+			{
+				bestErr = err;
+				bestA0 = lo;
+				bestA1 = hi;
+				memcpy(bestIdx, idx, 16);
+			}
+		}
+
+		out[0] = (uint8_t)bestA0;
+		out[1] = (uint8_t)bestA1;
+		uint64_t bits = 0;
+		for(int i = 0; i < 16; ++i)
+			bits |= (uint64_t)bestIdx[i] << (i * 3);
+		for(int i = 0; i < 6; ++i)
+			out[2 + i] = (uint8_t)(bits >> (i * 8));
+	}
+
+	void DecodeBC4(const uint8_t* block, uint8_t* dst, int stride)
+	{
+		int pal[8];
+		BC4Palette(block[0], block[1], pal);
+		uint64_t bits = 0;
+		for(int i = 0; i < 6; ++i)
+			bits |= (uint64_t)block[2 + i] << (i * 8);
+		for(int i = 0; i < 16; ++i)
+			dst[i * stride] = (uint8_t)pal[(bits >> (i * 3)) & 7];
+	}
+
+	//--------------------------------------------------------------------------
+	// BC7.  The encoder emits the single subset modes: 6 everywhere, and with
+	// High quality also tries mode 5 on blocks with varying alpha.
+	//--------------------------------------------------------------------------
+
+	const int Weights2[4] = { 0, 21, 43, 64 };
+	const int Weights3[8] = { 0, 9, 18, 27, 37, 46, 55, 64 };
+	const int Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	inline int Interpolate(int e0, int e1, int w)
+	{
+		return ((64 - w) * e0 + w * e1 + 32) >> 6;
+	}
+
+	class BitWriter
+	{
+	public:
+		explicit BitWriter(uint8_t* out) : mOut(out) { memset(mOut, 0, 16); }
+		void Write(uint32_t value, unsigned bits)
+		{
+			for(unsigned i = 0; i < bits; ++i, ++mPos)
+			{
+				if((value >> i) & 1)
+					mOut[mPos >> 3] |= (uint8_t)(1 << (mPos & 7));
+			}
+		}
+	private:
+		uint8_t* mOut;
+		unsigned mPos = 0;
+	};
+
+	class BitReader
+	{
+	public:
+		explicit BitReader(const uint8_t* in) : mIn(in) {}
+		uint32_t Read(unsigned bits)
+		{
+			uint32_t value = 0;
+			for(unsigned i = 0; i < bits; ++i, ++mPos)
+				value |= (uint32_t)((mIn[mPos >> 3] >> (mPos & 7)) & 1) << i;
+			return value;
+		}
+	private:
+		const uint8_t* mIn;
+		unsigned mPos = 0;
+	};
+
+	struct BC7Mode6
+	{
+		int Endpoints[2][4] = {};	// 7 bits per channel
+		int PBits[2] = {};
+		uint8_t Indices[16] = {};
+		float Error = std::numeric_limits<float>::max();
+	};
+
+	// Quantizes e0/e1 with every p-bit combination and keeps the best.
+	BC7Mode6 EvaluateMode6(const TexelBlock px, const float e0[4], const float e1[4])
+	{
+		static const bool all[16] = { true, true, true, true, true, true, true, true,
+									  true, true, true, true, true, true, true, true };
+		BC7Mode6 best;
+		for(int p = 0; p < 4; ++p)
+		{
+			BC7Mode6 cand;
+			cand.PBits[0] = p & 1;
+			cand.PBits[1] = p >> 1;
+
+			int v0[4], v1[4];
+			for(int c = 0; c < 4; ++c)
+			{
+				cand.Endpoints[0][c] = Clamp(RoundToInt((e0[c] - cand.PBits[0]) * 0.5f), 0, 127);
+				cand.Endpoints[1][c] = Clamp(RoundToInt((e1[c] - cand.PBits[1]) * 0.5f), 0, 127);
+				v0[c] = (cand.Endpoints[0][c] << 1) | cand.PBits[0];
+				v1[c] = (cand.Endpoints[1][c] << 1) | cand.PBits[1];
+			}
+
+			int pal[16][4];
+			for(int k = 0; k < 16; ++k)
+				for(int c = 0; c < 4; ++c)
+					pal[k][c] = Interpolate(v0[c], v1[c], Weights4[k]);
+
+			cand.Error = SelectIndices(px, all, pal, 16, 0, 4, cand.Indices);
+			if(cand.Error < best.Error)
+				best = cand;
+		}
+		return best;
+	}
+
+	BC7Mode6 EncodeMode6(const TexelBlock px, BCQuality quality)
+	{
+		static const bool all[16] = { true, true, true, true, true, true, true, true,
+									  true, true, true, true, true, true, true, true };
+		float e0[4], e1[4];
+		FitLine(px, all, 4, quality != BCQuality::Fast, e0, e1);
+		BC7Mode6 best = EvaluateMode6(px, e0, e1);
+
+		const int passes = quality == BCQuality::Fast ? 0 : (quality == BCQuality::Normal ? 1 : 3);
+		for(int pass = 0; pass < passes && best.Error > 0.0f; ++pass)
+		{
+			float w[16];
+			for(int i = 0; i < 16; ++i)
+				w[i] = Weights4[best.Indices[i]] / 64.0f;
+			if(!SolveEndpoints(px, w, all, 4, e0, e1))
+				break;
+			BC7Mode6 cand = EvaluateMode6(px, e0, e1);
+			if(cand.Error >= best.Error)
+				break;
+			best = cand;
+		}
+		return best;
+	}
+
+	void WriteMode6(BC7Mode6 m, uint8_t* out)
+	{
+		// The anchor index is stored without its top bit, so it must be < 8.
+		if(m.Indices[0] >= 8)
+		{
+			for(int c = 0; c < 4; ++c)
+				std::swap(m.Endpoints[0][c], m.Endpoints[1][c]);
+			std::swap(m.PBits[0], m.PBits[1]);
+			for(int i = 0; i < 16; ++i)
+				m.Indices[i] = (uint8_t)(15 - m.Indices[i]);
+		}
+
+		BitWriter w(out);
+		w.Write(1 << 6, 7);
+		for(int c = 0; c < 4; ++c)
+		{
+			w.Write(m.Endpoints[0][c], 7);
+			w.Write(m.Endpoints[1][c], 7);
+		}
+		w.Write(m.PBits[0], 1);
+		w.Write(m.PBits[1], 1);
+		w.Write(m.Indices[0], 3);
+		for(int i = 1; i < 16; ++i)
+			w.Write(m.Indices[i], 4);
+	}
+
+	struct BC7Mode5
+	{
+		int Rotation = 0;
+		int Color[2][3] = {};	// 7 bits per channel
+		int Alpha[2] = {};		// 8 bits
+		uint8_t ColorIndices[16] = {};
+		uint8_t AlphaIndices[16] = {};
+		float Error = std::numeric_limits<float>::max();
+	};
+
+	inline int Expand7(int v)
+	{
+		return (v << 1) | (v >> 6);
+	}
+
+	// Color endpoints for channels 0-2 of px, alpha for channel 3.
+	float EvaluateMode5Color(const TexelBlock px, const float e0[4], const float e1[4], BC7Mode5& m)
+	{
+		static const bool all[16] = { true, true, true, true, true, true, true, true,
+									  true, true, true, true, true, true, true, true };
+		int pal[4][4] = {};
+		for(int c = 0; c < 3; ++c)
+		{
+			m.Color[0][c] = Clamp(RoundToInt(e0[c] * 127.0f / 255.0f), 0, 127);
+			m.Color[1][c] = Clamp(RoundToInt(e1[c] * 127.0f / 255.0f), 0, 127);
+			for(int k = 0; k < 4; ++k)
+				pal[k][c] = Interpolate(Expand7(m.Color[0][c]), Expand7(m.Color[1][c]), Weights2[k]);
+		}
+		return SelectIndices(px, all, pal, 4, 0, 3, m.ColorIndices);
+	}
+
+	float EvaluateMode5Alpha(const TexelBlock px, int a0, int a1, uint8_t* indices)
+	{
+		int pal[4];
+		for(int k = 0; k < 4; ++k)
+			pal[k] = Interpolate(a0, a1, Weights2[k]);
+		float total = 0.0f;
+		for(int i = 0; i < 16; ++i)
+		{
+			float best = std::numeric_limits<float>::max();
+			for(int k = 0; k < 4; ++k)
+			{
+				float d = px[i][3] - (float)pal[k];
+				if(d * d < best)
+				{
+					best = d * d;
+					indices[i] = (uint8_t)k;
+				}
+			}
+			total += best;
+		}
+		return total;
+	}
+
+	BC7Mode5 EncodeMode5(const TexelBlock src, int rotation)
+	{
+		static const bool all[16] = { true, true, true, true, true, true, true, true,
+									  true, true, true, true, true, true, true, true };
+		// Rotation swaps alpha with one color channel before encoding; the
+		// squared error is the same in either space.
+		TexelBlock px;
+		memcpy(px, src, sizeof(TexelBlock));
+		if(rotation > 0)
+		{
+			for(int i = 0; i < 16; ++i)
+				std::swap(px[i][rotation - 1], px[i][3]);
+		}
+
+		BC7Mode5 m;
+		m.Rotation = rotation;
+
+		float e0[4], e1[4];
+		FitLine(px, all, 3, true, e0, e1);
+		float colorErr = EvaluateMode5Color(px, e0, e1, m);
+		float w[16];
+		for(int i = 0; i < 16; ++i)
+			w[i] = Weights2[m.ColorIndices[i]] / 64.0f;
+		if(colorErr > 0.0f && SolveEndpoints(px, w, all, 3, e0, e1))
+		{
+			BC7Mode5 refined = m;
+			float err = EvaluateMode5Color(px, e0, e1, refined);
+			if(err < colorErr)
+			{
+				colorErr = err;
+				m = refined;
+			}
+		}
+
+		int mn = 255, mx = 0;
+		for(int i = 0; i < 16; ++i)
+		{
+			mn = std::min(mn, (int)px[i][3]);
+			mx = std::max(mx, (int)px[i][3]);
+		}
+		uint8_t idx[16];
+		float alphaErr = std::numeric_limits<float>::max();
+		for(int d0 = 0; d0 <= 4; ++d0)
+		{
+			for(int d1 = 0; d1 <= 4; ++d1)
+			{
+				int a0 = std::min(mn + d0, 255), a1 = std::max(mx - d1, 0);
+				float err = EvaluateMode5Alpha(px, a0, a1, idx);
+				if(err < alphaErr)
+				{
+					alphaErr = err;
+					m.Alpha[0] = a0;
+					m.Alpha[1] = a1;
+					memcpy(m.AlphaIndices, idx, 16);
+				}
+			}
+		}
+
+		m.Error = colorErr + alphaErr;
+		return m;
+	}
+
+	void WriteMode5(BC7Mode5 m, uint8_t* out)
+	{
+		// Both anchors are stored without their top bit.
+		if(m.ColorIndices[0] >= 2)
+		{
+			for(int c = 0; c < 3; ++c)
+				std::swap(m.Color[0][c], m.Color[1][c]);
+			for(int i = 0; i < 16; ++i)
+				m.ColorIndices[i] = (uint8_t)(3 - m.ColorIndices[i]);
+		}
+		if(m.AlphaIndices[0] >= 2)
+		{
+			std::swap(m.Alpha[0], m.Alpha[1]);
+			for(int i = 0; i < 16; ++i)
+				m.AlphaIndices[i] = (uint8_t)(3 - m.AlphaIndices[i]);
+		}
+
+		BitWriter w(out);
+		w.Write(1 << 5, 6);
+		w.Write(m.Rotation, 2);
+		for(int c = 0; c < 3; ++c)
+		{
+			w.Write(m.Color[0][c], 7);
+			w.Write(m.Color[1][c], 7);
+		}
+		w.Write(m.Alpha[0], 8);
+		w.Write(m.Alpha[1], 8);
+		w.Write(m.ColorIndices[0], 1);
+		for(int i = 1; i < 16; ++i)
+			w.Write(m.ColorIndices[i], 2);
+		w.Write(m.AlphaIndices[0], 1);
+		for(int i = 1; i < 16; ++i)
+			w.Write(m.AlphaIndices[i], 2);
+	}
+
+	void EncodeBC7(const uint8_t* texels, uint8_t* out, BCQuality quality)
+	{
+		TexelBlock px;
+		bool alphaVaries = false;
+		for(int i = 0; i < 16; ++i)
+		{
+			for(int c = 0; c < 4; ++c)
+				px[i][c] = texels[i * 4 + c];
+			alphaVaries |= texels[i * 4 + 3] != texels[3];
+		}
+
+		BC7Mode6 m6 = EncodeMode6(px, quality);
+		if(quality == BCQuality::High && alphaVaries && m6.Error > 0.0f)
+		{
+			BC7Mode5 best5;
+			for(int rotation = 0; rotation < 4; ++rotation)
+			{
+				BC7Mode5 m5 = EncodeMode5(px, rotation);
+				if(m5.Error < best5.Error)
+					best5 = m5;
+			}
+			if(best5.Error < m6.Error)
+			{
+				WriteMode5(best5, out);
+				return;
+			}
+		}
+		WriteMode6(m6, out);
+	}
+
+	// Modes 4-6.  The partitioned modes need the partition tables and are not
+	// produced by the encoder, so they are reported as unsupported.
+	bool DecodeBC7(const uint8_t* block, uint8_t* texels)
+	{
+		int mode = 0;
+		while(mode < 8 && !((block[mode >> 3] >> (mode & 7)) & 1))
+			++mode;
+
+		BitReader r(block);
+		r.Read(mode + 1);
+
+		if(mode == 6)
+		{
+			int e[2][4];
+			for(int c = 0; c < 4; ++c)
+			{
+				e[0][c] = r.Read(7) << 1;
+				e[1][c] = r.Read(7) << 1;
+			}
+			int p0 = r.Read(1), p1 = r.Read(1);
+			for(int c = 0; c < 4; ++c)
+			{
+				e[0][c] |= p0;
+				e[1][c] |= p1;
+			}
+			for(int i = 0; i < 16; ++i)
+			{
+				int index = r.Read(i == 0 ? 3 : 4);
+				for(int c = 0; c < 4; ++c)
+					texels[i * 4 + c] = (uint8_t)Interpolate(e[0][c], e[1][c], Weights4[index]);
+			}
+			return true;
+		}
+
+		if(mode == 4 || mode == 5)
+		{
+			const int colorBits = mode == 4 ? 5 : 7;
+			const int alphaBits = mode == 4 ? 6 : 8;
+			int rotation = r.Read(2);
+			int indexMode = mode == 4 ? r.Read(1) : 0;
+
+			int color[2][3], alpha[2];
+			for(int c = 0; c < 3; ++c)
+			{
+				for(int k = 0; k < 2; ++k)
+				{
+					int v = r.Read(colorBits);
+					color[k][c] = (v << (8 - colorBits)) | (v >> (2 * colorBits - 8));
+				}
+			}
+			for(int k = 0; k < 2; ++k)
+			{
+				int v = r.Read(alphaBits);
+				alpha[k] = alphaBits == 8 ? v : ((v << 2) | (v >> 4));
+			}
+
+			// Mode 5 has two 2-bit index sets; mode 4 a 2-bit and a 3-bit set.
+			uint8_t first[16], second[16];
+			const int firstBits = 2;
+			const int secondBits = mode == 4 ? 3 : 2;
+			for(int i = 0; i < 16; ++i)
+				first[i] = (uint8_t)r.Read(i == 0 ? firstBits - 1 : firstBits);
+			for(int i = 0; i < 16; ++i)
+				second[i] = (uint8_t)r.Read(i == 0 ? secondBits - 1 : secondBits);
+
+			const uint8_t* colorIdx = indexMode ? second : first;
+			const uint8_t* alphaIdx = indexMode ? first : second;
+			const int* colorW = (indexMode ? secondBits : firstBits) == 3 ? Weights3 : Weights2;
+			const int* alphaW = (indexMode ? firstBits : secondBits) == 3 ? Weights3 : Weights2;
+
+			for(int i = 0; i < 16; ++i)
+			{
+				uint8_t* t = texels + i * 4;
+				for(int c = 0; c < 3; ++c)
+					t[c] = (uint8_t)Interpolate(color[0][c], color[1][c], colorW[colorIdx[i]]);
+				t[3] = (uint8_t)Interpolate(alpha[0], alpha[1], alphaW[alphaIdx[i]]);
+				if(rotation > 0)
+					std::swap(t[rotation - 1], t[3]);
+			}
+			return true;
+		}
+
+		if(mode == 8)
+		{
+			// Reserved encoding, decodes to transparent black.
+			memset(texels, 0, 64);
+			return true;
+		}
+
+		for(int i = 0; i < 16; ++i)
+		{
+			texels[i * 4 + 0] = 255;
+			texels[i * 4 + 1] = 0;
+			texels[i * 4 + 2] = 255;
+			texels[i * 4 + 3] = 255;
+		}
+		return false;
+	}
+}
+
+size_t BCBlockSize(BCFormat format)
+{
+	return format == BCFormat::BC1 ? 8 : 16;
+}
+
+uint32_t BCDxgiFormat(BCFormat format, bool srgb)
+{
+	switch(format)
+	{
+	case BCFormat::BC1: return srgb ? DxgiBC1UnormSrgb : DxgiBC1Unorm;
+	case BCFormat::BC3: return srgb ? DxgiBC3UnormSrgb : DxgiBC3Unorm;
+	case BCFormat::BC5: return DxgiBC5Unorm;
+	case BCFormat::BC7: return srgb ? DxgiBC7UnormSrgb : DxgiBC7Unorm;
+	}
+	return 0;
+}
+
+size_t BCSurfaceSize(BCFormat format, uint32_t width, uint32_t height)
+{
+	size_t blocksWide = std::max<size_t>(1, (width + 3) / 4);
+	size_t blocksHigh = std::max<size_t>(1, (height + 3) / 4);
+	return blocksWide * blocksHigh * BCBlockSize(format);
+}
+
+void EncodeBCBlock(BCFormat format, const uint8_t* texels, uint8_t* block, BCQuality quality)
+{
+	switch(format)
+	{
+	case BCFormat::BC1:
+		EncodeBC1(texels, block, quality, true);
+		break;
+	case BCFormat::BC3:
+		EncodeBC4(texels + 3, 4, block, quality);
+		EncodeBC1(texels, block + 8, quality, false);
+		break;
+	case BCFormat::BC5:
+		EncodeBC4(texels + 0, 4, block, quality);
+		EncodeBC4(texels + 1, 4, block + 8, quality);
+		break;
+	case BCFormat::BC7:
+		EncodeBC7(texels, block, quality);
+		break;
+	}
+}
+
+bool DecodeBCBlock(BCFormat format, const uint8_t* block, uint8_t* texels)
+{
+	switch(format)
+	{
+	case BCFormat::BC1:
+		DecodeBC1(block, texels, false);
+		return true;
+	case BCFormat::BC3:
+		DecodeBC1(block + 8, texels, true);
+		DecodeBC4(block, texels + 3, 4);
+		return true;
+	case BCFormat::BC5:
+		DecodeBC4(block, texels + 0, 4);
+		DecodeBC4(block + 8, texels + 1, 4);
+		for(int i = 0; i < 16; ++i)
+		{
+			texels[i * 4 + 2] = 0;
+			texels[i * 4 + 3] = 255;
+		}
+		return true;
+	case BCFormat::BC7:
+		return DecodeBC7(block, texels);
+	}
+	return false;
+}
+
+std::vector<uint8_t> CompressSurface(const uint8_t* rgba, uint32_t width, uint32_t height,
+	BCFormat format, BCQuality quality, unsigned threads)
+{
+	const uint32_t blocksWide = std::max<uint32_t>(1, (width + 3) / 4);
+	const uint32_t blocksHigh = std::max<uint32_t>(1, (height + 3) / 4);
+	const size_t blockSize = BCBlockSize(format);
+	std::vector<uint8_t> out(BCSurfaceSize(format, width, height));
+	if(width == 0 || height == 0)
+		return out;
+
+	// Block rows are handed out through a shared counter so threads that
+	// draw cheap rows (flat color, say) keep pulling work.
+	std::atomic<uint32_t> nextRow(0);
+	auto worker = [&]()
+	{
+		uint8_t texels[64];
+		for(uint32_t by = nextRow++; by < blocksHigh; by = nextRow++)
+		{
+			for(uint32_t bx = 0; bx < blocksWide; ++bx)
+			{
+				for(uint32_t y = 0; y < 4; ++y)
+				{
+					uint32_t sy = std::min(by * 4 + y, height - 1);
+					for(uint32_t x = 0; x < 4; ++x)
+					{
+						uint32_t sx = std::min(bx * 4 + x, width - 1);
+						memcpy(texels + (y * 4 + x) * 4, rgba + ((size_t)sy * width + sx) * 4, 4);
+					}
+				}
+				EncodeBCBlock(format, texels, &out[((size_t)by * blocksWide + bx) * blockSize], quality);
+			}
+		}
+	};
+
+	if(threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	threads = std::min(threads, blocksHigh);
+
+	std::vector<std::thread> pool;
+	for(unsigned i = 1; i < threads; ++i)
+		pool.emplace_back(worker);
+	worker();
+	for(auto& t : pool)
+		t.join();
+	return out;
+}
+
+bool DecompressSurface(const uint8_t* blocks, uint32_t width, uint32_t height,
+	BCFormat format, std::vector<uint8_t>& rgba)
+{
+	const uint32_t blocksWide = std::max<uint32_t>(1, (width + 3) / 4);
+	const uint32_t blocksHigh = std::max<uint32_t>(1, (height + 3) / 4);
+	const size_t blockSize = BCBlockSize(format);
+	rgba.assign((size_t)width * height * 4, 0);
+
+	bool ok = true;
+	uint8_t texels[64];
+	for(uint32_t by = 0; by < blocksHigh; ++by)
+	{
+		for(uint32_t bx = 0; bx < blocksWide; ++bx)
+		{
+			ok &= DecodeBCBlock(format, blocks + ((size_t)by * blocksWide + bx) * blockSize, texels);
+			for(uint32_t y = 0; y < 4 && by * 4 + y < height; ++y)
+			{
+				for(uint32_t x = 0; x < 4 && bx * 4 + x < width; ++x)
+				{
+					size_t dst = ((size_t)(by * 4 + y) * width + bx * 4 + x) * 4;
+					memcpy(&rgba[dst], texels + (y * 4 + x) * 4, 4);
+				}
+			}
+		}
+	}
+	return ok;
+}
+
+double BCPsnr(BCFormat format, const uint8_t* reference, const uint8_t* decoded, size_t texelCount)
+{
+	const int channels = format == BCFormat::BC5 ? 2 : (format == BCFormat::BC1 ? 3 : 4);
+	double sum = 0.0;
+	size_t counted = 0;
+	for(size_t i = 0; i < texelCount; ++i)
+	{
+		// BC1 stores texels below half alpha as transparent black; their color is irrelevant.
+		if(format == BCFormat::BC1 && reference[i * 4 + 3] < 128)
+			continue;
+		++counted;
+		for(int c = 0; c < channels; ++c)
+		{
+			double d = (double)reference[i * 4 + c] - (double)decoded[i * 4 + c];
+			sum += d * d;
+		}
+	}
+	if(sum == 0.0 || counted == 0)
+		return std::numeric_limits<double>::infinity();
+	double mse = sum / ((double)counted * channels);
+	return 10.0 * std::log10(255.0 * 255.0 / mse);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Block compression for offline texture cooking.  Everything here works on
+// plain RGBA8 memory and has no D3D dependency, so the tools can run anywhere.
+
+enum class BCFormat
+{
+	BC1,	// RGB + 1 bit alpha, 8 bytes per block
+	BC3,	// RGBA, BC1 color + BC4 alpha, 16 bytes per block
+	BC5,	// two channel (R, G), e.g. tangent space normals, 16 bytes per block
+	BC7		// RGBA, 16 bytes per block
+};
+
+// Speed/quality knob for the encoders.
+//  Fast   - bounding box endpoints, no refinement.
+//  Normal - principal axis endpoints plus one least squares refinement.
+//  High   - more refinement passes and extra candidate encodings per block.
+enum class BCQuality
+{
+	Fast,
+	Normal,
+	High
+};
+
+// Bytes per 4x4 block.
+size_t BCBlockSize(BCFormat format);
+
+// DXGI_FORMAT value of the compressed format.
+uint32_t BCDxgiFormat(BCFormat format, bool srgb);
+
+// Size in bytes of a width x height surface, partial edge blocks included.
+size_t BCSurfaceSize(BCFormat format, uint32_t width, uint32_t height);
+
+// Single block.  texels are 16 RGBA8 texels in row-major order.
+void EncodeBCBlock(BCFormat format, const uint8_t* texels, uint8_t* block, BCQuality quality);
+
+// Returns false for encodings the decoder does not support (BC7 partitioned
+// modes 0-3 and 7, which the encoder never emits); the block is filled with magenta.
+bool DecodeBCBlock(BCFormat format, const uint8_t* block, uint8_t* texels);
+
+// Whole surface.  rgba holds width * height tightly packed RGBA8 texels.  Edge
+// blocks replicate the border texels.  threads == 0 uses every hardware thread.
+std::vector<uint8_t> CompressSurface(const uint8_t* rgba, uint32_t width, uint32_t height,
+	BCFormat format, BCQuality quality, unsigned threads = 0);
+
+// Inverse of CompressSurface.  Returns false if any block failed to decode.
+bool DecompressSurface(const uint8_t* blocks, uint32_t width, uint32_t height,
+	BCFormat format, std::vector<uint8_t>& rgba);
+
+// Peak signal to noise ratio in dB over the channels the format stores
+// (RGB for BC1, RGBA for BC3/BC7, RG for BC5).  BC1 skips texels that are
+// punched through.  Infinite for identical images.
+double BCPsnr(BCFormat format, const uint8_t* reference, const uint8_t* decoded, size_t texelCount);
@@ -0,0 +1,35 @@
+#include "DDSHeader.h"
+#include <cstring>
+
+bool ReadDDSHeaders(const uint8_t* data, size_t size, DDSHeaders& out)
+{
+	out = DDSHeaders();
+
+	// Need at least enough data to fill the header and magic number to be a valid DDS
+	if (data == nullptr || size < sizeof(uint32_t) + sizeof(DDS_HEADER))
+		return false;
+
+	uint32_t magic;
+	memcpy(&magic, data, sizeof(magic));
+	if (magic != DDS_MAGIC)
+		return false;
+
+	auto header = reinterpret_cast<const DDS_HEADER*>(data + sizeof(uint32_t));
+	if (header->size != sizeof(DDS_HEADER) || header->ddspf.size != sizeof(DDS_PIXELFORMAT))
+		return false;
+
+	size_t offset = sizeof(uint32_t) + sizeof(DDS_HEADER);
+	if ((header->ddspf.flags & DDS_FOURCC) && MAKEFOURCC('D', 'X', '1', '0') == header->ddspf.fourCC)
+	{
+		// Must be long enough for both headers and magic value
+		if (size < offset + sizeof(DDS_HEADER_DXT10))
+			return false;
+		out.Extension = reinterpret_cast<const DDS_HEADER_DXT10*>(data + offset);
+		offset += sizeof(DDS_HEADER_DXT10);
+	}
+
+	out.Header = header;
+	out.Data = data + offset;
+	out.DataSize = size - offset;
+	return true;
+}
@@ -24,6 +24,11 @@
 #include <wrl.h>
 
 #include "DDSTextureLoader.h" 
+#include "DDSHeader.h"
+#include "MappedFile.h"
+#include "BCnCodec.h"
+#include "MipGenerator.h"
+#include <vector>
 
 using namespace Microsoft::WRL;
 
@@ -33,93 +38,6 @@ using namespace Microsoft::WRL;
 
 using namespace DirectX;
 
-//--------------------------------------------------------------------------------------
-// Macros
-//--------------------------------------------------------------------------------------
-#ifndef MAKEFOURCC
-    #define MAKEFOURCC(ch0, ch1, ch2, ch3)                              \
-                ((uint32_t)(uint8_t)(ch0) | ((uint32_t)(uint8_t)(ch1) << 8) |       \
-                ((uint32_t)(uint8_t)(ch2) << 16) | ((uint32_t)(uint8_t)(ch3) << 24 ))
-#endif /* defined(MAKEFOURCC) */
-
-//--------------------------------------------------------------------------------------
-// DDS file structure definitions
-//
-// See DDS.h in the 'Texconv' sample and the 'DirectXTex' library
-//--------------------------------------------------------------------------------------
-#pragma pack(push,1)
-
-const uint32_t DDS_MAGIC = 0x20534444; // "DDS "
-
-struct DDS_PIXELFORMAT
-{
-    uint32_t    size;
-    uint32_t    flags;
-    uint32_t    fourCC;
-    uint32_t    RGBBitCount;
-    uint32_t    RBitMask;
-    uint32_t    GBitMask;
-    uint32_t    BBitMask;
-    uint32_t    ABitMask;
-};
-
-#define DDS_FOURCC      0x00000004  // DDPF_FOURCC
-#define DDS_RGB         0x00000040  // DDPF_RGB
-#define DDS_LUMINANCE   0x00020000  // DDPF_LUMINANCE
-#define DDS_ALPHA       0x00000002  // DDPF_ALPHA
-
-#define DDS_HEADER_FLAGS_VOLUME         0x00800000  // DDSD_DEPTH
-
-#define DDS_HEIGHT 0x00000002 // DDSD_HEIGHT
-#define DDS_WIDTH  0x00000004 // DDSD_WIDTH
-
-#define DDS_CUBEMAP_POSITIVEX 0x00000600 // DDSCAPS2_CUBEMAP | DDSCAPS2_CUBEMAP_POSITIVEX
-#define DDS_CUBEMAP_NEGATIVEX 0x00000a00 // DDSCAPS2_CUBEMAP | DDSCAPS2_CUBEMAP_NEGATIVEX
-#define DDS_CUBEMAP_POSITIVEY 0x00001200 // DDSCAPS2_CUBEMAP | DDSCAPS2_CUBEMAP_POSITIVEY
-#define DDS_CUBEMAP_NEGATIVEY 0x00002200 // DDSCAPS2_CUBEMAP | DDSCAPS2_CUBEMAP_NEGATIVEY
-#define DDS_CUBEMAP_POSITIVEZ 0x00004200 // DDSCAPS2_CUBEMAP | DDSCAPS2_CUBEMAP_POSITIVEZ
-#define DDS_CUBEMAP_NEGATIVEZ 0x00008200 // DDSCAPS2_CUBEMAP | DDSCAPS2_CUBEMAP_NEGATIVEZ
-
-#define DDS_CUBEMAP_ALLFACES ( DDS_CUBEMAP_POSITIVEX | DDS_CUBEMAP_NEGATIVEX |\
-                               DDS_CUBEMAP_POSITIVEY | DDS_CUBEMAP_NEGATIVEY |\
-                               DDS_CUBEMAP_POSITIVEZ | DDS_CUBEMAP_NEGATIVEZ )
-
-#define DDS_CUBEMAP 0x00000200 // DDSCAPS2_CUBEMAP
-
-enum DDS_MISC_FLAGS2
-{
-    DDS_MISC_FLAGS2_ALPHA_MODE_MASK = 0x7L,
-};
-
-struct DDS_HEADER
-{
-    uint32_t        size;
-    uint32_t        flags;
-    uint32_t        height;
-    uint32_t        width;
-    uint32_t        pitchOrLinearSize;
-    uint32_t        depth; // only if DDS_HEADER_FLAGS_VOLUME is set in flags
-    uint32_t        mipMapCount;
-    uint32_t        reserved1[11];
-    DDS_PIXELFORMAT ddspf;
-    uint32_t        caps;
-    uint32_t        caps2;
-    uint32_t        caps3;
-    uint32_t        caps4;
-    uint32_t        reserved2;
-};
-
-struct DDS_HEADER_DXT10
-{
-    DXGI_FORMAT     dxgiFormat;
-    uint32_t        resourceDimension;
-    uint32_t        miscFlag; // see D3D11_RESOURCE_MISC_FLAG
-    uint32_t        arraySize;
-    uint32_t        miscFlags2;
-};
-
-#pragma pack(pop)
-
 //--------------------------------------------------------------------------------------
 namespace
 {
@@ -797,6 +715,28 @@ static DXGI_FORMAT MakeSRGB( _In_ DXGI_FORMAT format )
 }
 
 
+//--------------------------------------------------------------------------------------
+// True for the formats MakeSRGB produces.
+//--------------------------------------------------------------------------------------
+static bool IsSRGB( _In_ DXGI_FORMAT format )
+{
+    switch( format )
+    {
+    case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+    case DXGI_FORMAT_BC1_UNORM_SRGB:
+    case DXGI_FORMAT_BC2_UNORM_SRGB:
+    case DXGI_FORMAT_BC3_UNORM_SRGB:
+    case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+    case DXGI_FORMAT_B8G8R8X8_UNORM_SRGB:
+    case DXGI_FORMAT_BC7_UNORM_SRGB:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+
 //--------------------------------------------------------------------------------------
 static HRESULT FillInitData( _In_ size_t width,
                              _In_ size_t height,
@@ -963,7 +903,9 @@ static HRESULT FillInitData12(_In_ size_t width,
 				++skipMip;
 			}
 
-			if (pSrcBits + (NumBytes*d) > pEndBits)
+			// Compare sizes rather than pointers: bitData may be a mapped view, and
+			// a bogus header must not step the pointer past the end of the mapping.
+			if (NumBytes * d > static_cast<size_t>(pEndBits - pSrcBits))
 			{
 				return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
 			}
@@ -1319,6 +1261,113 @@ static HRESULT CreateD3DResources12(
 }
 
 
+//--------------------------------------------------------------------------------------
+// Builds a full mip chain for a single level 2D surface.  Level 0 is copied
+// as is, the smaller levels are filtered on the CPU and, for block compressed
+// formats, re-encoded with the fast encoder.  Returns S_FALSE when the format
+// is not handled, leaving the texture with the mips it has.
+//--------------------------------------------------------------------------------------
+static HRESULT GenerateMipChain12(
+	_In_ size_t width,
+	_In_ size_t height,
+	_In_ DXGI_FORMAT format,
+	_In_ bool srgb,
+	_In_reads_bytes_(bitSize) const uint8_t* bitData,
+	_In_ size_t bitSize,
+	std::vector<uint8_t>& chain,
+	size_t& mipCount)
+{
+	enum class Layout { RGBA, BGRA, BGRX, Blocks };
+	Layout layout;
+	BCFormat bcFormat = BCFormat::BC1;
+	switch (format)
+	{
+	case DXGI_FORMAT_R8G8B8A8_UNORM:
+	case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+		layout = Layout::RGBA;
+		break;
+	case DXGI_FORMAT_B8G8R8A8_UNORM:
+	case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+		layout = Layout::BGRA;
+		break;
+	case DXGI_FORMAT_B8G8R8X8_UNORM:
+	case DXGI_FORMAT_B8G8R8X8_UNORM_SRGB:
+		layout = Layout::BGRX;
+		break;
+	case DXGI_FORMAT_BC1_UNORM:
+	case DXGI_FORMAT_BC1_UNORM_SRGB:
+		layout = Layout::Blocks;
+		bcFormat = BCFormat::BC1;
+		break;
+	case DXGI_FORMAT_BC3_UNORM:
+	case DXGI_FORMAT_BC3_UNORM_SRGB:
+		layout = Layout::Blocks;
+		bcFormat = BCFormat::BC3;
+		break;
+	case DXGI_FORMAT_BC5_UNORM:
+		layout = Layout::Blocks;
+		bcFormat = BCFormat::BC5;
+		break;
+	case DXGI_FORMAT_BC7_UNORM:
+	case DXGI_FORMAT_BC7_UNORM_SRGB:
+		layout = Layout::Blocks;
+		bcFormat = BCFormat::BC7;
+		break;
+	default:
+		return S_FALSE;
+	}
+
+	size_t level0Bytes = 0;
+	GetSurfaceInfo(width, height, format, &level0Bytes, nullptr, nullptr);
+	if (bitSize < level0Bytes)
+		return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+
+	const uint32_t w = static_cast<uint32_t>(width);
+	const uint32_t h = static_cast<uint32_t>(height);
+	std::vector<uint8_t> rgba;
+	if (layout == Layout::Blocks)
+	{
+		if (!DecompressSurface(bitData, w, h, bcFormat, rgba))
+			return S_FALSE;
+	}
+	else
+	{
+		rgba.assign(bitData, bitData + (size_t)w * h * 4);
+		for (size_t i = 0; i < rgba.size(); i += 4)
+		{
+			if (layout != Layout::RGBA)
+				std::swap(rgba[i], rgba[i + 2]);
+			if (layout == Layout::BGRX)
+				rgba[i + 3] = 255;
+		}
+	}
+
+	std::vector<MipLevel> levels = GenerateMips(rgba.data(), w, h, MipFilter::Box, srgb);
+
+	chain.assign(bitData, bitData + level0Bytes);
+	for (MipLevel& level : levels)
+	{
+		if (layout == Layout::Blocks)
+		{
+			std::vector<uint8_t> blocks = CompressSurface(level.Pixels.data(),
+				level.Width, level.Height, bcFormat, BCQuality::Fast);
+			chain.insert(chain.end(), blocks.begin(), blocks.end());
+		}
+		else
+		{
+			if (layout != Layout::RGBA)
+			{
+				for (size_t i = 0; i < level.Pixels.size(); i += 4)
+					std::swap(level.Pixels[i], level.Pixels[i + 2]);
+			}
+			chain.insert(chain.end(), level.Pixels.begin(), level.Pixels.end());
+		}
+	}
+
+	mipCount = levels.size() + 1;
+	return S_OK;
+}
+
 //--------------------------------------------------------------------------------------
 static HRESULT CreateTextureFromDDS( _In_ ID3D11Device* d3dDevice,
                                      _In_opt_ ID3D11DeviceContext* d3dContext,
@@ -1362,7 +1411,7 @@ static HRESULT CreateTextureFromDDS( _In_ ID3D11Device* d3dDevice,
            return HRESULT_FROM_WIN32( ERROR_INVALID_DATA );
         }
 
-        switch( d3d10ext->dxgiFormat )
+        switch( static_cast<DXGI_FORMAT>( d3d10ext->dxgiFormat ) )
         {
         case DXGI_FORMAT_AI44:
         case DXGI_FORMAT_IA44:
@@ -1371,13 +1420,13 @@ static HRESULT CreateTextureFromDDS( _In_ ID3D11Device* d3dDevice,
             return HRESULT_FROM_WIN32( ERROR_NOT_SUPPORTED );
 
         default:
-            if ( BitsPerPixel( d3d10ext->dxgiFormat ) == 0 )
+            if ( BitsPerPixel( static_cast<DXGI_FORMAT>( d3d10ext->dxgiFormat ) ) == 0 )
             {
                 return HRESULT_FROM_WIN32( ERROR_NOT_SUPPORTED );
             }
         }
            
-        format = d3d10ext->dxgiFormat;
+        format = static_cast<DXGI_FORMAT>( d3d10ext->dxgiFormat );
 
         switch ( d3d10ext->resourceDimension )
         {
@@ -1677,6 +1726,7 @@ static HRESULT CreateTextureFromDDS12(
 	_In_ size_t bitSize,
 	_In_ size_t maxsize,
 	_In_ bool forceSRGB,
+	_In_ bool generateMips,
 	ComPtr<ID3D12Resource>& texture,
 	ComPtr<ID3D12Resource>& textureUploadHeap)
 {
@@ -1702,7 +1752,7 @@ static HRESULT CreateTextureFromDDS12(
 		if (arraySize == 0)
 			return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
 
-		switch (d3d10ext->dxgiFormat)
+		switch (static_cast<DXGI_FORMAT>(d3d10ext->dxgiFormat))
 		{
 		case DXGI_FORMAT_AI44:
 		case DXGI_FORMAT_IA44:
@@ -1711,11 +1761,11 @@ static HRESULT CreateTextureFromDDS12(
 			return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
 
 		default:
-			if (BitsPerPixel(d3d10ext->dxgiFormat) == 0)
+			if (BitsPerPixel(static_cast<DXGI_FORMAT>(d3d10ext->dxgiFormat)) == 0)
 				return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
 		}
 
-		format = d3d10ext->dxgiFormat;
+		format = static_cast<DXGI_FORMAT>(d3d10ext->dxgiFormat);
 
 		switch (d3d10ext->resourceDimension)
 		{
@@ -1835,6 +1885,24 @@ static HRESULT CreateTextureFromDDS12(
 		return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
 	}
 
+	// Without mips every minified sample touches a full resolution footprint,
+	// so single level 2D textures get their chain built here.  The generated
+	// chain replaces bitData and has to outlive the upload below.
+	std::vector<uint8_t> mipChain;
+	if (generateMips && mipCount == 1 && arraySize == 1 && !isCubeMap &&
+		resDim == D3D12_RESOURCE_DIMENSION_TEXTURE2D && (width > 1 || height > 1))
+	{
+		const bool srgb = IsSRGB(forceSRGB ? MakeSRGB(format) : format);
+		hr = GenerateMipChain12(width, height, format, srgb, bitData, bitSize, mipChain, mipCount);
+		if (FAILED(hr))
+			return hr;
+		if (hr == S_OK)
+		{
+			bitData = mipChain.data();
+			bitSize = mipChain.size();
+		}
+	}
+
 	// Create the texture
 	std::unique_ptr<D3D12_SUBRESOURCE_DATA[]> initData(
 		new (std::nothrow) D3D12_SUBRESOURCE_DATA[mipCount * arraySize]
@@ -1863,7 +1931,7 @@ static HRESULT CreateTextureFromDDS12(
 			mipCount - skipMip,
 			arraySize,
 			format,
-			false, // forceSRGB
+			forceSRGB,
 			isCubeMap,
 			initData.get(),
 			texture, 
@@ -1926,7 +1994,9 @@ HRESULT DirectX::CreateDDSTextureFromMemory12(
 	ComPtr<ID3D12Resource>& texture,
 	ComPtr<ID3D12Resource>& textureUploadHeap,
 	_In_ size_t maxsize,
-	_Out_opt_ DDS_ALPHA_MODE* alphaMode
+	_Out_opt_ DDS_ALPHA_MODE* alphaMode,
+	_In_ bool generateMips,
+	_In_ bool forceSRGB
 	)
 {
 	if (alphaMode)
@@ -1937,47 +2007,21 @@ HRESULT DirectX::CreateDDSTextureFromMemory12(
 		return E_INVALIDARG;
 	}
 
-	uint32_t dwMagicNumber = *(const uint32_t*)(ddsData);
-	if (dwMagicNumber != DDS_MAGIC)
-	{
-		return E_FAIL;
-	}
-
-	auto header = reinterpret_cast<const DDS_HEADER*>(ddsData + sizeof(uint32_t));
-
-	// Verify header to validate DDS file
-	if (header->size != sizeof(DDS_HEADER) ||
-		header->ddspf.size != sizeof(DDS_PIXELFORMAT))
+	DDSHeaders headers;
+	if (!ReadDDSHeaders(ddsData, ddsDataSize, headers))
 	{
 		return E_FAIL;
 	}
 
-	// Check for DX10 extension
-	bool bDXT10Header = false;
-	if ((header->ddspf.flags & DDS_FOURCC) &&
-		(MAKEFOURCC('D', 'X', '1', '0') == header->ddspf.fourCC))
-	{
-		// Must be long enough for both headers and magic value
-		if (ddsDataSize < (sizeof(DDS_HEADER) + sizeof(uint32_t) + sizeof(DDS_HEADER_DXT10)))
-		{
-			return E_FAIL;
-		}
-
-		bDXT10Header = true;
-	}
-
-	ptrdiff_t offset = sizeof(uint32_t)
-		+ sizeof(DDS_HEADER)
-		+ (bDXT10Header ? sizeof(DDS_HEADER_DXT10) : 0);
-
 	HRESULT hr = CreateTextureFromDDS12(
 		device,
 		cmdList,
-		header,
-		ddsData + offset,
-		ddsDataSize - offset,
+		headers.Header,
+		headers.Data,
+		headers.DataSize,
 		maxsize,
-		false,
+		forceSRGB,
+		generateMips,
 		texture,
 		textureUploadHeap
 		);
@@ -1985,7 +2029,7 @@ HRESULT DirectX::CreateDDSTextureFromMemory12(
 	if (SUCCEEDED(hr))
 	{
 		if (alphaMode)
-			(*alphaMode) = GetAlphaMode(header);
+			(*alphaMode) = GetAlphaMode(headers.Header);
 	}
 
 	return hr;
@@ -2140,7 +2184,9 @@ HRESULT DirectX::CreateDDSTextureFromFile12(_In_ ID3D12Device* device,
 	_Out_ ComPtr<ID3D12Resource>& texture,
 	_Out_ ComPtr<ID3D12Resource>& textureUploadHeap,
 	_In_ size_t maxsize,
-	_Out_opt_ DDS_ALPHA_MODE* alphaMode)
+	_Out_opt_ DDS_ALPHA_MODE* alphaMode,
+	_In_ bool generateMips,
+	_In_ bool forceSRGB)
 {
 	if (texture)
 	{
@@ -2160,72 +2206,21 @@ HRESULT DirectX::CreateDDSTextureFromFile12(_In_ ID3D12Device* device,
 		return E_INVALIDARG;
 	}
 
-	DDS_HEADER* header = nullptr;
-	uint8_t* bitData = nullptr;
-	size_t bitSize = 0;
-
-	std::unique_ptr<uint8_t[]> ddsData;
-	HRESULT hr = LoadTextureDataFromFile(szFileName, ddsData, &header, &bitData, &bitSize);
+	// Map the file instead of reading it into a heap copy.  Header and mip chain
+	// are validated directly on the mapped view and the subresource data points
+	// into it.  UpdateSubresources copies everything into the upload heap while
+	// recording, so the mapping is released as soon as this returns.  A mip
+	// chain generated for the texture is released the same way.
+	MappedFile ddsFile;
+	HRESULT hr = ddsFile.Open(szFileName);
 	if (FAILED(hr))
 	{
 		return hr;
 	}
 
-	hr = CreateTextureFromDDS12(device, cmdList, header,
-		bitData, bitSize, maxsize, false, texture, textureUploadHeap);
-
-	if (SUCCEEDED(hr))
-	{
-/*
-#if !defined(NO_D3D11_DEBUG_NAME) && ( defined(_DEBUG) || defined(PROFILE) )
-		if (texture != 0 || textureView != 0)
-		{
-			CHAR strFileA[MAX_PATH];
-			int result = WideCharToMultiByte(CP_ACP,
-				WC_NO_BEST_FIT_CHARS,
-				fileName,
-				-1,
-				strFileA,
-				MAX_PATH,
-				nullptr,
-				FALSE
-				);
-			if (result > 0)
-			{
-				const CHAR* pstrName = strrchr(strFileA, '\\');
-				if (!pstrName)
-				{
-					pstrName = strFileA;
-				}
-				else
-				{
-					pstrName++;
-				}
-
-				if (texture != 0 && *texture != 0)
-				{
-					(*texture)->SetPrivateData(WKPDID_D3DDebugObjectName,
-						static_cast<UINT>(strnlen_s(pstrName, MAX_PATH)),
-						pstrName
-						);
-				}
-
-				if (textureView != 0 && *textureView != 0)
-				{
-					(*textureView)->SetPrivateData(WKPDID_D3DDebugObjectName,
-						static_cast<UINT>(strnlen_s(pstrName, MAX_PATH)),
-						pstrName
-						);
-				}
-			}
-		}
-#endif
-*/
-		if (alphaMode)
-			*alphaMode = GetAlphaMode(header);
-	}
-
-	return hr;
+	return CreateDDSTextureFromMemory12(device, cmdList,
+		ddsFile.Data(), ddsFile.Size(),
+		texture, textureUploadHeap, maxsize, alphaMode, generateMips, forceSRGB);
 }
 
 _Use_decl_annotations_
@@ -65,6 +65,10 @@ namespace DirectX
                                         _Out_opt_ DDS_ALPHA_MODE* alphaMode = nullptr
                                       );
 
+	// 2D textures stored without a mip chain get a full one generated on the CPU
+	// unless generateMips is false.  sRGB formats, and any format when forceSRGB
+	// is set, are filtered in linear space; forceSRGB also creates the resource
+	// with the sRGB variant of the stored format.
 	HRESULT CreateDDSTextureFromMemory12(_In_ ID3D12Device* device,
 		                                 _In_ ID3D12GraphicsCommandList* cmdList,
 		                                 _In_reads_bytes_(ddsDataSize) const uint8_t* ddsData,
@@ -72,7 +76,9 @@ namespace DirectX
 		                                 _Out_ Microsoft::WRL::ComPtr<ID3D12Resource>& texture,
 		                                 _Out_ Microsoft::WRL::ComPtr<ID3D12Resource>& textureUploadHeap,
 		                                 _In_ size_t maxsize = 0,
-		                                 _Out_opt_ DDS_ALPHA_MODE* alphaMode = nullptr
+		                                 _Out_opt_ DDS_ALPHA_MODE* alphaMode = nullptr,
+		                                 _In_ bool generateMips = true,
+		                                 _In_ bool forceSRGB = false
 		                                 );
 
     HRESULT CreateDDSTextureFromFile( _In_ ID3D11Device* d3dDevice,
@@ -89,7 +95,9 @@ namespace DirectX
 		                               _Out_ Microsoft::WRL::ComPtr<ID3D12Resource>& texture,
 		                               _Out_ Microsoft::WRL::ComPtr<ID3D12Resource>& textureUploadHeap,
 		                               _In_ size_t maxsize = 0,
-		                               _Out_opt_ DDS_ALPHA_MODE* alphaMode = nullptr
+		                               _Out_opt_ DDS_ALPHA_MODE* alphaMode = nullptr,
+		                               _In_ bool generateMips = true,
+		                               _In_ bool forceSRGB = false
 		                               );
 
     // Standard version with optional auto-gen mipmap support
@@ -0,0 +1,179 @@
+#include "DescriptorHeap.h"
+
+void DescriptorHeapAllocator::Initialize(ID3D12Device* device, D3D12_DESCRIPTOR_HEAP_TYPE type,
+	UINT capacity, UINT pageSize, bool shaderVisible)
+{
+	// A partial last page would hand out indices past the end of the heap.
+	mPageSize = pageSize == 0 ? 1 : pageSize;
+	mCapacity = (capacity + mPageSize - 1) / mPageSize * mPageSize;
+	mCommittedPages = 0;
+	mUsed = 0;
+	mFreeList.clear();
+
+	D3D12_DESCRIPTOR_HEAP_DESC heapDesc = {};
+	heapDesc.NumDescriptors = mCapacity;
+	heapDesc.Type = type;
+	heapDesc.Flags = shaderVisible ? D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE : D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
+	ThrowIfFailed(device->CreateDescriptorHeap(&heapDesc, IID_PPV_ARGS(&mHeap)));
+
+	mDescriptorSize = device->GetDescriptorHandleIncrementSize(type);
+}
+
+void DescriptorHeapAllocator::CommitPage()
+{
+	if((mCommittedPages + 1) * mPageSize > mCapacity)
+		ThrowIfFailed(E_OUTOFMEMORY);
+
+	const UINT first = mCommittedPages * mPageSize;
+	for(UINT i = mPageSize; i > 0; --i)
+		mFreeList.push_back(first + i - 1);
+	++mCommittedPages;
+}
+
+UINT DescriptorHeapAllocator::Allocate()
+{
+	if(mFreeList.empty())
+		CommitPage();
+
+	UINT index = mFreeList.back();
+	mFreeList.pop_back();
+	++mUsed;
+	return index;
+}
+
+void DescriptorHeapAllocator::Free(UINT index)
+{
+	assert(index < mCommittedPages * mPageSize);
+	mFreeList.push_back(index);
+	--mUsed;
+}
+
+CD3DX12_CPU_DESCRIPTOR_HANDLE DescriptorHeapAllocator::CpuHandle(UINT index)const
+{
+	return CD3DX12_CPU_DESCRIPTOR_HANDLE(mHeap->GetCPUDescriptorHandleForHeapStart(), (INT)index, mDescriptorSize);
+}
+
+CD3DX12_GPU_DESCRIPTOR_HANDLE DescriptorHeapAllocator::GpuHandle(UINT index)const
+{
+	return CD3DX12_GPU_DESCRIPTOR_HANDLE(mHeap->GetGPUDescriptorHandleForHeapStart(), (INT)index, mDescriptorSize);
+}
+
+ID3D12DescriptorHeap* DescriptorHeapAllocator::Heap()const
+{
+	return mHeap.Get();
+}
+
+UINT DescriptorHeapAllocator::Capacity()const
+{
+	return mCapacity;
+}
+
+UINT DescriptorHeapAllocator::PageSize()const
+{
+	return mPageSize;
+}
+
+UINT DescriptorHeapAllocator::CommittedPages()const
+{
+	return mCommittedPages;
+}
+
+UINT DescriptorHeapAllocator::UsedCount()const
+{
+	return mUsed;
+}
+
+void TextureSrvTable::Initialize(ID3D12Device* device, UINT capacity, UINT pageSize)
+{
+	mDevice = device;
+	mEntries.clear();
+	mAllocator.Initialize(device, D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV, capacity, pageSize, true);
+	mSlotResources.assign(mAllocator.Capacity(), nullptr);
+
+	// The root table spans the whole heap, and resource binding tier 1 requires
+	// every descriptor in a bound table to be valid, used or not.
+	for(UINT i = 0; i < mAllocator.Capacity(); ++i)
+		WriteNullSrv(i);
+}
+
+void TextureSrvTable::WriteNullSrv(UINT index)
+{
+	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	srvDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+	srvDesc.Texture2D.MipLevels = 1;
+	mDevice->CreateShaderResourceView(nullptr, &srvDesc, mAllocator.CpuHandle(index));
+}
+
+UINT TextureSrvTable::Acquire(ID3D12Resource* resource)
+{
+	auto it = mEntries.find(resource);
+	if(it != mEntries.end())
+	{
+		++it->second.RefCount;
+		return it->second.Index;
+	}
+
+	Entry entry;
+	entry.Index = mAllocator.Allocate();
+	entry.RefCount = 1;
+	entry.Resource = resource;
+
+	const D3D12_RESOURCE_DESC desc = resource->GetDesc();
+	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	srvDesc.Format = desc.Format;
+	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+	srvDesc.Texture2D.MostDetailedMip = 0;
+	srvDesc.Texture2D.MipLevels = desc.MipLevels;
+	srvDesc.Texture2D.ResourceMinLODClamp = 0.0f;
+	mDevice->CreateShaderResourceView(resource, &srvDesc, mAllocator.CpuHandle(entry.Index));
+
+	mEntries[resource] = entry;
+	mSlotResources[entry.Index] = resource;
+	return entry.Index;
+}
+
+void TextureSrvTable::Release(ID3D12Resource* resource)
+{
+	auto it = mEntries.find(resource);
+	if(it == mEntries.end())
+		return;
+
+	// The slot may be overwritten by the next Acquire, so callers release only
+	// once the GPU is done sampling the texture.
+	if(--it->second.RefCount == 0)
+	{
+		WriteNullSrv(it->second.Index);
+		mSlotResources[it->second.Index] = nullptr;
+		mAllocator.Free(it->second.Index);
+		mEntries.erase(it);
+	}
+}
+
+int TextureSrvTable::Find(ID3D12Resource* resource)const
+{
+	auto it = mEntries.find(resource);
+	return it == mEntries.end() ? -1 : (int)it->second.Index;
+}
+
+ID3D12Resource* TextureSrvTable::ResourceAt(UINT index)const
+{
+	return index < mSlotResources.size() ? mSlotResources[index] : nullptr;
+}
+
+DescriptorHeapAllocator& TextureSrvTable::Allocator()
+{
+	return mAllocator;
+}
+
+ID3D12DescriptorHeap* TextureSrvTable::Heap()const
+{
+	return mAllocator.Heap();
+}
+
+CD3DX12_GPU_DESCRIPTOR_HANDLE TextureSrvTable::TableStart()const
+{
+	return mAllocator.GpuHandle(0);
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "d3dUtil.h"
+#include <unordered_map>
+#include <vector>
+
+// Descriptor slots handed out from one large heap.  The heap is created once
+// at its full capacity so it never has to be rebuilt or rebound; slots are
+// committed a page at a time as the table fills up and freed slots go back
+// on a free list, so indices stay small and dense.
+class DescriptorHeapAllocator
+{
+public:
+	DescriptorHeapAllocator() = default;
+	DescriptorHeapAllocator(const DescriptorHeapAllocator& rhs) = delete;
+	DescriptorHeapAllocator& operator=(const DescriptorHeapAllocator& rhs) = delete;
+
+	void Initialize(ID3D12Device* device, D3D12_DESCRIPTOR_HEAP_TYPE type,
+		UINT capacity, UINT pageSize, bool shaderVisible);
+
+	// Index of a free slot.  Throws E_OUTOFMEMORY once every page is in use.
+	UINT Allocate();
+	void Free(UINT index);
+
+	CD3DX12_CPU_DESCRIPTOR_HANDLE CpuHandle(UINT index)const;
+	CD3DX12_GPU_DESCRIPTOR_HANDLE GpuHandle(UINT index)const;
+
+	ID3D12DescriptorHeap* Heap()const;
+	UINT Capacity()const;
+	UINT PageSize()const;
+	UINT CommittedPages()const;
+	UINT UsedCount()const;
+
+private:
+	void CommitPage();
+
+	Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> mHeap = nullptr;
+	UINT mDescriptorSize = 0;
+	UINT mCapacity = 0;
+	UINT mPageSize = 0;
+	UINT mCommittedPages = 0;
+	UINT mUsed = 0;
+
+	// Free slots of the committed pages.  Recently freed slots are reused
+	// first; a new page is pushed so its lowest index comes out first.
+	std::vector<UINT> mFreeList;
+};
+
+// Bindless texture table.  Each resource gets exactly one SRV no matter how
+// many materials use it; materials keep the returned index and shaders index
+// the table with it.
+class TextureSrvTable
+{
+public:
+	void Initialize(ID3D12Device* device, UINT capacity, UINT pageSize = 64);
+
+	// Slot of the resource's SRV, created on first use.  Every Acquire takes a
+	// reference that Release gives back; the slot is freed with the last one.
+	UINT Acquire(ID3D12Resource* resource);
+	void Release(ID3D12Resource* resource);
+
+	// Slot of an already acquired resource, or -1.
+	int Find(ID3D12Resource* resource)const;
+	// Resource whose SRV is in the slot, or null for a free slot.
+	ID3D12Resource* ResourceAt(UINT index)const;
+
+	DescriptorHeapAllocator& Allocator();
+	ID3D12DescriptorHeap* Heap()const;
+	CD3DX12_GPU_DESCRIPTOR_HANDLE TableStart()const;
+
+private:
+	// Null Texture2D view, so unused slots stay valid descriptors.
+	void WriteNullSrv(UINT index);
+
+	struct Entry
+	{
+		UINT Index = 0;
+		UINT RefCount = 0;
+		// Keeps the resource, and with it the key, alive while the SRV exists.
+		Microsoft::WRL::ComPtr<ID3D12Resource> Resource;
+	};
+
+	ID3D12Device* mDevice = nullptr;
+	DescriptorHeapAllocator mAllocator;
+	std::unordered_map<ID3D12Resource*, Entry> mEntries;
+	std::vector<ID3D12Resource*> mSlotResources;
+};
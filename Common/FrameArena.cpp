@@ -0,0 +1,218 @@
+#include "FrameArena.h"
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(_DEBUG) && defined(_MSC_VER)
+#include <crtdbg.h>
+#endif
+
+namespace
+{
+	// Small indices for the threads alive at once; a thread's index goes back
+	// to the pool when it exits.
+	struct ThreadSlots
+	{
+		std::mutex Mutex;
+		std::vector<uint32_t> Free;
+		uint32_t Next = 0;
+	};
+
+	ThreadSlots& Slots()
+	{
+		static ThreadSlots slots;
+		return slots;
+	}
+
+	struct ThreadSlot
+	{
+		uint32_t Index;
+
+		ThreadSlot()
+		{
+			ThreadSlots& slots = Slots();
+			std::lock_guard<std::mutex> lock(slots.Mutex);
+			if (slots.Free.empty())
+			{
+				Index = slots.Next++;
+			}
+			else
+			{
+				Index = slots.Free.back();
+				slots.Free.pop_back();
+			}
+		}
+
+		~ThreadSlot()
+		{
+			ThreadSlots& slots = Slots();
+			std::lock_guard<std::mutex> lock(slots.Mutex);
+			slots.Free.push_back(Index);
+		}
+	};
+
+	uint32_t ThreadSlotIndex()
+	{
+		static thread_local ThreadSlot slot;
+		return slot.Index;
+	}
+
+#if defined(_DEBUG) && defined(_MSC_VER)
+	thread_local uint64_t tHeapAllocations = 0;
+	_CRT_ALLOC_HOOK gPreviousAllocHook = nullptr;
+
+	int __cdecl CountingAllocHook(int allocType, void* userData, size_t size, int blockType,
+		long requestNumber, const unsigned char* filename, int lineNumber)
+	{
+		// Blocks the CRT allocates for itself are not the program's doing.
+		if (allocType != _HOOK_FREE && blockType != _CRT_BLOCK)
+			++tHeapAllocations;
+		if (gPreviousAllocHook != nullptr)
+			return gPreviousAllocHook(allocType, userData, size, blockType, requestNumber, filename, lineNumber);
+		return TRUE;
+	}
+
+	struct AllocHookInstaller
+	{
+		AllocHookInstaller()
+		{
+			gPreviousAllocHook = _CrtSetAllocHook(CountingAllocHook);
+		}
+	} gAllocHookInstaller;
+#endif
+}
+
+LinearArena::LinearArena(size_t blockSize)
+	: mBlockSize(blockSize)
+{
+}
+
+void LinearArena::AddBlock(size_t minSize)
+{
+	Block block;
+	block.Size = std::max(mBlockSize, minSize);
+	block.Data.reset(new uint8_t[block.Size]);
+	mBlocks.push_back(std::move(block));
+	mBlockAllocations++;
+}
+
+void* LinearArena::Allocate(size_t size, size_t alignment)
+{
+	size = std::max<size_t>(size, 1);
+	for (;;)
+	{
+		if (mCurrent < mBlocks.size())
+		{
+			Block& block = mBlocks[mCurrent];
+			const uintptr_t base = reinterpret_cast<uintptr_t>(block.Data.get());
+			const uintptr_t start = (base + mOffset + alignment - 1) & ~(uintptr_t)(alignment - 1);
+			if (start + size <= base + block.Size)
+			{
+				mUsed += start + size - (base + mOffset);
+				mOffset = start + size - base;
+				return reinterpret_cast<void*>(start);
+			}
+
+			// Does not fit; the rest of this block goes unused until Reset.
+			if (mCurrent + 1 < mBlocks.size() || mOffset > 0)
+			{
+				mCurrent++;
+				mOffset = 0;
+				continue;
+			}
+		}
+		AddBlock(size + alignment);
+		mCurrent = mBlocks.size() - 1;
+		mOffset = 0;
+	}
+}
+
+void LinearArena::Reset()
+{
+	// A frame that spilled into several blocks gets them as one from now on.
+	if (mBlocks.size() > 1)
+	{
+		size_t total = 0;
+		for (const Block& block : mBlocks)
+			total += block.Size;
+		mBlocks.clear();
+		AddBlock(total);
+	}
+	mCurrent = 0;
+	mOffset = 0;
+	mUsed = 0;
+}
+
+size_t LinearArena::Used()const
+{
+	return mUsed;
+}
+
+size_t LinearArena::Capacity()const
+{
+	size_t total = 0;
+	for (const Block& block : mBlocks)
+		total += block.Size;
+	return total;
+}
+
+uint64_t LinearArena::BlockAllocations()const
+{
+	return mBlockAllocations;
+}
+
+LinearArena& FrameArena::Local()
+{
+	const uint32_t slot = ThreadSlotIndex();
+	if (slot >= MaxThreads)
+		throw std::runtime_error("FrameArena: too many threads");
+
+	LinearArena* arena = mThreads[slot].load(std::memory_order_acquire);
+	if (arena == nullptr)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mOwned.push_back(std::make_unique<LinearArena>());
+		arena = mOwned.back().get();
+		mThreads[slot].store(arena, std::memory_order_release);
+	}
+	return *arena;
+}
+
+void FrameArena::Reset()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	for (auto& arena : mOwned)
+		arena->Reset();
+}
+
+size_t FrameArena::Used()const
+{
+	size_t used = 0;
+	for (const auto& arena : mThreads)
+	{
+		const LinearArena* a = arena.load(std::memory_order_acquire);
+		if (a != nullptr)
+			used += a->Used();
+	}
+	return used;
+}
+
+uint64_t FrameArena::BlockAllocations()const
+{
+	uint64_t count = 0;
+	for (const auto& arena : mThreads)
+	{
+		const LinearArena* a = arena.load(std::memory_order_acquire);
+		if (a != nullptr)
+			count += a->BlockAllocations();
+	}
+	return count;
+}
+
+uint64_t ThreadHeapAllocations()
+{
+#if defined(_DEBUG) && defined(_MSC_VER)
+	return tHeapAllocations;
+#else
+	return 0;
+#endif
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+// Bump allocator.  Allocations are never freed one by one; Reset rewinds the
+// whole arena.  When a frame overflows the first block, more blocks are
+// chained on, and Reset replaces them with one block that holds them all, so
+// once the arena has seen the largest frame it stops touching the heap.
+class LinearArena
+{
+public:
+	explicit LinearArena(size_t blockSize = 64 * 1024);
+	LinearArena(const LinearArena& rhs) = delete;
+	LinearArena& operator=(const LinearArena& rhs) = delete;
+
+	// alignment must be a power of two.
+	void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+	template <typename T>
+	T* Allocate(size_t count)
+	{
+		return static_cast<T*>(Allocate(count * sizeof(T), alignof(T)));
+	}
+
+	void Reset();
+
+	// Bytes handed out since the last Reset.
+	size_t Used()const;
+	size_t Capacity()const;
+	// Blocks allocated from the heap since construction.
+	uint64_t BlockAllocations()const;
+
+private:
+	struct Block
+	{
+		std::unique_ptr<uint8_t[]> Data;
+		size_t Size = 0;
+	};
+
+	void AddBlock(size_t minSize);
+
+	std::vector<Block> mBlocks;
+	size_t mBlockSize;
+	size_t mCurrent = 0;
+	size_t mOffset = 0;
+	size_t mUsed = 0;
+	uint64_t mBlockAllocations = 0;
+};
+
+// Transient memory of one frame, tied to a frame resource: everything
+// allocated while the frame is built stays valid until the frame's fence
+// retires and the engine calls Reset.  Each thread allocates from its own
+// sub-arena, so workers need no locks.
+class FrameArena
+{
+public:
+	// Threads alive at once that can allocate from frame arenas.
+	static const uint32_t MaxThreads = 128;
+
+	FrameArena() = default;
+	FrameArena(const FrameArena& rhs) = delete;
+	FrameArena& operator=(const FrameArena& rhs) = delete;
+
+	// The calling thread's sub-arena, created on its first call.
+	LinearArena& Local();
+
+	// Rewinds every sub-arena.  No thread may be allocating from the frame.
+	void Reset();
+
+	size_t Used()const;
+	uint64_t BlockAllocations()const;
+
+private:
+	std::array<std::atomic<LinearArena*>, MaxThreads> mThreads = {};
+	std::mutex mMutex;
+	std::vector<std::unique_ptr<LinearArena>> mOwned;
+};
+
+// STL allocator over a LinearArena; deallocate is a no-op.  Without an
+// arena it falls back to the heap, so the same container type serves code
+// that runs outside a frame, like a load time bake.
+template <typename T>
+class ArenaAllocator
+{
+public:
+	typedef T value_type;
+	typedef std::true_type propagate_on_container_copy_assignment;
+	typedef std::true_type propagate_on_container_move_assignment;
+	typedef std::true_type propagate_on_container_swap;
+
+	ArenaAllocator(LinearArena* arena = nullptr) noexcept : mArena(arena) {}
+	template <typename U>
+	ArenaAllocator(const ArenaAllocator<U>& rhs) noexcept : mArena(rhs.Arena()) {}
+
+	T* allocate(size_t n)
+	{
+		if (mArena == nullptr)
+			return std::allocator<T>().allocate(n);
+		return mArena->Allocate<T>(n);
+	}
+
+	void deallocate(T* p, size_t n)
+	{
+		if (mArena == nullptr)
+			std::allocator<T>().deallocate(p, n);
+	}
+
+	LinearArena* Arena()const { return mArena; }
+
+private:
+	LinearArena* mArena;
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+	return a.Arena() == b.Arena();
+}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+	return a.Arena() != b.Arena();
+}
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// Heap allocations made by the calling thread so far.  Counted through the
+// CRT debug heap in debug builds; always 0 in release builds.
+uint64_t ThreadHeapAllocations();
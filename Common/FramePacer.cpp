@@ -0,0 +1,143 @@
+#include "FramePacer.h"
+#include <algorithm>
+
+namespace
+{
+	float Milliseconds(std::chrono::steady_clock::duration d)
+	{
+		return std::chrono::duration<float, std::milli>(d).count();
+	}
+}
+
+FramePacer::FramePacer(PacerQueue* queue, PacerLatencyWaiter* latency, uint32_t framesInFlight)
+	: mQueue(queue), mLatency(latency)
+{
+	const uint32_t maxFrames = MaxFramesInFlight;
+	framesInFlight = std::min(std::max(framesInFlight, 1u), maxFrames);
+	mSlotFences.assign(framesInFlight, 0);
+	if (mLatency)
+		mLatency->SetMaximumLatency(framesInFlight);
+
+	mCompletedTime = Clock::now();
+	mWatcher = std::thread(&FramePacer::WatcherMain, this);
+}
+
+FramePacer::~FramePacer()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mQuit = true;
+	}
+	mWake.notify_all();
+	mWatcher.join();
+}
+
+void FramePacer::SetFramesInFlight(uint32_t frames)
+{
+	const uint32_t maxFrames = MaxFramesInFlight;
+	frames = std::min(std::max(frames, 1u), maxFrames);
+
+	// Every slot's resources may be rebuilt, so none may still be in use.
+	Flush();
+	mSlotFences.assign(frames, 0);
+	mNextSlot = 0;
+	if (mLatency)
+		mLatency->SetMaximumLatency(frames);
+}
+
+uint32_t FramePacer::FramesInFlight()const
+{
+	return (uint32_t)mSlotFences.size();
+}
+
+uint32_t FramePacer::BeginFrame()
+{
+	Clock::time_point now = Clock::now();
+	mFrame = FramePacingStats();
+	if (mStarted)
+		mFrame.FrameMilliseconds = Milliseconds(now - mFrameStart);
+	mFrameStart = now;
+	mStarted = true;
+
+	if (mLatency)
+	{
+		mLatency->Wait();
+		const Clock::time_point end = Clock::now();
+		mFrame.LatencyWaitMilliseconds = Milliseconds(end - now);
+		now = end;
+	}
+
+	mSlot = mNextSlot;
+	const uint64_t fence = mSlotFences[mSlot];
+	if (fence != 0 && mQueue->CompletedValue() < fence)
+	{
+		mQueue->WaitFor(fence);
+		const Clock::time_point end = Clock::now();
+		mFrame.FenceWaitMilliseconds = Milliseconds(end - now);
+		now = end;
+	}
+	mFrame.CpuWaitMilliseconds = mFrame.LatencyWaitMilliseconds + mFrame.FenceWaitMilliseconds;
+
+	return mSlot;
+}
+
+uint64_t FramePacer::EndFrame()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (mLastSignaled != 0 && mCompletedValue >= mLastSignaled)
+			mFrame.GpuWaitMilliseconds = Milliseconds(Clock::now() - mCompletedTime);
+	}
+
+	mLastSignaled = mQueue->Signal();
+	mSlotFences[mSlot] = mLastSignaled;
+	Watch(mLastSignaled);
+	mNextSlot = (mSlot + 1) % (uint32_t)mSlotFences.size();
+
+	mStats = mFrame;
+	return mLastSignaled;
+}
+
+void FramePacer::Flush()
+{
+	mLastSignaled = mQueue->Signal();
+	Watch(mLastSignaled);
+	if (mQueue->CompletedValue() < mLastSignaled)
+		mQueue->WaitFor(mLastSignaled);
+}
+
+const FramePacingStats& FramePacer::Stats()const
+{
+	return mStats;
+}
+
+void FramePacer::Watch(uint64_t value)
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mWatchTarget = value;
+	}
+	mWake.notify_one();
+}
+
+void FramePacer::WatcherMain()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	for (;;)
+	{
+		mWake.wait(lock, [this]() { return mQuit || mWatchTarget > mCompletedValue; });
+		if (mQuit)
+			return;
+
+		// Fences complete in order; when several were signaled meanwhile,
+		// only the newest one's completion time matters.
+		const uint64_t value = mWatchTarget;
+		lock.unlock();
+		mQueue->WaitFor(value);
+		const Clock::time_point now = Clock::now();
+		lock.lock();
+
+		mCompletedValue = value;
+		mCompletedTime = now;
+	}
+}
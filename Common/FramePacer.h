@@ -0,0 +1,110 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// GPU side of the frame pacer.  FramePacerD3D12.h implements it on a D3D12
+// queue and fence; anything else, like a fake in a test, works as well.
+class PacerQueue
+{
+public:
+	virtual ~PacerQueue() = default;
+
+	// Queues a fence signal behind the work submitted so far and returns its value.
+	virtual uint64_t Signal() = 0;
+	virtual uint64_t CompletedValue() = 0;
+	// Blocks until the fence reaches value.  The pacer calls it from two
+	// threads at once.
+	virtual void WaitFor(uint64_t value) = 0;
+};
+
+// Swap chain side: blocks until the swap chain can queue another frame.
+class PacerLatencyWaiter
+{
+public:
+	virtual ~PacerLatencyWaiter() = default;
+
+	virtual void SetMaximumLatency(uint32_t frames) = 0;
+	virtual void Wait() = 0;
+};
+
+struct FramePacingStats
+{
+	// CPU time blocked on the swap chain.
+	float LatencyWaitMilliseconds = 0.0f;
+	// CPU time blocked until the frame resource being reused left the GPU.
+	float FenceWaitMilliseconds = 0.0f;
+	// Both of the above.
+	float CpuWaitMilliseconds = 0.0f;
+	// How long the GPU had been out of work when the frame was submitted:
+	// the time since the previous frame's fence completed, 0 if it had not.
+	float GpuWaitMilliseconds = 0.0f;
+	// Start of the previous frame to the start of this one.
+	float FrameMilliseconds = 0.0f;
+};
+
+// Hands out frame resource slots.  BeginFrame blocks on the swap chain,
+// which keeps input latency down, and then on the fence of the slot's last
+// use; EndFrame fences the slot.  More frames in flight keep the GPU busier
+// at the cost of latency.  A watcher thread timestamps fence completions to
+// measure how long the GPU starves.
+class FramePacer
+{
+public:
+	static const uint32_t MaxFramesInFlight = 8;
+
+	// latency may be null.
+	FramePacer(PacerQueue* queue, PacerLatencyWaiter* latency, uint32_t framesInFlight);
+	FramePacer(const FramePacer& rhs) = delete;
+	FramePacer& operator=(const FramePacer& rhs) = delete;
+	~FramePacer();
+
+	// Waits for the GPU to go idle and restarts at slot 0; the caller has to
+	// rebuild its frame resources to match.
+	void SetFramesInFlight(uint32_t frames);
+	uint32_t FramesInFlight()const;
+
+	// Returns the frame resource slot to record into once it is free.
+	uint32_t BeginFrame();
+	// Call after the frame was submitted and presented.  Returns the slot's fence value.
+	uint64_t EndFrame();
+	// Waits until the GPU has finished everything submitted.
+	void Flush();
+
+	// Of the last frame that ended.
+	const FramePacingStats& Stats()const;
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	void Watch(uint64_t value);
+	void WatcherMain();
+
+	PacerQueue* mQueue;
+	PacerLatencyWaiter* mLatency;
+
+	std::vector<uint64_t> mSlotFences;
+	uint32_t mSlot = 0;
+	uint32_t mNextSlot = 0;
+	uint64_t mLastSignaled = 0;
+
+	bool mStarted = false;
+	Clock::time_point mFrameStart;
+
+	FramePacingStats mFrame;
+	FramePacingStats mStats;
+
+	std::thread mWatcher;
+	std::mutex mMutex;
+	std::condition_variable mWake;
+	// Newest fence value to watch; a fixed slot, so a frame never allocates.
+	uint64_t mWatchTarget = 0;
+	// Last fence value the watcher saw complete, and when.
+	uint64_t mCompletedValue = 0;
+	Clock::time_point mCompletedTime;
+	bool mQuit = false;
+};
@@ -0,0 +1,86 @@
+#include "FramePacerD3D12.h"
+
+using Microsoft::WRL::ComPtr;
+
+FenceWaiter::FenceWaiter()
+{
+	mEvent = CreateEventEx(nullptr, nullptr, 0, EVENT_ALL_ACCESS);
+	if (mEvent == nullptr)
+		ThrowIfFailed(HRESULT_FROM_WIN32(GetLastError()));
+}
+
+FenceWaiter::~FenceWaiter()
+{
+	CloseHandle(mEvent);
+}
+
+void FenceWaiter::Wait(ID3D12Fence* fence, UINT64 value)
+{
+	if (fence->GetCompletedValue() >= value)
+		return;
+
+	// Fire event when GPU hits the fence value.
+	ThrowIfFailed(fence->SetEventOnCompletion(value, mEvent));
+	WaitForSingleObject(mEvent, INFINITE);
+}
+
+D3D12PacerQueue::D3D12PacerQueue(ID3D12CommandQueue* queue, ID3D12Fence* fence, UINT64* currentFence)
+	: mQueue(queue), mFence(fence), mCurrentFence(currentFence)
+{
+}
+
+uint64_t D3D12PacerQueue::Signal()
+{
+	// Because we are on the GPU timeline, the new fence point won't be set
+	// until the GPU finishes processing all the commands prior to this Signal().
+	ThrowIfFailed(mQueue->Signal(mFence, ++*mCurrentFence));
+	return *mCurrentFence;
+}
+
+uint64_t D3D12PacerQueue::CompletedValue()
+{
+	return mFence->GetCompletedValue();
+}
+
+void D3D12PacerQueue::WaitFor(uint64_t value)
+{
+	// One event per waiting thread: the render thread and the pacer's watcher.
+	static thread_local FenceWaiter waiter;
+	waiter.Wait(mFence, value);
+}
+
+SwapChainLatencyWaiter::~SwapChainLatencyWaiter()
+{
+	Reset(nullptr);
+}
+
+void SwapChainLatencyWaiter::Reset(IDXGISwapChain* swapChain)
+{
+	if (mWaitable != nullptr)
+	{
+		CloseHandle(mWaitable);
+		mWaitable = nullptr;
+	}
+	mSwapChain.Reset();
+	if (swapChain == nullptr)
+		return;
+
+	ThrowIfFailed(swapChain->QueryInterface(IID_PPV_ARGS(&mSwapChain)));
+	ThrowIfFailed(mSwapChain->SetMaximumFrameLatency(mMaxLatency));
+	mWaitable = mSwapChain->GetFrameLatencyWaitableObject();
+}
+
+void SwapChainLatencyWaiter::SetMaximumLatency(uint32_t frames)
+{
+	mMaxLatency = frames;
+	if (mSwapChain)
+		ThrowIfFailed(mSwapChain->SetMaximumFrameLatency(frames));
+}
+
+void SwapChainLatencyWaiter::Wait()
+{
+	// Time out rather than hang if the swap chain stops presenting, say
+	// while the window is occluded.
+	if (mWaitable != nullptr)
+		WaitForSingleObjectEx(mWaitable, 1000, TRUE);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "d3dUtil.h"
+#include "FramePacer.h"
+
+// Blocks until a fence reaches a value.  The event is created once and
+// reused for every wait.
+class FenceWaiter
+{
+public:
+	FenceWaiter();
+	FenceWaiter(const FenceWaiter& rhs) = delete;
+	FenceWaiter& operator=(const FenceWaiter& rhs) = delete;
+	~FenceWaiter();
+
+	void Wait(ID3D12Fence* fence, UINT64 value);
+
+private:
+	HANDLE mEvent = nullptr;
+};
+
+// Signals fence on queue.  The last signaled value is shared with the other
+// users of the fence, such as D3DApp::FlushCommandQueue.
+class D3D12PacerQueue : public PacerQueue
+{
+public:
+	D3D12PacerQueue(ID3D12CommandQueue* queue, ID3D12Fence* fence, UINT64* currentFence);
+
+	virtual uint64_t Signal()override;
+	virtual uint64_t CompletedValue()override;
+	virtual void WaitFor(uint64_t value)override;
+
+private:
+	ID3D12CommandQueue* mQueue;
+	ID3D12Fence* mFence;
+	UINT64* mCurrentFence;
+};
+
+// Waits on the frame latency object of a swap chain created with
+// DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT.
+class SwapChainLatencyWaiter : public PacerLatencyWaiter
+{
+public:
+	SwapChainLatencyWaiter() = default;
+	SwapChainLatencyWaiter(const SwapChainLatencyWaiter& rhs) = delete;
+	SwapChainLatencyWaiter& operator=(const SwapChainLatencyWaiter& rhs) = delete;
+	~SwapChainLatencyWaiter();
+
+	// Switches to a new swap chain, keeping the maximum latency; null detaches.
+	void Reset(IDXGISwapChain* swapChain);
+
+	virtual void SetMaximumLatency(uint32_t frames)override;
+	virtual void Wait()override;
+
+private:
+	Microsoft::WRL::ComPtr<IDXGISwapChain2> mSwapChain;
+	HANDLE mWaitable = nullptr;
+	uint32_t mMaxLatency = 1;
+};
@@ -121,3 +121,15 @@ void GameTimer::Tick()
 	}
 }
 
+void GameTimer::Set(float totalTime, float deltaTime)
+{
+	// Report exactly these times, as if the clock had run from zero
+	// without a pause.
+	mBaseTime   = 0;
+	mPausedTime = 0;
+	mStopTime   = 0;
+	mStopped    = false;
+	mCurrTime   = (__int64)(totalTime / mSecondsPerCount);
+	mPrevTime   = mCurrTime;
+	mDeltaTime  = deltaTime;
+}
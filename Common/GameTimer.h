@@ -13,6 +13,7 @@ public:
 	void Start(); // Call when unpaused.
 	void Stop();  // Call when paused.
 	void Tick();  // Call every frame.
+	void Set(float totalTime, float deltaTime); // Reports recorded times; Reset before ticking again.
 
 private:
 	double mSecondsPerCount;
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+// 64-bit non-cryptographic hash (XXH64 algorithm).  Large inputs are consumed
+// in 32-byte stripes by four independent lanes, which keeps the multiply/rotate
+// chains in parallel and runs at memory bandwidth on current CPUs.
+uint64_t Hash64(const void* data, size_t size, uint64_t seed = 0);
+
+inline uint64_t Hash64(const std::string& str, uint64_t seed = 0)
+{
+	return Hash64(str.data(), str.size(), seed);
+}
+
+inline uint64_t Hash64(const std::wstring& str, uint64_t seed = 0)
+{
+	return Hash64(str.data(), str.size() * sizeof(wchar_t), seed);
+}
+
+// Fixed width lower case hex, used for cache file names.
+std::string HashToString(uint64_t hash);
@@ -0,0 +1,141 @@
+#include "MappedFile.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+#ifdef _WIN32
+
+HRESULT MappedFile::Open(const std::wstring& filename)
+{
+	Close();
+	return Map(CreateFileW(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+}
+
+HRESULT MappedFile::Open(const std::string& filename)
+{
+	Close();
+	return Map(CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+}
+
+HRESULT MappedFile::Map(HANDLE file)
+{
+	mFile = file;
+	if(mFile == INVALID_HANDLE_VALUE)
+		return HRESULT_FROM_WIN32(GetLastError());
+
+	LARGE_INTEGER fileSize = { 0 };
+	if(!GetFileSizeEx(mFile, &fileSize))
+	{
+		HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+		Close();
+		return hr;
+	}
+
+	// Empty files cannot be mapped, and larger than the address space cannot be viewed.
+	if(fileSize.QuadPart == 0 || (ULONGLONG)fileSize.QuadPart > (ULONGLONG)SIZE_MAX)
+	{
+		Close();
+		return E_FAIL;
+	}
+
+	mMapping = CreateFileMappingW(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if(mMapping == nullptr)
+	{
+		HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+		Close();
+		return hr;
+	}
+
+	mData = static_cast<const uint8_t*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+	if(mData == nullptr)
+	{
+		HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+		Close();
+		return hr;
+	}
+
+	mSize = (size_t)fileSize.QuadPart;
+	return S_OK;
+}
+
+void MappedFile::Close()
+{
+	if(mData != nullptr)
+		UnmapViewOfFile(mData);
+	if(mMapping != nullptr)
+		CloseHandle(mMapping);
+	if(mFile != INVALID_HANDLE_VALUE)
+		CloseHandle(mFile);
+
+	mData = nullptr;
+	mMapping = nullptr;
+	mFile = INVALID_HANDLE_VALUE;
+	mSize = 0;
+}
+
+#else
+
+HRESULT MappedFile::Open(const std::string& filename)
+{
+	Close();
+
+	const int file = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+	if(file < 0)
+		return E_FAIL;
+
+	// Empty files cannot be mapped, and larger than the address space cannot be viewed.
+	struct stat info;
+	if(fstat(file, &info) != 0 || info.st_size <= 0 || (uint64_t)info.st_size > (uint64_t)SIZE_MAX)
+	{
+		close(file);
+		return E_FAIL;
+	}
+
+	// The mapping keeps the file open on its own.
+	void* data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+	if(data == MAP_FAILED)
+		return E_FAIL;
+	madvise(data, (size_t)info.st_size, MADV_SEQUENTIAL);
+
+	mData = static_cast<const uint8_t*>(data);
+	mSize = (size_t)info.st_size;
+	return S_OK;
+}
+
+void MappedFile::Close()
+{
+	if(mData != nullptr)
+		munmap(const_cast<uint8_t*>(mData), mSize);
+
+	mData = nullptr;
+	mSize = 0;
+}
+
+#endif
+
+bool MappedFile::IsOpen()const
+{
+	return mData != nullptr;
+}
+
+const uint8_t* MappedFile::Data()const
+{
+	return mData;
+}
+
+size_t MappedFile::Size()const
+{
+	return mSize;
+}
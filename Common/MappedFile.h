@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#ifdef _WIN32
+#include <windows.h>
+#else
+// Just enough of HRESULT for the POSIX mapping.
+typedef int32_t HRESULT;
+#define S_OK ((HRESULT)0)
+#define E_FAIL ((HRESULT)0x80004005L)
+#define SUCCEEDED(hr) (((HRESULT)(hr)) >= 0)
+#define FAILED(hr) (((HRESULT)(hr)) < 0)
+#endif
+
+// Read-only memory mapping of a whole file.  Pointers returned by Data()
+// stay valid until Close() or destruction.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile& rhs) = delete;
+	MappedFile& operator=(const MappedFile& rhs) = delete;
+	~MappedFile();
+
+	// Maps filename; fails for missing or empty files.
+#ifdef _WIN32
+	HRESULT Open(const std::wstring& filename);
+#endif
+	HRESULT Open(const std::string& filename);
+	void Close();
+
+	bool IsOpen()const;
+	const uint8_t* Data()const;
+	size_t Size()const;
+
+private:
+#ifdef _WIN32
+	// Maps the file behind a handle from CreateFile, taking it over.
+	HRESULT Map(HANDLE file);
+
+	HANDLE mFile = INVALID_HANDLE_VALUE;
+	HANDLE mMapping = nullptr;
+#endif
+	const uint8_t* mData = nullptr;
+	size_t mSize = 0;
+};
@@ -0,0 +1,238 @@
+#include "MipGenerator.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+
+namespace
+{
+	// Half width of the Kaiser kernel in destination texels, and its shape.
+	const float KaiserWidth = 3.0f;
+	const float KaiserAlpha = 4.0f;
+	const float Pi = 3.1415926535f;
+
+	float SrgbToLinear(float v)
+	{
+		return v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
+	}
+
+	// 256 entry tables for 8 bit sRGB decode, and the linear values halfway
+	// between neighbouring codes for an exact, pow-free encode.
+	struct SrgbTables
+	{
+		float ToLinear[256];
+		float Midpoints[255];
+
+		SrgbTables()
+		{
+			for(int i = 0; i < 256; ++i)
+				ToLinear[i] = SrgbToLinear(i / 255.0f);
+			for(int i = 0; i < 255; ++i)
+				Midpoints[i] = SrgbToLinear((i + 0.5f) / 255.0f);
+		}
+
+		uint8_t Encode(float linear)const
+		{
+			return (uint8_t)(std::upper_bound(Midpoints, Midpoints + 255, linear) - Midpoints);
+		}
+	};
+
+	const SrgbTables& Tables()
+	{
+		static const SrgbTables tables;
+		return tables;
+	}
+
+	uint8_t EncodeUnorm(float v)
+	{
+		v = v * 255.0f + 0.5f;
+		return (uint8_t)(v < 0.0f ? 0.0f : (v > 255.0f ? 255.0f : v));
+	}
+
+	// Zeroth order modified Bessel function of the first kind.
+	float BesselI0(float x)
+	{
+		float sum = 1.0f, term = 1.0f;
+		const float q = x * x * 0.25f;
+		for(int k = 1; k < 32 && term > sum * 1e-8f; ++k)
+		{
+			term *= q / (float)(k * k);
+			sum += term;
+		}
+		return sum;
+	}
+
+	float Kaiser(float t)
+	{
+		t = std::fabs(t);
+		if(t >= KaiserWidth)
+			return 0.0f;
+		const float r = t / KaiserWidth;
+		const float window = BesselI0(KaiserAlpha * std::sqrt(1.0f - r * r)) / BesselI0(KaiserAlpha);
+		const float sinc = t < 1e-5f ? 1.0f : std::sin(Pi * t) / (Pi * t);
+		return sinc * window;
+	}
+
+	// Contributions of source texels to one destination texel along one axis.
+	struct Taps
+	{
+		int First = 0;
+		std::vector<float> Weights;
+	};
+
+	// Weights for resampling srcSize texels to dstSize along one axis.
+	// Out of range texels clamp to the edge.
+	std::vector<Taps> BuildTaps(uint32_t srcSize, uint32_t dstSize, MipFilter filter)
+	{
+		std::vector<Taps> taps(dstSize);
+		const float scale = (float)srcSize / (float)dstSize;
+		for(uint32_t i = 0; i < dstSize; ++i)
+		{
+			const float center = (i + 0.5f) * scale;
+			Taps& t = taps[i];
+			float sum = 0.0f;
+			if(filter == MipFilter::Box)
+			{
+				// Exact area coverage of [center - scale/2, center + scale/2].
+				const float lo = center - scale * 0.5f, hi = center + scale * 0.5f;
+				t.First = (int)std::floor(lo);
+				for(int j = t.First; (float)j < hi; ++j)
+				{
+					float w = std::min(hi, (float)j + 1.0f) - std::max(lo, (float)j);
+					t.Weights.push_back(std::max(w, 0.0f));
+					sum += t.Weights.back();
+				}
+			}
+			else
+			{
+				const float support = KaiserWidth * scale;
+				t.First = (int)std::floor(center - support);
+				for(int j = t.First; (float)j < center + support; ++j)
+				{
+					t.Weights.push_back(Kaiser(((float)j + 0.5f - center) / scale));
+					sum += t.Weights.back();
+				}
+			}
+			for(float& w : t.Weights)
+				w /= sum;
+		}
+		return taps;
+	}
+
+	// Runs body(row) for rows [0, count) on up to threads threads.
+	template<typename Body>
+	void ParallelRows(uint32_t count, unsigned threads, const Body& body)
+	{
+		std::atomic<uint32_t> next(0);
+		auto worker = [&]()
+		{
+			for(uint32_t row = next++; row < count; row = next++)
+				body(row);
+		};
+		std::vector<std::thread> pool;
+		for(unsigned i = 1; i < std::min<unsigned>(threads, count); ++i)
+			pool.emplace_back(worker);
+		worker();
+		for(auto& t : pool)
+			t.join();
+	}
+
+	// Separable resample of a float RGBA image; horizontal pass first.
+	void Resample(const std::vector<float>& src, uint32_t srcW, uint32_t srcH,
+		std::vector<float>& dst, uint32_t dstW, uint32_t dstH, MipFilter filter, unsigned threads)
+	{
+		const std::vector<Taps> tapsX = BuildTaps(srcW, dstW, filter);
+		const std::vector<Taps> tapsY = BuildTaps(srcH, dstH, filter);
+
+		std::vector<float> temp((size_t)dstW * srcH * 4);
+		ParallelRows(srcH, threads, [&](uint32_t y)
+		{
+			const float* in = &src[(size_t)y * srcW * 4];
+			float* out = &temp[(size_t)y * dstW * 4];
+			for(uint32_t x = 0; x < dstW; ++x)
+			{
+				float acc[4] = {};
+				const Taps& t = tapsX[x];
+				for(size_t k = 0; k < t.Weights.size(); ++k)
+				{
+					const int sx = std::min(std::max(t.First + (int)k, 0), (int)srcW - 1);
+					const float w = t.Weights[k];
+					for(int c = 0; c < 4; ++c)
+						acc[c] += w * in[sx * 4 + c];
+				}
+				for(int c = 0; c < 4; ++c)
+					out[x * 4 + c] = acc[c];
+			}
+		});
+
+		dst.assign((size_t)dstW * dstH * 4, 0.0f);
+		ParallelRows(dstH, threads, [&](uint32_t y)
+		{
+			float* out = &dst[(size_t)y * dstW * 4];
+			const Taps& t = tapsY[y];
+			for(size_t k = 0; k < t.Weights.size(); ++k)
+			{
+				const int sy = std::min(std::max(t.First + (int)k, 0), (int)srcH - 1);
+				const float w = t.Weights[k];
+				const float* in = &temp[(size_t)sy * dstW * 4];
+				for(uint32_t i = 0; i < dstW * 4; ++i)
+					out[i] += w * in[i];
+			}
+		});
+	}
+}
+
+uint32_t FullMipCount(uint32_t width, uint32_t height)
+{
+	uint32_t count = 1;
+	while(width > 1 || height > 1)
+	{
+		width = std::max(1u, width / 2);
+		height = std::max(1u, height / 2);
+		++count;
+	}
+	return count;
+}
+
+std::vector<MipLevel> GenerateMips(const uint8_t* rgba, uint32_t width, uint32_t height,
+	MipFilter filter, bool srgb, unsigned threads)
+{
+	std::vector<MipLevel> levels;
+	if(width == 0 || height == 0)
+		return levels;
+	if(threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+
+	const SrgbTables& tables = Tables();
+	std::vector<float> current((size_t)width * height * 4);
+	for(size_t i = 0; i < current.size(); ++i)
+	{
+		const bool color = (i & 3) != 3;
+		current[i] = (srgb && color) ? tables.ToLinear[rgba[i]] : rgba[i] / 255.0f;
+	}
+
+	std::vector<float> next;
+	uint32_t w = width, h = height;
+	while(w > 1 || h > 1)
+	{
+		const uint32_t nw = std::max(1u, w / 2);
+		const uint32_t nh = std::max(1u, h / 2);
+		Resample(current, w, h, next, nw, nh, filter, threads);
+
+		MipLevel level;
+		level.Width = nw;
+		level.Height = nh;
+		level.Pixels.resize(next.size());
+		for(size_t i = 0; i < next.size(); ++i)
+		{
+			const bool color = (i & 3) != 3;
+			level.Pixels[i] = (srgb && color) ? tables.Encode(next[i]) : EncodeUnorm(next[i]);
+		}
+		levels.push_back(std::move(level));
+
+		current.swap(next);
+		w = nw;
+		h = nh;
+	}
+	return levels;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// CPU mip chain generation for RGBA8 images, used by the DDS loader for files
+// that ship without mips and by the offline texture tools.
+
+enum class MipFilter
+{
+	Box,	// area average, cheap and never rings
+	Kaiser	// Kaiser windowed sinc, sharper minification
+};
+
+struct MipLevel
+{
+	uint32_t Width = 0;
+	uint32_t Height = 0;
+	std::vector<uint8_t> Pixels;	// RGBA8, tightly packed
+};
+
+// Number of levels in a full chain down to 1x1, level 0 included.
+uint32_t FullMipCount(uint32_t width, uint32_t height);
+
+// Builds levels 1 to FullMipCount - 1 from the level 0 image in rgba.  With
+// srgb set the color channels are filtered in linear space and re-encoded, so
+// the smaller levels keep the brightness of the original; alpha is always
+// filtered as stored.  Each level is filtered from the previous one, kept in
+// float so the chain does not accumulate rounding.  Rows are split across
+// threads, threads == 0 uses every hardware thread.
+std::vector<MipLevel> GenerateMips(const uint8_t* rgba, uint32_t width, uint32_t height,
+	MipFilter filter, bool srgb, unsigned threads = 0);
@@ -0,0 +1,284 @@
+#include "Profiler.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+
+// Gives each thread its ring and retires it when the thread exits, so
+// EndFrame can drain what is left and let it go.
+struct ThreadRingOwner
+{
+	std::shared_ptr<Profiler::ThreadRing> Ring;
+
+	~ThreadRingOwner()
+	{
+		if (Ring)
+			Ring->Retired.store(true, std::memory_order_release);
+	}
+};
+
+namespace
+{
+	void WriteJsonString(std::ofstream& out, const std::string& s)
+	{
+		out << '"';
+		for (char c : s)
+		{
+			if (c == '"' || c == '\\')
+				out << '\\' << c;
+			else if ((unsigned char)c < 0x20)
+				out << ' ';
+			else
+				out << c;
+		}
+		out << '"';
+	}
+
+	float Milliseconds(uint64_t ticks)
+	{
+		return (float)((double)ticks / 1000000.0);
+	}
+}
+
+Profiler& Profiler::Instance()
+{
+	static Profiler profiler;
+	return profiler;
+}
+
+Profiler::Profiler()
+{
+	mIntervalStart = Now();
+}
+
+uint64_t Profiler::Now()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Profiler::ThreadRing* Profiler::Ring()
+{
+	static thread_local ThreadRingOwner owner;
+	if (!owner.Ring)
+	{
+		owner.Ring = std::make_shared<ThreadRing>();
+		std::lock_guard<std::mutex> lock(mRingsMutex);
+		owner.Ring->Id = mNextThreadId++;
+		mRings.push_back(owner.Ring);
+	}
+	return owner.Ring.get();
+}
+
+void Profiler::SetThreadName(const char* name)
+{
+	Ring()->Name.store(name, std::memory_order_release);
+}
+
+void Profiler::Record(const char* name, uint64_t start, uint64_t end)
+{
+	ThreadRing* ring = Ring();
+	const uint64_t head = ring->Head.load(std::memory_order_relaxed);
+	if (head - ring->Tail.load(std::memory_order_acquire) >= RingSize)
+	{
+		mDropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	Event& e = ring->Events[head & (RingSize - 1)];
+	e.Name = name;
+	e.Start = start;
+	e.End = end;
+	ring->Head.store(head + 1, std::memory_order_release);
+}
+
+uint32_t Profiler::ZoneId(const char* name)
+{
+	auto it = mZoneByPointer.find(name);
+	if (it != mZoneByPointer.end())
+		return it->second;
+
+	// The same name can live at several addresses, one per translation unit.
+	auto named = mZoneByName.emplace(name, (uint32_t)mZoneNames.size());
+	if (named.second)
+	{
+		mZoneNames.push_back(name);
+		mTotals.push_back(ZoneTotals());
+	}
+	mZoneByPointer.emplace(name, named.first->second);
+	return named.first->second;
+}
+
+void Profiler::EndFrame()
+{
+	const uint64_t now = Now();
+	const bool capturing = mCaptureFramesLeft > 0;
+
+	{
+		std::lock_guard<std::mutex> lock(mRingsMutex);
+		mDrainRings = mRings;
+	}
+
+	for (const std::shared_ptr<ThreadRing>& ring : mDrainRings)
+	{
+		// Read before draining: a retired ring gets no more events.
+		const bool retired = ring->Retired.load(std::memory_order_acquire);
+		const uint64_t head = ring->Head.load(std::memory_order_acquire);
+		uint64_t tail = ring->Tail.load(std::memory_order_relaxed);
+
+		for (; tail != head; ++tail)
+		{
+			const Event& e = ring->Events[tail & (RingSize - 1)];
+			const uint32_t zone = ZoneId(e.Name);
+			const uint64_t ticks = e.End - e.Start;
+
+			ZoneTotals& totals = mTotals[zone];
+			totals.Calls++;
+			totals.Ticks += ticks;
+			totals.MaxTicks = std::max(totals.MaxTicks, ticks);
+
+			if (capturing)
+				mCapture.push_back({ zone, ring->Id, e.Start, e.End });
+		}
+		ring->Tail.store(tail, std::memory_order_release);
+
+		if (capturing)
+		{
+			const char* name = ring->Name.load(std::memory_order_acquire);
+			if (name != nullptr)
+				mThreadNames[ring->Id] = name;
+		}
+
+		if (retired)
+		{
+			std::lock_guard<std::mutex> lock(mRingsMutex);
+			mRings.erase(std::find(mRings.begin(), mRings.end(), ring));
+		}
+	}
+
+	mDrainRings.clear();
+
+	if (capturing)
+	{
+		mCaptureFrames.push_back(now);
+		mCaptureFramesLeft--;
+	}
+
+	mIntervalFrames++;
+	if ((double)(now - mIntervalStart) >= mIntervalSeconds * 1.0e9)
+	{
+		Publish();
+		mIntervalStart = now;
+		mIntervalFrames = 0;
+	}
+}
+
+void Profiler::Publish()
+{
+	const float frames = (float)std::max(mIntervalFrames, 1u);
+
+	mStats.clear();
+	for (size_t i = 0; i < mTotals.size(); ++i)
+	{
+		ZoneTotals& totals = mTotals[i];
+		if (totals.Calls == 0)
+			continue;
+
+		ZoneStats stats;
+		stats.Name = mZoneNames[i];
+		stats.CallsPerFrame = (float)totals.Calls / frames;
+		stats.MillisecondsPerFrame = Milliseconds(totals.Ticks) / frames;
+		stats.MaxMilliseconds = Milliseconds(totals.MaxTicks);
+		mStats.push_back(stats);
+
+		totals = ZoneTotals();
+	}
+
+	std::sort(mStats.begin(), mStats.end(), [](const ZoneStats& a, const ZoneStats& b)
+	{
+		return a.MillisecondsPerFrame > b.MillisecondsPerFrame;
+	});
+
+	if (mCallback)
+		mCallback(mStats);
+}
+
+void Profiler::StartCapture(uint32_t frames)
+{
+	mCapture.clear();
+	mCaptureFrames.clear();
+	mThreadNames.clear();
+	mCaptureFramesLeft = frames;
+}
+
+bool Profiler::IsCapturing()const
+{
+	return mCaptureFramesLeft > 0;
+}
+
+bool Profiler::SaveCapture(const std::string& file)const
+{
+	std::ofstream out(file, std::ios::binary | std::ios::trunc);
+	if (!out)
+		return false;
+
+	uint64_t base = mCaptureFrames.empty() ? 0 : mCaptureFrames.front();
+	for (const CapturedEvent& e : mCapture)
+		base = std::min(base, e.Start);
+
+	// trace_event timestamps are in microseconds.
+	auto micros = [base](uint64_t t) { return (double)(t - base) / 1000.0; };
+
+	out << "{\"traceEvents\":[\n";
+	bool first = true;
+	auto separator = [&out, &first]()
+	{
+		if (!first)
+			out << ",\n";
+		first = false;
+	};
+
+	for (const auto& thread : mThreadNames)
+	{
+		separator();
+		out << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":0,\"tid\":" << thread.first << ",\"args\":{\"name\":";
+		WriteJsonString(out, thread.second);
+		out << "}}";
+	}
+
+	out.precision(3);
+	out << std::fixed;
+	for (size_t i = 0; i < mCaptureFrames.size(); ++i)
+	{
+		separator();
+		out << "{\"ph\":\"i\",\"s\":\"g\",\"name\":\"Frame " << i << "\",\"pid\":0,\"tid\":0,\"ts\":"
+			<< micros(mCaptureFrames[i]) << "}";
+	}
+
+	for (const CapturedEvent& e : mCapture)
+	{
+		separator();
+		out << "{\"ph\":\"X\",\"name\":";
+		WriteJsonString(out, mZoneNames[e.Zone]);
+		out << ",\"pid\":0,\"tid\":" << e.Thread << ",\"ts\":" << micros(e.Start)
+			<< ",\"dur\":" << (double)(e.End - e.Start) / 1000.0 << "}";
+	}
+
+	out << "\n]}\n";
+	return (bool)out;
+}
+
+void Profiler::SetStatsCallback(std::function<void(const std::vector<ZoneStats>&)> callback, float intervalSeconds)
+{
+	mCallback = std::move(callback);
+	mIntervalSeconds = intervalSeconds;
+}
+
+const std::vector<ZoneStats>& Profiler::Stats()const
+{
+	return mStats;
+}
+
+uint64_t Profiler::DroppedEvents()const
+{
+	return mDropped.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Instrumentation is compiled in unless the build defines PROFILER_ENABLED=0,
+// which turns every PROFILE_ macro below into nothing.
+#ifndef PROFILER_ENABLED
+#define PROFILER_ENABLED 1
+#endif
+
+// Timing of one zone, summed over every thread.
+struct ZoneStats
+{
+	// Zone name as passed to PROFILE_ZONE.
+	std::string Name;
+	// Per frame, averaged over the stats interval.
+	float CallsPerFrame = 0.0f;
+	float MillisecondsPerFrame = 0.0f;
+	// Longest single call in the interval.
+	float MaxMilliseconds = 0.0f;
+};
+
+// Collects timed zones from any thread.  Each thread writes into its own
+// ring buffer without locking; EndFrame, on the main thread, drains the
+// rings into per-zone statistics and, while capturing, into a trace that
+// SaveCapture writes in Chrome's trace_event format (chrome://tracing,
+// ui.perfetto.dev).  Use it through the PROFILE_ macros.
+class Profiler
+{
+public:
+	// Events a thread can record between two EndFrame calls; more are dropped.
+	static const uint32_t RingSize = 1 << 14;
+
+	static Profiler& Instance();
+
+	Profiler(const Profiler& rhs) = delete;
+	Profiler& operator=(const Profiler& rhs) = delete;
+
+	// name must outlive the profiler, like a string literal.
+	void SetThreadName(const char* name);
+
+	// Records a zone on the calling thread; times are from Now().
+	void Record(const char* name, uint64_t start, uint64_t end);
+	static uint64_t Now();
+
+	// Marks the end of a frame.  Call once per frame from the main thread.
+	void EndFrame();
+
+	// Records the next frames into a trace, replacing the previous capture.
+	void StartCapture(uint32_t frames);
+	bool IsCapturing()const;
+	// Writes the last capture; false if the file can't be written.
+	bool SaveCapture(const std::string& file)const;
+
+	// Called with the zones sorted by time per frame every interval.
+	void SetStatsCallback(std::function<void(const std::vector<ZoneStats>&)> callback, float intervalSeconds = 1.0f);
+	// Of the last complete interval.
+	const std::vector<ZoneStats>& Stats()const;
+	// Events lost to full rings since the start.
+	uint64_t DroppedEvents()const;
+
+private:
+	struct Event
+	{
+		const char* Name;
+		uint64_t Start;
+		uint64_t End;
+	};
+
+	// Single producer, the owning thread; single consumer, EndFrame.
+	struct ThreadRing
+	{
+		Event Events[RingSize];
+		std::atomic<uint64_t> Head{ 0 };
+		std::atomic<uint64_t> Tail{ 0 };
+		std::atomic<const char*> Name{ nullptr };
+		std::atomic<bool> Retired{ false };
+		uint32_t Id = 0;
+	};
+
+	struct CapturedEvent
+	{
+		uint32_t Zone;
+		uint32_t Thread;
+		uint64_t Start;
+		uint64_t End;
+	};
+
+	struct ZoneTotals
+	{
+		uint64_t Calls = 0;
+		uint64_t Ticks = 0;
+		uint64_t MaxTicks = 0;
+	};
+
+	friend struct ThreadRingOwner;
+
+	Profiler();
+
+	ThreadRing* Ring();
+	uint32_t ZoneId(const char* name);
+	void Publish();
+
+	std::mutex mRingsMutex;
+	std::vector<std::shared_ptr<ThreadRing>> mRings;
+	// EndFrame's copy of mRings, kept so a frame does not allocate.
+	std::vector<std::shared_ptr<ThreadRing>> mDrainRings;
+	uint32_t mNextThreadId = 0;
+	std::atomic<uint64_t> mDropped{ 0 };
+
+	// Everything below is only touched by EndFrame and the main thread.
+	std::unordered_map<const char*, uint32_t> mZoneByPointer;
+	std::unordered_map<std::string, uint32_t> mZoneByName;
+	std::vector<std::string> mZoneNames;
+	std::vector<ZoneTotals> mTotals;
+
+	uint64_t mIntervalStart = 0;
+	uint32_t mIntervalFrames = 0;
+	float mIntervalSeconds = 1.0f;
+	std::function<void(const std::vector<ZoneStats>&)> mCallback;
+	std::vector<ZoneStats> mStats;
+
+	uint32_t mCaptureFramesLeft = 0;
+	std::vector<CapturedEvent> mCapture;
+	std::vector<uint64_t> mCaptureFrames;
+	std::unordered_map<uint32_t, std::string> mThreadNames;
+};
+
+// Times its scope.
+class ProfileZone
+{
+public:
+	explicit ProfileZone(const char* name) : mName(name), mStart(Profiler::Now()) {}
+	ProfileZone(const ProfileZone& rhs) = delete;
+	ProfileZone& operator=(const ProfileZone& rhs) = delete;
+	~ProfileZone() { Profiler::Instance().Record(mName, mStart, Profiler::Now()); }
+
+private:
+	const char* mName;
+	uint64_t mStart;
+};
+
+#if PROFILER_ENABLED
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_FUNCTION() PROFILE_ZONE(__FUNCTION__)
+#define PROFILE_THREAD(name) Profiler::Instance().SetThreadName(name)
+#define PROFILE_FRAME() Profiler::Instance().EndFrame()
+#else
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_FUNCTION() ((void)0)
+#define PROFILE_THREAD(name) ((void)0)
+#define PROFILE_FRAME() ((void)0)
+#endif
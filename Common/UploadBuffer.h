@@ -55,6 +55,18 @@ public:
         memcpy(&mMappedData[elementIndex*mElementByteSize], &data, sizeof(T));
     }
 
+    // For writing many elements in place rather than through CopyData; the
+    // elements are ElementByteSize() apart.
+    BYTE* MappedData()const
+    {
+        return mMappedData;
+    }
+
+    UINT ElementByteSize()const
+    {
+        return mElementByteSize;
+    }
+
 private:
     Microsoft::WRL::ComPtr<ID3D12Resource> mUploadBuffer;
     BYTE* mMappedData = nullptr;
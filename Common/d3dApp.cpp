@@ -19,8 +19,9 @@ D3DApp* D3DApp::GetApp()
     return mApp;
 }
 
-D3DApp::D3DApp(HINSTANCE hInstance)
-:	mhAppInst(hInstance)
+D3DApp::D3DApp(HINSTANCE hInstance, bool headless)
+:	mhAppInst(hInstance),
+	mHeadless(headless)
 {
     // Only one D3DApp can be constructed.
     assert(mApp == nullptr);
@@ -60,7 +61,8 @@ void D3DApp::Set4xMsaaState(bool value)
         m4xMsaaState = value;
 
         // Recreate the swapchain and buffers with new multisample settings.
-        CreateSwapChain();
+        if(!mHeadless)
+            CreateSwapChain();
         OnResize();
     }
 }
@@ -102,7 +104,7 @@ int D3DApp::Run()
 
 bool D3DApp::Initialize()
 {
-	if(!InitMainWindow())
+	if(!mHeadless && !InitMainWindow())
 		return false;
 
 	if(!InitDirect3D())
@@ -137,7 +139,7 @@ void D3DApp::CreateRtvAndDsvDescriptorHeaps()
 void D3DApp::OnResize()
 {
 	assert(md3dDevice);
-	assert(mSwapChain);
+	assert(mSwapChain || mHeadless);
     assert(mDirectCmdListAlloc);
 
 	// Flush before changing any resources.
@@ -151,18 +153,37 @@ void D3DApp::OnResize()
     mDepthStencilBuffer.Reset();
 	
 	// Resize the swap chain.
-    ThrowIfFailed(mSwapChain->ResizeBuffers(
-		SwapChainBufferCount, 
-		mClientWidth, mClientHeight, 
-		mBackBufferFormat, 
-		DXGI_SWAP_CHAIN_FLAG_ALLOW_MODE_SWITCH));
+	if(!mHeadless)
+	{
+		ThrowIfFailed(mSwapChain->ResizeBuffers(
+			SwapChainBufferCount, 
+			mClientWidth, mClientHeight, 
+			mBackBufferFormat, 
+			SwapChainFlags));
+	}
 
 	mCurrBackBuffer = 0;
  
 	CD3DX12_CPU_DESCRIPTOR_HANDLE rtvHeapHandle(mRtvHeap->GetCPUDescriptorHandleForHeapStart());
 	for (UINT i = 0; i < SwapChainBufferCount; i++)
 	{
-		ThrowIfFailed(mSwapChain->GetBuffer(i, IID_PPV_ARGS(&mSwapChainBuffer[i])));
+		if(mHeadless)
+		{
+			// Stand-ins for the swap chain buffers, in the state Present leaves them.
+			CD3DX12_RESOURCE_DESC backBufferDesc = CD3DX12_RESOURCE_DESC::Tex2D(mBackBufferFormat,
+				mClientWidth, mClientHeight, 1, 1, 1, 0, D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET);
+			ThrowIfFailed(md3dDevice->CreateCommittedResource(
+				&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+				D3D12_HEAP_FLAG_NONE,
+				&backBufferDesc,
+				D3D12_RESOURCE_STATE_PRESENT,
+				nullptr,
+				IID_PPV_ARGS(&mSwapChainBuffer[i])));
+		}
+		else
+		{
+			ThrowIfFailed(mSwapChain->GetBuffer(i, IID_PPV_ARGS(&mSwapChainBuffer[i])));
+		}
 		md3dDevice->CreateRenderTargetView(mSwapChainBuffer[i].Get(), nullptr, rtvHeapHandle);
 		rtvHeapHandle.Offset(1, mRtvDescriptorSize);
 	}
@@ -419,11 +440,16 @@ bool D3DApp::InitDirect3D()
 
 	ThrowIfFailed(CreateDXGIFactory1(IID_PPV_ARGS(&mdxgiFactory)));
 
-	// Try to create hardware device.
-	HRESULT hardwareResult = D3D12CreateDevice(
-		nullptr,             // default adapter
-		D3D_FEATURE_LEVEL_11_0,
-		IID_PPV_ARGS(&md3dDevice));
+	// Try to create hardware device.  Headless apps always use WARP, so
+	// their results do not depend on the GPU or driver.
+	HRESULT hardwareResult = E_FAIL;
+	if(!mHeadless)
+	{
+		hardwareResult = D3D12CreateDevice(
+			nullptr,             // default adapter
+			D3D_FEATURE_LEVEL_11_0,
+			IID_PPV_ARGS(&md3dDevice));
+	}
 
 	// Fallback to WARP device.
 	if(FAILED(hardwareResult))
@@ -466,7 +492,8 @@ bool D3DApp::InitDirect3D()
 #endif
 
 	CreateCommandObjects();
-    CreateSwapChain();
+	if(!mHeadless)
+		CreateSwapChain();
     CreateRtvAndDsvDescriptorHeaps();
 
 	return true;
@@ -499,6 +526,7 @@ void D3DApp::CreateCommandObjects()
 void D3DApp::CreateSwapChain()
 {
     // Release the previous swapchain we will be recreating.
+    mLatencyWaiter.Reset(nullptr);
     mSwapChain.Reset();
 
     DXGI_SWAP_CHAIN_DESC sd;
@@ -516,13 +544,15 @@ void D3DApp::CreateSwapChain()
     sd.OutputWindow = mhMainWnd;
     sd.Windowed = true;
 	sd.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
-    sd.Flags = DXGI_SWAP_CHAIN_FLAG_ALLOW_MODE_SWITCH;
+    sd.Flags = SwapChainFlags;
 
 	// Note: Swap chain uses queue to perform flush.
     ThrowIfFailed(mdxgiFactory->CreateSwapChain(
 		mCommandQueue.Get(),
 		&sd, 
 		mSwapChain.GetAddressOf()));
+
+	mLatencyWaiter.Reset(mSwapChain.Get());
 }
 
 void D3DApp::FlushCommandQueue()
@@ -536,17 +566,7 @@ void D3DApp::FlushCommandQueue()
     ThrowIfFailed(mCommandQueue->Signal(mFence.Get(), mCurrentFence));
 
 	// Wait until the GPU has completed commands up to this fence point.
-    if(mFence->GetCompletedValue() < mCurrentFence)
-	{
-		HANDLE eventHandle = CreateEventEx(nullptr, false, false, EVENT_ALL_ACCESS);
-
-        // Fire event when GPU hits current fence.  
-        ThrowIfFailed(mFence->SetEventOnCompletion(mCurrentFence, eventHandle));
-
-        // Wait until the GPU hits current fence event is fired.
-		WaitForSingleObject(eventHandle, INFINITE);
-        CloseHandle(eventHandle);
-	}
+	mFenceWaiter.Wait(mFence.Get(), mCurrentFence);
 }
 
 ID3D12Resource* D3DApp::CurrentBackBuffer()const
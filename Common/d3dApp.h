@@ -7,6 +7,8 @@
 
 #include "d3dUtil.h"
 #include "GameTimer.h"
+#include "FramePacerD3D12.h"
+#include "Profiler.h"
 
 // Link necessary d3d12 libraries.
 #pragma comment(lib,"d3dcompiler.lib")
@@ -17,7 +19,9 @@ class D3DApp
 {
 protected:
 
-    D3DApp(HINSTANCE hInstance);
+    // A headless app has no window or swap chain and renders into offscreen
+    // buffers on the WARP device, for tools like trace replay.
+    D3DApp(HINSTANCE hInstance, bool headless = false);
     D3DApp(const D3DApp& rhs) = delete;
     D3DApp& operator=(const D3DApp& rhs) = delete;
     virtual ~D3DApp();
@@ -79,6 +83,7 @@ protected:
 	bool      mMaximized = false;  // is the application maximized?
 	bool      mResizing = false;   // are the resize bars being dragged?
     bool      mFullscreenState = false;// fullscreen enabled
+    bool      mHeadless = false;       // no window, swap chain or present
 
     bool      m4xMsaaState = false;    // 4X MSAA enabled
     UINT      m4xMsaaQuality = 0;      // quality level of 4X MSAA
@@ -91,12 +96,16 @@ protected:
 
     Microsoft::WRL::ComPtr<ID3D12Fence> mFence;
     UINT64 mCurrentFence = 0;
+    FenceWaiter mFenceWaiter;
+    // Tracks mSwapChain across CreateSwapChain calls.
+    SwapChainLatencyWaiter mLatencyWaiter;
 	
     Microsoft::WRL::ComPtr<ID3D12CommandQueue> mCommandQueue;
     Microsoft::WRL::ComPtr<ID3D12CommandAllocator> mDirectCmdListAlloc;
     Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> mCommandList;
 
 	static const int SwapChainBufferCount = 2;
+	static const UINT SwapChainFlags = DXGI_SWAP_CHAIN_FLAG_ALLOW_MODE_SWITCH | DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT;
 	int mCurrBackBuffer = 0;
     Microsoft::WRL::ComPtr<ID3D12Resource> mSwapChainBuffer[SwapChainBufferCount];
     Microsoft::WRL::ComPtr<ID3D12Resource> mDepthStencilBuffer;
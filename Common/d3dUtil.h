@@ -23,7 +23,9 @@
 #include "DDSTextureLoader.h"
 #include "MathHelper.h"
 
-extern const int gNumFrameResources;
+// Frame resources the CPU cycles through.  Changes at runtime together with
+// FramePacer::SetFramesInFlight.
+extern int gNumFrameResources;
 
 inline void d3dSetDebugName(IDXGIObject* obj, const char* name)
 {
@@ -221,6 +223,12 @@ struct MaterialConstants
 
 	// Used in texture mapping.
 	DirectX::XMFLOAT4X4 MatTransform = MathHelper::Identity4x4();
+
+	// Slots of the diffuse and normal maps in the bindless texture table.
+	UINT DiffuseMapIndex = 0;
+	UINT NormalMapIndex = 0;
+	UINT MaterialPad1;
+	UINT MaterialPad2;
 };
 
 // Simple struct to represent a material for our demos.  A production 3D engine
@@ -239,6 +247,9 @@ struct Material
 	// Index into SRV heap for normal texture.
 	int NormalSrvHeapIndex = -1;
 
+	// ShaderFeature bits the material needs, e.g. alpha test or normal mapping.
+	UINT Features = 0;
+
 	// Dirty flag indicating the material has changed and we need to update the constant buffer.
 	// Because we have a material constant buffer for each FrameResource, we have to apply the
 	// update to each FrameResource.  Thus, when we modify a material we should set 
@@ -267,8 +278,11 @@ struct Texture
 #define ThrowIfFailed(x)                                              \
 {                                                                     \
     HRESULT hr__ = (x);                                               \
-    std::wstring wfn = AnsiToWString(__FILE__);                       \
-    if(FAILED(hr__)) { throw DxException(hr__, L#x, wfn, __LINE__); } \
+    if(FAILED(hr__))                                                  \
+    {                                                                 \
+        std::wstring wfn = AnsiToWString(__FILE__);                   \
+        throw DxException(hr__, L#x, wfn, __LINE__);                  \
+    }                                                                 \
 }
 #endif
 
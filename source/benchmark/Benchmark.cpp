@@ -0,0 +1,120 @@
+#include "Benchmark.h"
+#include <cstdio>
+#include <fstream>
+#include <numeric>
+
+namespace
+{
+    void WriteJsonString(std::ofstream& out, const std::string& s)
+    {
+        out << '"';
+        for (char c : s)
+        {
+            if (c == '"' || c == '\\')
+                out << '\\' << c;
+            else if ((unsigned char)c < 0x20)
+                out << ' ';
+            else
+                out << c;
+        }
+        out << '"';
+    }
+}
+
+#if !defined(__GNUC__) && !defined(__clang__)
+// Another translation unit than the callers, so the store can't be proven dead.
+volatile const void* gKeepAliveSink = nullptr;
+
+void KeepAlivePointer(const void* p)
+{
+    gKeepAliveSink = p;
+}
+#endif
+
+void BenchmarkRunner::SetFilter(const std::string& filter)
+{
+    mFilter = filter;
+}
+
+void BenchmarkRunner::SetSampleTime(double seconds)
+{
+    mSampleNanoseconds = std::max<uint64_t>((uint64_t)(seconds * 1.0e9), 1);
+}
+
+void BenchmarkRunner::SetSamples(uint32_t samples)
+{
+    mSamples = std::max(samples, 1u);
+}
+
+bool BenchmarkRunner::Enabled(const std::string& name)const
+{
+    return mFilter.empty() || name.find(mFilter) != std::string::npos;
+}
+
+void BenchmarkRunner::Record(const std::string& name, const std::string& param, uint64_t items, uint64_t iterations,
+    std::vector<double>& samples)
+{
+    std::sort(samples.begin(), samples.end());
+    const size_t mid = samples.size() / 2;
+
+    BenchmarkResult r;
+    r.Name = name;
+    r.Param = param;
+    r.Iterations = iterations;
+    r.Items = items;
+    r.MedianNanoseconds = samples.size() % 2 ? samples[mid] : 0.5 * (samples[mid - 1] + samples[mid]);
+    r.MinNanoseconds = samples.front();
+    r.MeanNanoseconds = std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size();
+    r.ItemsPerSecond = items ? (double)items * 1.0e9 / r.MedianNanoseconds : 0.0;
+    mResults.push_back(r);
+
+    printf("%-28s %-14s %14.1f ns %14.1f ns", name.c_str(), param.c_str(), r.MedianNanoseconds, r.MinNanoseconds);
+    if (items)
+        printf(" %14.4g items/s", r.ItemsPerSecond);
+    printf("\n");
+    fflush(stdout);
+}
+
+const std::vector<BenchmarkResult>& BenchmarkRunner::Results()const
+{
+    return mResults;
+}
+
+bool BenchmarkRunner::SaveJson(const std::string& file)const
+{
+    std::ofstream out(file, std::ios::trunc);
+    if (!out)
+        return false;
+
+    out.precision(17);
+    out << "{\"benchmarks\":[";
+    for (size_t i = 0; i < mResults.size(); ++i)
+    {
+        const BenchmarkResult& r = mResults[i];
+        out << (i ? ",\n" : "\n") << "{\"name\":";
+        WriteJsonString(out, r.Name);
+        out << ",\"param\":";
+        WriteJsonString(out, r.Param);
+        out << ",\"iterations\":" << r.Iterations << ",\"items\":" << r.Items
+            << ",\"median_ns\":" << r.MedianNanoseconds << ",\"min_ns\":" << r.MinNanoseconds
+            << ",\"mean_ns\":" << r.MeanNanoseconds << ",\"items_per_second\":" << r.ItemsPerSecond << "}";
+    }
+    out << "\n]}\n";
+    return (bool)out;
+}
+
+bool BenchmarkRunner::SaveCsv(const std::string& file)const
+{
+    std::ofstream out(file, std::ios::trunc);
+    if (!out)
+        return false;
+
+    out.precision(17);
+    out << "name,param,iterations,items,median_ns,min_ns,mean_ns,items_per_second\n";
+    for (const BenchmarkResult& r : mResults)
+    {
+        out << r.Name << ',' << r.Param << ',' << r.Iterations << ',' << r.Items << ',' << r.MedianNanoseconds << ','
+            << r.MinNanoseconds << ',' << r.MeanNanoseconds << ',' << r.ItemsPerSecond << '\n';
+    }
+    return (bool)out;
+}
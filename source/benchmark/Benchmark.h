@@ -0,0 +1,92 @@
+#pragma once
+#include "../../Common/Profiler.h"
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Timings of one benchmark, per call of its body.
+struct BenchmarkResult
+{
+    std::string Name;
+    // What the case was run with, like a tessellation or an object count.
+    std::string Param;
+    // Calls over all samples.
+    uint64_t Iterations = 0;
+    // Items one call processes, for the throughput; 0 when it has none.
+    uint64_t Items = 0;
+    double MedianNanoseconds = 0.0;
+    double MinNanoseconds = 0.0;
+    double MeanNanoseconds = 0.0;
+    double ItemsPerSecond = 0.0;
+};
+
+// Runs benchmark bodies long enough for stable timings.  A body is first
+// called in growing batches until a batch lasts the sample time, then that
+// batch is timed Samples times; results are per call.
+class BenchmarkRunner
+{
+public:
+    // Only benchmarks whose name contains filter run; empty runs them all.
+    void SetFilter(const std::string& filter);
+    void SetSampleTime(double seconds);
+    void SetSamples(uint32_t samples);
+
+    bool Enabled(const std::string& name)const;
+
+    template<typename Body>
+    void Run(const std::string& name, const std::string& param, uint64_t items, Body body)
+    {
+        if (!Enabled(name))
+            return;
+
+        auto batch = [&body](uint64_t calls)
+        {
+            const uint64_t start = Profiler::Now();
+            for (uint64_t i = 0; i < calls; ++i)
+                body();
+            return std::max<uint64_t>(Profiler::Now() - start, 1);
+        };
+
+        uint64_t calls = 1;
+        for (uint64_t ticks = batch(calls); ticks < mSampleNanoseconds; ticks = batch(calls))
+            calls = std::max(calls * 2, std::min(calls * 100, calls * mSampleNanoseconds / ticks * 6 / 5));
+
+        std::vector<double> samples(mSamples);
+        for (double& sample : samples)
+            sample = (double)batch(calls) / (double)calls;
+        Record(name, param, items, calls * mSamples, samples);
+    }
+
+    const std::vector<BenchmarkResult>& Results()const;
+    // False if the file can't be written.
+    bool SaveJson(const std::string& file)const;
+    bool SaveCsv(const std::string& file)const;
+
+private:
+    // Summarizes the samples and prints the result.
+    void Record(const std::string& name, const std::string& param, uint64_t items, uint64_t iterations,
+        std::vector<double>& samples);
+
+    std::string mFilter;
+    uint64_t mSampleNanoseconds = 50000000;
+    uint32_t mSamples = 10;
+    std::vector<BenchmarkResult> mResults;
+};
+
+// Keeps the optimizer from dropping a value a benchmark computes but never uses.
+#if defined(__GNUC__) || defined(__clang__)
+template<typename T>
+inline void KeepAlive(const T& value)
+{
+    asm volatile("" : : "r"(&value) : "memory");
+}
+#else
+void KeepAlivePointer(const void* p);
+
+template<typename T>
+inline void KeepAlive(const T& value)
+{
+    KeepAlivePointer(&value);
+}
+#endif
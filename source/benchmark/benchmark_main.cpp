@@ -0,0 +1,415 @@
+#include "Benchmark.h"
+#include "../../Common/Camera.h"
+#include "../../Common/DDSHeader.h"
+#include "../../Common/GeometryGenerator.h"
+#include "../../Common/MappedFile.h"
+#include "../source/Collider.h"
+#include "../source/ObjParser.h"
+#include "../source/ObjectConstants.h"
+#include "../source/ObjectCulling.h"
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <random>
+
+#ifdef BENCHMARK_ASSIMP
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+#endif
+
+using namespace DirectX;
+
+#ifndef BENCHMARK_DATA_DIR
+#define BENCHMARK_DATA_DIR "."
+#endif
+
+namespace
+{
+    struct Options
+    {
+        std::string filter;
+        std::string json;
+        std::string csv;
+        // Holds the Models and Textures folders.
+        std::string data = BENCHMARK_DATA_DIR;
+        double sampleTime = 0.05;
+        uint32_t samples = 10;
+    };
+
+    // The part of a RenderItem culling reads.
+    struct SyntheticItem
+    {
+        XMFLOAT4X4 World;
+        XMFLOAT4X4 TexTransform;
+        BoundingBox Bounds;
+        float MaxDrawDistance;
+    };
+
+    // Constant buffer entries are 256 byte aligned, see d3dUtil::CalcConstantBufferByteSize.
+    const size_t ObjectCBStride = (sizeof(ObjectConstants) + 255) & ~(size_t)255;
+
+    const uint32_t ObjectCounts[] = { 1000, 10000, 100000 };
+    // Packing is cheap per object; these reach past the caches.
+    const uint32_t PackCounts[] = { 10000, 100000, 1000000 };
+
+    void PrintUsage()
+    {
+        printf("usage: engine_benchmark [--filter text] [--json file] [--csv file] [--data dir]\n"
+            "                        [--sample-time seconds] [--samples n]\n");
+    }
+
+    bool ParseOptions(int argc, char** argv, Options& options)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            const std::string arg = argv[i];
+            if (arg == "--help" || i + 1 == argc)
+                return false;
+
+            const char* value = argv[++i];
+            if (arg == "--filter")
+                options.filter = value;
+            else if (arg == "--json")
+                options.json = value;
+            else if (arg == "--csv")
+                options.csv = value;
+            else if (arg == "--data")
+                options.data = value;
+            else if (arg == "--sample-time")
+                options.sampleTime = atof(value);
+            else if (arg == "--samples")
+                options.samples = (uint32_t)atoi(value);
+            else
+                return false;
+        }
+        return true;
+    }
+
+    // Objects scattered around a camera at the origin looking down +z, about
+    // half of them in front of it.
+    std::vector<SyntheticItem> MakeItems(uint32_t count)
+    {
+        std::mt19937 rng(count);
+        std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+        std::uniform_real_distribution<float> angle(0.0f, XM_2PI);
+        std::uniform_real_distribution<float> scale(0.5f, 4.0f);
+
+        std::vector<SyntheticItem> items(count);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            SyntheticItem& item = items[i];
+            const float s = scale(rng);
+            XMMATRIX world = XMMatrixScaling(s, s, s) * XMMatrixRotationY(angle(rng)) *
+                XMMatrixTranslation(position(rng), position(rng) * 0.1f, position(rng));
+            XMStoreFloat4x4(&item.World, world);
+            XMStoreFloat4x4(&item.TexTransform, XMMatrixScaling(s, s, 1.0f));
+            item.Bounds = BoundingBox(XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(1.0f, 1.0f, 1.0f));
+            // A quarter have a draw distance, like small props.
+            item.MaxDrawDistance = i % 4 == 0 ? 150.0f : 0.0f;
+        }
+        return items;
+    }
+
+    void RunGeometry(BenchmarkRunner& runner)
+    {
+        GeometryGenerator geo;
+        for (uint32_t n : { 8u, 32u, 128u })
+        {
+            const uint64_t vertices = geo.CreateSphere(1.0f, n, n).Vertices.size();
+            runner.Run("geometry_sphere", std::to_string(n), vertices, [&]()
+            {
+                GeometryGenerator::MeshData mesh = geo.CreateSphere(1.0f, n, n);
+                KeepAlive(mesh);
+            });
+        }
+        for (uint32_t n : { 1u, 3u, 5u })
+        {
+            const uint64_t vertices = geo.CreateGeosphere(1.0f, n).Vertices.size();
+            runner.Run("geometry_geosphere", std::to_string(n), vertices, [&]()
+            {
+                GeometryGenerator::MeshData mesh = geo.CreateGeosphere(1.0f, n);
+                KeepAlive(mesh);
+            });
+        }
+        for (uint32_t n : { 0u, 2u, 4u })
+        {
+            const uint64_t vertices = geo.CreateBox(1.0f, 1.0f, 1.0f, n).Vertices.size();
+            runner.Run("geometry_box", std::to_string(n), vertices, [&]()
+            {
+                GeometryGenerator::MeshData mesh = geo.CreateBox(1.0f, 1.0f, 1.0f, n);
+                KeepAlive(mesh);
+            });
+        }
+        for (uint32_t n : { 16u, 64u, 256u })
+        {
+            const uint64_t vertices = geo.CreateGrid(100.0f, 100.0f, n, n).Vertices.size();
+            runner.Run("geometry_grid", std::to_string(n), vertices, [&]()
+            {
+                GeometryGenerator::MeshData mesh = geo.CreateGrid(100.0f, 100.0f, n, n);
+                KeepAlive(mesh);
+            });
+        }
+        for (uint32_t n : { 16u, 64u })
+        {
+            const uint64_t vertices = geo.CreateCylinder(1.0f, 0.5f, 2.0f, n, n).Vertices.size();
+            runner.Run("geometry_cylinder", std::to_string(n), vertices, [&]()
+            {
+                GeometryGenerator::MeshData mesh = geo.CreateCylinder(1.0f, 0.5f, 2.0f, n, n);
+                KeepAlive(mesh);
+            });
+        }
+    }
+
+    // The .obj path of ObjLoader.  Built with Assimp, obj_parse_assimp times
+    // the import ObjLoader falls back to, with the same post processing, so
+    // the two compare per vertex.
+    void RunObjParser(BenchmarkRunner& runner, const Options& options)
+    {
+        for (const char* model : { "cat.obj", "monkey.obj", "teapot.obj" })
+        {
+            const std::string file = options.data + "/Models/" + model;
+            for (unsigned threads : { 1u, 0u })
+            {
+                ObjParser parser;
+                parser.set_thread_count(threads);
+                Mesh mesh;
+                if (!parser.Parse(file, mesh))
+                {
+                    fprintf(stderr, "skipping %s: %s\n", file.c_str(), parser.get_error().c_str());
+                    break;
+                }
+
+                const std::string param = std::string(model) + (threads == 1 ? "/1t" : "/all");
+                runner.Run("obj_parse", param, mesh.vertices.size(), [&]()
+                {
+                    Mesh parsed;
+                    parser.Parse(file, parsed);
+                    KeepAlive(parsed);
+                });
+
+#ifdef BENCHMARK_ASSIMP
+                // Assimp imports on one thread; timed once per model.
+                if (threads != 1)
+                    continue;
+                runner.Run("obj_parse_assimp", model, mesh.vertices.size(), [&]()
+                {
+                    Assimp::Importer importer;
+                    importer.SetPropertyInteger(AI_CONFIG_PP_SLM_VERTEX_LIMIT, 0xFFFF);
+                    const aiScene* scene = importer.ReadFile(file, aiProcess_Triangulate | aiProcess_GenSmoothNormals |
+                        aiProcess_FlipUVs | aiProcess_CalcTangentSpace | aiProcess_SplitLargeMeshes);
+                    KeepAlive(scene);
+                });
+#endif
+            }
+        }
+    }
+
+    void RunCollider(BenchmarkRunner& runner)
+    {
+        GeometryGenerator geo;
+        std::vector<XMFLOAT3> points;
+        for (const GeometryGenerator::Vertex& v : geo.CreateSphere(1.0f, 32, 32).Vertices)
+            points.push_back(v.Position);
+
+        runner.Run("collider_construct", std::to_string(points.size()), points.size(), [&]()
+        {
+            Collider collider(points);
+            KeepAlive(collider);
+        });
+
+        const uint32_t pairs = 4096;
+        std::mt19937 rng(pairs);
+        std::uniform_real_distribution<float> position(-10.0f, 10.0f);
+        std::vector<XMFLOAT3> positions(2 * pairs);
+        for (XMFLOAT3& p : positions)
+            p = XMFLOAT3(position(rng), position(rng), position(rng));
+
+        Collider a(points);
+        Collider b(points);
+        runner.Run("collider_intersect", std::to_string(pairs), pairs, [&]()
+        {
+            uint32_t hits = 0;
+            for (uint32_t i = 0; i < pairs; ++i)
+                hits += a.is_intersect(&b, positions[2 * i], positions[2 * i + 1]);
+            KeepAlive(hits);
+        });
+    }
+
+    void RunCamera(BenchmarkRunner& runner)
+    {
+        Camera cam;
+        cam.SetLens(0.25f * MathHelper::Pi, 16.0f / 9.0f, 1.0f, 1000.0f);
+        cam.LookAt(XMFLOAT3(0.0f, 2.0f, -10.0f), XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(0.0f, 1.0f, 0.0f));
+
+        // Turning marks the view dirty, as mouse look does every frame.
+        runner.Run("camera_update_view", "", 1, [&]()
+        {
+            cam.RotateY(0.001f);
+            cam.UpdateViewMatrix();
+            XMFLOAT4X4 view = cam.GetView4x4f();
+            KeepAlive(view);
+        });
+    }
+
+    void RunCulling(BenchmarkRunner& runner)
+    {
+        Camera cam;
+        cam.SetLens(0.25f * MathHelper::Pi, 16.0f / 9.0f, 1.0f, 1000.0f);
+        cam.UpdateViewMatrix();
+
+        BoundingFrustum frustum;
+        BoundingFrustum::CreateFromMatrix(frustum, cam.GetProj());
+        CullCamera camera;
+        camera.Set(cam.GetView(), frustum, cam.GetFovY(), 1080.0f, 1.0f);
+
+        for (uint32_t count : ObjectCounts)
+        {
+            const std::vector<SyntheticItem> items = MakeItems(count);
+            runner.Run("frustum_cull", std::to_string(count), count, [&]()
+            {
+                uint32_t visible = 0;
+                CulledObject culled;
+                for (const SyntheticItem& item : items)
+                {
+                    if (CullObject(XMLoadFloat4x4(&item.World), item.Bounds, item.MaxDrawDistance, camera, culled) == CullResult::Visible)
+                        ++visible;
+                }
+                KeepAlive(visible);
+            });
+        }
+    }
+
+    // Game_engine::UpdateObjectCBs packing every item, into memory laid out
+    // like the object constant buffer: object_cb_pack one item at a time
+    // through a copy, object_cb_pack_batch from contiguous matrices, and
+    // object_cb_pack_transforms composing compact transforms as it does now,
+    // once the texture transforms are uploaded.
+    void RunConstantPacking(BenchmarkRunner& runner)
+    {
+        for (uint32_t count : PackCounts)
+        {
+            const std::vector<SyntheticItem> items = MakeItems(count);
+            std::vector<XMFLOAT4X4> worlds(count);
+            std::vector<XMFLOAT4X4> texTransforms(count);
+            std::vector<ObjectTransform> transforms(count);
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                worlds[i] = items[i].World;
+                texTransforms[i] = items[i].TexTransform;
+                DecomposeTransform(XMLoadFloat4x4(&items[i].World), transforms[i]);
+            }
+
+            // Mapped upload buffers are at least 256 byte aligned.
+            std::vector<uint8_t> storage(count * ObjectCBStride + 256);
+            uint8_t* buffer = storage.data() + (256 - (uintptr_t)storage.data() % 256) % 256;
+
+            runner.Run("object_cb_pack", std::to_string(count), count, [&]()
+            {
+                for (uint32_t i = 0; i < count; ++i)
+                {
+                    ObjectConstants objConstants;
+                    PackObjectConstants(items[i].World, items[i].TexTransform, objConstants);
+                    memcpy(&buffer[i * ObjectCBStride], &objConstants, sizeof(ObjectConstants));
+                }
+                KeepAlive(buffer[0]);
+            });
+            runner.Run("object_cb_pack_batch", std::to_string(count), count, [&]()
+            {
+                PackObjectConstantsBatch(worlds.data(), texTransforms.data(), count, buffer, ObjectCBStride);
+                KeepAlive(buffer[0]);
+            });
+            runner.Run("object_cb_pack_transforms", std::to_string(count), count, [&]()
+            {
+                PackObjectTransformsBatch(transforms.data(), count, false, buffer, ObjectCBStride);
+                KeepAlive(buffer[0]);
+            });
+        }
+    }
+
+    void RunDDSHeaders(BenchmarkRunner& runner, const Options& options)
+    {
+        std::vector<std::string> files;
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator(options.data + "/Textures", error))
+        {
+            if (entry.path().extension() == ".dds")
+                files.push_back(entry.path().string());
+        }
+        if (files.empty())
+        {
+            fprintf(stderr, "skipping DDS headers: no .dds files in %s/Textures\n", options.data.c_str());
+            return;
+        }
+
+        // Only the headers are read, so copies of them are enough.
+        std::vector<std::vector<uint8_t>> headers;
+        for (const std::string& file : files)
+        {
+            MappedFile mapped;
+            if (FAILED(mapped.Open(file)))
+                continue;
+            const size_t size = std::min(mapped.Size(), sizeof(uint32_t) + sizeof(DDS_HEADER) + sizeof(DDS_HEADER_DXT10));
+            headers.emplace_back(mapped.Data(), mapped.Data() + size);
+        }
+
+        runner.Run("dds_read_headers", std::to_string(headers.size()), headers.size(), [&]()
+        {
+            uint32_t valid = 0;
+            DDSHeaders dds;
+            for (const std::vector<uint8_t>& header : headers)
+                valid += ReadDDSHeaders(header.data(), header.size(), dds);
+            KeepAlive(valid);
+        });
+
+        // What CreateDDSTextureFromFile12 does before it needs a device.
+        runner.Run("dds_map_and_read_headers", std::to_string(files.size()), files.size(), [&]()
+        {
+            uint32_t valid = 0;
+            DDSHeaders dds;
+            for (const std::string& file : files)
+            {
+                MappedFile mapped;
+                if (SUCCEEDED(mapped.Open(file)))
+                    valid += ReadDDSHeaders(mapped.Data(), mapped.Size(), dds);
+            }
+            KeepAlive(valid);
+        });
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    BenchmarkRunner runner;
+    runner.SetFilter(options.filter);
+    runner.SetSampleTime(options.sampleTime);
+    runner.SetSamples(options.samples);
+
+    printf("%-28s %-14s %17s %17s %22s\n", "benchmark", "param", "median", "min", "throughput");
+    RunGeometry(runner);
+    RunObjParser(runner, options);
+    RunCollider(runner);
+    RunCamera(runner);
+    RunCulling(runner);
+    RunConstantPacking(runner);
+    RunDDSHeaders(runner, options);
+
+    if (!options.json.empty() && !runner.SaveJson(options.json))
+    {
+        fprintf(stderr, "can't write %s\n", options.json.c_str());
+        return 1;
+    }
+    if (!options.csv.empty() && !runner.SaveCsv(options.csv))
+    {
+        fprintf(stderr, "can't write %s\n", options.csv.c_str());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,221 @@
+#include "ApiTrace.h"
+#include "Lighting.h"
+
+namespace
+{
+    const uint32_t ApiTraceMagic = 0x43525441; // "ATRC"
+    // Bump whenever a call's arguments change.
+    const uint32_t ApiTraceVersion = 1;
+
+    struct ApiTraceHeader
+    {
+        uint32_t Magic = ApiTraceMagic;
+        uint32_t Version = ApiTraceVersion;
+        // Stored raw in the calls, so they must match the reader's.
+        uint32_t VertexSize = sizeof(Vertex);
+        uint32_t LightDescSize = sizeof(LightDesc);
+    };
+
+    struct TracedSubset
+    {
+        UINT MaterialSlot;
+        UINT IndexCount;
+        UINT StartIndexLocation;
+        INT BaseVertexLocation;
+        DirectX::BoundingBox Bounds;
+    };
+}
+
+bool ApiTraceWriter::Open(const std::string& file)
+{
+    Close();
+    mOut.open(file, std::ios::binary | std::ios::trunc);
+    if (!mOut)
+        return false;
+    Pod(ApiTraceHeader());
+    return true;
+}
+
+bool ApiTraceWriter::Close()
+{
+    if (!mOut.is_open())
+        return true;
+    mOut.close();
+    const bool ok = (bool)mOut;
+    mOut.clear();
+    return ok;
+}
+
+bool ApiTraceWriter::IsOpen()const
+{
+    return mOut.is_open();
+}
+
+ApiTraceWriter& ApiTraceWriter::Call(ApiCall call)
+{
+    return Pod(call);
+}
+
+ApiTraceWriter& ApiTraceWriter::Bytes(const void* data, size_t size)
+{
+    mOut.write(static_cast<const char*>(data), size);
+    return *this;
+}
+
+ApiTraceWriter& ApiTraceWriter::String(const std::string& s)
+{
+    Pod((uint32_t)s.size());
+    return Bytes(s.data(), s.size());
+}
+
+ApiTraceWriter& ApiTraceWriter::WString(const std::wstring& s)
+{
+    Pod((uint32_t)s.size());
+    return Bytes(s.data(), s.size() * sizeof(wchar_t));
+}
+
+ApiTraceWriter& ApiTraceWriter::Geometry(const Mesh& mesh)
+{
+    Pod((uint32_t)mesh.vertices.size());
+    Bytes(mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+    Pod((uint32_t)mesh.indices.size());
+    Bytes(mesh.indices.data(), mesh.indices.size() * sizeof(uint16_t));
+
+    Pod((uint32_t)mesh.subsets.size());
+    for (const MeshSubset& s : mesh.subsets)
+    {
+        TracedSubset t = { s.MaterialSlot, s.IndexCount, s.StartIndexLocation, s.BaseVertexLocation, s.Bounds };
+        String(s.Name);
+        Pod(t);
+    }
+
+    Pod((uint32_t)mesh.materials.size());
+    for (const std::string& m : mesh.materials)
+        String(m);
+    return *this;
+}
+
+bool ApiTraceReader::Open(const std::wstring& file)
+{
+    mPos = mEnd = nullptr;
+    mError.clear();
+    if (FAILED(mFile.Open(file)))
+    {
+        mError = "can't open the trace";
+        return false;
+    }
+    mPos = mFile.Data();
+    mEnd = mPos + mFile.Size();
+
+    ApiTraceHeader header;
+    const ApiTraceHeader expected;
+    if (!Pod(header) || header.Magic != expected.Magic)
+    {
+        mError = "not a trace";
+        return false;
+    }
+    if (header.Version != expected.Version || header.VertexSize != expected.VertexSize ||
+        header.LightDescSize != expected.LightDescSize)
+    {
+        mError = "trace recorded by an incompatible build";
+        return false;
+    }
+    return true;
+}
+
+const std::string& ApiTraceReader::Error()const
+{
+    return mError;
+}
+
+bool ApiTraceReader::Next(ApiCall& call)
+{
+    if (mPos == mEnd || !Pod(call))
+        return false;
+    if (call >= ApiCall::Count)
+    {
+        mError = "unknown call " + std::to_string((int)call);
+        return false;
+    }
+    return true;
+}
+
+bool ApiTraceReader::Has(size_t size)
+{
+    if ((size_t)(mEnd - mPos) < size)
+    {
+        mError = "truncated trace";
+        return false;
+    }
+    return true;
+}
+
+bool ApiTraceReader::Bytes(void* dst, size_t size)
+{
+    if (!Has(size))
+        return false;
+    memcpy(dst, mPos, size);
+    mPos += size;
+    return true;
+}
+
+bool ApiTraceReader::String(std::string& s)
+{
+    uint32_t size = 0;
+    if (!Pod(size) || !Has(size))
+        return false;
+    s.assign(reinterpret_cast<const char*>(mPos), size);
+    mPos += size;
+    return true;
+}
+
+bool ApiTraceReader::WString(std::wstring& s)
+{
+    uint32_t size = 0;
+    if (!Pod(size) || !Has((size_t)size * sizeof(wchar_t)))
+        return false;
+    s.resize(size);
+    return Bytes(&s[0], size * sizeof(wchar_t));
+}
+
+bool ApiTraceReader::Geometry(Mesh& mesh)
+{
+    // Counts are checked against what is left before anything is sized by them.
+    uint32_t count = 0;
+    if (!Pod(count) || !Has((size_t)count * sizeof(Vertex)))
+        return false;
+    mesh.vertices.resize(count);
+    if (!Bytes(mesh.vertices.data(), count * sizeof(Vertex)))
+        return false;
+
+    if (!Pod(count) || !Has((size_t)count * sizeof(uint16_t)))
+        return false;
+    mesh.indices.resize(count);
+    if (!Bytes(mesh.indices.data(), count * sizeof(uint16_t)))
+        return false;
+
+    if (!Pod(count) || !Has((size_t)count * (sizeof(uint32_t) + sizeof(TracedSubset))))
+        return false;
+    mesh.subsets.resize(count);
+    for (MeshSubset& s : mesh.subsets)
+    {
+        TracedSubset t;
+        if (!String(s.Name) || !Pod(t))
+            return false;
+        s.MaterialSlot = t.MaterialSlot;
+        s.IndexCount = t.IndexCount;
+        s.StartIndexLocation = t.StartIndexLocation;
+        s.BaseVertexLocation = t.BaseVertexLocation;
+        s.Bounds = t.Bounds;
+    }
+
+    if (!Pod(count) || !Has((size_t)count * sizeof(uint32_t)))
+        return false;
+    mesh.materials.resize(count);
+    for (std::string& m : mesh.materials)
+    {
+        if (!String(m))
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,114 @@
+#pragma once
+#include "FrameResource.h"
+#include "../../Common/MappedFile.h"
+#include <fstream>
+
+// Public calls of Game_engine a trace records.  The values are stored in
+// trace files: add new calls at the end.
+enum class ApiCall : uint8_t
+{
+    Initialize,
+    Update,
+    Draw,
+    LoadTexture,
+    CreateMaterial,
+    UpdateMaterial,
+    SetMaterialNormalMap,
+    SetMaterialAlphaTest,
+    CreateGeometry,
+    CreateWorld,
+    MoveObject,
+    DrawObject,
+    DoNotDrawObject,
+    SetLight,
+    SetAmbient,
+    EditLight,
+    EditAmbient,
+    CreateLight,
+    UpdateLight,
+    DestroyLight,
+    AddPointLight,
+    AddSpotLight,
+    ClearLocalLights,
+    SetShadowSettings,
+    SetOccluder,
+    EnableOcclusionCulling,
+    SetDrawDistance,
+    SetDrawCategory,
+    SetMinScreenSize,
+    SetCategoryBudget,
+    LoadCells,
+    SetFramesInFlight,
+    SetFog,
+    DisableFog,
+    SetCameraPos,
+    CameraWalk,
+    CameraStrafe,
+    CameraPitch,
+    CameraRotateY,
+    CameraLookAt,
+    CameraLookAtVectors,
+    CameraSetLens,
+    Count
+};
+
+// Writes calls into a trace file: each is its ApiCall byte followed by its
+// arguments.  Structures are stored as they are in memory, so a trace is
+// read back by builds with the same Vertex and LightDesc layout.
+class ApiTraceWriter
+{
+public:
+    ApiTraceWriter() = default;
+    ApiTraceWriter(const ApiTraceWriter& rhs) = delete;
+    ApiTraceWriter& operator=(const ApiTraceWriter& rhs) = delete;
+
+    // Replaces file; false if it can't be written.
+    bool Open(const std::string& file);
+    // False if any of the trace could not be written.
+    bool Close();
+    bool IsOpen()const;
+
+    // Starts a call; its arguments follow.
+    ApiTraceWriter& Call(ApiCall call);
+    ApiTraceWriter& Bytes(const void* data, size_t size);
+    template<typename T> ApiTraceWriter& Pod(const T& v) { return Bytes(&v, sizeof(T)); }
+    ApiTraceWriter& String(const std::string& s);
+    ApiTraceWriter& WString(const std::wstring& s);
+    // What CreateGeometry uses of a mesh: vertices, indices, subsets and material names.
+    ApiTraceWriter& Geometry(const Mesh& mesh);
+
+private:
+    std::ofstream mOut;
+};
+
+// Reads a trace back call by call.  Reads fail at the end of the trace and
+// on truncated data rather than running past it.
+class ApiTraceReader
+{
+public:
+    ApiTraceReader() = default;
+    ApiTraceReader(const ApiTraceReader& rhs) = delete;
+    ApiTraceReader& operator=(const ApiTraceReader& rhs) = delete;
+
+    // False if the file is missing or not a trace of this build's layout.
+    bool Open(const std::wstring& file);
+    // The reason Open or Next failed.
+    const std::string& Error()const;
+
+    // False at the end of the trace, and on a call this build doesn't know.
+    bool Next(ApiCall& call);
+    bool Bytes(void* dst, size_t size);
+    template<typename T> bool Pod(T& v) { return Bytes(&v, sizeof(T)); }
+    bool String(std::string& s);
+    bool WString(std::wstring& s);
+    bool Geometry(Mesh& mesh);
+
+private:
+    // False, and a truncated trace, unless size bytes are left.
+    bool Has(size_t size);
+
+    MappedFile mFile;
+    const uint8_t* mPos = nullptr;
+    const uint8_t* mEnd = nullptr;
+    std::string mError;
+};
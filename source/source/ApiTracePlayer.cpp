@@ -0,0 +1,405 @@
+#include "ApiTracePlayer.h"
+
+namespace
+{
+    UINT64 LightKey(const LightHandle& light)
+    {
+        return ((UINT64)light.Generation << 32) | light.Index;
+    }
+
+    float Milliseconds(uint64_t start, uint64_t end)
+    {
+        return (float)((double)(end - start) / 1000000.0);
+    }
+}
+
+ApiTracePlayer::ApiTracePlayer(Game_engine* engine)
+    : mEngine(engine)
+{
+    mEngine->mReplaying = true;
+}
+
+ApiTracePlayer::~ApiTracePlayer()
+{
+    mEngine->mReplaying = false;
+}
+
+bool ApiTracePlayer::Open(const std::wstring& file)
+{
+    mLights.clear();
+    mTimings.clear();
+    mCpuTimes.Reset();
+    mError.clear();
+    if (!mReader.Open(file))
+    {
+        mError = mReader.Error();
+        return false;
+    }
+    return true;
+}
+
+bool ApiTracePlayer::Step()
+{
+    ApiCall call;
+    while (mReader.Next(call))
+    {
+        if (!Replay(call))
+        {
+            mError = mReader.Error().empty() ? "can't replay call " + std::to_string((int)call) : mReader.Error();
+            return false;
+        }
+        if (call == ApiCall::Draw)
+            return true;
+    }
+    mError = mReader.Error();
+    return false;
+}
+
+bool ApiTracePlayer::Run()
+{
+    while (Step())
+        ;
+    return mError.empty();
+}
+
+const std::string& ApiTracePlayer::Error()const
+{
+    return mError;
+}
+
+const std::vector<ReplayFrameTiming>& ApiTracePlayer::Timings()const
+{
+    return mTimings;
+}
+
+const FrameTimeHistogram& ApiTracePlayer::CpuTimes()const
+{
+    return mCpuTimes;
+}
+
+bool ApiTracePlayer::SaveTimings(const std::string& file)const
+{
+    std::ofstream out(file, std::ios::trunc);
+    if (!out)
+        return false;
+
+    out << "frame,cpu_ms,update_ms,draw_ms,wait_ms,draws,triangles\n";
+    for (size_t i = 0; i < mTimings.size(); ++i)
+    {
+        const ReplayFrameTiming& t = mTimings[i];
+        out << i << ',' << t.CpuMilliseconds << ',' << t.UpdateMilliseconds << ',' << t.DrawMilliseconds << ','
+            << t.WaitMilliseconds << ',' << t.Draws << ',' << t.Triangles << '\n';
+    }
+    return (bool)out;
+}
+
+LightHandle ApiTracePlayer::MapLight(const LightHandle& recorded)const
+{
+    auto it = mLights.find(LightKey(recorded));
+    return it == mLights.end() ? LightHandle() : it->second;
+}
+
+void ApiTracePlayer::AddLight(const LightHandle& recorded, const LightHandle& replayed)
+{
+    mLights[LightKey(recorded)] = replayed;
+}
+
+bool ApiTracePlayer::Replay(ApiCall call)
+{
+    ApiTraceReader& in = mReader;
+    Game_engine& e = *mEngine;
+
+    std::string name, other;
+    std::wstring path;
+    XMFLOAT4 f4;
+    XMFLOAT3 a, b, c;
+    float x, y, z, w;
+    UINT u, v;
+    bool flag;
+    LightDesc desc;
+    LightHandle light;
+
+    switch (call)
+    {
+    case ApiCall::Initialize:
+        e.Initialize();
+        return true;
+
+    case ApiCall::Update:
+    {
+        float totalTime, deltaTime;
+        if (!in.Pod(totalTime) || !in.Pod(deltaTime) || !in.Pod(flag) || !in.Pod(a) || !in.Pod(b) || !in.Pod(c))
+            return false;
+        mTimer.Set(totalTime, deltaTime);
+
+        // Stands in for the keyboard and mouse input of the recording.
+        e.mIsWireframe = flag;
+        e.mCam.LookAt(a, XMFLOAT3(a.x + b.x, a.y + b.y, a.z + b.z), c);
+
+        const uint64_t start = Profiler::Now();
+        e.Update(mTimer);
+        mFrame = ReplayFrameTiming();
+        mFrame.UpdateMilliseconds = Milliseconds(start, Profiler::Now());
+        return true;
+    }
+
+    case ApiCall::Draw:
+    {
+        const uint64_t start = Profiler::Now();
+        e.Draw(mTimer);
+        mFrame.DrawMilliseconds = Milliseconds(start, Profiler::Now());
+
+        const FrameCounters& counters = e.GetFrameStats().LastFrame();
+        mFrame.WaitMilliseconds = e.GetFramePacingStats().CpuWaitMilliseconds;
+        mFrame.CpuMilliseconds = std::max(mFrame.UpdateMilliseconds + mFrame.DrawMilliseconds - mFrame.WaitMilliseconds, 0.0f);
+        mFrame.Draws = counters.Draws;
+        mFrame.Triangles = counters.Triangles;
+        mTimings.push_back(mFrame);
+        mCpuTimes.Record(mFrame.CpuMilliseconds);
+        return true;
+    }
+
+    case ApiCall::LoadTexture:
+        if (!in.WString(path) || !in.String(name))
+            return false;
+        e.LoadTexture(path, name);
+        return true;
+
+    case ApiCall::CreateMaterial:
+        if (!in.String(name) || !in.Pod(f4) || !in.Pod(a) || !in.Pod(x) || !in.String(other) || !in.Pod(b))
+            return false;
+        e.CreateMaterial(name, f4, a, x, other, b);
+        return true;
+
+    case ApiCall::UpdateMaterial:
+        if (!in.String(name) || !in.Pod(f4) || !in.Pod(a) || !in.Pod(x) || !in.Pod(b))
+            return false;
+        e.UpdateMaterial(name, f4, a, x, b);
+        return true;
+
+    case ApiCall::SetMaterialNormalMap:
+        if (!in.String(name) || !in.String(other))
+            return false;
+        e.SetMaterialNormalMap(name, other);
+        return true;
+
+    case ApiCall::SetMaterialAlphaTest:
+        if (!in.String(name) || !in.Pod(flag))
+            return false;
+        e.SetMaterialAlphaTest(name, flag);
+        return true;
+
+    case ApiCall::CreateGeometry:
+    {
+        Mesh mesh;
+        if (!in.Geometry(mesh) || !in.Pod(a) || !in.String(other) || !in.String(name))
+            return false;
+        e.CreateGeometry(std::move(mesh), a, other, name);
+        return true;
+    }
+
+    case ApiCall::CreateWorld:
+        e.CreateWorld();
+        return true;
+
+    case ApiCall::MoveObject:
+    {
+        XMFLOAT4X4 world;
+        if (!in.String(name) || !in.Pod(world))
+            return false;
+        e.MoveObject(name, XMLoadFloat4x4(&world));
+        return true;
+    }
+
+    case ApiCall::DrawObject:
+        if (!in.String(name))
+            return false;
+        e.DrawObject(name);
+        return true;
+
+    case ApiCall::DoNotDrawObject:
+        if (!in.String(name))
+            return false;
+        e.DoNotDrawObject(name);
+        return true;
+
+    case ApiCall::SetLight:
+        if (!in.Pod(a) || !in.Pod(b))
+            return false;
+        e.SetLight(a, b);
+        return true;
+
+    case ApiCall::SetAmbient:
+        if (!in.Pod(f4))
+            return false;
+        e.SetAmbient(f4);
+        return true;
+
+    case ApiCall::EditLight:
+        if (!in.Pod(a) || !in.Pod(b) || !in.Pod(u))
+            return false;
+        e.EditLight(a, b, u);
+        return true;
+
+    case ApiCall::EditAmbient:
+        if (!in.Pod(f4))
+            return false;
+        e.EditAmbient(f4);
+        return true;
+
+    case ApiCall::CreateLight:
+        if (!in.Pod(desc) || !in.Pod(light))
+            return false;
+        AddLight(light, e.CreateLight(desc));
+        return true;
+
+    case ApiCall::UpdateLight:
+        if (!in.Pod(light) || !in.Pod(desc))
+            return false;
+        e.UpdateLight(MapLight(light), desc);
+        return true;
+
+    case ApiCall::DestroyLight:
+        if (!in.Pod(light))
+            return false;
+        e.DestroyLight(MapLight(light));
+        return true;
+
+    case ApiCall::AddPointLight:
+        if (!in.Pod(a) || !in.Pod(b) || !in.Pod(x) || !in.Pod(y) || !in.Pod(light))
+            return false;
+        AddLight(light, e.AddPointLight(a, b, x, y));
+        return true;
+
+    case ApiCall::AddSpotLight:
+        if (!in.Pod(a) || !in.Pod(b) || !in.Pod(c) || !in.Pod(x) || !in.Pod(y) || !in.Pod(z) || !in.Pod(light))
+            return false;
+        AddLight(light, e.AddSpotLight(a, b, c, x, y, z));
+        return true;
+
+    case ApiCall::ClearLocalLights:
+        e.ClearLocalLights();
+        return true;
+
+    case ApiCall::SetShadowSettings:
+    {
+        CascadeSettings settings;
+        if (!in.Pod(settings))
+            return false;
+        e.SetShadowSettings(settings);
+        return true;
+    }
+
+    case ApiCall::SetOccluder:
+    {
+        OccluderShape shape;
+        if (!in.String(name) || !in.Pod(shape))
+            return false;
+        e.SetOccluder(name, shape);
+        return true;
+    }
+
+    case ApiCall::EnableOcclusionCulling:
+        if (!in.Pod(flag))
+            return false;
+        e.EnableOcclusionCulling(flag);
+        return true;
+
+    case ApiCall::SetDrawDistance:
+        if (!in.String(name) || !in.Pod(x))
+            return false;
+        e.SetDrawDistance(name, x);
+        return true;
+
+    case ApiCall::SetDrawCategory:
+        if (!in.String(name) || !in.Pod(u))
+            return false;
+        e.SetDrawCategory(name, u);
+        return true;
+
+    case ApiCall::SetMinScreenSize:
+        if (!in.Pod(x))
+            return false;
+        e.SetMinScreenSize(x);
+        return true;
+
+    case ApiCall::SetCategoryBudget:
+        if (!in.Pod(u) || !in.Pod(v))
+            return false;
+        e.SetCategoryBudget(u, v);
+        return true;
+
+    case ApiCall::LoadCells:
+        if (!in.String(name))
+            return false;
+        e.LoadCells(name);
+        return true;
+
+    case ApiCall::SetFramesInFlight:
+        if (!in.Pod(u))
+            return false;
+        e.SetFramesInFlight(u);
+        return true;
+
+    case ApiCall::SetFog:
+        if (!in.Pod(f4) || !in.Pod(x) || !in.Pod(y))
+            return false;
+        e.SetFog(f4, x, y);
+        return true;
+
+    case ApiCall::DisableFog:
+        e.DisableFog();
+        return true;
+
+    case ApiCall::SetCameraPos:
+        if (!in.Pod(a))
+            return false;
+        e.SetCameraPos(a);
+        return true;
+
+    case ApiCall::CameraWalk:
+        if (!in.Pod(x))
+            return false;
+        e.CameraWalk(x);
+        return true;
+
+    case ApiCall::CameraStrafe:
+        if (!in.Pod(x))
+            return false;
+        e.CameraStrafe(x);
+        return true;
+
+    case ApiCall::CameraPitch:
+        if (!in.Pod(x))
+            return false;
+        e.CameraPitch(x);
+        return true;
+
+    case ApiCall::CameraRotateY:
+        if (!in.Pod(x))
+            return false;
+        e.CameraRotateY(x);
+        return true;
+
+    case ApiCall::CameraLookAt:
+        if (!in.Pod(a) || !in.Pod(b) || !in.Pod(c))
+            return false;
+        e.CameraLookAt(a, b, c);
+        return true;
+
+    case ApiCall::CameraLookAtVectors:
+        if (!in.Pod(a) || !in.Pod(b) || !in.Pod(c))
+            return false;
+        e.CameraLookAt(XMLoadFloat3(&a), XMLoadFloat3(&b), XMLoadFloat3(&c));
+        return true;
+
+    case ApiCall::CameraSetLens:
+        if (!in.Pod(x) || !in.Pod(y) || !in.Pod(z) || !in.Pod(w))
+            return false;
+        e.CameraSetLens(x, y, z, w);
+        return true;
+
+    default:
+        return false;
+    }
+}
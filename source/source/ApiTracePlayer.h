@@ -0,0 +1,62 @@
+#pragma once
+#include "Game_engine_core.h"
+
+// CPU cost of one replayed frame.
+struct ReplayFrameTiming
+{
+    float UpdateMilliseconds = 0.0f;
+    float DrawMilliseconds = 0.0f;
+    // Blocked on the GPU and swap chain, part of the two above.
+    float WaitMilliseconds = 0.0f;
+    // Update and Draw without the waits: the engine's own work.
+    float CpuMilliseconds = 0.0f;
+    UINT64 Draws = 0;
+    UINT64 Triangles = 0;
+};
+
+// Drives an engine from a trace recorded by Game_engine::StartApiCapture.
+// Calls are replayed in order, frames with their recorded times and camera
+// input, so every replay of a trace does the same work.  Meant for a
+// headless engine: with the GPU out of the picture, the frame timings of two
+// builds can be compared frame by frame.
+class ApiTracePlayer
+{
+public:
+    explicit ApiTracePlayer(Game_engine* engine);
+    ApiTracePlayer(const ApiTracePlayer& rhs) = delete;
+    ApiTracePlayer& operator=(const ApiTracePlayer& rhs) = delete;
+    ~ApiTracePlayer();
+
+    bool Open(const std::wstring& file);
+
+    // Replays the calls up to the end of the next frame; false at the end of
+    // the trace or on an error.
+    bool Step();
+    // Replays the rest of the trace; false on an error.
+    bool Run();
+    // Why Open, Step or Run failed.
+    const std::string& Error()const;
+
+    const std::vector<ReplayFrameTiming>& Timings()const;
+    // Of ReplayFrameTiming::CpuMilliseconds over every replayed frame.
+    const FrameTimeHistogram& CpuTimes()const;
+    // One CSV row per frame; false if the file can't be written.
+    bool SaveTimings(const std::string& file)const;
+
+private:
+    // False on a truncated call.
+    bool Replay(ApiCall call);
+    // The replay's handle for a light the trace recorded.
+    LightHandle MapLight(const LightHandle& recorded)const;
+    void AddLight(const LightHandle& recorded, const LightHandle& replayed);
+
+    Game_engine* mEngine;
+    ApiTraceReader mReader;
+    GameTimer mTimer;
+    std::unordered_map<UINT64, LightHandle> mLights;
+
+    ReplayFrameTiming mFrame;
+    std::vector<ReplayFrameTiming> mTimings;
+    FrameTimeHistogram mCpuTimes;
+    std::string mError;
+};
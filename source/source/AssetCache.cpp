@@ -0,0 +1,365 @@
+#include "AssetCache.h"
+#include "../../Common/Hash.h"
+#include "../../Common/MappedFile.h"
+#include "../../Common/Profiler.h"
+
+namespace
+{
+    const uint32_t CookedMeshMagic = 0x4853454D; // "MESH"
+    // Bump whenever Vertex, MeshSubset, MeshNode or the importers change.
+    const uint32_t CookedMeshVersion = 2;
+
+    struct CookedMeshHeader
+    {
+        uint32_t Magic = CookedMeshMagic;
+        uint32_t Version = CookedMeshVersion;
+        uint64_t ContentHash = 0;
+        uint32_t VertexCount = 0;
+        uint32_t IndexCount = 0;
+        uint32_t SubsetCount = 0;
+        uint32_t NodeCount = 0;
+        uint32_t MaterialCount = 0;
+        DirectX::BoundingBox Bounds;
+    };
+
+    struct CookedSubset
+    {
+        UINT MaterialSlot;
+        UINT IndexCount;
+        UINT StartIndexLocation;
+        INT BaseVertexLocation;
+        DirectX::BoundingBox Bounds;
+    };
+
+    struct CookedNode
+    {
+        int Parent;
+        uint32_t SubsetCount;
+        DirectX::XMFLOAT4X4 Transform;
+    };
+
+    class Writer
+    {
+    public:
+        explicit Writer(std::ofstream& out) : mOut(out) {}
+        void Bytes(const void* data, size_t size) { mOut.write(static_cast<const char*>(data), size); }
+        template<typename T> void Pod(const T& v) { Bytes(&v, sizeof(T)); }
+        void String(const std::string& s) { Pod((uint32_t)s.size()); Bytes(s.data(), s.size()); }
+    private:
+        std::ofstream& mOut;
+    };
+
+    // Bounds checked cursor over a mapped cooked file.
+    class Reader
+    {
+    public:
+        Reader(const uint8_t* data, size_t size) : mPos(data), mEnd(data + size) {}
+        bool Bytes(void* dst, size_t size)
+        {
+            if ((size_t)(mEnd - mPos) < size)
+                return false;
+            memcpy(dst, mPos, size);
+            mPos += size;
+            return true;
+        }
+        template<typename T> bool Pod(T& v) { return Bytes(&v, sizeof(T)); }
+        // True when count elements of at least elementSize bytes each could still follow.
+        bool Holds(uint64_t count, size_t elementSize)const
+        {
+            return count <= (size_t)(mEnd - mPos) / elementSize;
+        }
+        bool String(std::string& s)
+        {
+            uint32_t size = 0;
+            if (!Pod(size) || (size_t)(mEnd - mPos) < size)
+                return false;
+            s.assign(reinterpret_cast<const char*>(mPos), size);
+            mPos += size;
+            return true;
+        }
+    private:
+        const uint8_t* mPos;
+        const uint8_t* mEnd;
+    };
+
+    // Whether every range in a mesh read from disk stays inside its buffers.
+    // The counts alone fitting the file does not make the ranges sane.
+    bool RangesValid(const Mesh& mesh)
+    {
+        for (const MeshSubset& s : mesh.subsets)
+        {
+            if ((uint64_t)s.StartIndexLocation + s.IndexCount > mesh.indices.size() ||
+                s.BaseVertexLocation < 0 || (size_t)s.BaseVertexLocation > mesh.vertices.size())
+                return false;
+            const size_t vertices = mesh.vertices.size() - s.BaseVertexLocation;
+            for (UINT i = s.StartIndexLocation; i < s.StartIndexLocation + s.IndexCount; ++i)
+            {
+                if (mesh.indices[i] >= vertices)
+                    return false;
+            }
+        }
+        for (size_t i = 0; i < mesh.nodes.size(); ++i)
+        {
+            const MeshNode& n = mesh.nodes[i];
+            if (n.Parent < -1 || n.Parent >= (int)i)
+                return false;
+            for (UINT subset : n.subsets)
+            {
+                if (subset >= mesh.subsets.size())
+                    return false;
+            }
+        }
+        return true;
+    }
+}
+
+size_t AssetCache::AssetKeyHash::operator()(const AssetKey& k)const
+{
+    return (size_t)Hash64(k.Path, k.Hash);
+}
+
+AssetCache::AssetCache()
+{
+    SetCacheDirectory(L"AssetCache");
+}
+
+void AssetCache::SetCacheDirectory(const std::wstring& dir)
+{
+    mCacheDir = dir;
+    if (!mCacheDir.empty())
+    {
+        CreateDirectoryW(mCacheDir.c_str(), nullptr);
+        if (mCacheDir.back() != L'\\' && mCacheDir.back() != L'/')
+            mCacheDir += L'\\';
+    }
+}
+
+std::shared_ptr<const Mesh> AssetCache::LoadMesh(const std::string& path, const std::string& importer, const MeshImporter& import)
+{
+    PROFILE_FUNCTION();
+    AssetKey key;
+    key.Path = AnsiToWString(path);
+    {
+        MappedFile file;
+        if (FAILED(file.Open(key.Path)))
+        {
+            // Nothing to hash, let the importer report the error and do not remember the result.
+            ++mMeshStats.Misses;
+            return std::make_shared<const Mesh>(import(path));
+        }
+        key.Hash = Hash64(importer, Hash64(file.Data(), file.Size()));
+    }
+
+    auto it = mMeshes.find(key);
+    if (it != mMeshes.end())
+    {
+        ++mMeshStats.MemoryHits;
+        return it->second;
+    }
+
+    auto mesh = std::make_shared<Mesh>();
+    const std::wstring cooked = CookedMeshPath(key);
+    if (!cooked.empty() && ReadCookedMesh(cooked, key.Hash, *mesh))
+    {
+        ++mMeshStats.DiskHits;
+    }
+    else
+    {
+        ++mMeshStats.Misses;
+        *mesh = import(path);
+        if (!cooked.empty() && !mesh->vertices.empty())
+            WriteCookedMesh(cooked, key.Hash, *mesh);
+    }
+
+    mMeshes[key] = mesh;
+    return mesh;
+}
+
+std::shared_ptr<Texture> AssetCache::LoadTexture(const std::wstring& path, const TextureCreator& create)
+{
+    PROFILE_FUNCTION();
+    MappedFile file;
+    ThrowIfFailed(file.Open(path));
+
+    AssetKey key;
+    key.Path = path;
+    key.Hash = Hash64(file.Data(), file.Size());
+
+    auto it = mTextures.find(key);
+    if (it != mTextures.end())
+    {
+        ++mTextureStats.MemoryHits;
+        return it->second;
+    }
+
+    // DDS files already are the cooked form, so there is no disk tier here.
+    ++mTextureStats.Misses;
+    auto tex = std::make_shared<Texture>();
+    tex->Filename = path;
+    ThrowIfFailed(create(file.Data(), file.Size(), *tex));
+
+    mTextures[key] = tex;
+    return tex;
+}
+
+std::shared_ptr<MeshGeometry> AssetCache::FindGeometry(UINT64 key)
+{
+    auto it = mGeometries.find(key);
+    if (it == mGeometries.end())
+    {
+        ++mGeometryStats.Misses;
+        return nullptr;
+    }
+    ++mGeometryStats.MemoryHits;
+    return it->second;
+}
+
+void AssetCache::AddGeometry(UINT64 key, const std::shared_ptr<MeshGeometry>& geo)
+{
+    mGeometries[key] = geo;
+}
+
+UINT64 AssetCache::GeometryKey(const Mesh& mesh)
+{
+    UINT64 h = Hash64(mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+    h = Hash64(mesh.indices.data(), mesh.indices.size() * sizeof(uint16_t), h);
+    for (const MeshSubset& s : mesh.subsets)
+    {
+        UINT range[3] = { s.IndexCount, s.StartIndexLocation, (UINT)s.BaseVertexLocation };
+        h = Hash64(range, sizeof(range), h);
+    }
+    return h;
+}
+
+void AssetCache::Trim()
+{
+    for (auto it = mMeshes.begin(); it != mMeshes.end();)
+        it = it->second.use_count() == 1 ? mMeshes.erase(it) : std::next(it);
+    for (auto it = mTextures.begin(); it != mTextures.end();)
+        it = it->second.use_count() == 1 ? mTextures.erase(it) : std::next(it);
+    for (auto it = mGeometries.begin(); it != mGeometries.end();)
+        it = it->second.use_count() == 1 ? mGeometries.erase(it) : std::next(it);
+}
+
+std::wstring AssetCache::CookedMeshPath(const AssetKey& key)const
+{
+    if (mCacheDir.empty())
+        return std::wstring();
+    std::string name = HashToString(Hash64(key.Path, key.Hash)) + ".mesh";
+    return mCacheDir + std::wstring(name.begin(), name.end());
+}
+
+bool AssetCache::ReadCookedMesh(const std::wstring& file, UINT64 contentHash, Mesh& out)const
+{
+    MappedFile mapped;
+    if (FAILED(mapped.Open(file)))
+        return false;
+
+    Reader in(mapped.Data(), mapped.Size());
+    CookedMeshHeader header;
+    if (!in.Pod(header) || header.Magic != CookedMeshMagic ||
+        header.Version != CookedMeshVersion || header.ContentHash != contentHash)
+        return false;
+
+    // The counts come from the file, so make sure it can hold that much before allocating.
+    out.Bounds = header.Bounds;
+
+    if (!in.Holds(header.VertexCount, sizeof(Vertex)))
+        return false;
+    out.vertices.resize(header.VertexCount);
+    if (!in.Bytes(out.vertices.data(), out.vertices.size() * sizeof(Vertex)))
+        return false;
+
+    if (!in.Holds(header.IndexCount, sizeof(uint16_t)))
+        return false;
+    out.indices.resize(header.IndexCount);
+    if (!in.Bytes(out.indices.data(), out.indices.size() * sizeof(uint16_t)))
+        return false;
+
+    // Strings take at least their length prefix.
+    if (!in.Holds(header.SubsetCount, sizeof(uint32_t) + sizeof(CookedSubset)))
+        return false;
+    out.subsets.resize(header.SubsetCount);
+    for (MeshSubset& s : out.subsets)
+    {
+        CookedSubset c;
+        if (!in.String(s.Name) || !in.Pod(c))
+            return false;
+        s.MaterialSlot = c.MaterialSlot;
+        s.IndexCount = c.IndexCount;
+        s.StartIndexLocation = c.StartIndexLocation;
+        s.BaseVertexLocation = c.BaseVertexLocation;
+        s.Bounds = c.Bounds;
+    }
+
+    if (!in.Holds(header.NodeCount, sizeof(uint32_t) + sizeof(CookedNode)))
+        return false;
+    out.nodes.resize(header.NodeCount);
+    for (MeshNode& n : out.nodes)
+    {
+        CookedNode c;
+        if (!in.String(n.Name) || !in.Pod(c))
+            return false;
+        n.Parent = c.Parent;
+        n.Transform = c.Transform;
+        if (!in.Holds(c.SubsetCount, sizeof(UINT)))
+            return false;
+        n.subsets.resize(c.SubsetCount);
+        if (!in.Bytes(n.subsets.data(), n.subsets.size() * sizeof(UINT)))
+            return false;
+    }
+
+    if (!in.Holds(header.MaterialCount, sizeof(uint32_t)))
+        return false;
+    out.materials.resize(header.MaterialCount);
+    for (std::string& m : out.materials)
+    {
+        if (!in.String(m))
+            return false;
+    }
+    return RangesValid(out);
+}
+
+void AssetCache::WriteCookedMesh(const std::wstring& file, UINT64 contentHash, const Mesh& mesh)const
+{
+    // Write next to the target and rename, so a crash never leaves a torn cache file.
+    const std::wstring temp = file + L".tmp";
+    {
+        std::ofstream fout(temp, std::ios::binary | std::ios::trunc);
+        if (!fout)
+            return;
+        Writer out(fout);
+
+        CookedMeshHeader header;
+        header.ContentHash = contentHash;
+        header.VertexCount = (uint32_t)mesh.vertices.size();
+        header.IndexCount = (uint32_t)mesh.indices.size();
+        header.SubsetCount = (uint32_t)mesh.subsets.size();
+        header.NodeCount = (uint32_t)mesh.nodes.size();
+        header.MaterialCount = (uint32_t)mesh.materials.size();
+        header.Bounds = mesh.Bounds;
+        out.Pod(header);
+
+        out.Bytes(mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+        out.Bytes(mesh.indices.data(), mesh.indices.size() * sizeof(uint16_t));
+        for (const MeshSubset& s : mesh.subsets)
+        {
+            CookedSubset c = { s.MaterialSlot, s.IndexCount, s.StartIndexLocation, s.BaseVertexLocation, s.Bounds };
+            out.String(s.Name);
+            out.Pod(c);
+        }
+        for (const MeshNode& n : mesh.nodes)
+        {
+            CookedNode c = { n.Parent, (uint32_t)n.subsets.size(), n.Transform };
+            out.String(n.Name);
+            out.Pod(c);
+            out.Bytes(n.subsets.data(), n.subsets.size() * sizeof(UINT));
+        }
+        for (const std::string& m : mesh.materials)
+            out.String(m);
+
+        if (!fout)
+            return;
+    }
+    MoveFileExW(temp.c_str(), file.c_str(), MOVEFILE_REPLACE_EXISTING);
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include "FrameResource.h"
+#include <functional>
+
+struct AssetCacheStats
+{
+    // Served from an entry already in memory.
+    UINT64 MemoryHits = 0;
+    // Served from a cooked file in the cache directory.
+    UINT64 DiskHits = 0;
+    // Had to run the importer.
+    UINT64 Misses = 0;
+};
+
+// Registry of imported assets shared by the loaders.  Entries are keyed by the
+// source path plus a hash of the file contents, so loading the same file twice
+// hands out the same reference-counted object while an edited file is imported
+// again.  Imported meshes are also cooked into the cache directory, which lets
+// the next launch skip the import entirely.
+class AssetCache
+{
+public:
+    typedef std::function<Mesh(const std::string&)> MeshImporter;
+    typedef std::function<HRESULT(const uint8_t* data, size_t size, Texture& tex)> TextureCreator;
+
+    AssetCache();
+
+    // Empty string disables the on-disk cache.
+    void SetCacheDirectory(const std::wstring& dir);
+
+    // importer names the code path that builds the mesh, so switching importers never
+    // hands back a mesh cooked by the other one.
+    std::shared_ptr<const Mesh> LoadMesh(const std::string& path, const std::string& importer, const MeshImporter& import);
+    std::shared_ptr<Texture> LoadTexture(const std::wstring& path, const TextureCreator& create);
+
+    // GPU buffers keyed by the hash of the vertex and index data they were built from.
+    std::shared_ptr<MeshGeometry> FindGeometry(UINT64 key);
+    void AddGeometry(UINT64 key, const std::shared_ptr<MeshGeometry>& geo);
+    static UINT64 GeometryKey(const Mesh& mesh);
+
+    // Releases entries that are no longer referenced outside the cache.
+    void Trim();
+
+    const AssetCacheStats& MeshStats()const { return mMeshStats; }
+    const AssetCacheStats& TextureStats()const { return mTextureStats; }
+    const AssetCacheStats& GeometryStats()const { return mGeometryStats; }
+
+private:
+    struct AssetKey
+    {
+        std::wstring Path;
+        UINT64 Hash = 0;
+        bool operator==(const AssetKey& rhs)const { return Hash == rhs.Hash && Path == rhs.Path; }
+    };
+    struct AssetKeyHash
+    {
+        size_t operator()(const AssetKey& k)const;
+    };
+
+    std::wstring CookedMeshPath(const AssetKey& key)const;
+    bool ReadCookedMesh(const std::wstring& file, UINT64 contentHash, Mesh& out)const;
+    void WriteCookedMesh(const std::wstring& file, UINT64 contentHash, const Mesh& mesh)const;
+
+    std::wstring mCacheDir;
+
+    std::unordered_map<AssetKey, std::shared_ptr<const Mesh>, AssetKeyHash> mMeshes;
+    std::unordered_map<AssetKey, std::shared_ptr<Texture>, AssetKeyHash> mTextures;
+    std::unordered_map<UINT64, std::shared_ptr<MeshGeometry>> mGeometries;
+
+    AssetCacheStats mMeshStats;
+    AssetCacheStats mTextureStats;
+    AssetCacheStats mGeometryStats;
+};
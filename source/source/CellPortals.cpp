@@ -0,0 +1,473 @@
+#include "CellPortals.h"
+#include "../../Common/Profiler.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <thread>
+
+using namespace DirectX;
+
+namespace
+{
+    // Eyes closer than this to a portal's plane stand in the doorway and see
+    // through it in every direction.
+    const float DoorwayEpsilon = 1e-3f;
+    // How far bake samples on a portal are pushed into their cell.
+    const float SampleInset = 1e-2f;
+
+    float PlaneDistance(const XMFLOAT4& plane, const XMFLOAT3& p)
+    {
+        return plane.x * p.x + plane.y * p.y + plane.z * p.z + plane.w;
+    }
+
+    // Keeps the part of the convex polygon on the plane's positive side.
+    void ClipPolygon(ArenaVector<XMFLOAT3>& poly, const XMFLOAT4& plane, ArenaVector<XMFLOAT3>& scratch)
+    {
+        scratch.clear();
+        for (size_t i = 0; i < poly.size(); ++i)
+        {
+            const XMFLOAT3& a = poly[i];
+            const XMFLOAT3& b = poly[(i + 1) % poly.size()];
+            const float da = PlaneDistance(plane, a);
+            const float db = PlaneDistance(plane, b);
+            if (da >= 0.0f)
+                scratch.push_back(a);
+            if ((da >= 0.0f) != (db >= 0.0f))
+            {
+                XMFLOAT3 p;
+                XMStoreFloat3(&p, XMVectorLerp(XMLoadFloat3(&a), XMLoadFloat3(&b), da / (da - db)));
+                scratch.push_back(p);
+            }
+        }
+        poly.swap(scratch);
+    }
+
+    // Planes through the eye and each edge of the polygon, facing inward.
+    void PortalFrustum(const XMFLOAT3& eye, const ArenaVector<XMFLOAT3>& poly, ArenaVector<XMFLOAT4>& planes)
+    {
+        const XMVECTOR e = XMLoadFloat3(&eye);
+        XMVECTOR centroid = XMVectorZero();
+        for (const XMFLOAT3& p : poly)
+            centroid = XMVectorAdd(centroid, XMLoadFloat3(&p));
+        centroid = XMVectorScale(centroid, 1.0f / poly.size());
+
+        planes.clear();
+        for (size_t i = 0; i < poly.size(); ++i)
+        {
+            const XMVECTOR a = XMVectorSubtract(XMLoadFloat3(&poly[i]), e);
+            const XMVECTOR b = XMVectorSubtract(XMLoadFloat3(&poly[(i + 1) % poly.size()]), e);
+            XMVECTOR n = XMVector3Cross(a, b);
+            if (XMVectorGetX(XMVector3LengthSq(n)) < 1e-12f)
+                continue;
+            n = XMVector3Normalize(n);
+            if (XMVectorGetX(XMVector3Dot(n, XMVectorSubtract(centroid, e))) < 0.0f)
+                n = XMVectorNegate(n);
+
+            XMFLOAT4 plane;
+            XMStoreFloat4(&plane, XMVectorSetW(n, -XMVectorGetX(XMVector3Dot(n, e))));
+            planes.push_back(plane);
+        }
+    }
+
+    // The six planes of a D3D projection, facing inward.
+    void ViewProjPlanes(FXMMATRIX viewProj, ArenaVector<XMFLOAT4>& planes)
+    {
+        const XMMATRIX m = XMMatrixTranspose(viewProj);
+        const XMVECTOR rows[6] =
+        {
+            XMVectorAdd(m.r[3], m.r[0]),
+            XMVectorSubtract(m.r[3], m.r[0]),
+            XMVectorAdd(m.r[3], m.r[1]),
+            XMVectorSubtract(m.r[3], m.r[1]),
+            m.r[2],
+            XMVectorSubtract(m.r[3], m.r[2])
+        };
+        planes.resize(6);
+        for (int i = 0; i < 6; ++i)
+        {
+            const float length = XMVectorGetX(XMVector3Length(rows[i]));
+            XMStoreFloat4(&planes[i], XMVectorScale(rows[i], 1.0f / length));
+        }
+    }
+}
+
+uint32_t CellGraph::AddCell(const BoundingBox& bounds)
+{
+    Cell cell;
+    cell.Bounds = bounds;
+    mCells.push_back(cell);
+    mPvs.clear();
+    ++mVersion;
+    return (uint32_t)mCells.size() - 1;
+}
+
+uint32_t CellGraph::AddPortal(uint32_t cellA, uint32_t cellB, const XMFLOAT3 corners[4])
+{
+    if (cellA >= mCells.size() || cellB >= mCells.size() || cellA == cellB)
+        return NoCell;
+
+    Portal portal;
+    portal.Cells[0] = cellA;
+    portal.Cells[1] = cellB;
+    for (int i = 0; i < 4; ++i)
+        portal.Corners[i] = corners[i];
+
+    const XMVECTOR c0 = XMLoadFloat3(&corners[0]);
+    XMVECTOR n = XMVector3Normalize(XMVector3Cross(XMVectorSubtract(XMLoadFloat3(&corners[1]), c0),
+        XMVectorSubtract(XMLoadFloat3(&corners[2]), c0)));
+    if (XMVectorGetX(XMVector3Dot(n, XMVectorSubtract(XMLoadFloat3(&mCells[cellB].Bounds.Center), c0))) < 0.0f)
+        n = XMVectorNegate(n);
+    XMStoreFloat4(&portal.Plane, XMVectorSetW(n, -XMVectorGetX(XMVector3Dot(n, c0))));
+
+    const uint32_t index = (uint32_t)mPortals.size();
+    mPortals.push_back(portal);
+    mCells[cellA].Portals.push_back(index);
+    mCells[cellB].Portals.push_back(index);
+    mPvs.clear();
+    ++mVersion;
+    return index;
+}
+
+void CellGraph::Clear()
+{
+    mCells.clear();
+    mPortals.clear();
+    mPvs.clear();
+    ++mVersion;
+}
+
+bool CellGraph::Load(const std::string& file)
+{
+    std::ifstream fin(file);
+    if (!fin)
+    {
+        mError = "Cannot open " + file;
+        return false;
+    }
+
+    Clear();
+    std::vector<uint64_t> pvs;
+    std::string line;
+    for (int lineNumber = 1; std::getline(fin, line); ++lineNumber)
+    {
+        std::istringstream in(line);
+        std::string kind;
+        if (!(in >> kind) || kind[0] == '#')
+            continue;
+
+        bool ok = false;
+        if (kind == "cell")
+        {
+            XMFLOAT3 lo, hi;
+            ok = (bool)(in >> lo.x >> lo.y >> lo.z >> hi.x >> hi.y >> hi.z);
+            if (ok)
+            {
+                BoundingBox bounds;
+                BoundingBox::CreateFromPoints(bounds, XMLoadFloat3(&lo), XMLoadFloat3(&hi));
+                AddCell(bounds);
+            }
+        }
+        else if (kind == "portal")
+        {
+            uint32_t a, b;
+            XMFLOAT3 corners[4];
+            ok = (bool)(in >> a >> b);
+            for (int i = 0; ok && i < 4; ++i)
+                ok = (bool)(in >> corners[i].x >> corners[i].y >> corners[i].z);
+            ok = ok && AddPortal(a, b, corners) != NoCell;
+        }
+        else if (kind == "pvs")
+        {
+            uint32_t cell;
+            ok = (bool)(in >> cell) && cell < mCells.size();
+            if (ok)
+            {
+                pvs.resize(mCells.size() * PvsWords());
+                for (uint32_t w = 0; ok && w < PvsWords(); ++w)
+                    ok = (bool)(in >> std::hex >> pvs[cell * PvsWords() + w]);
+            }
+        }
+
+        if (!ok)
+        {
+            mError = file + "(" + std::to_string(lineNumber) + "): bad " + kind;
+            Clear();
+            return false;
+        }
+    }
+
+    if (pvs.size() == mCells.size() * PvsWords())
+        mPvs.swap(pvs);
+    return true;
+}
+
+bool CellGraph::Save(const std::string& file)const
+{
+    std::ofstream fout(file);
+    if (!fout)
+        return false;
+    fout.precision(std::numeric_limits<float>::max_digits10);
+
+    for (const Cell& cell : mCells)
+    {
+        const BoundingBox& b = cell.Bounds;
+        fout << "cell " << b.Center.x - b.Extents.x << " " << b.Center.y - b.Extents.y << " " << b.Center.z - b.Extents.z
+            << " " << b.Center.x + b.Extents.x << " " << b.Center.y + b.Extents.y << " " << b.Center.z + b.Extents.z << "\n";
+    }
+    for (const Portal& portal : mPortals)
+    {
+        fout << "portal " << portal.Cells[0] << " " << portal.Cells[1];
+        for (const XMFLOAT3& c : portal.Corners)
+            fout << " " << c.x << " " << c.y << " " << c.z;
+        fout << "\n";
+    }
+    for (uint32_t cell = 0; cell < mCells.size() && HasPVS(); ++cell)
+    {
+        fout << "pvs " << cell << std::hex;
+        for (uint32_t w = 0; w < PvsWords(); ++w)
+            fout << " " << mPvs[cell * PvsWords() + w];
+        fout << std::dec << "\n";
+    }
+    return (bool)fout;
+}
+
+const std::string& CellGraph::Error()const
+{
+    return mError;
+}
+
+uint32_t CellGraph::CellCount()const
+{
+    return (uint32_t)mCells.size();
+}
+
+uint32_t CellGraph::PortalCount()const
+{
+    return (uint32_t)mPortals.size();
+}
+
+const Cell& CellGraph::GetCell(uint32_t i)const
+{
+    return mCells[i];
+}
+
+const Portal& CellGraph::GetPortal(uint32_t i)const
+{
+    return mPortals[i];
+}
+
+uint32_t CellGraph::Version()const
+{
+    return mVersion;
+}
+
+uint32_t CellGraph::FindCell(const XMFLOAT3& p)const
+{
+    const XMVECTOR point = XMLoadFloat3(&p);
+    for (uint32_t i = 0; i < mCells.size(); ++i)
+    {
+        if (mCells[i].Bounds.Contains(point) != DISJOINT)
+            return i;
+    }
+    return NoCell;
+}
+
+void CellGraph::CellsOverlapping(const BoundingBox& box, std::vector<uint32_t>& cells)const
+{
+    cells.clear();
+    for (uint32_t i = 0; i < mCells.size(); ++i)
+    {
+        if (mCells[i].Bounds.Intersects(box))
+            cells.push_back(i);
+    }
+}
+
+uint32_t CellGraph::PvsWords()const
+{
+    return ((uint32_t)mCells.size() + 63) / 64;
+}
+
+bool CellGraph::HasPVS()const
+{
+    return !mPvs.empty();
+}
+
+bool CellGraph::PotentiallyVisible(uint32_t from, uint32_t to)const
+{
+    if (!HasPVS())
+        return true;
+    return (mPvs[from * PvsWords() + to / 64] >> (to % 64)) & 1;
+}
+
+void CellGraph::BakePVS(uint32_t samplesPerPortal, unsigned threads)
+{
+    PROFILE_FUNCTION();
+    const uint32_t count = (uint32_t)mCells.size();
+    std::vector<uint64_t> pvs(count * PvsWords(), 0);
+    // Bake against the portals alone; the previous PVS must not prune.
+    mPvs.clear();
+
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, std::max(count, 1u));
+
+    // Rows are disjoint, so threads write them without locking.
+    std::atomic<uint32_t> next(0);
+    auto work = [&]()
+    {
+        PROFILE_ZONE("CellGraph::BakeCells");
+        std::vector<uint8_t> visible;
+        for (uint32_t cell = next++; cell < count; cell = next++)
+        {
+            BakeCell(cell, samplesPerPortal, visible);
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                if (visible[i])
+                    pvs[cell * PvsWords() + i / 64] |= uint64_t(1) << (i % 64);
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < threads; ++i)
+        workers.emplace_back(work);
+    work();
+    for (auto& t : workers)
+        t.join();
+
+    mPvs.swap(pvs);
+}
+
+void CellGraph::BakeCell(uint32_t cell, uint32_t samplesPerPortal, std::vector<uint8_t>& visible)
+{
+    const Cell& c = mCells[cell];
+    visible.assign(mCells.size(), 0);
+    visible[cell] = 1;
+
+    // The eye can stand in any doorway, so neighbours are always visible.
+    std::vector<XMFLOAT3> eyes;
+    const uint32_t grid = std::max(1u, (uint32_t)std::ceil(std::sqrt((float)samplesPerPortal)));
+    for (uint32_t p : c.Portals)
+    {
+        const Portal& portal = mPortals[p];
+        visible[portal.Cells[0] == cell ? portal.Cells[1] : portal.Cells[0]] = 1;
+
+        const XMVECTOR inset = XMVectorScale(XMLoadFloat4(&portal.Plane), portal.Cells[1] == cell ? SampleInset : -SampleInset);
+        for (uint32_t v = 0; v < grid; ++v)
+        {
+            for (uint32_t u = 0; u < grid; ++u)
+            {
+                const float s = (u + 0.5f) / grid;
+                const float t = (v + 0.5f) / grid;
+                const XMVECTOR top = XMVectorLerp(XMLoadFloat3(&portal.Corners[0]), XMLoadFloat3(&portal.Corners[1]), s);
+                const XMVECTOR bottom = XMVectorLerp(XMLoadFloat3(&portal.Corners[3]), XMLoadFloat3(&portal.Corners[2]), s);
+                XMFLOAT3 eye;
+                XMStoreFloat3(&eye, XMVectorAdd(XMVectorLerp(top, bottom, t), XMVectorSetW(inset, 0.0f)));
+                eyes.push_back(eye);
+            }
+        }
+    }
+
+    XMFLOAT3 corners[8];
+    c.Bounds.GetCorners(corners);
+    const XMVECTOR center = XMLoadFloat3(&c.Bounds.Center);
+    eyes.push_back(c.Bounds.Center);
+    for (const XMFLOAT3& corner : corners)
+    {
+        XMFLOAT3 eye;
+        XMStoreFloat3(&eye, XMVectorLerp(center, XMLoadFloat3(&corner), 0.9f));
+        eyes.push_back(eye);
+    }
+
+    // Looking every way from each eye: no planes to start with.
+    const ArenaVector<XMFLOAT4> planes;
+    Traversal t;
+    t.PvsRow = nullptr;
+    t.Visible = &visible;
+    t.Arena = nullptr;
+    t.OnPath.assign(mCells.size(), 0);
+    t.OnPath[cell] = 1;
+    for (const XMFLOAT3& eye : eyes)
+    {
+        t.Eye = eye;
+        Flood(t, cell, NoCell, planes, 0);
+    }
+}
+
+bool CellGraph::FindVisibleCells(const XMFLOAT3& eye, FXMMATRIX viewProj, std::vector<uint8_t>& visible,
+    LinearArena* scratch)const
+{
+    PROFILE_FUNCTION();
+    const uint32_t cell = FindCell(eye);
+    if (cell == NoCell)
+    {
+        visible.assign(mCells.size(), 1);
+        return false;
+    }
+
+    visible.assign(mCells.size(), 0);
+    visible[cell] = 1;
+
+    ArenaVector<XMFLOAT4> planes(scratch);
+    ViewProjPlanes(viewProj, planes);
+
+    Traversal t;
+    t.Eye = eye;
+    t.PvsRow = HasPVS() ? &mPvs[cell * PvsWords()] : nullptr;
+    t.Visible = &visible;
+    t.OnPath = ArenaVector<uint8_t>(scratch);
+    t.Arena = scratch;
+    t.OnPath.assign(mCells.size(), 0);
+    t.OnPath[cell] = 1;
+    Flood(t, cell, NoCell, planes, 0);
+    return true;
+}
+
+void CellGraph::Flood(Traversal& t, uint32_t cell, uint32_t fromPortal, const ArenaVector<XMFLOAT4>& planes,
+    uint32_t depth)const
+{
+    if (depth >= MaxPortalDepth)
+        return;
+
+    ArenaVector<XMFLOAT3> poly(t.Arena);
+    ArenaVector<XMFLOAT3> scratch(t.Arena);
+    ArenaVector<XMFLOAT4> portalPlanes(t.Arena);
+    for (uint32_t p : mCells[cell].Portals)
+    {
+        if (p == fromPortal)
+            continue;
+        const Portal& portal = mPortals[p];
+        const uint32_t next = portal.Cells[0] == cell ? portal.Cells[1] : portal.Cells[0];
+        if (t.OnPath[next])
+            continue;
+        if (t.PvsRow != nullptr && !((t.PvsRow[next / 64] >> (next % 64)) & 1))
+            continue;
+
+        // The eye has to be on this cell's side to look through the portal.
+        float distance = PlaneDistance(portal.Plane, t.Eye);
+        if (portal.Cells[1] == cell)
+            distance = -distance;
+        if (distance > DoorwayEpsilon)
+            continue;
+
+        const ArenaVector<XMFLOAT4>* nextPlanes = &planes;
+        if (distance < -DoorwayEpsilon)
+        {
+            poly.assign(portal.Corners, portal.Corners + 4);
+            for (size_t i = 0; i < planes.size() && poly.size() >= 3; ++i)
+                ClipPolygon(poly, planes[i], scratch);
+            if (poly.size() < 3)
+                continue;
+            PortalFrustum(t.Eye, poly, portalPlanes);
+            nextPlanes = &portalPlanes;
+        }
+
+        (*t.Visible)[next] = 1;
+        t.OnPath[next] = 1;
+        Flood(t, next, p, *nextPlanes, depth + 1);
+        t.OnPath[next] = 0;
+    }
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "../../Common/FrameArena.h"
+
+// Cells and portals for indoor levels.  Cells are authored boxes, usually
+// rooms; portals are convex quads, usually doorways, joining two cells.
+// Visibility is found in two steps:
+//   - offline, BakePVS samples eye points on every cell's portals and in the
+//     cell and records which cells can be seen from it (the potentially
+//     visible set);
+//   - each frame, FindVisibleCells starts in the camera's cell and recurses
+//     through the portals, clipping each one to the frustum of the portals
+//     before it.  Cells outside the camera cell's PVS are never entered.
+// Nothing here touches D3D, so the bake also runs in tools.
+
+struct Cell
+{
+    DirectX::BoundingBox Bounds;
+    std::vector<uint32_t> Portals;
+};
+
+struct Portal
+{
+    uint32_t Cells[2];
+    // Convex, in order around the quad.
+    DirectX::XMFLOAT3 Corners[4];
+    // Plane of the quad, facing into Cells[1].
+    DirectX::XMFLOAT4 Plane;
+};
+
+class CellGraph
+{
+public:
+    static const uint32_t NoCell = 0xffffffff;
+    // Portals passed through before FindVisibleCells gives up on a path.
+    static const uint32_t MaxPortalDepth = 32;
+
+    // Returns the new cell's index.
+    uint32_t AddCell(const DirectX::BoundingBox& bounds);
+    // Returns the new portal's index, NoCell when a cell does not exist.
+    uint32_t AddPortal(uint32_t cellA, uint32_t cellB, const DirectX::XMFLOAT3 corners[4]);
+    void Clear();
+
+    // Text format, one entry per line:
+    //   cell minX minY minZ maxX maxY maxZ
+    //   portal cellA cellB x0 y0 z0 x1 y1 z1 x2 y2 z2 x3 y3 z3
+    //   pvs cell word0 word1 ...      (hex bit rows written by Save after a bake)
+    // Returns false when the file could not be read, Error() tells why.
+    bool Load(const std::string& file);
+    bool Save(const std::string& file)const;
+    const std::string& Error()const;
+
+    uint32_t CellCount()const;
+    uint32_t PortalCount()const;
+    const Cell& GetCell(uint32_t i)const;
+    const Portal& GetPortal(uint32_t i)const;
+    // Bumped by every change to the cells or portals.
+    uint32_t Version()const;
+
+    // First cell containing p, NoCell if none does.
+    uint32_t FindCell(const DirectX::XMFLOAT3& p)const;
+    void CellsOverlapping(const DirectX::BoundingBox& box, std::vector<uint32_t>& cells)const;
+
+    // samplesPerPortal eye points are spread over each portal of a cell, plus
+    // the cell's center and inset corners.  threads = 0 uses one per core.
+    void BakePVS(uint32_t samplesPerPortal = 16, unsigned threads = 0);
+    bool HasPVS()const;
+    bool PotentiallyVisible(uint32_t from, uint32_t to)const;
+
+    // visible[cell] is 1 for the cells seen from eye through the frustum of
+    // viewProj.  Returns false, leaving every cell marked, when eye is in no cell.
+    // The traversal's scratch memory comes from scratch, or the heap if null.
+    bool FindVisibleCells(const DirectX::XMFLOAT3& eye, DirectX::FXMMATRIX viewProj, std::vector<uint8_t>& visible,
+        LinearArena* scratch = nullptr)const;
+
+private:
+    struct Traversal
+    {
+        DirectX::XMFLOAT3 Eye;
+        const uint64_t* PvsRow;
+        std::vector<uint8_t>* Visible;
+        ArenaVector<uint8_t> OnPath;
+        LinearArena* Arena;
+    };
+
+    void Flood(Traversal& t, uint32_t cell, uint32_t fromPortal, const ArenaVector<DirectX::XMFLOAT4>& planes,
+        uint32_t depth)const;
+    void BakeCell(uint32_t cell, uint32_t samplesPerPortal, std::vector<uint8_t>& visible);
+    uint32_t PvsWords()const;
+
+    std::vector<Cell> mCells;
+    std::vector<Portal> mPortals;
+    // One bit row of PvsWords() words per cell; empty until baked.
+    std::vector<uint64_t> mPvs;
+    uint32_t mVersion = 0;
+    std::string mError;
+};
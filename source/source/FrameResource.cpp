@@ -1,6 +1,7 @@
 #include "FrameResource.h"
 
-FrameResource::FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT materialCount)
+FrameResource::FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT materialCount,
+    UINT clusterLightCount, UINT clusterCount, UINT clusterIndexCount)
 {
     ThrowIfFailed(device->CreateCommandAllocator(
         D3D12_COMMAND_LIST_TYPE_DIRECT,
@@ -10,6 +11,10 @@ FrameResource::FrameResource(ID3D12Device* device, UINT passCount, UINT objectCo
     PassCB = std::make_unique<UploadBuffer<PassConstants>>(device, passCount, true);
     MaterialCB = std::make_unique<UploadBuffer<MaterialConstants>>(device, materialCount, true);
     ObjectCB = std::make_unique<UploadBuffer<ObjectConstants>>(device, objectCount, true);
+
+    ClusterLights = std::make_unique<UploadBuffer<ClusterLight>>(device, std::max(clusterLightCount, 1u), false);
+    ClusterRanges = std::make_unique<UploadBuffer<ClusterRange>>(device, std::max(clusterCount, 1u), false);
+    ClusterIndices = std::make_unique<UploadBuffer<UINT>>(device, std::max(clusterIndexCount, 1u), false);
 }
 FrameResource::~FrameResource()
 {
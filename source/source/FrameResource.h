@@ -3,12 +3,10 @@
 #include "../../Common/d3dUtil.h"
 #include "../../Common/MathHelper.h"
 #include "../../Common/UploadBuffer.h"
-
-struct ObjectConstants
-{
-    DirectX::XMFLOAT4X4 World = MathHelper::Identity4x4();
-    DirectX::XMFLOAT4X4 TexTransform = MathHelper::Identity4x4();
-};
+#include "../../Common/FrameArena.h"
+#include "LightClusters.h"
+#include "Mesh.h"
+#include "ObjectConstants.h"
 
 struct PassConstants
 {
@@ -29,6 +27,16 @@ struct PassConstants
 
     DirectX::XMFLOAT4 AmbientLight = { 0.0f, 0.0f, 0.0f, 1.0f };
 
+    // Used by the FOG shader permutation.
+    DirectX::XMFLOAT4 FogColor = { 0.7f, 0.7f, 0.7f, 1.0f };
+    float FogStart = 5.0f;
+    float FogRange = 150.0f;
+    DirectX::XMFLOAT2 cbPerObjectPad2;
+
+    // Used by the CLUSTERED_LIGHTS permutation, see LightClusterBuilder::ShaderParams.
+    DirectX::XMUINT4 ClusterDims = { 1, 1, 1, 0 };
+    DirectX::XMFLOAT4 ClusterParams = { 0.0f, 0.0f, 0.0f, 0.0f };
+
     // Indices [0, NUM_DIR_LIGHTS) are directional lights;
     // indices [NUM_DIR_LIGHTS, NUM_DIR_LIGHTS+NUM_POINT_LIGHTS) are point lights;
     // indices [NUM_DIR_LIGHTS+NUM_POINT_LIGHTS, NUM_DIR_LIGHTS+NUM_POINT_LIGHT+NUM_SPOT_LIGHTS)
@@ -36,26 +44,14 @@ struct PassConstants
     Light Lights[MaxLights];
 };
 
-
-struct Vertex
-{
-    DirectX::XMFLOAT3 Pos;
-    DirectX::XMFLOAT3 Normal;
-    DirectX::XMFLOAT2 TexC;
-};
-
-struct Mesh {
-    std::vector<Vertex> vertices;
-    std::vector<uint16_t> indices;
-};
-
 // Stores the resources needed for the CPU to build the command lists
 // for a frame.  
 struct FrameResource
 {
 public:
 
-    FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT materialCount);
+    FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT materialCount,
+        UINT clusterLightCount, UINT clusterCount, UINT clusterIndexCount);
     FrameResource(const FrameResource& rhs) = delete;
     FrameResource& operator=(const FrameResource& rhs) = delete;
     ~FrameResource();
@@ -70,6 +66,16 @@ public:
     std::unique_ptr<UploadBuffer<ObjectConstants>> ObjectCB = nullptr;
     std::unique_ptr<UploadBuffer<MaterialConstants>> MaterialCB = nullptr;
 
+    // Point and spot lights and their froxel lists, read by the pixel shader
+    // as structured buffers.
+    std::unique_ptr<UploadBuffer<ClusterLight>> ClusterLights = nullptr;
+    std::unique_ptr<UploadBuffer<ClusterRange>> ClusterRanges = nullptr;
+    std::unique_ptr<UploadBuffer<UINT>> ClusterIndices = nullptr;
+
+    // CPU scratch of the frame, like the culled draw list.  Reset when the
+    // frame resource is handed out again, so it can be used until then.
+    FrameArena Arena;
+
     // Fence value to mark commands up to this fence point.  This lets us
     // check if these frame resources are still in use by the GPU.
     UINT64 Fence = 0;
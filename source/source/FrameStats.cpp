@@ -0,0 +1,262 @@
+#include "FrameStats.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    // Frame times are bucketed in whole microseconds up to about 71 minutes.
+    const uint64_t MaxMicros = 0xFFFFFFFFull;
+
+    // Calls f(name, per frame value) for every counter, in file column order.
+    template <typename F>
+    void ForEachCounter(const FrameCounters& c, double frames, F f)
+    {
+        f("draws", c.Draws / frames);
+        f("triangles", c.Triangles / frames);
+        f("state_changes", c.StateChanges / frames);
+        f("pipeline_changes", c.PipelineChanges / frames);
+        f("cb_bytes", c.ConstantBufferBytes / frames);
+        f("cell_culled", c.CellCulled / frames);
+        f("distance_culled", c.DistanceCulled / frames);
+        f("size_culled", c.SizeCulled / frames);
+        f("frustum_culled", c.FrustumCulled / frames);
+        f("occluded", c.Occluded / frames);
+        f("budget_culled", c.BudgetCulled / frames);
+        f("submeshes_culled", c.SubmeshesCulled / frames);
+        f("fence_wait_ms", c.FenceWaitMilliseconds / frames);
+    }
+}
+
+FrameTimeHistogram::FrameTimeHistogram()
+{
+    mBuckets.assign(BucketOf(MaxMicros) + 1, 0);
+}
+
+uint32_t FrameTimeHistogram::BucketOf(uint64_t micros)
+{
+    if (micros < SubBuckets)
+        return (uint32_t)micros;
+
+    // Keep the top bits, SubBuckets to 2 * SubBuckets - 1, and count the shift.
+    uint32_t shift = 0;
+    while ((micros >> shift) >= 2 * SubBuckets)
+        ++shift;
+    return shift * SubBuckets + (uint32_t)(micros >> shift);
+}
+
+uint64_t FrameTimeHistogram::BucketValue(uint32_t bucket)
+{
+    if (bucket < 2 * SubBuckets)
+        return bucket;
+
+    // Middle of the range of times the bucket holds.
+    const uint32_t shift = bucket / SubBuckets - 1;
+    const uint64_t low = (uint64_t)(bucket % SubBuckets + SubBuckets) << shift;
+    return low + ((uint64_t(1) << shift) >> 1);
+}
+
+void FrameTimeHistogram::Record(float milliseconds)
+{
+    milliseconds = std::max(milliseconds, 0.0f);
+    const uint64_t micros = std::min((uint64_t)std::llround(milliseconds * 1000.0), MaxMicros);
+    mBuckets[BucketOf(micros)]++;
+
+    mMin = mCount == 0 ? milliseconds : std::min(mMin, milliseconds);
+    mMax = mCount == 0 ? milliseconds : std::max(mMax, milliseconds);
+    mSumMilliseconds += milliseconds;
+    mCount++;
+}
+
+void FrameTimeHistogram::Merge(const FrameTimeHistogram& other)
+{
+    if (other.mCount == 0)
+        return;
+
+    for (size_t i = 0; i < mBuckets.size(); ++i)
+        mBuckets[i] += other.mBuckets[i];
+
+    mMin = mCount == 0 ? other.mMin : std::min(mMin, other.mMin);
+    mMax = mCount == 0 ? other.mMax : std::max(mMax, other.mMax);
+    mSumMilliseconds += other.mSumMilliseconds;
+    mCount += other.mCount;
+}
+
+void FrameTimeHistogram::Reset()
+{
+    std::fill(mBuckets.begin(), mBuckets.end(), 0);
+    mCount = 0;
+    mSumMilliseconds = 0.0;
+    mMin = 0.0f;
+    mMax = 0.0f;
+}
+
+uint64_t FrameTimeHistogram::Count()const
+{
+    return mCount;
+}
+
+float FrameTimeHistogram::Percentile(float p)const
+{
+    if (mCount == 0)
+        return 0.0f;
+
+    p = std::min(std::max(p, 0.0f), 100.0f);
+    // Shaved a little, as a float like 99.9 is slightly above the percentile it stands for.
+    const uint64_t rank = std::max<uint64_t>(1, (uint64_t)std::ceil(p / 100.0 * mCount * (1.0 - 1.0e-6)));
+
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < (uint32_t)mBuckets.size(); ++i)
+    {
+        seen += mBuckets[i];
+        if (seen >= rank)
+        {
+            // The extremes are known exactly.
+            const float ms = BucketValue(i) / 1000.0f;
+            return std::min(std::max(ms, mMin), mMax);
+        }
+    }
+    return mMax;
+}
+
+float FrameTimeHistogram::Min()const
+{
+    return mMin;
+}
+
+float FrameTimeHistogram::Max()const
+{
+    return mMax;
+}
+
+float FrameTimeHistogram::Mean()const
+{
+    return mCount == 0 ? 0.0f : (float)(mSumMilliseconds / mCount);
+}
+
+void FrameStats::AddFrame(float frameMilliseconds, const FrameCounters& counters)
+{
+    mLast = counters;
+
+    mWindowTotals.Draws += counters.Draws;
+    mWindowTotals.Triangles += counters.Triangles;
+    mWindowTotals.StateChanges += counters.StateChanges;
+    mWindowTotals.PipelineChanges += counters.PipelineChanges;
+    mWindowTotals.ConstantBufferBytes += counters.ConstantBufferBytes;
+    mWindowTotals.CellCulled += counters.CellCulled;
+    mWindowTotals.DistanceCulled += counters.DistanceCulled;
+    mWindowTotals.SizeCulled += counters.SizeCulled;
+    mWindowTotals.FrustumCulled += counters.FrustumCulled;
+    mWindowTotals.Occluded += counters.Occluded;
+    mWindowTotals.BudgetCulled += counters.BudgetCulled;
+    mWindowTotals.SubmeshesCulled += counters.SubmeshesCulled;
+    mWindowTotals.FenceWaitMilliseconds += counters.FenceWaitMilliseconds;
+    mWindowFrames++;
+
+    mWindow.Record(frameMilliseconds);
+    mSession.Record(frameMilliseconds);
+    mWindowMilliseconds += frameMilliseconds;
+    mSessionMilliseconds += frameMilliseconds;
+
+    if (mDump.is_open() && mWindowMilliseconds >= mIntervalSeconds * 1000.0)
+    {
+        Dump();
+        ResetWindow();
+    }
+}
+
+const FrameCounters& FrameStats::LastFrame()const
+{
+    return mLast;
+}
+
+const FrameTimeHistogram& FrameStats::Window()const
+{
+    return mWindow;
+}
+
+const FrameCounters& FrameStats::WindowTotals()const
+{
+    return mWindowTotals;
+}
+
+uint64_t FrameStats::WindowFrames()const
+{
+    return mWindowFrames;
+}
+
+const FrameTimeHistogram& FrameStats::Session()const
+{
+    return mSession;
+}
+
+void FrameStats::Reset()
+{
+    ResetWindow();
+    mSession.Reset();
+    mSessionMilliseconds = 0.0;
+}
+
+void FrameStats::ResetWindow()
+{
+    mWindowTotals = FrameCounters();
+    mWindowFrames = 0;
+    mWindowMilliseconds = 0.0;
+    mWindow.Reset();
+}
+
+bool FrameStats::SetDumpFile(const std::string& file, FrameStatsFormat format, float intervalSeconds)
+{
+    if (mDump.is_open())
+        mDump.close();
+    mFormat = format;
+    mIntervalSeconds = intervalSeconds;
+    if (file.empty())
+        return true;
+
+    // Appending keeps the runs of several builds in one file; the CSV header
+    // is only written into an empty one.
+    bool empty;
+    {
+        std::ifstream existing(file, std::ios::binary | std::ios::ate);
+        empty = !existing || existing.tellg() <= 0;
+    }
+
+    mDump.open(file, std::ios::app);
+    if (!mDump)
+        return false;
+
+    if (format == FrameStatsFormat::Csv && empty)
+    {
+        mDump << "time_s,frames,mean_ms,p50_ms,p95_ms,p99_ms,max_ms";
+        ForEachCounter(FrameCounters(), 1.0, [this](const char* name, double) { mDump << ',' << name; });
+        mDump << '\n';
+    }
+    ResetWindow();
+    return true;
+}
+
+void FrameStats::Dump()
+{
+    const double frames = (double)std::max<uint64_t>(mWindowFrames, 1);
+    const double time = mSessionMilliseconds / 1000.0;
+
+    if (mFormat == FrameStatsFormat::Csv)
+    {
+        mDump << time << ',' << mWindowFrames << ',' << mWindow.Mean() << ',' << mWindow.Percentile(50.0f) << ','
+            << mWindow.Percentile(95.0f) << ',' << mWindow.Percentile(99.0f) << ',' << mWindow.Max();
+        ForEachCounter(mWindowTotals, frames, [this](const char*, double value) { mDump << ',' << value; });
+    }
+    else
+    {
+        mDump << "{\"time_s\":" << time << ",\"frames\":" << mWindowFrames << ",\"mean_ms\":" << mWindow.Mean()
+            << ",\"p50_ms\":" << mWindow.Percentile(50.0f) << ",\"p95_ms\":" << mWindow.Percentile(95.0f)
+            << ",\"p99_ms\":" << mWindow.Percentile(99.0f) << ",\"max_ms\":" << mWindow.Max();
+        ForEachCounter(mWindowTotals, frames, [this](const char* name, double value)
+        {
+            mDump << ",\"" << name << "\":" << value;
+        });
+        mDump << '}';
+    }
+    mDump << '\n';
+    mDump.flush();
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// What the engine did in one frame.  Culled objects count once, under the
+// first stage that rejected them.
+struct FrameCounters
+{
+    uint64_t Draws = 0;
+    uint64_t Triangles = 0;
+    // Pipeline switches, buffer and root parameter bindings.
+    uint64_t StateChanges = 0;
+    uint64_t PipelineChanges = 0;
+    // Object, material and pass constants written to the upload heaps.
+    uint64_t ConstantBufferBytes = 0;
+
+    uint64_t CellCulled = 0;
+    uint64_t DistanceCulled = 0;
+    uint64_t SizeCulled = 0;
+    uint64_t FrustumCulled = 0;
+    uint64_t Occluded = 0;
+    uint64_t BudgetCulled = 0;
+    // Submeshes of drawn objects outside the frustum.
+    uint64_t SubmeshesCulled = 0;
+
+    // CPU time blocked until a frame resource came back from the GPU.
+    float FenceWaitMilliseconds = 0.0f;
+};
+
+// Frame times in a log-linear histogram, HdrHistogram style: exact below
+// SubBuckets microseconds, then SubBuckets buckets per power of two, so any
+// percentile is within 1% of the true frame time, from 1 us to over an hour,
+// in a fixed 27 KB.
+class FrameTimeHistogram
+{
+public:
+    static const uint32_t SubBuckets = 128;
+
+    FrameTimeHistogram();
+
+    void Record(float milliseconds);
+    void Merge(const FrameTimeHistogram& other);
+    void Reset();
+
+    uint64_t Count()const;
+    // Smallest time at least p percent of the frames took no longer than; 0 when empty.
+    float Percentile(float p)const;
+    float Min()const;
+    float Max()const;
+    float Mean()const;
+
+private:
+    static uint32_t BucketOf(uint64_t micros);
+    static uint64_t BucketValue(uint32_t bucket);
+
+    std::vector<uint64_t> mBuckets;
+    uint64_t mCount = 0;
+    double mSumMilliseconds = 0.0;
+    float mMin = 0.0f;
+    float mMax = 0.0f;
+};
+
+enum class FrameStatsFormat
+{
+    Csv,
+    // One JSON object per line.
+    Json
+};
+
+// Collects a histogram of frame times and the engine's counters every frame.
+// Game code can query the current window or the whole session, and the
+// window can be appended to a file every interval for dashboards that track
+// tail latency across builds.
+class FrameStats
+{
+public:
+    // Counters of each frame are summed until the window closes.
+    void AddFrame(float frameMilliseconds, const FrameCounters& counters);
+
+    const FrameCounters& LastFrame()const;
+    // Since the last dump, or since the start without one.
+    const FrameTimeHistogram& Window()const;
+    const FrameCounters& WindowTotals()const;
+    uint64_t WindowFrames()const;
+    // Since the start or the last Reset.
+    const FrameTimeHistogram& Session()const;
+    void Reset();
+
+    // Appends the window to file and starts a new one every intervalSeconds
+    // of frame time.  An empty file name stops dumping.  False if the file
+    // can't be opened.
+    bool SetDumpFile(const std::string& file, FrameStatsFormat format, float intervalSeconds = 1.0f);
+
+private:
+    void Dump();
+    void ResetWindow();
+
+    FrameCounters mLast;
+    FrameCounters mWindowTotals;
+    uint64_t mWindowFrames = 0;
+    double mWindowMilliseconds = 0.0;
+    double mSessionMilliseconds = 0.0;
+    FrameTimeHistogram mWindow;
+    FrameTimeHistogram mSession;
+
+    std::ofstream mDump;
+    FrameStatsFormat mFormat = FrameStatsFormat::Csv;
+    float mIntervalSeconds = 1.0f;
+};
@@ -1,37 +1,46 @@
 //game engine core
 #include "Game_engine_core.h"
+#include "../../Common/Hash.h"
 
-const int gNumFrameResources = 3;
+int gNumFrameResources = 3;
 
-Game_engine::Game_engine(HINSTANCE hInstance)
-    : D3DApp(hInstance)
+Game_engine::Game_engine(HINSTANCE hInstance, bool headless)
+    : D3DApp(hInstance, headless), mPermutations(&mShaderCache), mLights(MaxClusterLights), mPipelines(&mPipelineLibrary)
 {
+    PROFILE_THREAD("Main");
     if (!D3DApp::Initialize())
         abort();
 
     // Reset the command list to prep for initialization commands.
     ThrowIfFailed(mCommandList->Reset(mDirectCmdListAlloc.Get(), nullptr));
 
-    mCbvSrvDescriptorSize = md3dDevice->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
-
+    mPacerQueue = std::make_unique<D3D12PacerQueue>(mCommandQueue.Get(), mFence.Get(), &mCurrentFence);
+    mPacer = std::make_unique<FramePacer>(mPacerQueue.get(), &mLatencyWaiter, gNumFrameResources);
 }
 
 Game_engine::~Game_engine()
 {
+    mTrace.Close();
     if (md3dDevice != nullptr)
         FlushCommandQueue();
+
+    // Variants compiled this run are kept for the next launch.
+    mPipelines.WaitIdle();
+    mPipelineLibrary.Save();
 }
 
 bool Game_engine::Initialize()
 {
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::Initialize);
 
-    D3D12_DESCRIPTOR_HEAP_DESC srvHeapDesc = {};
-    srvHeapDesc.NumDescriptors = 3;
-    srvHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
-    srvHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
-    ThrowIfFailed(md3dDevice->CreateDescriptorHeap(&srvHeapDesc, IID_PPV_ARGS(&mSrvDescriptorHeap)));
+    // Tier 1 hardware can only bind 128 SRVs to a stage; above that the
+    // table is sized for a bindless scene and never has to be rebuilt.
+    D3D12_FEATURE_DATA_D3D12_OPTIONS options = {};
+    ThrowIfFailed(md3dDevice->CheckFeatureSupport(D3D12_FEATURE_D3D12_OPTIONS, &options, sizeof(options)));
+    mTextureTableSize = options.ResourceBindingTier == D3D12_RESOURCE_BINDING_TIER_1 ? 128 : 4096;
+    mTextureSrvs.Initialize(md3dDevice.Get(), mTextureTableSize);
 
-    hDescriptor = mSrvDescriptorHeap->GetCPUDescriptorHandleForHeapStart();
     BuildRootSignature();
     BuildShadersAndInputLayout();
 
@@ -49,28 +58,49 @@ void Game_engine::OnResize()
 
 void Game_engine::Update(const GameTimer& gt)
 {
-
-    OnKeyboardInput(gt);
-    // Cycle through the circular frame resource array.
-    mCurrFrameResourceIndex = (mCurrFrameResourceIndex + 1) % gNumFrameResources;
+    PROFILE_FUNCTION();
+    // Cycle through the circular frame resource array.  The pacer waits for
+    // the swap chain and for the GPU to finish with the frame resource, so
+    // input is read as late as possible.
+    {
+        PROFILE_ZONE("Wait for frame");
+        mCurrFrameResourceIndex = mPacer->BeginFrame();
+    }
     mCurrFrameResource = mFrameResources[mCurrFrameResourceIndex].get();
+    mFrameCounters = FrameCounters();
+
+    // The GPU is done with the frame resource, so is everything that pointed
+    // into the frame's scratch.
+    mCurrFrameResource->Arena.Reset();
+    mFrameHeapAllocations = ThreadHeapAllocations();
+    ReleaseRetiredTextureSrvs();
 
-    // Has the GPU finished processing the commands of the current frame resource?
-    // If not, wait until the GPU has completed commands up to this fence point.
-    if (mCurrFrameResource->Fence != 0 && mFence->GetCompletedValue() < mCurrFrameResource->Fence)
+    // A replay has already set the camera and wireframe state it recorded.
+    if (mReplaying)
+        mCam.UpdateViewMatrix();
+    else
+        OnKeyboardInput(gt);
+    if (mTrace.IsOpen())
     {
-        HANDLE eventHandle = CreateEventEx(nullptr, false, false, EVENT_ALL_ACCESS);
-        ThrowIfFailed(mFence->SetEventOnCompletion(mCurrFrameResource->Fence, eventHandle));
-        WaitForSingleObject(eventHandle, INFINITE);
-        CloseHandle(eventHandle);
+        mTrace.Call(ApiCall::Update).Pod(gt.TotalTime()).Pod(gt.DeltaTime()).Pod(mIsWireframe)
+            .Pod(mCam.GetPosition3f()).Pod(mCam.GetLook3f()).Pod(mCam.GetUp3f());
     }
+
     UpdateMaterialCBs(gt);
     UpdateObjectCBs(gt);
+    UpdateLightClusters();
+    UpdateVisibleCells();
+    UpdateShadowCascades();
+    UpdateOcclusion();
     UpdateMainPassCB(gt);
 }
 
 void Game_engine::Draw(const GameTimer& gt)
 {
+    PROFILE_FUNCTION();
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::Draw);
+
     auto cmdListAlloc = mCurrFrameResource->CmdListAlloc;
 
     // Reuse the memory associated with command recording.
@@ -79,14 +109,7 @@ void Game_engine::Draw(const GameTimer& gt)
 
     // A command list can be reset after it has been added to the command queue via ExecuteCommandList.
     // Reusing the command list reuses memory.
-    if (mIsWireframe)
-    {
-        ThrowIfFailed(mCommandList->Reset(cmdListAlloc.Get(), mPSOs["opaque_wireframe"].Get()));
-    }
-    else
-    {
-        ThrowIfFailed(mCommandList->Reset(cmdListAlloc.Get(), mPSOs["opaque"].Get()));
-    }
+    ThrowIfFailed(mCommandList->Reset(cmdListAlloc.Get(), GetBasePSO()));
 
     mCommandList->RSSetViewports(1, &mScreenViewport);
     mCommandList->RSSetScissorRects(1, &mScissorRect);
@@ -102,13 +125,20 @@ void Game_engine::Draw(const GameTimer& gt)
     // Specify the buffers we are going to render to.
     mCommandList->OMSetRenderTargets(1, &CurrentBackBufferView(), true, &DepthStencilView());
 
-    ID3D12DescriptorHeap* descriptorHeaps[] = { mSrvDescriptorHeap.Get() };
+    ID3D12DescriptorHeap* descriptorHeaps[] = { mTextureSrvs.Heap() };
     mCommandList->SetDescriptorHeaps(_countof(descriptorHeaps), descriptorHeaps);
 
     mCommandList->SetGraphicsRootSignature(mRootSignature.Get());
 
+    // The whole texture table is bound once; materials pick their slot.
+    mCommandList->SetGraphicsRootDescriptorTable(0, mTextureSrvs.TableStart());
+
     mCommandList->SetGraphicsRootConstantBufferView(2, mCurrFrameResource->PassCB->Resource()->GetGPUVirtualAddress());
 
+    mCommandList->SetGraphicsRootShaderResourceView(4, mCurrFrameResource->ClusterLights->Resource()->GetGPUVirtualAddress());
+    mCommandList->SetGraphicsRootShaderResourceView(5, mCurrFrameResource->ClusterRanges->Resource()->GetGPUVirtualAddress());
+    mCommandList->SetGraphicsRootShaderResourceView(6, mCurrFrameResource->ClusterIndices->Resource()->GetGPUVirtualAddress());
+
     DrawRenderItems(mCommandList.Get(), mOpaqueRitems);
 
     // Indicate a state transition on the resource usage.
@@ -123,16 +153,30 @@ void Game_engine::Draw(const GameTimer& gt)
     mCommandQueue->ExecuteCommandLists(_countof(cmdsLists), cmdsLists);
 
     // Swap the back and front buffers
-    ThrowIfFailed(mSwapChain->Present(0, 0));
+    if (!mHeadless)
+    {
+        PROFILE_ZONE("Present");
+        ThrowIfFailed(mSwapChain->Present(0, 0));
+    }
     mCurrBackBuffer = (mCurrBackBuffer + 1) % SwapChainBufferCount;
 
-    // Advance the fence value to mark commands up to this fence point.
-    mCurrFrameResource->Fence = ++mCurrentFence;
+    // Mark commands up to this fence point; the pacer waits on it before
+    // handing this frame resource out again.
+    mCurrFrameResource->Fence = mPacer->EndFrame();
+
+#if defined(_DEBUG)
+    if (ThreadHeapAllocations() == mFrameHeapAllocations)
+        mAllocatingFrames = 0;
+    else
+        ++mAllocatingFrames;
+    assert(mAllocatingFrames < SteadyStateFrames && "every recent frame allocated from the heap");
+#endif
 
-    // Add an instruction to the command queue to set a new fence point. 
-    // Because we are on the GPU timeline, the new fence point won't be 
-    // set until the GPU finishes processing all the commands prior to this Signal().
-    mCommandQueue->Signal(mFence.Get(), mCurrentFence);
+    mFrameCounters.FenceWaitMilliseconds = mPacer->Stats().FenceWaitMilliseconds;
+    mFrameStats.AddFrame(gt.DeltaTime() * 1000.0f, mFrameCounters);
+
+    // Games drive Update and Draw from their own loop, so the frame ends here.
+    PROFILE_FRAME();
 }
 
 void Game_engine::OnMouseDown(WPARAM btnState, int x, int y)
@@ -200,13 +244,18 @@ bool Game_engine::IsKeyPresed(char key) {
 }
 /*
 * comming soon (maybe)
-void Game_engine::RotateObject(std::string name, XMMATRIX rotation)
+void Game_engine::RotateObject(const std::string& name, XMMATRIX rotation)
 {
     XMStoreFloat4x4(&mOpaqueRitems[names[name]]->World, rotation);
 }*/
 
 void Game_engine::CreateMaterial(std::string name, XMFLOAT4 difuse_albedo, XMFLOAT3 FresnelR0, float Roughnes, std::string tex_name, XMFLOAT3 MatTransform)
 {
+    if (mTrace.IsOpen())
+    {
+        mTrace.Call(ApiCall::CreateMaterial).String(name).Pod(difuse_albedo).Pod(FresnelR0)
+            .Pod(Roughnes).String(tex_name).Pod(MatTransform);
+    }
     auto mat = std::make_unique<Material>();
     mat->Name = name;
     mat->DiffuseAlbedo = difuse_albedo;
@@ -214,33 +263,73 @@ void Game_engine::CreateMaterial(std::string name, XMFLOAT4 difuse_albedo, XMFLO
     mat->Roughness = Roughnes;
     XMStoreFloat4x4(&mat->MatTransform, XMMatrixScaling(MatTransform.x, MatTransform.y, MatTransform.z));
     mat->MatCBIndex = mat_CBI_index;
-    mat->DiffuseSrvHeapIndex = mat_CBI_index;
-    mat->NormalSrvHeapIndex = mat_CBI_index;
+    // Materials sharing a texture share its SRV.
+    mat->DiffuseSrvHeapIndex = mTextureSrvs.Acquire(mTextures[tex_name]->Resource.Get());
+    mat->NormalSrvHeapIndex = mat->DiffuseSrvHeapIndex;
     ++mat_CBI_index;
     mMaterials[name] = std::move(mat);
-
-    auto tex = mTextures[tex_name]->Resource;
-
-    D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
-    srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-    srvDesc.Format = tex->GetDesc().Format;
-    srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
-    srvDesc.Texture2D.MostDetailedMip = 0;
-    srvDesc.Texture2D.MipLevels = tex->GetDesc().MipLevels;
-    srvDesc.Texture2D.ResourceMinLODClamp = 0.0f;
-    md3dDevice->CreateShaderResourceView(tex.Get(), &srvDesc, hDescriptor);
-
-    hDescriptor.Offset(1, mCbvSrvDescriptorSize);
 }
 
 void Game_engine::UpdateMaterial(std::string name, XMFLOAT4 difuse_albedo, XMFLOAT3 FresnelR0, float Roughnes, XMFLOAT3 MatTransform)
 {
+    if (mTrace.IsOpen())
+    {
+        mTrace.Call(ApiCall::UpdateMaterial).String(name).Pod(difuse_albedo).Pod(FresnelR0)
+            .Pod(Roughnes).Pod(MatTransform);
+    }
     mMaterials[name]->DiffuseAlbedo = difuse_albedo;
     mMaterials[name]->FresnelR0 = FresnelR0;
     mMaterials[name]->Roughness = Roughnes;
     XMStoreFloat4x4(&mMaterials[name]->MatTransform, XMMatrixScaling(MatTransform.x, MatTransform.y, MatTransform.z));
 }
 
+void Game_engine::SetMaterialNormalMap(std::string name, std::string tex_name)
+{
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::SetMaterialNormalMap).String(name).String(tex_name);
+    Material* mat = mMaterials[name].get();
+    // Acquire first, so setting the same map again keeps its slot alive.
+    const UINT slot = mTextureSrvs.Acquire(mTextures[tex_name]->Resource.Get());
+    if (mat->Features & ShaderFeatureNormalMap)
+        RetireTextureSrv(mat->NormalSrvHeapIndex);
+    mat->NormalSrvHeapIndex = slot;
+    mat->Features |= ShaderFeatureNormalMap;
+    mat->NumFramesDirty = gNumFrameResources;
+}
+
+void Game_engine::RetireTextureSrv(UINT slot)
+{
+    // Submitted frames, and the one being recorded, may still sample the slot
+    // through their material constants.
+    RetiredTextureSrv retired;
+    retired.Resource = mTextureSrvs.ResourceAt(slot);
+    retired.Fence = mCurrentFence + 1;
+    mRetiredTextureSrvs.push_back(retired);
+}
+
+void Game_engine::ReleaseRetiredTextureSrvs()
+{
+    if (mRetiredTextureSrvs.empty())
+        return;
+    const UINT64 completed = mFence->GetCompletedValue();
+    auto done = std::partition(mRetiredTextureSrvs.begin(), mRetiredTextureSrvs.end(),
+        [completed](const RetiredTextureSrv& r) { return r.Fence > completed; });
+    for (auto it = done; it != mRetiredTextureSrvs.end(); ++it)
+        mTextureSrvs.Release(it->Resource);
+    mRetiredTextureSrvs.erase(done, mRetiredTextureSrvs.end());
+}
+
+void Game_engine::SetMaterialAlphaTest(std::string name, bool enabled)
+{
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::SetMaterialAlphaTest).String(name).Pod(enabled);
+    Material* mat = mMaterials[name].get();
+    if (enabled)
+        mat->Features |= ShaderFeatureAlphaTest;
+    else
+        mat->Features &= ~ShaderFeatureAlphaTest;
+}
+
 std::vector<XMFLOAT3> Game_engine::GetVertices(std::string name)
 {
     return verts[name];
@@ -248,40 +337,310 @@ std::vector<XMFLOAT3> Game_engine::GetVertices(std::string name)
 
 void Game_engine::LoadTexture(std::wstring filepath, std::string name)
 {
-    auto tex = std::make_unique<Texture>();
-    tex->Name = name;
-    tex->Filename = filepath;
-    ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-        mCommandList.Get(), tex->Filename.c_str(),
-        tex->Resource, tex->UploadHeap));
-    mTextures[name] = std::move(tex);
+    PROFILE_FUNCTION();
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::LoadTexture).WString(filepath).String(name);
+    // Loading the same file again, under any name, shares the first resource.
+    auto tex = mAssets.LoadTexture(filepath, [&](const uint8_t* data, size_t size, Texture& t)
+    {
+        t.Name = name;
+        return DirectX::CreateDDSTextureFromMemory12(md3dDevice.Get(),
+            mCommandList.Get(), data, size,
+            t.Resource, t.UploadHeap);
+    });
+    mTextures[name] = tex;
     tex_names.push_back(name);
 }
 
+AssetCache& Game_engine::GetAssetCache()
+{
+    return mAssets;
+}
+
 //Light
 void Game_engine::SetLight(DirectX::XMFLOAT3 pos_dir, DirectX::XMFLOAT3 strength)
 {
-    set_light(pos_dir, strength);
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::SetLight).Pod(pos_dir).Pod(strength);
+    LightDesc desc;
+    desc.Type = LightDirectional;
+    desc.Direction = pos_dir;
+    desc.Strength = strength;
+    mLights.Create(desc);
 }
 
 void Game_engine::SetAmbient(DirectX::XMFLOAT4 amb)
 {
-    set_ambient(amb);
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::SetAmbient).Pod(amb);
+    mLights.SetAmbient(amb);
 }
 
 void Game_engine::EditLight(DirectX::XMFLOAT3 pos_dir, DirectX::XMFLOAT3 strength, unsigned int index)
 {
-    edit_light(pos_dir, strength, index);
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::EditLight).Pod(pos_dir).Pod(strength).Pod(index);
+    // index counts the directional lights made by SetLight.
+    LightHandle light = mLights.Directional(index);
+    const LightDesc* current = mLights.Get(light);
+    if (current == nullptr)
+        return;
+    LightDesc desc = *current;
+    desc.Direction = pos_dir;
+    desc.Strength = strength;
+    mLights.Update(light, desc);
 }
 
 void Game_engine::EditAmbient(DirectX::XMFLOAT4 amb)
 {
-    edit_ambient(amb);
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::EditAmbient).Pod(amb);
+    mLights.SetAmbient(amb);
+}
+
+LightHandle Game_engine::CreateLight(const LightDesc& desc)
+{
+    LightHandle light = mLights.Create(desc);
+    // The handle lets a replay map later calls onto the light it makes.
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::CreateLight).Pod(desc).Pod(light);
+    return light;
+}
+
+bool Game_engine::UpdateLight(LightHandle light, const LightDesc& desc)
+{
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::UpdateLight).Pod(light).Pod(desc);
+    return mLights.Update(light, desc);
+}
+
+bool Game_engine::DestroyLight(LightHandle light)
+{
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::DestroyLight).Pod(light);
+    return mLights.Destroy(light);
+}
+
+LightHandle Game_engine::AddPointLight(DirectX::XMFLOAT3 pos, DirectX::XMFLOAT3 strength, float falloffStart, float falloffEnd)
+{
+    LightDesc desc;
+    desc.Type = LightPoint;
+    desc.Position = pos;
+    desc.Strength = strength;
+    desc.FalloffStart = falloffStart;
+    desc.FalloffEnd = falloffEnd;
+    LightHandle light = mLights.Create(desc);
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::AddPointLight).Pod(pos).Pod(strength).Pod(falloffStart).Pod(falloffEnd).Pod(light);
+    return light;
+}
+
+LightHandle Game_engine::AddSpotLight(DirectX::XMFLOAT3 pos, DirectX::XMFLOAT3 dir, DirectX::XMFLOAT3 strength,
+    float falloffStart, float falloffEnd, float spotPower)
+{
+    LightDesc desc;
+    desc.Type = LightSpot;
+    desc.Position = pos;
+    desc.Direction = dir;
+    desc.Strength = strength;
+    desc.FalloffStart = falloffStart;
+    desc.FalloffEnd = falloffEnd;
+    desc.SpotPower = spotPower;
+    LightHandle light = mLights.Create(desc);
+    if (mTrace.IsOpen())
+    {
+        mTrace.Call(ApiCall::AddSpotLight).Pod(pos).Pod(dir).Pod(strength)
+            .Pod(falloffStart).Pod(falloffEnd).Pod(spotPower).Pod(light);
+    }
+    return light;
+}
+
+void Game_engine::ClearLocalLights()
+{
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::ClearLocalLights);
+    mLights.ClearLocal();
+}
+
+LightManager& Game_engine::GetLights()
+{
+    return mLights;
+}
+
+//Shadows
+void Game_engine::SetShadowSettings(const CascadeSettings& settings)
+{
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::SetShadowSettings).Pod(settings);
+    mShadows.SetSettings(settings);
+    // Empty until the next Update fills them for the new cascades.
+    mCascadeCasters.assign(mShadows.Count(), std::vector<RenderItem*>());
+}
+
+const ShadowCascades& Game_engine::GetShadowCascades()const
+{
+    return mShadows;
+}
+
+const std::vector<RenderItem*>& Game_engine::GetCascadeCasters(UINT cascade)const
+{
+    static const std::vector<RenderItem*> none;
+    return cascade < mCascadeCasters.size() ? mCascadeCasters[cascade] : none;
+}
+
+//Occlusion
+void Game_engine::SetOccluder(std::string name, OccluderShape shape)
+{
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::SetOccluder).String(name).Pod(shape);
+    mOpaqueRitems[names[name]]->Occluder = shape;
+}
+
+void Game_engine::EnableOcclusionCulling(bool enabled)
+{
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::EnableOcclusionCulling).Pod(enabled);
+    mOcclusionCulling = enabled;
+}
+
+const OcclusionStats& Game_engine::GetOcclusionStats()const
+{
+    return mOcclusion.Stats();
+}
+
+//Draw distance
+void Game_engine::SetDrawDistance(std::string name, float distance)
+{
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::SetDrawDistance).String(name).Pod(distance);
+    mOpaqueRitems[names[name]]->MaxDrawDistance = distance;
+}
+
+void Game_engine::SetDrawCategory(std::string name, UINT category)
+{
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::SetDrawCategory).String(name).Pod(category);
+    mOpaqueRitems[names[name]]->Category = std::min(category, MaxDrawCategories - 1);
+}
+
+void Game_engine::SetMinScreenSize(float pixels)
+{
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::SetMinScreenSize).Pod(pixels);
+    mMinScreenSize = pixels;
+}
+
+void Game_engine::SetCategoryBudget(UINT category, UINT maxDraws)
+{
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::SetCategoryBudget).Pod(category).Pod(maxDraws);
+    if (category < MaxDrawCategories)
+        mCategoryBudgets[category] = maxDraws;
+}
+
+const DrawCategoryStats& Game_engine::GetDrawStats(UINT category)const
+{
+    return mDrawStats[category];
+}
+
+//Cells and portals
+CellGraph& Game_engine::GetCellGraph()
+{
+    return mCells;
+}
+
+bool Game_engine::LoadCells(const std::string& file)
+{
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::LoadCells).String(file);
+    // GetCellGraph().Error() tells why loading failed.
+    if (!mCells.Load(file))
+        return false;
+    if (!mCells.HasPVS())
+        mCells.BakePVS();
+    return true;
+}
+
+UINT Game_engine::GetVisibleCellCount()const
+{
+    if (!mCellCulling)
+        return mCells.CellCount();
+    return (UINT)std::count(mVisibleCells.begin(), mVisibleCells.end(), 1);
+}
+
+//Frame pacing
+void Game_engine::SetFramesInFlight(UINT frames)
+{
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::SetFramesInFlight).Pod(frames);
+    mPacer->SetFramesInFlight(frames);
+    gNumFrameResources = (int)mPacer->FramesInFlight();
+    mCurrFrameResourceIndex = 0;
+    mCurrFrameResource = nullptr;
+    if (mFrameResources.empty())
+        return;
+
+    // New frame resources start out empty: everything is uploaded again.
+    // The draw list pointed into an old frame's arena.
+    mVisibleItems = ArenaVector<VisibleItem>();
+    mFrameResources.clear();
+    BuildFrameResources();
+    mObjectTexFramesDirty = gNumFrameResources;
+    for (auto& e : mMaterials)
+        e.second->NumFramesDirty = gNumFrameResources;
+    mLights.MarkAllDirty();
+}
+
+UINT Game_engine::GetFramesInFlight()const
+{
+    return mPacer->FramesInFlight();
+}
+
+const FramePacingStats& Game_engine::GetFramePacingStats()const
+{
+    return mPacer->Stats();
+}
+
+//Frame statistics
+FrameStats& Game_engine::GetFrameStats()
+{
+    return mFrameStats;
+}
+
+//Capture
+bool Game_engine::StartApiCapture(const std::string& file)
+{
+    return mTrace.Open(file);
+}
+
+void Game_engine::StopApiCapture()
+{
+    mTrace.Close();
+}
+
+//Fog
+void Game_engine::SetFog(DirectX::XMFLOAT4 color, float start, float range)
+{
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::SetFog).Pod(color).Pod(start).Pod(range);
+    mMainPassCB.FogColor = color;
+    mMainPassCB.FogStart = start;
+    mMainPassCB.FogRange = range;
+    mFogEnabled = true;
+}
+
+void Game_engine::DisableFog()
+{
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::DisableFog);
+    mFogEnabled = false;
 }
 
 //Camera
 void Game_engine::SetCameraPos(DirectX::XMFLOAT3 pos)
 {
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::SetCameraPos).Pod(pos);
     mCam.SetPosition(pos);
     mCam.UpdateViewMatrix();
 }
@@ -293,41 +652,61 @@ DirectX::XMFLOAT3 Game_engine::GetCameraPos()
 
 void Game_engine::CameraWalk(float d)
 {
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::CameraWalk).Pod(d);
     mCam.Walk(d);
     mCam.UpdateViewMatrix();
 }
 
 void Game_engine::CameraStrafe(float d)
 {
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::CameraStrafe).Pod(d);
     mCam.Strafe(d);
     mCam.UpdateViewMatrix();
 }
 
 void Game_engine::CameraPitch(float angle)
 {
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::CameraPitch).Pod(angle);
     mCam.Pitch(angle);
     mCam.UpdateViewMatrix();
 }
 
 void Game_engine::CameraRotateY(float angle)
 {
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::CameraRotateY).Pod(angle);
     mCam.RotateY(angle);
     mCam.UpdateViewMatrix();
 }
 
 void Game_engine::CameraLookAt(DirectX::FXMVECTOR pos, DirectX::FXMVECTOR target, DirectX::FXMVECTOR worldUp)
 {
+    if (mTrace.IsOpen())
+    {
+        XMFLOAT3 p, t, u;
+        XMStoreFloat3(&p, pos);
+        XMStoreFloat3(&t, target);
+        XMStoreFloat3(&u, worldUp);
+        mTrace.Call(ApiCall::CameraLookAtVectors).Pod(p).Pod(t).Pod(u);
+    }
     mCam.LookAt(pos, target, worldUp);
     mCam.UpdateViewMatrix();
 }
 
 void Game_engine::CameraLookAt(const DirectX::XMFLOAT3& pos, const DirectX::XMFLOAT3& target, const DirectX::XMFLOAT3& up)
 {
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::CameraLookAt).Pod(pos).Pod(target).Pod(up);
     mCam.LookAt(pos, target, up);
 }
 
 void Game_engine::CameraSetLens(float fovY, float aspect, float zn, float zf)
 {
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::CameraSetLens).Pod(fovY).Pod(aspect).Pod(zn).Pod(zf);
     mCam.SetLens(fovY, aspect, zn, zf);
 }
 
@@ -343,21 +722,70 @@ void Game_engine::UseBaseCamControl()
 
 void Game_engine::UpdateObjectCBs(const GameTimer& gt)
 {
+    PROFILE_FUNCTION();
     auto currObjectCB = mCurrFrameResource->ObjectCB.get();
-    for (auto& e : mAllRitems)
-    {      
-        ObjectConstants objConstants;
-        XMStoreFloat4x4(&objConstants.World, XMMatrixTranspose(XMLoadFloat4x4(&e->World)));
-        XMStoreFloat4x4(&objConstants.TexTransform, XMMatrixTranspose(XMLoadFloat4x4(&e->TexTransform)));
-        
-        currObjectCB->CopyData(e->ObjCBIndex, objConstants);           
-        
+    BYTE* mapped = currObjectCB->MappedData();
+    const UINT stride = currObjectCB->ElementByteSize();
+
+    const bool texDirty = mObjectTexFramesDirty > 0;
+    PackObjectTransformsBatch(mObjectTransforms.data(), mObjectTransforms.size(), texDirty, mapped, stride);
+    mFrameCounters.ConstantBufferBytes += mObjectTransforms.size() * sizeof(XMFLOAT4X4);
+    for (const ObjectWorldMatrix& e : mObjectWorlds)
+    {
+        ObjectConstants* objConstants = reinterpret_cast<ObjectConstants*>(mapped + e.ObjCBIndex * stride);
+        XMStoreFloat4x4(&objConstants->World, XMMatrixTranspose(XMLoadFloat4x4(&e.World)));
+    }
+    mFrameCounters.ConstantBufferBytes += mObjectWorlds.size() * sizeof(XMFLOAT4X4);
+    if (texDirty)
+    {
+        for (const ObjectTexTransform& e : mObjectTexTransforms)
+        {
+            ObjectConstants* objConstants = reinterpret_cast<ObjectConstants*>(mapped + e.ObjCBIndex * stride);
+            XMStoreFloat4x4(&objConstants->TexTransform, XMMatrixTranspose(XMLoadFloat4x4(&e.Transform)));
+        }
+        mFrameCounters.ConstantBufferBytes += mObjectTransforms.size() * sizeof(XMFLOAT4X4);
+
+        // Next FrameResource need to be updated too.
+        mObjectTexFramesDirty--;
+    }
+}
+
+void Game_engine::SetObjectWorld(UINT objCBIndex, FXMMATRIX world)
+{
+    int& slot = mObjectWorldSlots[objCBIndex];
+    if (DecomposeTransform(world, mObjectTransforms[objCBIndex]))
+    {
+        if (slot >= 0)
+        {
+            // Move the last full matrix into the hole.
+            mObjectWorlds[slot] = mObjectWorlds.back();
+            mObjectWorldSlots[mObjectWorlds[slot].ObjCBIndex] = slot;
+            mObjectWorlds.pop_back();
+            slot = -1;
+        }
+        return;
+    }
+
+    if (slot < 0)
+    {
+        slot = (int)mObjectWorlds.size();
+        mObjectWorlds.emplace_back();
+        mObjectWorlds[slot].ObjCBIndex = objCBIndex;
     }
+    XMStoreFloat4x4(&mObjectWorlds[slot].World, world);
 }
 
+XMMATRIX Game_engine::ObjectWorld(UINT objCBIndex)const
+{
+    const int slot = mObjectWorldSlots[objCBIndex];
+    if (slot >= 0)
+        return XMLoadFloat4x4(&mObjectWorlds[slot].World);
+    return ComposeTransform(mObjectTransforms[objCBIndex]);
+}
 
 void Game_engine::UpdateMainPassCB(const GameTimer& gt)
 {
+    PROFILE_FUNCTION();
     XMMATRIX view = mCam.GetView();
     XMMATRIX proj = mCam.GetProj();
 
@@ -380,13 +808,154 @@ void Game_engine::UpdateMainPassCB(const GameTimer& gt)
     mMainPassCB.TotalTime = gt.TotalTime();
     mMainPassCB.DeltaTime = gt.DeltaTime();
     
-    set_lights(&mMainPassCB);
+    // Only rewritten when a directional light or the ambient term changed.
+    mLights.PackPassLights(mMainPassCB);
 
     mCurrFrameResource->PassCB.get()->CopyData(0, mMainPassCB);
+    mFrameCounters.ConstantBufferBytes += sizeof(PassConstants);
+}
+
+void Game_engine::UpdateLightClusters()
+{
+    PROFILE_FUNCTION();
+    // The pass constants pick up the grid parameters in UpdateMainPassCB.
+    mLightClusters.SetProjection(mCam.GetFovY(), mCam.GetAspect(), mCam.GetNearZ(), mCam.GetFarZ());
+    const std::vector<ClusterLight>& lights = mLights.LocalLights();
+    mLightClusters.Build(mCam.GetView(), lights.data(), lights.size());
+    mLightClusters.ShaderParams(mClientWidth, mClientHeight, mMainPassCB.ClusterDims, mMainPassCB.ClusterParams);
+
+    mLights.UploadLocalLights(*mCurrFrameResource->ClusterLights);
+
+    // Both are structured buffers, tightly packed like the vectors, so each
+    // goes up in a single copy rather than one CopyData per element.
+    const std::vector<ClusterRange>& ranges = mLightClusters.Ranges();
+    auto rangeBuffer = mCurrFrameResource->ClusterRanges.get();
+    assert(rangeBuffer->ElementByteSize() == sizeof(ClusterRange));
+    memcpy(rangeBuffer->MappedData(), ranges.data(), ranges.size() * sizeof(ClusterRange));
+
+    const std::vector<UINT>& indices = mLightClusters.Indices();
+    auto indexBuffer = mCurrFrameResource->ClusterIndices.get();
+    assert(indexBuffer->ElementByteSize() == sizeof(UINT));
+    memcpy(indexBuffer->MappedData(), indices.data(), indices.size() * sizeof(UINT));
+}
+
+void Game_engine::UpdateShadowCascades()
+{
+    PROFILE_FUNCTION();
+    mCascadeCasters.resize(mShadows.Count());
+    for (auto& casters : mCascadeCasters)
+        casters.clear();
+
+    const LightDesc* sun = mLights.Get(mLights.Directional(0));
+    if (sun == nullptr)
+        return;
+    mShadows.Fit(mCam.GetView(), mCam.GetFovY(), mCam.GetAspect(), mCam.GetNearZ(), mCam.GetFarZ(), sun->Direction);
+
+    // World bounds of everything drawn; culled against all cascades at once.
+    mCasterBounds.clear();
+    mCasterItems.clear();
+    for (size_t i = 0; i < mOpaqueRitems.size(); ++i)
+    {
+        if (!visible_objects[i])
+            continue;
+        RenderItem* ri = mOpaqueRitems[i];
+        BoundingBox worldBounds;
+        ri->Bounds.Transform(worldBounds, ObjectWorld(ri->ObjCBIndex));
+        mCasterBounds.push_back(worldBounds);
+        mCasterItems.push_back(ri);
+    }
+    mShadows.CullCasters(mCasterBounds.data(), mCasterBounds.size());
+
+    for (UINT c = 0; c < mShadows.Count(); ++c)
+    {
+        for (uint32_t i : mShadows.Casters(c))
+            mCascadeCasters[c].push_back(mCasterItems[i]);
+    }
+}
+
+void Game_engine::UpdateVisibleCells()
+{
+    PROFILE_FUNCTION();
+    mCellCulling = false;
+    if (mCells.CellCount() == 0)
+        return;
+
+    XMMATRIX viewProj = XMMatrixMultiply(mCam.GetView(), mCam.GetProj());
+    mCellCulling = mCells.FindVisibleCells(mCam.GetPosition3f(), viewProj, mVisibleCells, &mCurrFrameResource->Arena.Local());
+}
+
+bool Game_engine::InVisibleCell(RenderItem* ri)
+{
+    if (!mCellCulling)
+        return true;
+
+    // Cell membership only changes when the item moves or the cells do.
+    if (ri->CellsMoved || ri->CellsVersion != mCells.Version())
+    {
+        BoundingBox worldBounds;
+        ri->Bounds.Transform(worldBounds, ObjectWorld(ri->ObjCBIndex));
+        mCells.CellsOverlapping(worldBounds, ri->Cells);
+        ri->CellsMoved = false;
+        ri->CellsVersion = mCells.Version();
+    }
+
+    // Outdoor objects belong to no cell and are always candidates.
+    if (ri->Cells.empty())
+        return true;
+    for (uint32_t cell : ri->Cells)
+    {
+        if (mVisibleCells[cell])
+            return true;
+    }
+    return false;
+}
+
+void Game_engine::UpdateOcclusion()
+{
+    PROFILE_FUNCTION();
+    XMMATRIX view = mCam.GetView();
+    mOcclusion.BeginFrame(XMMatrixMultiply(view, mCam.GetProj()));
+    if (!mOcclusionCulling)
+        return;
+
+    XMVECTOR det = XMMatrixDeterminant(view);
+    BoundingFrustum worldFrustum;
+    mCamFrustum.Transform(worldFrustum, XMMatrixInverse(&det, view));
+
+    for (size_t i = 0; i < mOpaqueRitems.size(); ++i)
+    {
+        RenderItem* ri = mOpaqueRitems[i];
+        if (!visible_objects[i] || ri->Occluder == OccluderNone || !InVisibleCell(ri))
+            continue;
+
+        XMMATRIX world = ObjectWorld(ri->ObjCBIndex);
+        BoundingBox worldBounds;
+        ri->Bounds.Transform(worldBounds, world);
+        if (worldFrustum.Contains(worldBounds) == DirectX::DISJOINT)
+            continue;
+
+        if (ri->Occluder == OccluderBounds || ri->Geo->VertexBufferCPU == nullptr || ri->Geo->IndexBufferCPU == nullptr)
+        {
+            mOcclusion.AddOccluderBox(ri->Bounds, world);
+            continue;
+        }
+
+        const BYTE* vertices = static_cast<const BYTE*>(ri->Geo->VertexBufferCPU->GetBufferPointer());
+        const std::uint16_t* indices = static_cast<const std::uint16_t*>(ri->Geo->IndexBufferCPU->GetBufferPointer());
+        for (const auto& sub : ri->Submeshes)
+        {
+            mOcclusion.AddOccluder(vertices + offsetof(Vertex, Pos), ri->Geo->VertexByteStride,
+                indices + sub.StartIndexLocation, sub.IndexCount, sub.BaseVertexLocation, world);
+        }
+    }
+
+    if (mOcclusion.Stats().Occluders > 0)
+        mOcclusion.Rasterize();
 }
 
 void Game_engine::UpdateMaterialCBs(const GameTimer& gt)
 {
+    PROFILE_FUNCTION();
     auto currMaterialCB = mCurrFrameResource->MaterialCB.get();
     for (auto& e : mMaterials)
     {
@@ -399,75 +968,45 @@ void Game_engine::UpdateMaterialCBs(const GameTimer& gt)
             matConstants.DiffuseAlbedo = mat->DiffuseAlbedo;
             matConstants.FresnelR0 = mat->FresnelR0;
             matConstants.Roughness = mat->Roughness;
+            matConstants.DiffuseMapIndex = mat->DiffuseSrvHeapIndex;
+            matConstants.NormalMapIndex = mat->NormalSrvHeapIndex;
 
             XMStoreFloat4x4(&matConstants.MatTransform, XMMatrixTranspose(XMLoadFloat4x4(&mat->MatTransform)));
 
             currMaterialCB->CopyData(mat->MatCBIndex, matConstants);
+            mFrameCounters.ConstantBufferBytes += sizeof(MaterialConstants);
 
             // Next FrameResource need to be updated too.
             mat->NumFramesDirty--;
         }
     }
 }
-/*
-void Game_engine::BuildDescriptorHeaps()
-{
-    //
-    // Create the SRV heap.
-    //
-    D3D12_DESCRIPTOR_HEAP_DESC srvHeapDesc = {};
-    srvHeapDesc.NumDescriptors = 3;
-    srvHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
-    srvHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
-    ThrowIfFailed(md3dDevice->CreateDescriptorHeap(&srvHeapDesc, IID_PPV_ARGS(&mSrvDescriptorHeap)));
-
-    //
-    // Fill out the heap with actual descriptors.
-    //
-    CD3DX12_CPU_DESCRIPTOR_HANDLE hDescriptor(mSrvDescriptorHeap->GetCPUDescriptorHandleForHeapStart());
-
-    auto firstTex = mTextures[tex_names[0]]->Resource;
-    D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
-    srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-    srvDesc.Format = firstTex->GetDesc().Format;
-    srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
-    srvDesc.Texture2D.MostDetailedMip = 0;
-    srvDesc.Texture2D.MipLevels = firstTex->GetDesc().MipLevels;
-    srvDesc.Texture2D.ResourceMinLODClamp = 0.0f;
-    md3dDevice->CreateShaderResourceView(firstTex.Get(), &srvDesc, hDescriptor);
-
-    // next descriptor
-    for (int i = 1; i < tex_names.size(); ++i) {
-        hDescriptor.Offset(1, mCbvSrvDescriptorSize);
-
-        srvDesc.Format = mTextures[tex_names[i]]->Resource->GetDesc().Format;
-        srvDesc.Texture2D.MipLevels = mTextures[tex_names[i]]->Resource->GetDesc().MipLevels;
-        md3dDevice->CreateShaderResourceView(mTextures[tex_names[i]]->Resource.Get(), &srvDesc, hDescriptor);
-    }
-}
-*/
 
 void Game_engine::BuildRootSignature()
 {
     CD3DX12_DESCRIPTOR_RANGE texTable;
     texTable.Init(
         D3D12_DESCRIPTOR_RANGE_TYPE_SRV,
-        1,  // number of descriptors
+        mTextureTableSize,  // number of descriptors
         0); // register t0
 
     // Root parameter can be a table, root descriptor or root constants.
-    CD3DX12_ROOT_PARAMETER slotRootParameter[4];
+    CD3DX12_ROOT_PARAMETER slotRootParameter[7];
 
     // Perfomance TIP: Order from most frequent to least frequent.
     slotRootParameter[0].InitAsDescriptorTable(1, &texTable, D3D12_SHADER_VISIBILITY_PIXEL);
     slotRootParameter[1].InitAsConstantBufferView(0); // register b0
     slotRootParameter[2].InitAsConstantBufferView(1); // register b1
     slotRootParameter[3].InitAsConstantBufferView(2); // register b2
+    // Clustered lights: lights, froxel ranges, light indices.
+    slotRootParameter[4].InitAsShaderResourceView(0, 1, D3D12_SHADER_VISIBILITY_PIXEL); // register t0, space1
+    slotRootParameter[5].InitAsShaderResourceView(1, 1, D3D12_SHADER_VISIBILITY_PIXEL); // register t1, space1
+    slotRootParameter[6].InitAsShaderResourceView(2, 1, D3D12_SHADER_VISIBILITY_PIXEL); // register t2, space1
 
     auto staticSamplers = GetStaticSamplers();
 
     // A root signature is an array of root parameters.
-    CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(4, slotRootParameter,
+    CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(7, slotRootParameter,
         (UINT)staticSamplers.size(), staticSamplers.data(),
         D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
 
@@ -483,6 +1022,9 @@ void Game_engine::BuildRootSignature()
     }
     ThrowIfFailed(hr);
 
+    // Pipeline cache keys stand in this hash for the root signature pointer.
+    mRootSignatureHash = Hash64(serializedRootSig->GetBufferPointer(), serializedRootSig->GetBufferSize());
+
     ThrowIfFailed(md3dDevice->CreateRootSignature(
         0,
         serializedRootSig->GetBufferPointer(),
@@ -492,14 +1034,19 @@ void Game_engine::BuildRootSignature()
 
 void Game_engine::BuildShadersAndInputLayout()
 {
-    const D3D_SHADER_MACRO alphaTestDefines[] =
-    {
-        "ALPHA_TEST", "1",
-        NULL, NULL
-    };
-
-    mShaders["standardVS"] = d3dUtil::CompileShader(L"Shaders\\Default.hlsl", nullptr, "VS", "vs_5_0");
-    mShaders["opaquePS"] = d3dUtil::CompileShader(L"Shaders\\Default.hlsl", nullptr, "PS", "ps_5_0");
+    // The texture array must match the root signature's table size.
+    // Shader model 5.1 for dynamically indexed texture arrays.
+    mPermutations.SetSource(L"Shaders\\Default.hlsl",
+        { { "TEXTURE_TABLE_SIZE", std::to_string(mTextureTableSize) } },
+        "VS", "vs_5_1", "PS", "ps_5_1");
+
+    // The base pixel shader (one directional light, no features) compiles in
+    // the background while the vertex shader compiles here.  Both come from
+    // the shader cache when nothing changed.
+    ShaderPermutationKey baseKey;
+    mPermutations.Request(baseKey);
+    mShaders["standardVS"] = mPermutations.VertexShader();
+    mShaders["opaquePS"] = mPermutations.Get(baseKey);
 
     mInputLayout =
     {
@@ -511,13 +1058,16 @@ void Game_engine::BuildShadersAndInputLayout()
 
 void Game_engine::CreateGeometry(Mesh mesh, XMFLOAT3 pos, std::string mat_name, std::string name)
 {
-
-    SubmeshGeometry objSubmesh;
-    objSubmesh.IndexCount = (UINT)mesh.indices.size();
-    objSubmesh.StartIndexLocation = 0;
-    objSubmesh.BaseVertexLocation = 0;
-
-    std::vector<Vertex> vertices(mesh.vertices.size());
+    PROFILE_FUNCTION();
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::CreateGeometry).Geometry(mesh).Pod(pos).String(mat_name).String(name);
+    // Meshes built by hand carry no subsets, draw them as a single one.
+    if (mesh.subsets.empty())
+    {
+        MeshSubset subset;
+        subset.IndexCount = (UINT)mesh.indices.size();
+        mesh.subsets.push_back(subset);
+    }
 
     XMFLOAT3 vMinf3(+MathHelper::Infinity, +MathHelper::Infinity, +MathHelper::Infinity);
     XMFLOAT3 vMaxf3(-MathHelper::Infinity, -MathHelper::Infinity, -MathHelper::Infinity);
@@ -527,13 +1077,9 @@ void Game_engine::CreateGeometry(Mesh mesh, XMFLOAT3 pos, std::string mat_name,
 
     for (size_t i = 0; i < mesh.vertices.size(); ++i)
     {
-        vertices[i].Pos = mesh.vertices[i].Pos;
-        vertices[i].Normal = mesh.vertices[i].Normal;
-        vertices[i].TexC = mesh.vertices[i].TexC;
-
-        verts[name].push_back(vertices[i].Pos);
+        verts[name].push_back(mesh.vertices[i].Pos);
 
-        XMVECTOR P = XMLoadFloat3(&vertices[i].Pos);
+        XMVECTOR P = XMLoadFloat3(&mesh.vertices[i].Pos);
 
         vMin = XMVectorMin(vMin, P);
         vMax = XMVectorMax(vMax, P);
@@ -543,127 +1089,122 @@ void Game_engine::CreateGeometry(Mesh mesh, XMFLOAT3 pos, std::string mat_name,
     XMStoreFloat3(&bounds.Center, 0.5f * (vMin + vMax));
     XMStoreFloat3(&bounds.Extents, 0.5f * (vMax - vMin));
 
-    objSubmesh.Bounds = bounds;
-
-    std::vector<std::uint16_t> indices;
-    indices.insert(indices.end(), std::begin(mesh.indices), std::end(mesh.indices));
+    // Objects built from identical data share one set of GPU buffers.
+    const UINT64 geoKey = AssetCache::GeometryKey(mesh);
+    std::shared_ptr<MeshGeometry> geo = mAssets.FindGeometry(geoKey);
+    if (!geo)
+    {
+        const UINT vbByteSize = (UINT)mesh.vertices.size() * sizeof(Vertex);
+        const UINT ibByteSize = (UINT)mesh.indices.size() * sizeof(std::uint16_t);
 
-    const UINT vbByteSize = (UINT)vertices.size() * sizeof(Vertex);
-    const UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint16_t);
+        geo = std::make_shared<MeshGeometry>();
+        geo->Name = name;
 
-    auto geo = std::make_unique<MeshGeometry>();
-    geo->Name = name;
+        ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
+        CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), mesh.vertices.data(), vbByteSize);
 
-    ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
-    CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
+        ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
+        CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), mesh.indices.data(), ibByteSize);
 
-    ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
-    CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
+        geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
+            mCommandList.Get(), mesh.vertices.data(), vbByteSize, geo->VertexBufferUploader);
 
-    geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-        mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
+        geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
+            mCommandList.Get(), mesh.indices.data(), ibByteSize, geo->IndexBufferUploader);
 
-    geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-        mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
+        geo->VertexByteStride = sizeof(Vertex);
+        geo->VertexBufferByteSize = vbByteSize;
+        geo->IndexFormat = DXGI_FORMAT_R16_UINT;
+        geo->IndexBufferByteSize = ibByteSize;
 
-    geo->VertexByteStride = sizeof(Vertex);
-    geo->VertexBufferByteSize = vbByteSize;
-    geo->IndexFormat = DXGI_FORMAT_R16_UINT;
-    geo->IndexBufferByteSize = ibByteSize;
+        mAssets.AddGeometry(geoKey, geo);
+    }
 
+    SubmeshGeometry objSubmesh;
+    objSubmesh.IndexCount = (UINT)mesh.indices.size();
+    objSubmesh.StartIndexLocation = 0;
+    objSubmesh.BaseVertexLocation = 0;
+    objSubmesh.Bounds = bounds;
     geo->DrawArgs[name] = objSubmesh;
 
-    mGeometries[geo->Name] = std::move(geo);
-    ++CBI_index;
     Material mat_return;
     if (mMaterials.count(mat_name)) {
         mat_return = *mMaterials[mat_name].get();
     }
-    BuildRenderItems(XMMatrixTranslation(pos.x, pos.y, pos.z), name, mat_return);
+
+    // A subset uses the engine material named like its material slot in the
+    // source file if there is one, otherwise the material passed in.
+    std::vector<RenderSubmesh> submeshes;
+    for (size_t i = 0; i < mesh.subsets.size(); ++i)
+    {
+        const MeshSubset& subset = mesh.subsets[i];
+
+        SubmeshGeometry args;
+        args.IndexCount = subset.IndexCount;
+        args.StartIndexLocation = subset.StartIndexLocation;
+        args.BaseVertexLocation = subset.BaseVertexLocation;
+        args.Bounds = mesh.subsets.size() == 1 ? bounds : subset.Bounds;
+        geo->DrawArgs[name + "_" + std::to_string(i)] = args;
+
+        RenderSubmesh sub;
+        sub.MatCBIndex = mat_return.MatCBIndex;
+        if (mMaterials.count(mat_name)) {
+            sub.Mat = mMaterials[mat_name].get();
+        }
+        if (subset.MaterialSlot < mesh.materials.size() && mMaterials.count(mesh.materials[subset.MaterialSlot])) {
+            sub.Mat = mMaterials[mesh.materials[subset.MaterialSlot]].get();
+            sub.MatCBIndex = sub.Mat->MatCBIndex;
+        }
+        sub.Bounds = args.Bounds;
+        sub.IndexCount = args.IndexCount;
+        sub.StartIndexLocation = args.StartIndexLocation;
+        sub.BaseVertexLocation = args.BaseVertexLocation;
+        submeshes.push_back(sub);
+    }
+
+    mGeometries[name] = std::move(geo);
+    ++CBI_index;
+    BuildRenderItems(XMMatrixTranslation(pos.x, pos.y, pos.z), name, mat_return, std::move(submeshes));
 }
 
 void Game_engine::CreateGeometry(GeometryGenerator::MeshData obj, XMFLOAT3 pos, std::string mat_name, std::string name)
 {
-    GeometryGenerator::MeshData object = obj;
-
-    SubmeshGeometry objSubmesh;
-    objSubmesh.IndexCount = (UINT)object.Indices32.size();
-    objSubmesh.StartIndexLocation = 0;
-    objSubmesh.BaseVertexLocation = 0;
-
-    std::vector<Vertex> vertices(object.Vertices.size());
-
-    XMFLOAT3 vMinf3(+MathHelper::Infinity, +MathHelper::Infinity, +MathHelper::Infinity);
-    XMFLOAT3 vMaxf3(-MathHelper::Infinity, -MathHelper::Infinity, -MathHelper::Infinity);
-
-    XMVECTOR vMin = XMLoadFloat3(&vMinf3);
-    XMVECTOR vMax = XMLoadFloat3(&vMaxf3);
-
-    for (size_t i = 0; i < object.Vertices.size(); ++i)
+    Mesh mesh;
+    mesh.vertices.resize(obj.Vertices.size());
+    for (size_t i = 0; i < obj.Vertices.size(); ++i)
     {
-        vertices[i].Pos = object.Vertices[i].Position;
-        vertices[i].Normal = object.Vertices[i].Normal;
-        vertices[i].TexC = object.Vertices[i].TexC;
-
-        verts[name].push_back(vertices[i].Pos);
-
-        XMVECTOR P = XMLoadFloat3(&vertices[i].Pos);
-
-        vMin = XMVectorMin(vMin, P);
-        vMax = XMVectorMax(vMax, P);
+        mesh.vertices[i].Pos = obj.Vertices[i].Position;
+        mesh.vertices[i].Normal = obj.Vertices[i].Normal;
+        mesh.vertices[i].TexC = obj.Vertices[i].TexC;
     }
+    mesh.indices = obj.GetIndices16();
 
-    BoundingBox bounds;
-    XMStoreFloat3(&bounds.Center, 0.5f * (vMin + vMax));
-    XMStoreFloat3(&bounds.Extents, 0.5f * (vMax - vMin));
-
-    objSubmesh.Bounds = bounds;
-
-    std::vector<std::uint16_t> indices;
-    indices.insert(indices.end(), std::begin(object.GetIndices16()), std::end(object.GetIndices16()));
-
-    const UINT vbByteSize = (UINT)vertices.size() * sizeof(Vertex);
-    const UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint16_t);
-
-    auto geo = std::make_unique<MeshGeometry>();
-    geo->Name = name;
-
-    ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
-    CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
-
-    ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
-    CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
-
-    geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-        mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
-
-    geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-        mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
-
-    geo->VertexByteStride = sizeof(Vertex);
-    geo->VertexBufferByteSize = vbByteSize;
-    geo->IndexFormat = DXGI_FORMAT_R16_UINT;
-    geo->IndexBufferByteSize = ibByteSize;
-
-    geo->DrawArgs[name] = objSubmesh;
-
-    mGeometries[geo->Name] = std::move(geo);
-    ++CBI_index;
-    Material mat_return;
-    if (mMaterials.count(mat_name)) {
-        mat_return = *mMaterials[mat_name].get();
-    }
-    BuildRenderItems(XMMatrixTranslation(pos.x, pos.y, pos.z), name, mat_return);
+    CreateGeometry(std::move(mesh), pos, mat_name, name);
 }
 
 void Game_engine::CreateWorld()
 {
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::CreateWorld);
     for (auto& e : mAllRitems)
         mOpaqueRitems.push_back(e.get());
     BuildFrameResources();
     //BuildDescriptorHeaps();
     BuildPSOs();
 
+    // Compile the permutations the scene needs now rather than on first draw.
+    std::vector<ShaderPermutationKey> keys;
+    for (auto& e : mMaterials)
+    {
+        keys.push_back(SelectPermutation(e.second.get(), false));
+        if (mLights.LocalCount() > 0)
+            keys.push_back(SelectPermutation(e.second.get(), true));
+    }
+    mPermutations.Prewarm(keys);
+    ID3D12PipelineState* base = GetBasePSO();
+    for (const ShaderPermutationKey& key : keys)
+        GetPermutationPSO(key, base);
+
     // Execute the initialization commands.
     ThrowIfFailed(mCommandList->Close());
     ID3D12CommandList* cmdsLists[] = { mCommandList.Get() };
@@ -673,8 +1214,16 @@ void Game_engine::CreateWorld()
     FlushCommandQueue();
 }
 
-void Game_engine::MoveObject(std::string name, XMMATRIX pos) {
-    XMStoreFloat4x4(&mOpaqueRitems[names[name]]->World, pos);
+void Game_engine::MoveObject(const std::string& name, XMMATRIX pos) {
+    if (mTrace.IsOpen())
+    {
+        XMFLOAT4X4 world;
+        XMStoreFloat4x4(&world, pos);
+        mTrace.Call(ApiCall::MoveObject).String(name).Pod(world);
+    }
+    RenderItem* ri = mOpaqueRitems[names[name]];
+    SetObjectWorld(ri->ObjCBIndex, pos);
+    ri->CellsMoved = true;
 }
 
 void Game_engine::BuildPSOs()
@@ -708,7 +1257,7 @@ void Game_engine::BuildPSOs()
     opaquePsoDesc.SampleDesc.Count = m4xMsaaState ? 4 : 1;
     opaquePsoDesc.SampleDesc.Quality = m4xMsaaState ? (m4xMsaaQuality - 1) : 0;
     opaquePsoDesc.DSVFormat = mDepthStencilFormat;
-    ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&opaquePsoDesc, IID_PPV_ARGS(&mPSOs["opaque"])));
+    AddPSO("opaque", opaquePsoDesc);
 
 
     //
@@ -717,7 +1266,96 @@ void Game_engine::BuildPSOs()
 
     D3D12_GRAPHICS_PIPELINE_STATE_DESC opaqueWireframePsoDesc = opaquePsoDesc;
     opaqueWireframePsoDesc.RasterizerState.FillMode = D3D12_FILL_MODE_WIREFRAME;
-    ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&opaqueWireframePsoDesc, IID_PPV_ARGS(&mPSOs["opaque_wireframe"])));
+    AddPSO("opaque_wireframe", opaqueWireframePsoDesc);
+
+    mOpaquePso = &mPsoDescs["opaque"];
+    mWireframePso = &mPsoDescs["opaque_wireframe"];
+
+    // Pipelines saved by an earlier run load from the library instead of
+    // compiling.  Only the base pipeline is needed before the first frame,
+    // the other variants build in the background.
+    mPipelineLibrary.Open(md3dDevice.Get(), L"AssetCache\\Pipelines.bin");
+    for (const auto& e : mPsoDescs)
+        GetPSO(e.first);
+}
+
+void Game_engine::AddPSO(const std::string& name, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc)
+{
+    NamedPso& pso = mPsoDescs[name];
+    pso.Desc = desc;
+    pso.Key = HashPipelineDesc(desc, mRootSignatureHash);
+}
+
+ShaderPermutationKey Game_engine::SelectPermutation(const Material* mat, bool localLights)
+{
+    // Directional lights come from the pass constants; point and spot lights
+    // through the clusters, for objects that any of them reaches.
+    UINT features = mat ? mat->Features : 0;
+    if (mFogEnabled)
+        features |= ShaderFeatureFog;
+    if (localLights)
+        features |= ShaderFeatureClustered;
+    return ShaderPermutationKey::Select(mLights.DirectionalCount(), 0, 0, features);
+}
+
+ID3D12PipelineState* Game_engine::GetPermutationPSO(const ShaderPermutationKey& key, ID3D12PipelineState* base)
+{
+    // A permutation of whichever base pipeline is in use; that base is also
+    // what draws while the permutation's shader and pipeline compile.
+    const UINT64 id = ((UINT64)mIsWireframe << 32) | key.Packed();
+
+    auto it = mPermutationPsos.find(id);
+    if (it == mPermutationPsos.end())
+    {
+        ID3DBlob* ps = mPermutations.Request(key);
+        if (ps == nullptr)
+            return base;
+
+        NamedPso& pso = mPermutationPsos[id];
+        pso.Desc = (mIsWireframe ? mWireframePso : mOpaquePso)->Desc;
+        pso.Desc.PS = { reinterpret_cast<BYTE*>(ps->GetBufferPointer()), ps->GetBufferSize() };
+        pso.Key = HashPipelineDesc(pso.Desc, mRootSignatureHash);
+        it = mPermutationPsos.find(id);
+    }
+    return mPipelines.Request(it->second.Key, it->second.Desc, base);
+}
+
+void Game_engine::ResolveMaterialPsos(ID3D12PipelineState* base)
+{
+    PROFILE_FUNCTION();
+    // Fog, wireframe, the directional light count and finished compiles all
+    // change the answer, so this runs once per frame instead of per draw.
+    mMaterialPsos.assign(((size_t)mat_CBI_index + 1) * 2, base);
+    const bool localLights = mLights.LocalCount() > 0;
+    auto resolve = [&](const Material* mat, int matCBIndex)
+    {
+        const size_t slot = MaterialPsoSlot(matCBIndex, false);
+        mMaterialPsos[slot] = GetPermutationPSO(SelectPermutation(mat, false), base);
+        // Items only reach local lights when there are some.
+        mMaterialPsos[slot + 1] = localLights ?
+            GetPermutationPSO(SelectPermutation(mat, true), base) : mMaterialPsos[slot];
+    };
+    resolve(nullptr, -1);
+    for (auto& e : mMaterials)
+        resolve(e.second.get(), e.second->MatCBIndex);
+}
+
+ID3D12PipelineState* Game_engine::GetPSO(const std::string& name)
+{
+    // Variants still compiling draw with the opaque pipeline.
+    const NamedPso& base = mPsoDescs["opaque"];
+    ID3D12PipelineState* basePso = mPipelines.Get(base.Key, base.Desc);
+    const NamedPso& pso = mPsoDescs[name];
+    return mPipelines.Request(pso.Key, pso.Desc, basePso);
+}
+
+ID3D12PipelineState* Game_engine::GetBasePSO()
+{
+    // The wireframe pipeline draws opaque until it has compiled.
+    ID3D12PipelineState* opaque = mPipelines.Get(mOpaquePso->Key, mOpaquePso->Desc);
+    if (!mIsWireframe)
+        return opaque;
+    return mPipelines.Request(mWireframePso->Key, mWireframePso->Desc, opaque);
 }
 
 void Game_engine::BuildFrameResources()
@@ -725,16 +1363,26 @@ void Game_engine::BuildFrameResources()
     for (int i = 0; i < gNumFrameResources; ++i)
     {
         mFrameResources.push_back(std::make_unique<FrameResource>(md3dDevice.Get(),
-            1, (UINT)mAllRitems.size(), (UINT)mMaterials.size()));
+            1, (UINT)mAllRitems.size(), (UINT)mMaterials.size(),
+            MaxClusterLights, mLightClusters.ClusterCount(), mLightClusters.MaxIndices()));
     }
 }
 
-void Game_engine::BuildRenderItems(XMMATRIX pos, std::string name, Material mat)
+void Game_engine::BuildRenderItems(XMMATRIX pos, std::string name, Material mat, std::vector<RenderSubmesh> submeshes)
 {
     auto objRitem = std::make_unique<RenderItem>();
-    XMStoreFloat4x4(&objRitem->World, pos);
-    objRitem->TexTransform = mat.MatTransform;
     objRitem->ObjCBIndex = CBI_index;
+    mObjectTransforms.resize(CBI_index + 1);
+    mObjectWorldSlots.resize(CBI_index + 1, -1);
+    SetObjectWorld(CBI_index, pos);
+    if (!XMMatrixIsIdentity(XMLoadFloat4x4(&mat.MatTransform)))
+    {
+        ObjectTexTransform texTransform;
+        texTransform.ObjCBIndex = CBI_index;
+        texTransform.Transform = mat.MatTransform;
+        mObjectTexTransforms.push_back(texTransform);
+    }
+    mObjectTexFramesDirty = gNumFrameResources;
     objRitem->Geo = mGeometries[name].get();
     objRitem->PrimitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
     objRitem->IndexCount = objRitem->Geo->DrawArgs[name].IndexCount;
@@ -742,67 +1390,183 @@ void Game_engine::BuildRenderItems(XMMATRIX pos, std::string name, Material mat)
     objRitem->BaseVertexLocation = objRitem->Geo->DrawArgs[name].BaseVertexLocation;
     objRitem->Mat = &mat;
     objRitem->Bounds = objRitem->Geo->DrawArgs[name].Bounds;
-    mat_cbis.push_back(mat.MatCBIndex);
+    objRitem->Submeshes = std::move(submeshes);
     mAllRitems.push_back(std::move(objRitem));
     names[name] = CBI_index;
     visible_objects.push_back(1);
 }
 
-void Game_engine::DrawObject(std::string name) {
+void Game_engine::DrawObject(const std::string& name) {
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::DrawObject).String(name);
     visible_objects[names[name]] = 1;
 }
-void Game_engine::DoNotDrawObject(std::string name) {
+void Game_engine::DoNotDrawObject(const std::string& name) {
+    if (mTrace.IsOpen())
+        mTrace.Call(ApiCall::DoNotDrawObject).String(name);
     visible_objects[names[name]] = 0;
 }
 
+void Game_engine::CullRenderItems(const std::vector<RenderItem*>& ritems)
+{
+    PROFILE_FUNCTION();
+    for (auto& stats : mDrawStats)
+        stats = DrawCategoryStats();
+
+    // The list and its frustum copies live until the frame resource is reused.
+    LinearArena& arena = mCurrFrameResource->Arena.Local();
+    mVisibleItems = ArenaVector<VisibleItem>(&arena);
+    mVisibleItems.reserve(ritems.size());
+
+    CullCamera camera;
+    camera.Set(mCam.GetView(), mCamFrustum, mCam.GetFovY(), mScreenViewport.Height, mMinScreenSize);
+
+    for (size_t i = 0; i < ritems.size(); ++i)
+    {
+        if (!visible_objects[i])
+            continue;
+        if (!InVisibleCell(ritems[i]))
+        {
+            ++mFrameCounters.CellCulled;
+            continue;
+        }
+        auto ri = ritems[i];
+        DrawCategoryStats& stats = mDrawStats[ri->Category];
+        ++stats.Candidates;
+
+        XMMATRIX world = ObjectWorld(ri->ObjCBIndex);
+        CulledObject culled;
+        const CullResult result = CullObject(world, ri->Bounds, ri->MaxDrawDistance, camera, culled);
+        if (result == CullResult::Distance)
+        {
+            ++stats.DistanceCulled;
+            continue;
+        }
+        if (result == CullResult::Size)
+        {
+            ++stats.SizeCulled;
+            continue;
+        }
+        if (result == CullResult::Frustum)
+        {
+            ++stats.FrustumCulled;
+            continue;
+        }
+
+        // Occluders themselves are always drawn; their own depth would hide them.
+        if (ri->Occluder == OccluderNone && mOcclusion.Stats().Occluders > 0 && mOcclusion.IsOccluded(ri->Bounds, world))
+        {
+            ++stats.Occluded;
+            continue;
+        }
+
+        VisibleItem item;
+        item.Item = ri;
+        item.LocalFrustum = culled.LocalFrustum;
+        // Objects out of reach of every point and spot light skip the cluster loop.
+        item.LocalLights = mLights.AnyLocal(culled.WorldBounds);
+        item.ScreenSize = culled.ScreenSize;
+        mVisibleItems.push_back(item);
+    }
+
+    // Categories over budget keep their largest items on screen.
+    for (UINT category = 0; category < MaxDrawCategories; ++category)
+    {
+        const UINT budget = mCategoryBudgets[category];
+        DrawCategoryStats& stats = mDrawStats[category];
+        const UINT visible = stats.Candidates - stats.DistanceCulled - stats.SizeCulled - stats.FrustumCulled - stats.Occluded;
+        if (budget == 0 || visible <= budget)
+            continue;
+
+        ArenaVector<UINT> sortKeys(&arena);
+        sortKeys.reserve(visible);
+        for (UINT i = 0; i < mVisibleItems.size(); ++i)
+        {
+            if (mVisibleItems[i].Item->Category == category)
+                sortKeys.push_back(i);
+        }
+        std::nth_element(sortKeys.begin(), sortKeys.begin() + budget, sortKeys.end(),
+            [this](UINT a, UINT b) { return mVisibleItems[a].ScreenSize > mVisibleItems[b].ScreenSize; });
+        for (auto it = sortKeys.begin() + budget; it != sortKeys.end(); ++it)
+            mVisibleItems[*it].Item = nullptr;
+        stats.BudgetCulled = visible - budget;
+    }
+    mVisibleItems.erase(std::remove_if(mVisibleItems.begin(), mVisibleItems.end(),
+        [](const VisibleItem& item) { return item.Item == nullptr; }), mVisibleItems.end());
+
+    for (const auto& item : mVisibleItems)
+        ++mDrawStats[item.Item->Category].Drawn;
+
+    for (const auto& stats : mDrawStats)
+    {
+        mFrameCounters.DistanceCulled += stats.DistanceCulled;
+        mFrameCounters.SizeCulled += stats.SizeCulled;
+        mFrameCounters.FrustumCulled += stats.FrustumCulled;
+        mFrameCounters.Occluded += stats.Occluded;
+        mFrameCounters.BudgetCulled += stats.BudgetCulled;
+    }
+}
+
 void Game_engine::DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& ritems)
 {
+    PROFILE_FUNCTION();
     UINT objCBByteSize = d3dUtil::CalcConstantBufferByteSize(sizeof(ObjectConstants));
     UINT matCBByteSize = d3dUtil::CalcConstantBufferByteSize(sizeof(MaterialConstants));
 
     auto objectCB = mCurrFrameResource->ObjectCB->Resource();
     auto matCB = mCurrFrameResource->MaterialCB->Resource();
 
-    XMMATRIX view = mCam.GetView();
-    XMMATRIX invView = XMMatrixInverse(&XMMatrixDeterminant(view), view);
+    // The command list starts out with the base pipeline bound by Reset.
+    ID3D12PipelineState* boundPso = GetBasePSO();
+    ResolveMaterialPsos(boundPso);
+
+    CullRenderItems(ritems);
 
     // For each render item...
-    for (size_t i = 0; i < ritems.size(); ++i)
+    for (const auto& item : mVisibleItems)
     {
-        if (visible_objects[i]) {
-            auto ri = ritems[i];
-
-            //frustum vars
-            XMMATRIX world = XMLoadFloat4x4(&ri->World);
-            //XMMATRIX texTransform = XMLoadFloat4x4(&ri->TexTransform);
-
-            XMMATRIX invWorld = XMMatrixInverse(&XMMatrixDeterminant(world), world);
+        auto ri = item.Item;
 
-            // View space to the object's local space.
-            XMMATRIX viewToLocal = XMMatrixMultiply(invView, invWorld);
+        cmdList->IASetVertexBuffers(0, 1, &ri->Geo->VertexBufferView());
+        cmdList->IASetIndexBuffer(&ri->Geo->IndexBufferView());
+        cmdList->IASetPrimitiveTopology(ri->PrimitiveType);
 
-            // Transform the camera frustum from view space to the object's local space.
-            BoundingFrustum localSpaceFrustum;
-            mCamFrustum.Transform(localSpaceFrustum, viewToLocal);
+        D3D12_GPU_VIRTUAL_ADDRESS objCBAddress = objectCB->GetGPUVirtualAddress() + ri->ObjCBIndex * objCBByteSize;
+        cmdList->SetGraphicsRootConstantBufferView(1, objCBAddress);
+        // Vertex and index buffers, topology and object constants.
+        mFrameCounters.StateChanges += 4;
 
-            if (localSpaceFrustum.Contains(ri->Bounds) != DirectX::DISJOINT) {
-
-                cmdList->IASetVertexBuffers(0, 1, &ri->Geo->VertexBufferView());
-                cmdList->IASetIndexBuffer(&ri->Geo->IndexBufferView());
-                cmdList->IASetPrimitiveTopology(ri->PrimitiveType);
+        // Consecutive submeshes sharing a material keep the bound pipeline and cbuffer.
+        int boundMat = -1;
+        for (const auto& sub : ri->Submeshes)
+        {
+            if (ri->Submeshes.size() > 1 && item.LocalFrustum.Contains(sub.Bounds) == DirectX::DISJOINT)
+            {
+                ++mFrameCounters.SubmeshesCulled;
+                continue;
+            }
 
-                CD3DX12_GPU_DESCRIPTOR_HANDLE tex(mSrvDescriptorHeap->GetGPUDescriptorHandleForHeapStart());
-                tex.Offset(mat_cbis[i], mCbvSrvDescriptorSize);
+            if (sub.MatCBIndex != boundMat)
+            {
+                ID3D12PipelineState* pso = mMaterialPsos[MaterialPsoSlot(sub.MatCBIndex, item.LocalLights)];
+                if (pso != boundPso)
+                {
+                    cmdList->SetPipelineState(pso);
+                    boundPso = pso;
+                    ++mFrameCounters.PipelineChanges;
+                    ++mFrameCounters.StateChanges;
+                }
 
-                D3D12_GPU_VIRTUAL_ADDRESS objCBAddress = objectCB->GetGPUVirtualAddress() + ri->ObjCBIndex * objCBByteSize;
-                D3D12_GPU_VIRTUAL_ADDRESS matCBAddress = matCB->GetGPUVirtualAddress() + mat_cbis[i] * matCBByteSize;
+                D3D12_GPU_VIRTUAL_ADDRESS matCBAddress = matCB->GetGPUVirtualAddress() + sub.MatCBIndex * matCBByteSize;
 
-                cmdList->SetGraphicsRootDescriptorTable(0, tex);
-                cmdList->SetGraphicsRootConstantBufferView(1, objCBAddress);
                 cmdList->SetGraphicsRootConstantBufferView(3, matCBAddress);
-
-                cmdList->DrawIndexedInstanced(ri->IndexCount, 1, ri->StartIndexLocation, ri->BaseVertexLocation, 0);
+                boundMat = sub.MatCBIndex;
+                ++mFrameCounters.StateChanges;
             }
+
+            cmdList->DrawIndexedInstanced(sub.IndexCount, 1, sub.StartIndexLocation, sub.BaseVertexLocation, 0);
+            ++mFrameCounters.Draws;
+            mFrameCounters.Triangles += sub.IndexCount / 3;
         }
     }
 }
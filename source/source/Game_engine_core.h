@@ -7,6 +7,16 @@
 #include <DirectXCollision.h>
 #include "Lighting.h"
 #include "../../Common/Camera.h"
+#include "AssetCache.h"
+#include "../../Common/DescriptorHeap.h"
+#include "PipelineCache.h"
+#include "ShaderPermutations.h"
+#include "ShadowCascades.h"
+#include "OcclusionCuller.h"
+#include "ObjectCulling.h"
+#include "CellPortals.h"
+#include "FrameStats.h"
+#include "ApiTrace.h"
 
 
 using Microsoft::WRL::ComPtr;
@@ -48,24 +58,32 @@ struct Rotation {
     }
 };
 
+// Part of a render item with its own index range and material.  Shares the
+// item's vertex/index buffers and object constants.
+struct RenderSubmesh
+{
+    int MatCBIndex = -1;
+    // Selects the shader permutation; owned by the engine's material map.
+    Material* Mat = nullptr;
+
+    BoundingBox Bounds;
+
+    // DrawIndexedInstanced parameters.
+    UINT IndexCount = 0;
+    UINT StartIndexLocation = 0;
+    int BaseVertexLocation = 0;
+};
+
 // Lightweight structure stores parameters to draw a shape.  This will
 // vary from app-to-app.
 struct RenderItem
 {
     RenderItem() = default;
 
-    // World matrix of the shape that describes the object's local space
-    // relative to the world space, which defines the position, orientation,
-    // and scale of the object in the world.
-    XMFLOAT4X4 World = MathHelper::Identity4x4();
-
-    XMFLOAT4X4 TexTransform = MathHelper::Identity4x4();
-
-    // Dirty flag indicating the object data has changed and we need to update the constant buffer.
-    // Because we have an object cbuffer for each FrameResource, we have to apply the
-    // update to each FrameResource.  Thus, when we modify obect data we should set 
-    // NumFramesDirty = gNumFrameResources so that each frame resource gets the update.
-    int NumFramesDirty = gNumFrameResources;
+    // The world transform is Game_engine::ObjectWorld(ObjCBIndex), packed into
+    // the object constants every frame; a texture transform other than
+    // identity is in mObjectTexTransforms, uploaded while
+    // mObjectTexFramesDirty counts down.
 
     // Index into GPU constant buffer corresponding to the ObjectCB for this render item.
     UINT ObjCBIndex = -1;
@@ -82,12 +100,60 @@ struct RenderItem
     UINT IndexCount = 0;
     UINT StartIndexLocation = 0;
     int BaseVertexLocation = 0;
+
+    // Submeshes are culled individually once Bounds passed the frustum test.
+    std::vector<RenderSubmesh> Submeshes;
+
+    // Occluders hide the objects behind them and are never culled by occlusion.
+    OccluderShape Occluder = OccluderNone;
+
+    // Not drawn when its bounds are farther than this from the camera; 0 draws it at any distance.
+    float MaxDrawDistance = 0.0f;
+    // Draw budget and statistics bucket, below Game_engine::MaxDrawCategories.
+    UINT Category = 0;
+
+    // Cells of the engine's cell graph the world bounds touch; empty outside
+    // every cell.  Refreshed when the item moves or the graph changes.
+    std::vector<uint32_t> Cells;
+    // Set by MoveObject.
+    bool CellsMoved = true;
+    uint32_t CellsVersion = 0;
 };
 
-class Game_engine : public D3DApp, public Light_c
+// Texture transform of a render item that isn't identity.
+struct ObjectTexTransform
+{
+    UINT ObjCBIndex = 0;
+    XMFLOAT4X4 Transform = MathHelper::Identity4x4();
+};
+
+// World matrix of a render item that has no scale, rotation and translation
+// form, such as a sheared one.
+struct ObjectWorldMatrix
+{
+    UINT ObjCBIndex = 0;
+    XMFLOAT4X4 World = MathHelper::Identity4x4();
+};
+
+// Why the render items of a category were or were not drawn last frame.
+// Each culled item counts once, under the first test it failed.
+struct DrawCategoryStats
+{
+    // Shown and in a visible cell.
+    UINT Candidates = 0;
+    UINT DistanceCulled = 0;
+    UINT SizeCulled = 0;
+    UINT FrustumCulled = 0;
+    UINT Occluded = 0;
+    UINT BudgetCulled = 0;
+    UINT Drawn = 0;
+};
+
+class Game_engine : public D3DApp
 {
 public:
-    Game_engine(HINSTANCE hInstance);
+    // A headless engine opens no window and renders on WARP; see D3DApp.
+    Game_engine(HINSTANCE hInstance, bool headless = false);
     Game_engine(const Game_engine& rhs) = delete;
     Game_engine& operator=(const Game_engine& rhs) = delete;
     ~Game_engine();
@@ -100,25 +166,99 @@ public:
     void CreateGeometry(GeometryGenerator::MeshData obj, XMFLOAT3 pos, std::string mat_name, std::string name);
     void CreateGeometry(Mesh mesh, XMFLOAT3 pos, std::string mat_name, std::string name);
     void CreateWorld();
-    void MoveObject(std::string name, XMMATRIX pos);
-    void DrawObject(std::string name);
-    void DoNotDrawObject(std::string name);
+    // pos is stored as scale, rotation and translation when it is one, and
+    // kept as a full matrix otherwise, e.g. when it shears.
+    void MoveObject(const std::string& name, XMMATRIX pos);
+    void DrawObject(const std::string& name);
+    void DoNotDrawObject(const std::string& name);
     bool IsKeyPresed(char key);
-    void RotateObject(std::string name, XMMATRIX rotation);
+    void RotateObject(const std::string& name, XMMATRIX rotation);
     //legacy func
     //void CreateMaterial(std::string name, XMFLOAT4 difuse_albedo, XMFLOAT3 FresnelR0, float Roughnes, XMFLOAT3 matTransform = XMFLOAT3(1, 1, 1));
     void CreateMaterial(std::string name, XMFLOAT4 difuse_albedo, XMFLOAT3 FresnelR0, float Roughnes, std::string tex_name,  XMFLOAT3 matTransform = XMFLOAT3(1, 1, 1));
     void UpdateMaterial(std::string name, XMFLOAT4 difuse_albedo, XMFLOAT3 FresnelR0, float Roughnes, XMFLOAT3 matTransform = XMFLOAT3(1, 1, 1));
+    void SetMaterialNormalMap(std::string name, std::string tex_name);
+    void SetMaterialAlphaTest(std::string name, bool enabled);
     std::vector<XMFLOAT3> GetVertices(std::string name);
 
     //Tex
     void LoadTexture(std::wstring filepath, std::string name);
 
+    //Assets
+    AssetCache& GetAssetCache();
+
     //Light
     void SetLight(DirectX::XMFLOAT3 pos_dir, DirectX::XMFLOAT3 strength);
     void SetAmbient(DirectX::XMFLOAT4);
     void EditLight(DirectX::XMFLOAT3 pos_dir, DirectX::XMFLOAT3 strength, unsigned int index);
     void EditAmbient(DirectX::XMFLOAT4);
+    LightHandle CreateLight(const LightDesc& desc);
+    bool UpdateLight(LightHandle light, const LightDesc& desc);
+    bool DestroyLight(LightHandle light);
+    // Point and spot lights are binned into view frustum clusters each frame,
+    // so there can be many of them.  Invalid handle when full.
+    LightHandle AddPointLight(DirectX::XMFLOAT3 pos, DirectX::XMFLOAT3 strength, float falloffStart, float falloffEnd);
+    LightHandle AddSpotLight(DirectX::XMFLOAT3 pos, DirectX::XMFLOAT3 dir, DirectX::XMFLOAT3 strength,
+        float falloffStart, float falloffEnd, float spotPower);
+    void ClearLocalLights();
+    LightManager& GetLights();
+
+    //Shadows
+    // Cascades follow the first directional light; each frame they are
+    // refitted and given the objects that can cast into them.
+    void SetShadowSettings(const CascadeSettings& settings);
+    const ShadowCascades& GetShadowCascades()const;
+    const std::vector<RenderItem*>& GetCascadeCasters(UINT cascade)const;
+
+    //Occlusion
+    // Objects behind the occluders' software rasterized depth are not drawn.
+    // Large, solid, simple objects like buildings and terrain make good occluders.
+    void SetOccluder(std::string name, OccluderShape shape);
+    void EnableOcclusionCulling(bool enabled);
+    const OcclusionStats& GetOcclusionStats()const;
+
+    //Draw distance
+    static const UINT MaxDrawCategories = 8;
+    void SetDrawDistance(std::string name, float distance);
+    void SetDrawCategory(std::string name, UINT category);
+    // Objects whose bounding sphere is fewer pixels across than this are not drawn.
+    void SetMinScreenSize(float pixels);
+    // At most maxDraws objects of the category are drawn, the largest on
+    // screen first; 0 lifts the limit.
+    void SetCategoryBudget(UINT category, UINT maxDraws);
+    const DrawCategoryStats& GetDrawStats(UINT category)const;
+
+    //Cells and portals
+    // Indoors, only objects in cells seen through the portals from the
+    // camera's cell are frustum culled and drawn.  Load or author the graph,
+    // then bake its PVS once, offline or at load time.
+    CellGraph& GetCellGraph();
+    bool LoadCells(const std::string& file);
+    UINT GetVisibleCellCount()const;
+
+    //Frame pacing
+    // More frames in flight keep the GPU busier, fewer cut input latency.
+    // Waits for the GPU to go idle and rebuilds the frame resources; call
+    // between frames.
+    void SetFramesInFlight(UINT frames);
+    UINT GetFramesInFlight()const;
+    const FramePacingStats& GetFramePacingStats()const;
+
+    //Frame statistics
+    // Frame time percentiles and per frame counters of draws, culling and
+    // uploads; SetDumpFile on it writes them out periodically.
+    FrameStats& GetFrameStats();
+
+    //Capture
+    // Records the calls of this interface, with each frame's times and
+    // camera input, into a trace ApiTracePlayer replays.  Start before the
+    // scene is built; replays load textures and cells from the same paths.
+    bool StartApiCapture(const std::string& file);
+    void StopApiCapture();
+
+    //Fog
+    void SetFog(DirectX::XMFLOAT4 color, float start, float range);
+    void DisableFog();
 
     //Camera
     void SetCameraPos(DirectX::XMFLOAT3 pos);
@@ -146,20 +286,41 @@ private:
 
     void OnKeyboardInput(const GameTimer& gt);
     void UpdateObjectCBs(const GameTimer& gt);
+    void SetObjectWorld(UINT objCBIndex, FXMMATRIX world);
+    void RetireTextureSrv(UINT slot);
+    void ReleaseRetiredTextureSrvs();
+    XMMATRIX ObjectWorld(UINT objCBIndex)const;
     void UpdateMainPassCB(const GameTimer& gt);
     void UpdateMaterialCBs(const GameTimer& gt);
+    void UpdateLightClusters();
+    void UpdateShadowCascades();
+    void UpdateOcclusion();
+    void UpdateVisibleCells();
+    bool InVisibleCell(RenderItem* ri);
 
-    //void BuildDescriptorHeaps();
     void BuildRootSignature();
     void BuildShadersAndInputLayout();
     void BuildPSOs();
+    void AddPSO(const std::string& name, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc);
+    ShaderPermutationKey SelectPermutation(const Material* mat, bool localLights);
+    // base draws while the permutation compiles.
+    ID3D12PipelineState* GetPermutationPSO(const ShaderPermutationKey& key, ID3D12PipelineState* base);
+    // Fills mMaterialPsos for this frame's fog, wireframe and light state.
+    void ResolveMaterialPsos(ID3D12PipelineState* base);
+    static size_t MaterialPsoSlot(int matCBIndex, bool localLights) { return ((size_t)(matCBIndex + 1) << 1) | (localLights ? 1 : 0); }
+    ID3D12PipelineState* GetPSO(const std::string& name);
+    // "opaque" or "opaque_wireframe", whichever mode is on.
+    ID3D12PipelineState* GetBasePSO();
     void BuildFrameResources();
-    void BuildRenderItems(XMMATRIX pos, std::string name, Material mat);
+    void BuildRenderItems(XMMATRIX pos, std::string name, Material mat, std::vector<RenderSubmesh> submeshes);
+    void CullRenderItems(const std::vector<RenderItem*>& ritems);
     void DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& ritems);
 
     std::array<const CD3DX12_STATIC_SAMPLER_DESC, 6> GetStaticSamplers();
 
 private:
+    friend class ApiTracePlayer;
+
     bool basic_camera_control = 1;
     bool mDraw_all = 0;
     int CBI_index = -1;
@@ -167,29 +328,110 @@ private:
 
     std::unordered_map<std::string, int> names;
     std::vector<std::string> tex_names;
-    std::vector<int> mat_cbis;
     std::vector<bool> visible_objects;
 
     std::vector<std::unique_ptr<FrameResource>> mFrameResources;
     FrameResource* mCurrFrameResource = nullptr;
     int mCurrFrameResourceIndex = 0;
+    std::unique_ptr<D3D12PacerQueue> mPacerQueue;
+    std::unique_ptr<FramePacer> mPacer;
 
-    ComPtr<ID3D12RootSignature> mRootSignature = nullptr;
-    ComPtr<ID3D12DescriptorHeap> mCbvHeap = nullptr;
+    FrameStats mFrameStats;
+    // Of the frame being built, handed to mFrameStats once it is submitted.
+    FrameCounters mFrameCounters;
 
-    ComPtr<ID3D12DescriptorHeap> mSrvDescriptorHeap = nullptr;
+    // Once the scene settled, frames should not touch the heap.  Debug builds
+    // count the main thread's allocations from Update to the end of Draw and
+    // assert when every one of SteadyStateFrames frames in a row allocated.
+    static const UINT SteadyStateFrames = 120;
+    uint64_t mFrameHeapAllocations = 0;
+    UINT mAllocatingFrames = 0;
 
-    UINT mCbvSrvDescriptorSize = 0;
+    ApiTraceWriter mTrace;
+    // Set by ApiTracePlayer, which supplies the camera and wireframe state
+    // instead of the keyboard.
+    bool mReplaying = false;
 
-    std::unordered_map<std::string, std::unique_ptr<MeshGeometry>> mGeometries;
+    ComPtr<ID3D12RootSignature> mRootSignature = nullptr;
+    ComPtr<ID3D12DescriptorHeap> mCbvHeap = nullptr;
+
+    // Bindless SRV table; materials store their texture's slot in it.
+    TextureSrvTable mTextureSrvs;
+    UINT mTextureTableSize = 0;
+    // Texture table references given up while the GPU may still use the
+    // slot; released once the fence passes Fence.
+    struct RetiredTextureSrv
+    {
+        ID3D12Resource* Resource = nullptr;
+        UINT64 Fence = 0;
+    };
+    std::vector<RetiredTextureSrv> mRetiredTextureSrvs;
+
+    // Geometries and textures are shared with mAssets and between objects
+    // built from identical data.
+    std::unordered_map<std::string, std::shared_ptr<MeshGeometry>> mGeometries;
     std::unordered_map<std::string, std::unique_ptr<Material>> mMaterials;
-    std::unordered_map<std::string, std::unique_ptr<Texture>> mTextures;
+    std::unordered_map<std::string, std::shared_ptr<Texture>> mTextures;
     std::unordered_map<std::string, ComPtr<ID3DBlob>> mShaders;
-    std::unordered_map<std::string, ComPtr<ID3D12PipelineState>> mPSOs;
-    CD3DX12_CPU_DESCRIPTOR_HANDLE hDescriptor;
+    ShaderCache mShaderCache;
+    ShaderPermutations mPermutations;
+    bool mFogEnabled = false;
+
+    static const UINT MaxClusterLights = 4096;
+    LightManager mLights;
+    LightClusterBuilder mLightClusters;
+
+    ShadowCascades mShadows;
+    std::vector<BoundingBox> mCasterBounds;
+    std::vector<RenderItem*> mCasterItems;
+    std::vector<std::vector<RenderItem*>> mCascadeCasters;
+
+    OcclusionCuller mOcclusion;
+    bool mOcclusionCulling = true;
+
+    float mMinScreenSize = 1.0f;
+    std::array<UINT, MaxDrawCategories> mCategoryBudgets = {};
+    std::array<DrawCategoryStats, MaxDrawCategories> mDrawStats;
+
+    // Render items that passed CullRenderItems, in draw order; in the frame's arena.
+    struct VisibleItem
+    {
+        RenderItem* Item;
+        // Camera frustum in the item's local space, for its submeshes.
+        BoundingFrustum LocalFrustum;
+        bool LocalLights;
+        // Bounding sphere diameter in pixels.
+        float ScreenSize;
+    };
+    ArenaVector<VisibleItem> mVisibleItems;
+
+    CellGraph mCells;
+    // Per cell, from the last UpdateVisibleCells; only used while mCellCulling.
+    std::vector<uint8_t> mVisibleCells;
+    bool mCellCulling = false;
+    // Descriptions of the named pipelines; the states themselves live in mPipelines.
+    struct NamedPso
+    {
+        D3D12_GRAPHICS_PIPELINE_STATE_DESC Desc;
+        UINT64 Key = 0;
+    };
+    std::unordered_map<std::string, NamedPso> mPsoDescs;
+    // Looked up once, so drawing never builds a name string.
+    const NamedPso* mOpaquePso = nullptr;
+    const NamedPso* mWireframePso = nullptr;
+    // Pipelines of the pixel shader permutations, keyed by wireframe bit and packed key.
+    std::unordered_map<UINT64, NamedPso> mPermutationPsos;
+    // This frame's pipeline per material and local light flag, see MaterialPsoSlot;
+    // the first pair is for submeshes without a material.
+    std::vector<ID3D12PipelineState*> mMaterialPsos;
+    PipelineLibraryBackend mPipelineLibrary;
+    PipelineCache mPipelines;
+    UINT64 mRootSignatureHash = 0;
 
     std::unordered_map<std::string, std::vector<XMFLOAT3>> verts;
 
+    AssetCache mAssets;
+
     std::vector<D3D12_INPUT_ELEMENT_DESC> mInputLayout;
 
     Camera mCam;
@@ -198,6 +440,18 @@ private:
 
     // List of all the render items.
     std::vector<std::unique_ptr<RenderItem>> mAllRitems;
+    // World transforms of the render items, at their ObjCBIndex.  Contiguous,
+    // so UpdateObjectCBs composes and packs them in one batch.
+    std::vector<ObjectTransform> mObjectTransforms;
+    // Full matrices of the items DecomposeTransform rejected, written over
+    // the batch packed World; mObjectWorldSlots holds each item's entry or -1.
+    std::vector<ObjectWorldMatrix> mObjectWorlds;
+    std::vector<int> mObjectWorldSlots;
+    // Only the texture transforms that aren't identity.  They never change,
+    // so they are uploaded while mObjectTexFramesDirty counts down and the
+    // frame resources keep them after that.
+    std::vector<ObjectTexTransform> mObjectTexTransforms;
+    int mObjectTexFramesDirty = 0;
 
     // Render items divided by PSO.
     std::vector<RenderItem*> mOpaqueRitems;
@@ -0,0 +1,302 @@
+#include "LightClusters.h"
+#include "../../Common/Profiler.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace DirectX;
+
+namespace
+{
+    // Spot lights fade with pow(cos, SpotPower); past the angle where that
+    // drops below 1/256 the light cannot change an 8 bit pixel.
+    float SpotCutoffCos(float spotPower)
+    {
+        if (spotPower <= 0.0f)
+            return 0.0f;
+        return std::pow(1.0f / 256.0f, 1.0f / spotPower);
+    }
+
+    // Smallest sphere around a cone of the given range and half angle.
+    void ConeBoundingSphere(FXMVECTOR apex, FXMVECTOR dir, float range, float cosAngle,
+        XMVECTOR& center, float& radius)
+    {
+        if (cosAngle <= 0.0f)
+        {
+            center = apex;
+            radius = range;
+        }
+        else if (cosAngle < 0.70710678f)
+        {
+            // Wider than 90 degrees: the cap's rim decides.
+            const float sinAngle = std::sqrt(1.0f - cosAngle * cosAngle);
+            center = XMVectorMultiplyAdd(dir, XMVectorReplicate(range * cosAngle), apex);
+            radius = range * sinAngle;
+        }
+        else
+        {
+            radius = range / (2.0f * cosAngle);
+            center = XMVectorMultiplyAdd(dir, XMVectorReplicate(radius), apex);
+        }
+    }
+}
+
+void ClusterLightBounds(const ClusterLight& light, XMFLOAT3& center, float& radius)
+{
+    if (light.Type != ClusterLightSpot)
+    {
+        center = light.Position;
+        radius = light.FalloffEnd;
+        return;
+    }
+    XMVECTOR c;
+    ConeBoundingSphere(XMLoadFloat3(&light.Position), XMVector3Normalize(XMLoadFloat3(&light.Direction)),
+        light.FalloffEnd, SpotCutoffCos(light.SpotPower), c, radius);
+    XMStoreFloat3(&center, c);
+}
+
+LightClusterBuilder::LightClusterBuilder(const ClusterGrid& grid, uint32_t maxIndices)
+    : mGrid(grid), mMaxIndices(maxIndices)
+{
+    mRanges.resize(ClusterCount());
+}
+
+uint32_t LightClusterBuilder::ClusterCount()const
+{
+    return mGrid.TilesX * mGrid.TilesY * mGrid.Slices;
+}
+
+uint32_t LightClusterBuilder::MaxIndices()const
+{
+    return mMaxIndices;
+}
+
+const ClusterGrid& LightClusterBuilder::Grid()const
+{
+    return mGrid;
+}
+
+const std::vector<ClusterRange>& LightClusterBuilder::Ranges()const
+{
+    return mRanges;
+}
+
+const std::vector<uint32_t>& LightClusterBuilder::Indices()const
+{
+    return mIndices;
+}
+
+const ClusterStats& LightClusterBuilder::Stats()const
+{
+    return mStats;
+}
+
+uint32_t LightClusterBuilder::ClusterIndex(uint32_t x, uint32_t y, uint32_t z)const
+{
+    return (z * mGrid.TilesY + y) * mGrid.TilesX + x;
+}
+
+uint32_t LightClusterBuilder::SliceOf(float viewZ)const
+{
+    // Same formula as the pixel shader.
+    const float slice = std::log(viewZ) * mSliceScale + mSliceBias;
+    return (uint32_t)std::min(std::max(slice, 0.0f), (float)(mGrid.Slices - 1));
+}
+
+void LightClusterBuilder::SetProjection(float fovY, float aspect, float nearZ, float farZ)
+{
+    if (fovY == mFovY && aspect == mAspect && nearZ == mNearZ && farZ == mFarZ && !mBounds.empty())
+        return;
+    mFovY = fovY;
+    mAspect = aspect;
+    mNearZ = nearZ;
+    mFarZ = farZ;
+
+    mProjY = 1.0f / std::tan(0.5f * fovY);
+    mProjX = mProjY / aspect;
+
+    // Exponential slices: each one is the same fraction deeper than the last,
+    // which keeps froxels roughly cubic.
+    const float logRange = std::log(farZ / nearZ);
+    mSliceScale = mGrid.Slices / logRange;
+    mSliceBias = -(float)mGrid.Slices * std::log(nearZ) / logRange;
+
+    mBounds.resize(ClusterCount());
+    for (uint32_t z = 0; z < mGrid.Slices; ++z)
+    {
+        const float z0 = nearZ * std::pow(farZ / nearZ, (float)z / mGrid.Slices);
+        const float z1 = nearZ * std::pow(farZ / nearZ, (float)(z + 1) / mGrid.Slices);
+        for (uint32_t y = 0; y < mGrid.TilesY; ++y)
+        {
+            // Tile rows count down from the top of the screen.
+            const float ny0 = 1.0f - 2.0f * (y + 1) / mGrid.TilesY;
+            const float ny1 = 1.0f - 2.0f * y / mGrid.TilesY;
+            for (uint32_t x = 0; x < mGrid.TilesX; ++x)
+            {
+                const float nx0 = -1.0f + 2.0f * x / mGrid.TilesX;
+                const float nx1 = -1.0f + 2.0f * (x + 1) / mGrid.TilesX;
+
+                // The tile's side planes pass through the eye, so its extent
+                // at either slice depth bounds it in between.
+                ClusterBounds& b = mBounds[ClusterIndex(x, y, z)];
+                b.Min.x = std::min(nx0 * z0, nx0 * z1) / mProjX;
+                b.Max.x = std::max(nx1 * z0, nx1 * z1) / mProjX;
+                b.Min.y = std::min(ny0 * z0, ny0 * z1) / mProjY;
+                b.Max.y = std::max(ny1 * z0, ny1 * z1) / mProjY;
+                b.Min.z = z0;
+                b.Max.z = z1;
+            }
+        }
+    }
+}
+
+void LightClusterBuilder::Build(FXMMATRIX view, const ClusterLight* lights, size_t count)
+{
+    PROFILE_FUNCTION();
+    mStats = ClusterStats();
+    mStats.Lights = (uint32_t)count;
+    mPairs.clear();
+
+    const uint32_t tilesX = mGrid.TilesX;
+    const uint32_t tilesY = mGrid.TilesY;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const ClusterLight& light = lights[i];
+        const float range = light.FalloffEnd;
+        const XMVECTOR apex = XMVector3TransformCoord(XMLoadFloat3(&light.Position), view);
+
+        XMVECTOR center = apex;
+        float radius = range;
+        XMVECTOR dir = XMVectorZero();
+        float cosAngle = 0.0f, sinAngle = 1.0f;
+        const bool spot = light.Type == ClusterLightSpot;
+        if (spot)
+        {
+            dir = XMVector3Normalize(XMVector3TransformNormal(XMLoadFloat3(&light.Direction), view));
+            cosAngle = SpotCutoffCos(light.SpotPower);
+            sinAngle = std::sqrt(1.0f - cosAngle * cosAngle);
+            ConeBoundingSphere(apex, dir, range, cosAngle, center, radius);
+        }
+
+        XMFLOAT3 c;
+        XMStoreFloat3(&c, center);
+        if (c.z + radius < mNearZ || c.z - radius > mFarZ)
+            continue;
+
+        const uint32_t z0 = SliceOf(std::max(c.z - radius, mNearZ));
+        const uint32_t z1 = SliceOf(std::min(c.z + radius, mFarZ));
+
+        // Screen rectangle of the sphere's view space box; the whole screen
+        // when it reaches the near plane.
+        uint32_t x0 = 0, x1 = tilesX - 1, y0 = 0, y1 = tilesY - 1;
+        const float nearDepth = c.z - radius;
+        if (nearDepth > mNearZ)
+        {
+            const float farDepth = c.z + radius;
+            const float minX = mProjX * std::min((c.x - radius) / nearDepth, (c.x - radius) / farDepth);
+            const float maxX = mProjX * std::max((c.x + radius) / nearDepth, (c.x + radius) / farDepth);
+            const float minY = mProjY * std::min((c.y - radius) / nearDepth, (c.y - radius) / farDepth);
+            const float maxY = mProjY * std::max((c.y + radius) / nearDepth, (c.y + radius) / farDepth);
+            if (maxX < -1.0f || minX > 1.0f || maxY < -1.0f || minY > 1.0f)
+                continue;
+
+            auto tile = [](float ndc, uint32_t tiles)
+            {
+                return (uint32_t)std::min(std::max(ndc * 0.5f * tiles, 0.0f), (float)(tiles - 1));
+            };
+            x0 = tile(minX + 1.0f, tilesX);
+            x1 = tile(maxX + 1.0f, tilesX);
+            y0 = tile(1.0f - maxY, tilesY);
+            y1 = tile(1.0f - minY, tilesY);
+        }
+
+        const XMVECTOR radiusSq = XMVectorReplicate(radius * radius);
+        const XMVECTOR cosV = XMVectorReplicate(cosAngle);
+        const XMVECTOR sinV = XMVectorReplicate(sinAngle);
+        const XMVECTOR rangeV = XMVectorReplicate(range);
+        const size_t firstPair = mPairs.size();
+        for (uint32_t z = z0; z <= z1; ++z)
+        {
+            for (uint32_t y = y0; y <= y1; ++y)
+            {
+                for (uint32_t x = x0; x <= x1; ++x)
+                {
+                    const uint32_t cluster = ClusterIndex(x, y, z);
+                    const ClusterBounds& b = mBounds[cluster];
+                    const XMVECTOR bmin = XMLoadFloat3(&b.Min);
+                    const XMVECTOR bmax = XMLoadFloat3(&b.Max);
+
+                    // Squared distance from the sphere center to the box.
+                    XMVECTOR d = XMVectorMax(XMVectorSubtract(bmin, center), XMVectorSubtract(center, bmax));
+                    d = XMVectorMax(d, XMVectorZero());
+                    if (XMVector3Greater(XMVector3Dot(d, d), radiusSq))
+                        continue;
+
+                    if (spot)
+                    {
+                        // Cone against the froxel's bounding sphere.
+                        const XMVECTOR half = XMVectorScale(XMVectorSubtract(bmax, bmin), 0.5f);
+                        const XMVECTOR sphereR = XMVector3Length(half);
+                        const XMVECTOR v = XMVectorSubtract(XMVectorAdd(bmin, half), apex);
+                        const XMVECTOR lenSq = XMVector3Dot(v, v);
+                        const XMVECTOR along = XMVector3Dot(v, dir);
+                        const XMVECTOR across = XMVectorSqrt(XMVectorMax(
+                            XMVectorSubtract(lenSq, XMVectorMultiply(along, along)), XMVectorZero()));
+                        const XMVECTOR closest = XMVectorSubtract(XMVectorMultiply(cosV, across), XMVectorMultiply(along, sinV));
+                        if (XMVector3Greater(closest, sphereR) ||
+                            XMVector3Greater(along, XMVectorAdd(sphereR, rangeV)) ||
+                            XMVector3Less(along, XMVectorNegate(sphereR)))
+                            continue;
+                    }
+
+                    mPairs.push_back(((uint64_t)cluster << 32) | (uint32_t)i);
+                }
+            }
+        }
+        if (mPairs.size() != firstPair)
+            ++mStats.VisibleLights;
+    }
+
+    // Group by cluster with a counting sort; lights keep their order inside a cluster.
+    for (ClusterRange& r : mRanges)
+        r = ClusterRange();
+    for (uint64_t pair : mPairs)
+        ++mRanges[(uint32_t)(pair >> 32)].Count;
+
+    uint32_t offset = 0;
+    for (ClusterRange& r : mRanges)
+    {
+        r.Offset = offset;
+        offset += r.Count;
+        mStats.MaxPerCluster = std::max(mStats.MaxPerCluster, r.Count);
+    }
+
+    // Pairs past the end of the index list are dropped, so the far slices
+    // lose lights first.
+    mIndices.resize(std::min<size_t>(mPairs.size(), mMaxIndices));
+    mFill.assign(mRanges.size(), 0);
+    for (uint64_t pair : mPairs)
+    {
+        const uint32_t cluster = (uint32_t)(pair >> 32);
+        const uint32_t slot = mRanges[cluster].Offset + mFill[cluster]++;
+        if (slot < mIndices.size())
+            mIndices[slot] = (uint32_t)pair;
+    }
+    for (ClusterRange& r : mRanges)
+    {
+        if (r.Offset + r.Count > mIndices.size())
+            r.Count = r.Offset < mIndices.size() ? (uint32_t)mIndices.size() - r.Offset : 0;
+    }
+
+    mStats.Indices = (uint32_t)mIndices.size();
+    mStats.Dropped = (uint32_t)(mPairs.size() - mIndices.size());
+}
+
+void LightClusterBuilder::ShaderParams(uint32_t width, uint32_t height, XMUINT4& dims, XMFLOAT4& params)const
+{
+    dims = XMUINT4(mGrid.TilesX, mGrid.TilesY, mGrid.Slices, 0);
+    params.x = mSliceScale;
+    params.y = mSliceBias;
+    params.z = (float)mGrid.TilesX / std::max(width, 1u);
+    params.w = (float)mGrid.TilesY / std::max(height, 1u);
+}
@@ -0,0 +1,116 @@
+#pragma once
+#include <DirectXMath.h>
+#include <cstdint>
+#include <vector>
+
+// Clustered forward lighting, CPU side.  The view frustum is cut into a grid
+// of froxels (screen tiles times exponential depth slices); every point and
+// spot light is binned into the froxels its falloff volume touches, and the
+// pixel shader only walks the lights of its own froxel.  Nothing here touches
+// D3D, so binning can be timed and checked without a device.
+
+enum ClusterLightType : uint32_t
+{
+    ClusterLightPoint = 0,
+    ClusterLightSpot = 1
+};
+
+// Layout matches ClusterLight in Default.hlsl: a Light followed by its type.
+struct ClusterLight
+{
+    DirectX::XMFLOAT3 Strength = { 0.5f, 0.5f, 0.5f };
+    float FalloffStart = 1.0f;
+    DirectX::XMFLOAT3 Direction = { 0.0f, -1.0f, 0.0f };   // spot light only
+    float FalloffEnd = 10.0f;
+    DirectX::XMFLOAT3 Position = { 0.0f, 0.0f, 0.0f };
+    float SpotPower = 64.0f;                                // spot light only
+    uint32_t Type = ClusterLightPoint;
+    float Pad[3] = {};
+};
+
+// World space sphere around the light's falloff volume: the falloff sphere of
+// a point light, the tightest sphere around a spot light's cone.
+void ClusterLightBounds(const ClusterLight& light, DirectX::XMFLOAT3& center, float& radius);
+
+// Lights of one froxel are Indices[Offset, Offset + Count).
+struct ClusterRange
+{
+    uint32_t Offset = 0;
+    uint32_t Count = 0;
+};
+
+struct ClusterGrid
+{
+    uint32_t TilesX = 16;
+    uint32_t TilesY = 9;
+    uint32_t Slices = 24;
+};
+
+struct ClusterStats
+{
+    // Lights passed to Build and those that touched at least one froxel.
+    uint32_t Lights = 0;
+    uint32_t VisibleLights = 0;
+    // Light/froxel pairs written, and pairs dropped because the index list was full.
+    uint32_t Indices = 0;
+    uint32_t Dropped = 0;
+    uint32_t MaxPerCluster = 0;
+};
+
+class LightClusterBuilder
+{
+public:
+    explicit LightClusterBuilder(const ClusterGrid& grid = ClusterGrid(), uint32_t maxIndices = 1u << 17);
+
+    // Rebuilds the froxel bounds; cheap to call every frame, it only does work
+    // when the lens changed.
+    void SetProjection(float fovY, float aspect, float nearZ, float farZ);
+
+    // Bins lights, given in world space, for the camera's view matrix.
+    void Build(DirectX::FXMMATRIX view, const ClusterLight* lights, size_t count);
+
+    uint32_t ClusterCount()const;
+    uint32_t MaxIndices()const;
+    const ClusterGrid& Grid()const;
+    const std::vector<ClusterRange>& Ranges()const;
+    const std::vector<uint32_t>& Indices()const;
+    const ClusterStats& Stats()const;
+
+    // Constants for the pixel shader to find its froxel: dims is the grid,
+    // params holds the log depth scale and bias and the reciprocal tile size
+    // in pixels for a width x height render target.
+    void ShaderParams(uint32_t width, uint32_t height, DirectX::XMUINT4& dims, DirectX::XMFLOAT4& params)const;
+
+private:
+    struct ClusterBounds
+    {
+        DirectX::XMFLOAT3 Min;
+        DirectX::XMFLOAT3 Max;
+    };
+
+    uint32_t SliceOf(float viewZ)const;
+    uint32_t ClusterIndex(uint32_t x, uint32_t y, uint32_t z)const;
+
+    ClusterGrid mGrid;
+    uint32_t mMaxIndices;
+
+    float mFovY = 0.0f;
+    float mAspect = 0.0f;
+    float mNearZ = 0.0f;
+    float mFarZ = 0.0f;
+    float mSliceScale = 0.0f;
+    float mSliceBias = 0.0f;
+    // Projection scale of x and y (P00 and P11).
+    float mProjX = 1.0f;
+    float mProjY = 1.0f;
+
+    std::vector<ClusterBounds> mBounds;
+
+    // (cluster, light) pairs of the last Build before they are grouped by cluster.
+    std::vector<uint64_t> mPairs;
+    // Per cluster write cursor while scattering mPairs into mIndices.
+    std::vector<uint32_t> mFill;
+    std::vector<ClusterRange> mRanges;
+    std::vector<uint32_t> mIndices;
+    ClusterStats mStats;
+};
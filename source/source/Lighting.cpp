@@ -1,34 +1,468 @@
 #include "Lighting.h"
+#include <algorithm>
+#include <cfloat>
 
-void Light_c::set_lights(PassConstants* pc){
-	for (short i = 0; i < count_light; ++i) {
-		pc->Lights[i].Direction = pos_dir_m[i];
-		pc->Lights[i].Position = pos_dir_m[i];
-		pc->Lights[i].Strength = strength_m[i];
-		pc->AmbientLight = ambient_m;
+using namespace DirectX;
+
+namespace
+{
+	// Lights per leaf of the light tree.
+	const uint32_t LightTreeLeafSize = 4;
+	// Moved lights are refit into the tree in place until its node boxes add
+	// up to this much more surface than right after the last build.
+	const float LightTreeRefitLimit = 2.0f;
+
+	float SurfaceArea(const BoundingBox& box)
+	{
+		const XMFLOAT3& e = box.Extents;
+		return 8.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+	}
+
+	ClusterLight ToClusterLight(const LightDesc& desc)
+	{
+		ClusterLight light;
+		light.Type = desc.Type == LightSpot ? ClusterLightSpot : ClusterLightPoint;
+		light.Strength = desc.Strength;
+		light.FalloffStart = desc.FalloffStart;
+		XMStoreFloat3(&light.Direction, XMVector3Normalize(XMLoadFloat3(&desc.Direction)));
+		light.FalloffEnd = desc.FalloffEnd;
+		light.Position = desc.Position;
+		light.SpotPower = desc.SpotPower;
+		return light;
+	}
+
+	// Whether a change from a to b can move the light's bounds.
+	bool SameVolume(const LightDesc& a, const LightDesc& b)
+	{
+		return a.Type == b.Type &&
+			a.Position.x == b.Position.x && a.Position.y == b.Position.y && a.Position.z == b.Position.z &&
+			a.Direction.x == b.Direction.x && a.Direction.y == b.Direction.y && a.Direction.z == b.Direction.z &&
+			a.FalloffEnd == b.FalloffEnd && a.SpotPower == b.SpotPower;
+	}
+}
+
+LightManager::LightManager(UINT maxLocalLights)
+	: mMaxLocalLights(maxLocalLights)
+{
+}
+
+LightManager::Slot* LightManager::Find(LightHandle light)
+{
+	if (light.Index >= mSlots.size())
+		return nullptr;
+	Slot& slot = mSlots[light.Index];
+	return slot.Alive && slot.Generation == light.Generation ? &slot : nullptr;
+}
+
+const LightManager::Slot* LightManager::Find(LightHandle light)const
+{
+	return const_cast<LightManager*>(this)->Find(light);
+}
+
+LightHandle LightManager::Create(const LightDesc& desc)
+{
+	if (desc.Type != LightDirectional && mLocal.size() >= mMaxLocalLights)
+		return LightHandle();
+
+	uint32_t index;
+	if (!mFreeSlots.empty())
+	{
+		index = mFreeSlots.back();
+		mFreeSlots.pop_back();
 	}
+	else
+	{
+		index = (uint32_t)mSlots.size();
+		mSlots.emplace_back();
+	}
+
+	Slot& slot = mSlots[index];
+	slot.Desc = desc;
+	slot.Alive = true;
+	Pack(index);
+
+	LightHandle light;
+	light.Index = index;
+	light.Generation = slot.Generation;
+	return light;
+}
+
+bool LightManager::Update(LightHandle light, const LightDesc& desc)
+{
+	Slot* slot = Find(light);
+	if (slot == nullptr)
+		return false;
+
+	const bool wasLocal = slot->Desc.Type != LightDirectional;
+	const bool isLocal = desc.Type != LightDirectional;
+	if (wasLocal != isLocal)
+	{
+		if (isLocal && mLocal.size() >= mMaxLocalLights)
+			return false;
+		Unpack(light.Index);
+		slot->Desc = desc;
+		Pack(light.Index);
+		return true;
+	}
+
+	if (isLocal)
+	{
+		// Only the bounds changed; the tree keeps its shape and is refit.
+		if (!SameVolume(slot->Desc, desc) && !mTreeDirty)
+			mMovedLights.push_back(slot->Packed);
+		mLocal[slot->Packed] = ToClusterLight(desc);
+		mLocalFramesDirty[slot->Packed] = gNumFrameResources;
+	}
+	else
+	{
+		mPassDirty = true;
+	}
+	slot->Desc = desc;
+	return true;
+}
+
+bool LightManager::Destroy(LightHandle light)
+{
+	Slot* slot = Find(light);
+	if (slot == nullptr)
+		return false;
+
+	Unpack(light.Index);
+	slot->Alive = false;
+	++slot->Generation;
+	mFreeSlots.push_back(light.Index);
+	return true;
+}
+
+bool LightManager::IsValid(LightHandle light)const
+{
+	return Find(light) != nullptr;
+}
+
+const LightDesc* LightManager::Get(LightHandle light)const
+{
+	const Slot* slot = Find(light);
+	return slot ? &slot->Desc : nullptr;
+}
+
+void LightManager::ClearLocal()
+{
+	while (!mLocalSlots.empty())
+	{
+		LightHandle light;
+		light.Index = mLocalSlots.back();
+		light.Generation = mSlots[light.Index].Generation;
+		Destroy(light);
+	}
+}
+
+void LightManager::Pack(uint32_t index)
+{
+	Slot& slot = mSlots[index];
+	if (slot.Desc.Type == LightDirectional)
+	{
+		slot.Packed = (uint32_t)mDirectional.size();
+		mDirectional.push_back(index);
+		mPassDirty = true;
+	}
+	else
+	{
+		slot.Packed = (uint32_t)mLocal.size();
+		mLocal.push_back(ToClusterLight(slot.Desc));
+		mLocalSlots.push_back(index);
+		mLocalFramesDirty.push_back(gNumFrameResources);
+		mTreeDirty = true;
+	}
+}
+
+void LightManager::Unpack(uint32_t index)
+{
+	const Slot& slot = mSlots[index];
+	if (slot.Desc.Type == LightDirectional)
+	{
+		// Keep creation order, it is what EditLight indices refer to.
+		mDirectional.erase(mDirectional.begin() + slot.Packed);
+		for (uint32_t i = slot.Packed; i < mDirectional.size(); ++i)
+			mSlots[mDirectional[i]].Packed = i;
+		mPassDirty = true;
+	}
+	else
+	{
+		// Move the last light into the hole; only it has to be uploaded again.
+		const uint32_t last = (uint32_t)mLocal.size() - 1;
+		if (slot.Packed != last)
+		{
+			mLocal[slot.Packed] = mLocal[last];
+			mLocalSlots[slot.Packed] = mLocalSlots[last];
+			mLocalFramesDirty[slot.Packed] = gNumFrameResources;
+			mSlots[mLocalSlots[slot.Packed]].Packed = slot.Packed;
+		}
+		mLocal.pop_back();
+		mLocalSlots.pop_back();
+		mLocalFramesDirty.pop_back();
+		mTreeDirty = true;
+	}
+}
+
+void LightManager::SetAmbient(const XMFLOAT4& ambient)
+{
+	mAmbient = ambient;
+	mPassDirty = true;
 }
 
-void Light_c::set_light(DirectX::XMFLOAT3 pos_dir, DirectX::XMFLOAT3 strength)
+const XMFLOAT4& LightManager::Ambient()const
 {
-	pos_dir_m.push_back(pos_dir);
-	strength_m.push_back(strength);
-	++count_light;
+	return mAmbient;
+}
+
+UINT LightManager::DirectionalCount()const
+{
+	return (UINT)mDirectional.size();
+}
+
+LightHandle LightManager::Directional(UINT index)const
+{
+	LightHandle light;
+	if (index < mDirectional.size())
+	{
+		light.Index = mDirectional[index];
+		light.Generation = mSlots[light.Index].Generation;
+	}
+	return light;
+}
+
+UINT LightManager::LocalCount()const
+{
+	return (UINT)mLocal.size();
+}
+
+UINT LightManager::MaxLocalLights()const
+{
+	return mMaxLocalLights;
+}
+
+bool LightManager::PackPassLights(PassConstants& pc)
+{
+	if (!mPassDirty)
+		return false;
+
+	pc.AmbientLight = mAmbient;
+	const size_t count = std::min<size_t>(mDirectional.size(), MaxLights);
+	for (size_t i = 0; i < count; ++i)
+	{
+		const LightDesc& desc = mSlots[mDirectional[i]].Desc;
+		pc.Lights[i].Strength = desc.Strength;
+		pc.Lights[i].Direction = desc.Direction;
+	}
+	mPassDirty = false;
+	return true;
+}
+
+const std::vector<ClusterLight>& LightManager::LocalLights()const
+{
+	return mLocal;
+}
+
+void LightManager::UploadLocalLights(UploadBuffer<ClusterLight>& buffer)
+{
+	for (size_t i = 0; i < mLocal.size(); ++i)
+	{
+		if (mLocalFramesDirty[i] > 0)
+		{
+			buffer.CopyData((int)i, mLocal[i]);
+			--mLocalFramesDirty[i];
+		}
+	}
+}
+
+void LightManager::MarkAllDirty()
+{
+	std::fill(mLocalFramesDirty.begin(), mLocalFramesDirty.end(), gNumFrameResources);
+	mPassDirty = true;
+}
+
+void LightManager::RebuildTree()
+{
+	const uint32_t count = (uint32_t)mLocal.size();
+	mLocalBounds.resize(count);
+	mTreeItems.resize(count);
+	mTreeLeaves.resize(count);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		ClusterLightBounds(mLocal[i], mLocalBounds[i].Center, mLocalBounds[i].Radius);
+		mTreeItems[i] = i;
+	}
+
+	mTree.clear();
+	if (count > 0)
+	{
+		mTree.reserve(2 * count);
+		mTree.emplace_back();
+		BuildNode(0, 0, count);
+	}
+
+	mTreeArea = 0.0f;
+	for (const TreeNode& node : mTree)
+		mTreeArea += SurfaceArea(node.Bounds);
+	mBuiltTreeArea = mTreeArea;
+	mMovedLights.clear();
+	mTreeDirty = false;
+}
+
+void LightManager::RefitTree()
+{
+	for (uint32_t packed : mMovedLights)
+		ClusterLightBounds(mLocal[packed], mLocalBounds[packed].Center, mLocalBounds[packed].Radius);
+
+	// A leaf shared by several moved lights, or an ancestor of several, is
+	// merged more than once; the result is the same and the walks are short.
+	for (uint32_t packed : mMovedLights)
+	{
+		int node = (int)mTreeLeaves[packed];
+		while (node >= 0)
+		{
+			TreeNode& n = mTree[node];
+			const float area = SurfaceArea(n.Bounds);
+			if (n.Left < 0)
+			{
+				XMVECTOR boxMin = XMVectorReplicate(FLT_MAX);
+				XMVECTOR boxMax = XMVectorReplicate(-FLT_MAX);
+				for (uint32_t i = n.First; i < n.First + n.Count; ++i)
+				{
+					const BoundingSphere& s = mLocalBounds[mTreeItems[i]];
+					const XMVECTOR c = XMLoadFloat3(&s.Center);
+					const XMVECTOR r = XMVectorReplicate(s.Radius);
+					boxMin = XMVectorMin(boxMin, XMVectorSubtract(c, r));
+					boxMax = XMVectorMax(boxMax, XMVectorAdd(c, r));
+				}
+				BoundingBox::CreateFromPoints(n.Bounds, boxMin, boxMax);
+			}
+			else
+			{
+				BoundingBox::CreateMerged(n.Bounds, mTree[n.Left].Bounds, mTree[n.Left + 1].Bounds);
+			}
+			mTreeArea += SurfaceArea(n.Bounds) - area;
+			node = n.Parent;
+		}
+	}
+	mMovedLights.clear();
+
+	// Lights that drifted apart from their leaf mates leave loose boxes that
+	// every query has to open; past the limit a rebuild regroups them.
+	if (mTreeArea > mBuiltTreeArea * LightTreeRefitLimit)
+		RebuildTree();
+}
+
+void LightManager::BuildNode(uint32_t node, uint32_t first, uint32_t count)
+{
+	XMVECTOR boxMin = XMVectorReplicate(FLT_MAX);
+	XMVECTOR boxMax = XMVectorReplicate(-FLT_MAX);
+	XMVECTOR centerMin = boxMin;
+	XMVECTOR centerMax = boxMax;
+	for (uint32_t i = first; i < first + count; ++i)
+	{
+		const BoundingSphere& s = mLocalBounds[mTreeItems[i]];
+		const XMVECTOR c = XMLoadFloat3(&s.Center);
+		const XMVECTOR r = XMVectorReplicate(s.Radius);
+		boxMin = XMVectorMin(boxMin, XMVectorSubtract(c, r));
+		boxMax = XMVectorMax(boxMax, XMVectorAdd(c, r));
+		centerMin = XMVectorMin(centerMin, c);
+		centerMax = XMVectorMax(centerMax, c);
+	}
+	BoundingBox::CreateFromPoints(mTree[node].Bounds, boxMin, boxMax);
+
+	if (count <= LightTreeLeafSize)
+	{
+		mTree[node].Left = -1;
+		mTree[node].First = first;
+		mTree[node].Count = count;
+		for (uint32_t i = first; i < first + count; ++i)
+			mTreeLeaves[mTreeItems[i]] = node;
+		return;
+	}
+
+	// Median split along the axis the light centers spread the most.
+	XMFLOAT3 extent;
+	XMStoreFloat3(&extent, XMVectorSubtract(centerMax, centerMin));
+	int axis = 0;
+	if (extent.y > extent.x)
+		axis = 1;
+	if (extent.z > (&extent.x)[axis])
+		axis = 2;
+
+	const uint32_t half = count / 2;
+	std::nth_element(mTreeItems.begin() + first, mTreeItems.begin() + first + half, mTreeItems.begin() + first + count,
+		[this, axis](uint32_t a, uint32_t b)
+		{
+			return (&mLocalBounds[a].Center.x)[axis] < (&mLocalBounds[b].Center.x)[axis];
+		});
+
+	const uint32_t left = (uint32_t)mTree.size();
+	mTree.emplace_back();
+	mTree.emplace_back();
+	mTree[node].Left = (int)left;
+	mTree[left].Parent = (int)node;
+	mTree[left + 1].Parent = (int)node;
+	BuildNode(left, first, half);
+	BuildNode(left + 1, first + half, count - half);
+}
+
+template<typename Volume>
+bool LightManager::Query(const Volume& volume, std::vector<LightHandle>* lights)
+{
+	if (mTreeDirty)
+		RebuildTree();
+	else if (!mMovedLights.empty())
+		RefitTree();
+	if (mTree.empty())
+		return false;
+
+	bool found = false;
+	uint32_t stack[64];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		const TreeNode& node = mTree[stack[--top]];
+		if (!node.Bounds.Intersects(volume))
+			continue;
+
+		if (node.Left >= 0)
+		{
+			stack[top++] = node.Left;
+			stack[top++] = node.Left + 1;
+			continue;
+		}
+
+		for (uint32_t i = node.First; i < node.First + node.Count; ++i)
+		{
+			const uint32_t packed = mTreeItems[i];
+			if (!mLocalBounds[packed].Intersects(volume))
+				continue;
+			found = true;
+			if (lights == nullptr)
+				return true;
+
+			LightHandle light;
+			light.Index = mLocalSlots[packed];
+			light.Generation = mSlots[light.Index].Generation;
+			lights->push_back(light);
+		}
+	}
+	return found;
 }
 
-void Light_c::set_ambient(DirectX::XMFLOAT4 amb)
+void LightManager::QueryLocal(const BoundingBox& box, std::vector<LightHandle>& lights)
 {
-	ambient_m = amb;
-	++count_light;
+	Query(box, &lights);
 }
 
-void Light_c::edit_light(DirectX::XMFLOAT3 pos, DirectX::XMFLOAT3 str, unsigned int index)
+void LightManager::QueryLocal(const BoundingSphere& sphere, std::vector<LightHandle>& lights)
 {
-	pos_dir_m[index] = pos;
-	strength_m[index] = str;
+	Query(sphere, &lights);
 }
 
-void Light_c::edit_ambient(DirectX::XMFLOAT4 amb)
+bool LightManager::AnyLocal(const BoundingBox& box)
 {
-	ambient_m = amb;
+	return Query(box, nullptr);
 }
@@ -1,18 +1,143 @@
 #pragma once
-#include "../../Common/d3dApp.h"
 #include "FrameResource.h"
+#include <DirectXCollision.h>
 
-class Light_c {
-protected:
-	void set_lights(PassConstants* pc);
-	void set_light(DirectX::XMFLOAT3, DirectX::XMFLOAT3);
-	void set_ambient(DirectX::XMFLOAT4);
-	void edit_light(DirectX::XMFLOAT3, DirectX::XMFLOAT3, unsigned int index);
-	void edit_ambient(DirectX::XMFLOAT4);
-protected:
-	int count_light = -1;
-
-	std::vector<DirectX::XMFLOAT3> pos_dir_m;
-	std::vector<DirectX::XMFLOAT3> strength_m;
-	DirectX::XMFLOAT4 ambient_m;
-};
\ No newline at end of file
+enum LightType : uint32_t
+{
+	LightDirectional,
+	LightPoint,
+	LightSpot
+};
+
+// Direction is used by directional and spot lights; Position and the falloff
+// by point and spot lights; SpotPower by spot lights only.
+struct LightDesc
+{
+	LightType Type = LightDirectional;
+	DirectX::XMFLOAT3 Strength = { 0.5f, 0.5f, 0.5f };
+	DirectX::XMFLOAT3 Direction = { 0.57735f, -0.57735f, 0.57735f };
+	DirectX::XMFLOAT3 Position = { 0.0f, 0.0f, 0.0f };
+	float FalloffStart = 1.0f;
+	float FalloffEnd = 10.0f;
+	float SpotPower = 64.0f;
+};
+
+// Names a light for as long as it lives.  The generation makes a handle to a
+// destroyed light invalid instead of aliasing the next light in its slot.
+struct LightHandle
+{
+	uint32_t Index = UINT32_MAX;
+	uint32_t Generation = 0;
+
+	bool operator==(const LightHandle& rhs)const { return Index == rhs.Index && Generation == rhs.Generation; }
+	bool operator!=(const LightHandle& rhs)const { return !(*this == rhs); }
+};
+
+// Owns the scene's lights.  Directional lights go into the pass constants,
+// point and spot lights are packed densely for the light clusters and indexed
+// by a bounding volume hierarchy over their falloff spheres.  Packing only
+// touches lights that changed.
+class LightManager
+{
+public:
+	explicit LightManager(UINT maxLocalLights);
+
+	// Returns an invalid handle when the local lights are full.
+	LightHandle Create(const LightDesc& desc);
+	// False when the handle is stale.
+	bool Update(LightHandle light, const LightDesc& desc);
+	bool Destroy(LightHandle light);
+	bool IsValid(LightHandle light)const;
+	const LightDesc* Get(LightHandle light)const;
+	// Destroys every point and spot light.
+	void ClearLocal();
+
+	void SetAmbient(const DirectX::XMFLOAT4& ambient);
+	const DirectX::XMFLOAT4& Ambient()const;
+
+	// Directional lights in creation order.
+	UINT DirectionalCount()const;
+	LightHandle Directional(UINT index)const;
+	UINT LocalCount()const;
+	UINT MaxLocalLights()const;
+
+	// Writes the ambient term and the first MaxLights directional lights when
+	// they changed since the last call; pc is expected to keep them otherwise.
+	bool PackPassLights(PassConstants& pc);
+
+	// Point and spot lights, packed; Build the light clusters from these.
+	const std::vector<ClusterLight>& LocalLights()const;
+	// Copies the packed lights this frame resource has not seen yet.  Call
+	// once per frame, with the frame resources in their usual rotation.
+	void UploadLocalLights(UploadBuffer<ClusterLight>& buffer);
+	// Uploads every light again, to frame resources that were just rebuilt.
+	void MarkAllDirty();
+
+	// Point and spot lights whose falloff volume may touch the volume.
+	void QueryLocal(const DirectX::BoundingBox& box, std::vector<LightHandle>& lights);
+	void QueryLocal(const DirectX::BoundingSphere& sphere, std::vector<LightHandle>& lights);
+	bool AnyLocal(const DirectX::BoundingBox& box);
+
+private:
+	struct Slot
+	{
+		LightDesc Desc;
+		uint32_t Generation = 0;
+		bool Alive = false;
+		// Position in mDirectional or mLocal.
+		uint32_t Packed = 0;
+	};
+
+	struct TreeNode
+	{
+		DirectX::BoundingBox Bounds;
+		// Children are Left and Left + 1; leaves have Left == -1 and own
+		// mTreeItems[First, First + Count).
+		int Left = -1;
+		int Parent = -1;
+		uint32_t First = 0;
+		uint32_t Count = 0;
+	};
+
+	Slot* Find(LightHandle light);
+	const Slot* Find(LightHandle light)const;
+	void Pack(uint32_t slot);
+	void Unpack(uint32_t slot);
+
+	// Lights are added or removed.
+	void RebuildTree();
+	// Lights only moved or changed range: recomputes the boxes of their leaves and
+	// ancestors, or rebuilds when the tree has grown too loose.
+	void RefitTree();
+	void BuildNode(uint32_t node, uint32_t first, uint32_t count);
+	// Appends the lights touching volume to lights, or with lights null
+	// stops at the first one.  True when any light was found.
+	template<typename Volume>
+	bool Query(const Volume& volume, std::vector<LightHandle>* lights);
+
+	UINT mMaxLocalLights;
+
+	std::vector<Slot> mSlots;
+	std::vector<uint32_t> mFreeSlots;
+
+	std::vector<uint32_t> mDirectional;
+	bool mPassDirty = true;
+	DirectX::XMFLOAT4 mAmbient = { 0.0f, 0.0f, 0.0f, 1.0f };
+
+	std::vector<ClusterLight> mLocal;
+	std::vector<uint32_t> mLocalSlots;
+	// Frame resources that still hold an old copy of each packed light.
+	std::vector<int> mLocalFramesDirty;
+
+	bool mTreeDirty = true;
+	std::vector<TreeNode> mTree;
+	std::vector<uint32_t> mTreeItems;
+	std::vector<DirectX::BoundingSphere> mLocalBounds;
+	// Leaf holding each packed light, for refits.
+	std::vector<uint32_t> mTreeLeaves;
+	// Packed lights whose bounds changed since the tree was last fit.
+	std::vector<uint32_t> mMovedLights;
+	// Summed node surface area, now and right after the last build.
+	float mTreeArea = 0.0f;
+	float mBuiltTreeArea = 0.0f;
+};
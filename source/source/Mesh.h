@@ -0,0 +1,46 @@
+#pragma once
+
+#include "../../Common/MathHelper.h"
+#include <DirectXCollision.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct Vertex
+{
+    DirectX::XMFLOAT3 Pos;
+    DirectX::XMFLOAT3 Normal;
+    DirectX::XMFLOAT2 TexC;
+};
+
+// Range of a Mesh's shared index buffer drawn with one material.  Indices
+// are local to the subset; BaseVertexLocation points at its first vertex.
+struct MeshSubset {
+    std::string Name;
+    // Slot into Mesh::materials.
+    uint32_t MaterialSlot = 0;
+    uint32_t IndexCount = 0;
+    uint32_t StartIndexLocation = 0;
+    int32_t BaseVertexLocation = 0;
+    DirectX::BoundingBox Bounds;
+};
+
+// Node of the imported scene hierarchy.  Transform is relative to Parent
+// (-1 for the root) and is already baked into the node's subset vertices.
+struct MeshNode {
+    std::string Name;
+    int Parent = -1;
+    DirectX::XMFLOAT4X4 Transform = MathHelper::Identity4x4();
+    std::vector<uint32_t> subsets;
+};
+
+struct Mesh {
+    std::vector<Vertex> vertices;
+    std::vector<uint16_t> indices;
+
+    std::vector<MeshSubset> subsets;
+    std::vector<MeshNode> nodes;
+    // Material names as stored in the source file, indexed by MeshSubset::MaterialSlot.
+    std::vector<std::string> materials;
+    DirectX::BoundingBox Bounds;
+};
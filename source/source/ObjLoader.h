@@ -4,84 +4,189 @@
 #include <assimp/postprocess.h>     // Post processing flags
 #include <DirectXMath.h>
 #include "FrameResource.h"
+#include "ObjParser.h"
+#include "AssetCache.h"
 
 class ObjLoader {
 public:
+    ObjLoader() = default;
+    // With a cache, repeated loads share one import and later launches read the cooked copy.
+    explicit ObjLoader(AssetCache* cache) : m_cache(cache) {}
+
     Mesh LoadObj(const std::string& pFile) {
+        m_err.clear();
+        if (m_cache)
+            return *LoadObjShared(pFile);
+        return import(pFile);
+    }
+    std::shared_ptr<const Mesh> LoadObjShared(const std::string& pFile) {
+        m_err.clear();
+        if (!m_cache)
+            return std::make_shared<const Mesh>(import(pFile));
+        return m_cache->LoadMesh(pFile, importer_name(pFile), [this](const std::string& path) { return import(path); });
+    }
+    std::string get_error() {
+        return m_err;
+    }
+    // True, the default, reads .obj files with the native parser and falls back
+    // to Assimp when it fails; false reads them with Assimp like every other format.
+    void use_native_obj(bool use) {
+        m_native_obj = use;
+    }
+
+private:
+    std::string m_err = "";
+    bool m_native_obj = true;
+    AssetCache* m_cache = nullptr;
+
+    Mesh import(const std::string& pFile) {
+        // Plain .obj files go through the native parser, Assimp handles everything else
+        // and any .obj the native parser rejects.
+        if (m_native_obj && has_obj_extension(pFile)) {
+            Mesh m_mesh;
+            ObjParser parser;
+            if (parser.Parse(pFile, m_mesh))
+                return m_mesh;
+            m_err = parser.get_error();
+        }
+
         // Create an instance of the Importer class
         Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(pFile, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace | aiProcess_PreTransformVertices);
+        // Indices are 16 bit, so meshes are split to stay below that, as ObjParser does.
+        importer.SetPropertyInteger(AI_CONFIG_PP_SLM_VERTEX_LIMIT, 0xFFFF);
+        const aiScene* scene = importer.ReadFile(pFile, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs |
+            aiProcess_CalcTangentSpace | aiProcess_SplitLargeMeshes);
 
         // If the import failed, report it
-        if (nullptr == scene) {
+        if (nullptr == scene || nullptr == scene->mRootNode) {
             m_err = importer.GetErrorString();
             return Mesh();
         }
+        for (unsigned int i = 0; i < scene->mNumMeshes; i++) {
+            if (scene->mMeshes[i]->mNumVertices > 0x10000) {
+                m_err = "mesh has more vertices than 16 bit indices can address";
+                return Mesh();
+            }
+        }
+        m_err.clear();
+
+        Mesh m_mesh;
+        for (unsigned int i = 0; i < scene->mNumMaterials; i++)
+        {
+            aiString name;
+            scene->mMaterials[i]->Get(AI_MATKEY_NAME, name);
+            m_mesh.materials.push_back(name.C_Str());
+        }
+
+        processNode(scene->mRootNode, scene, DirectX::XMMatrixIdentity(), -1, m_mesh);
 
-        return processNode(scene->mRootNode, scene);
+        if (!m_mesh.vertices.empty()) {
+            DirectX::BoundingBox::CreateFromPoints(m_mesh.Bounds, m_mesh.vertices.size(),
+                &m_mesh.vertices[0].Pos, sizeof(Vertex));
+        }
+        return m_mesh;
     }
-    std::string get_error() {
-        return m_err;
+
+    // Which path import() takes first; a native parse that falls back to Assimp
+    // does so for every load of the same file, so the name still keys one result.
+    std::string importer_name(const std::string& pFile) const {
+        return m_native_obj && has_obj_extension(pFile) ? "obj-native" : "assimp";
     }
 
-private:
-    std::string m_err = "";
-    std::vector<Vertex> mVertexes;
-    Mesh processNode(aiNode* node, const aiScene* scene)
+    static bool has_obj_extension(const std::string& pFile)
+    {
+        if (pFile.size() < 4)
+            return false;
+        std::string ext = pFile.substr(pFile.size() - 4);
+        std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return (char)tolower(c); });
+        return ext == ".obj";
+    }
+
+    static DirectX::XMMATRIX toXM(const aiMatrix4x4& m)
     {
-        // process each mesh located at the current node
-        std::vector<Vertex> vertices;
-        std::vector<uint16_t> indices;
+        // assimp stores column-vector matrices, DirectXMath expects row vectors
+        return DirectX::XMMatrixSet(
+            m.a1, m.b1, m.c1, m.d1,
+            m.a2, m.b2, m.c2, m.d2,
+            m.a3, m.b3, m.c3, m.d3,
+            m.a4, m.b4, m.c4, m.d4);
+    }
+
+    void processNode(aiNode* node, const aiScene* scene, DirectX::FXMMATRIX parentWorld, int parent, Mesh& out)
+    {
+        DirectX::XMMATRIX local = toXM(node->mTransformation);
+        DirectX::XMMATRIX world = DirectX::XMMatrixMultiply(local, parentWorld);
+        DirectX::XMMATRIX normalWorld = MathHelper::InverseTranspose(world);
+
+        MeshNode m_node;
+        m_node.Name = node->mName.C_Str();
+        m_node.Parent = parent;
+        DirectX::XMStoreFloat4x4(&m_node.Transform, local);
+
+        // process each mesh located at the current node, each one becomes a subset
+        // of the shared vertex/index buffers
         for (unsigned int i = 0; i < node->mNumMeshes; i++)
         {
-            // the node object only contains indices to index the actual objects in the scene. 
+            // the node object only contains indices to index the actual objects in the scene.
             // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
             aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
 
+            MeshSubset subset;
+            subset.Name = mesh->mName.length ? mesh->mName.C_Str() : m_node.Name;
+            subset.MaterialSlot = mesh->mMaterialIndex;
+            subset.StartIndexLocation = (UINT)out.indices.size();
+            subset.BaseVertexLocation = (INT)out.vertices.size();
+
             // walk through each of the mesh's vertices
-            for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+            for (unsigned int v = 0; v < mesh->mNumVertices; v++)
             {
-                Vertex vertex;
-                DirectX::XMFLOAT3 vector;
+                Vertex vertex = {};
                 // positions
-                vector.x = mesh->mVertices[i].x;
-                vector.y = mesh->mVertices[i].y;
-                vector.z = mesh->mVertices[i].z;
-                vertex.Pos = vector;
+                DirectX::XMVECTOR P = DirectX::XMVectorSet(mesh->mVertices[v].x, mesh->mVertices[v].y, mesh->mVertices[v].z, 1.0f);
+                DirectX::XMStoreFloat3(&vertex.Pos, DirectX::XMVector3TransformCoord(P, world));
                 // normals
                 if (mesh->HasNormals())
                 {
-                    vector.x = mesh->mNormals[i].x;
-                    vector.y = mesh->mNormals[i].y;
-                    vector.z = mesh->mNormals[i].z;
-                    vertex.Normal = vector;
+                    DirectX::XMVECTOR N = DirectX::XMVectorSet(mesh->mNormals[v].x, mesh->mNormals[v].y, mesh->mNormals[v].z, 0.0f);
+                    DirectX::XMStoreFloat3(&vertex.Normal, DirectX::XMVector3Normalize(DirectX::XMVector3TransformNormal(N, normalWorld)));
                 }
 
                 if (mesh->mTextureCoords[0]) // does the mesh contain texture coordinates?
                 {
-                    DirectX::XMFLOAT2 vec;
-                    vec.x = mesh->mTextureCoords[0][i].x;
-                    vec.y = mesh->mTextureCoords[0][i].y;
-                    vertex.TexC = vec;
+                    vertex.TexC.x = mesh->mTextureCoords[0][v].x;
+                    vertex.TexC.y = mesh->mTextureCoords[0][v].y;
                 }
 
-                vertices.push_back(vertex);
+                out.vertices.push_back(vertex);
             }
-            // now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
-            for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+            // now walk through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
+            // indices stay local to the subset, BaseVertexLocation offsets them at draw time.
+            for (unsigned int f = 0; f < mesh->mNumFaces; f++)
             {
-                aiFace face = mesh->mFaces[i];
+                const aiFace& face = mesh->mFaces[f];
                 // retrieve all indices of the face and store them in the indices vector
                 for (unsigned int j = 0; j < face.mNumIndices; j++)
-                    indices.push_back(face.mIndices[j]);
+                    out.indices.push_back((uint16_t)face.mIndices[j]);
             }
-            
+            subset.IndexCount = (UINT)out.indices.size() - subset.StartIndexLocation;
+
+            if (mesh->mNumVertices > 0)
+            {
+                DirectX::BoundingBox::CreateFromPoints(subset.Bounds, mesh->mNumVertices,
+                    &out.vertices[subset.BaseVertexLocation].Pos, sizeof(Vertex));
+            }
+
+            m_node.subsets.push_back((UINT)out.subsets.size());
+            out.subsets.push_back(subset);
         }
-        // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
-        Mesh m_mesh;
-        m_mesh.vertices = vertices;
-        m_mesh.indices = indices;
-        return m_mesh;
 
+        int index = (int)out.nodes.size();
+        out.nodes.push_back(m_node);
+
+        // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
+        for (unsigned int i = 0; i < node->mNumChildren; i++)
+        {
+            processNode(node->mChildren[i], scene, world, index, out);
+        }
     }
-};
\ No newline at end of file
+};
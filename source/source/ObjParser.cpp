@@ -0,0 +1,480 @@
+#include "ObjParser.h"
+#include "../../Common/MappedFile.h"
+#include "../../Common/Profiler.h"
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+using namespace DirectX;
+
+namespace
+{
+    // Chunks below this size are not worth a thread of their own.
+    const size_t MinChunkBytes = 256 * 1024;
+
+    // Bits of ObjCorner::rel, set when the index was negative (relative to the
+    // end of the list) and still needs the counts of the preceding chunks.
+    const uint8_t RelPos = 1;
+    const uint8_t RelTex = 2;
+    const uint8_t RelNorm = 4;
+
+    // One corner of a triangle.  Indices are zero based, -1 when absent.
+    struct ObjCorner {
+        int v = 0;
+        int vt = -1;
+        int vn = -1;
+        uint8_t rel = 0;
+    };
+
+    // usemtl, o or g seen before corner First of the chunk.
+    struct ObjEvent {
+        size_t First = 0;
+        bool IsMaterial = false;
+        std::string Name;
+    };
+
+    // Everything one worker read from its slice of the file.
+    struct ObjChunk {
+        std::vector<XMFLOAT3> positions;
+        std::vector<XMFLOAT2> texcoords;
+        std::vector<XMFLOAT3> normals;
+        std::vector<ObjCorner> corners;
+        std::vector<ObjEvent> events;
+    };
+
+    inline bool IsSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    inline bool IsDigit(char c) {
+        return (unsigned)(c - '0') < 10u;
+    }
+
+    inline const char* SkipSpace(const char* p, const char* end) {
+        while (p < end && IsSpace(*p))
+            ++p;
+        return p;
+    }
+
+    inline const char* SkipLine(const char* p, const char* end) {
+        while (p < end && *p != '\n')
+            ++p;
+        return p < end ? p + 1 : end;
+    }
+
+    inline double Pow10(int e) {
+        static const double table[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+        return e < 23 ? table[e] : pow(10.0, e);
+    }
+
+    // Branch-light decimal parser for the plain "-1.2345e-3" floats exporters
+    // write.  Accumulates up to 19 significant digits in an integer and applies
+    // the decimal exponent once, which is far cheaper than strtof's locale and
+    // hex/inf/nan handling.
+    const char* ParseFloat(const char* p, const char* end, float& out) {
+        p = SkipSpace(p, end);
+
+        bool neg = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            neg = *p == '-';
+            ++p;
+        }
+
+        uint64_t mantissa = 0;
+        int digits = 0;
+        int exponent = 0;
+        for (; p < end && IsDigit(*p); ++p) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits += mantissa != 0;
+            }
+            else {
+                ++exponent;
+            }
+        }
+        if (p < end && *p == '.') {
+            for (++p; p < end && IsDigit(*p); ++p) {
+                if (digits < 19) {
+                    mantissa = mantissa * 10 + (*p - '0');
+                    digits += mantissa != 0;
+                    --exponent;
+                }
+            }
+        }
+        if (p < end && (*p == 'e' || *p == 'E')) {
+            ++p;
+            bool expNeg = false;
+            if (p < end && (*p == '-' || *p == '+')) {
+                expNeg = *p == '-';
+                ++p;
+            }
+            int e = 0;
+            for (; p < end && IsDigit(*p); ++p) {
+                if (e < 10000)
+                    e = e * 10 + (*p - '0');
+            }
+            exponent += expNeg ? -e : e;
+        }
+
+        double value = (double)mantissa;
+        if (exponent < 0)
+            value /= Pow10(-exponent);
+        else if (exponent > 0)
+            value *= Pow10(exponent);
+
+        out = (float)(neg ? -value : value);
+        return p;
+    }
+
+    const char* ParseInt(const char* p, const char* end, int& out) {
+        bool neg = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            neg = *p == '-';
+            ++p;
+        }
+        int value = 0;
+        for (; p < end && IsDigit(*p); ++p)
+            value = value * 10 + (*p - '0');
+        out = neg ? -value : value;
+        return p;
+    }
+
+    // Turns a 1-based or negative OBJ index into a zero-based one.  Negative
+    // indices are relative to the entries read so far in this chunk and get
+    // flagged so the merge can add the counts of earlier chunks.
+    inline int ResolveIndex(int index, size_t localCount, uint8_t relBit, uint8_t& rel) {
+        if (index < 0) {
+            rel |= relBit;
+            return (int)localCount + index;
+        }
+        return index - 1;
+    }
+
+    // "v", "v/t", "v//n" or "v/t/n".
+    const char* ParseCorner(const char* p, const char* end, const ObjChunk& chunk, ObjCorner& c) {
+        int index = 0;
+        p = ParseInt(p, end, index);
+        c.v = ResolveIndex(index, chunk.positions.size(), RelPos, c.rel);
+        if (p < end && *p == '/') {
+            ++p;
+            if (p < end && *p != '/') {
+                p = ParseInt(p, end, index);
+                c.vt = ResolveIndex(index, chunk.texcoords.size(), RelTex, c.rel);
+            }
+            if (p < end && *p == '/') {
+                ++p;
+                p = ParseInt(p, end, index);
+                c.vn = ResolveIndex(index, chunk.normals.size(), RelNorm, c.rel);
+            }
+        }
+        return p;
+    }
+
+    std::string ParseName(const char* p, const char* end) {
+        p = SkipSpace(p, end);
+        const char* e = p;
+        while (e < end && *e != '\n' && *e != '\r')
+            ++e;
+        while (e > p && IsSpace(e[-1]))
+            --e;
+        return std::string(p, e);
+    }
+
+    void ParseChunk(const char* p, const char* end, ObjChunk& chunk) {
+        while (p < end) {
+            p = SkipSpace(p, end);
+            if (p >= end)
+                break;
+
+            if (p[0] == 'v' && p + 1 < end) {
+                if (IsSpace(p[1])) {
+                    XMFLOAT3 v;
+                    p = ParseFloat(p + 1, end, v.x);
+                    p = ParseFloat(p, end, v.y);
+                    p = ParseFloat(p, end, v.z);
+                    chunk.positions.push_back(v);
+                }
+                else if (p[1] == 't') {
+                    XMFLOAT2 t;
+                    p = ParseFloat(p + 2, end, t.x);
+                    p = ParseFloat(p, end, t.y);
+                    // Same convention as aiProcess_FlipUVs on the Assimp path.
+                    t.y = 1.0f - t.y;
+                    chunk.texcoords.push_back(t);
+                }
+                else if (p[1] == 'n') {
+                    XMFLOAT3 n;
+                    p = ParseFloat(p + 2, end, n.x);
+                    p = ParseFloat(p, end, n.y);
+                    p = ParseFloat(p, end, n.z);
+                    chunk.normals.push_back(n);
+                }
+            }
+            else if (p[0] == 'f' && p + 1 < end && IsSpace(p[1])) {
+                // Fan triangulation, like aiProcess_Triangulate does for convex
+                // faces; only the first and the previous corner are needed, so
+                // faces of any size are kept whole.
+                int count = 0;
+                ObjCorner first, previous;
+                ++p;
+                for (;;) {
+                    p = SkipSpace(p, end);
+                    if (p >= end || *p == '\n' || !(IsDigit(*p) || *p == '-' || *p == '+'))
+                        break;
+                    ObjCorner c;
+                    p = ParseCorner(p, end, chunk, c);
+                    if (count == 0)
+                        first = c;
+                    else if (count >= 2) {
+                        chunk.corners.push_back(first);
+                        chunk.corners.push_back(previous);
+                        chunk.corners.push_back(c);
+                    }
+                    previous = c;
+                    ++count;
+                }
+            }
+            else if (end - p > 7 && strncmp(p, "usemtl", 6) == 0 && IsSpace(p[6])) {
+                ObjEvent e;
+                e.First = chunk.corners.size();
+                e.IsMaterial = true;
+                e.Name = ParseName(p + 6, end);
+                chunk.events.push_back(e);
+            }
+            else if ((p[0] == 'o' || p[0] == 'g') && p + 1 < end && IsSpace(p[1])) {
+                ObjEvent e;
+                e.First = chunk.corners.size();
+                e.Name = ParseName(p + 1, end);
+                chunk.events.push_back(e);
+            }
+
+            p = SkipLine(p, end);
+        }
+    }
+
+    struct CornerKey {
+        int v, vt, vn;
+        bool operator==(const CornerKey& rhs)const {
+            return v == rhs.v && vt == rhs.vt && vn == rhs.vn;
+        }
+    };
+
+    struct CornerKeyHash {
+        size_t operator()(const CornerKey& k)const {
+            uint64_t h = (uint64_t)(uint32_t)k.v * 0x9E3779B97F4A7C15ull;
+            h ^= (uint64_t)(uint32_t)k.vt * 0xC2B2AE3D27D4EB4Full + (h << 6) + (h >> 2);
+            h ^= (uint64_t)(uint32_t)k.vn * 0x165667B19E3779F9ull + (h << 6) + (h >> 2);
+            return (size_t)h;
+        }
+    };
+}
+
+bool ObjParser::Parse(const std::string& pFile, Mesh& out)
+{
+    PROFILE_FUNCTION();
+    MappedFile file;
+    if (FAILED(file.Open(pFile))) {
+        m_err = "cannot map " + pFile;
+        return false;
+    }
+
+    const char* begin = reinterpret_cast<const char*>(file.Data());
+    const char* end = begin + file.Size();
+
+    unsigned int threads = m_thread_count ? m_thread_count : std::thread::hardware_concurrency();
+    size_t chunkCount = MathHelper::Clamp<size_t>(file.Size() / MinChunkBytes, 1, MathHelper::Max(threads, 1u));
+
+    // Split at line starts so no record straddles two chunks.
+    std::vector<const char*> bounds(chunkCount + 1, end);
+    bounds[0] = begin;
+    for (size_t i = 1; i < chunkCount; ++i) {
+        const char* p = MathHelper::Max(begin + file.Size() * i / chunkCount, bounds[i - 1]);
+        while (p < end && p[-1] != '\n')
+            ++p;
+        bounds[i] = p;
+    }
+
+    std::vector<ObjChunk> chunks(chunkCount);
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < chunkCount; ++i)
+        workers.emplace_back(ParseChunk, bounds[i], bounds[i + 1], std::ref(chunks[i]));
+    ParseChunk(bounds[0], bounds[1], chunks[0]);
+    for (auto& w : workers)
+        w.join();
+
+    // Concatenate the attribute tables, remembering where each chunk starts.
+    std::vector<XMFLOAT3> positions;
+    std::vector<XMFLOAT2> texcoords;
+    std::vector<XMFLOAT3> normals;
+    std::vector<size_t> posBase(chunkCount), texBase(chunkCount), normBase(chunkCount);
+    for (size_t i = 0; i < chunkCount; ++i) {
+        posBase[i] = positions.size();
+        texBase[i] = texcoords.size();
+        normBase[i] = normals.size();
+        positions.insert(positions.end(), chunks[i].positions.begin(), chunks[i].positions.end());
+        texcoords.insert(texcoords.end(), chunks[i].texcoords.begin(), chunks[i].texcoords.end());
+        normals.insert(normals.end(), chunks[i].normals.begin(), chunks[i].normals.end());
+    }
+
+    if (positions.empty()) {
+        m_err = pFile + " has no vertices";
+        return false;
+    }
+
+    out = Mesh();
+    MeshNode root;
+    root.Name = pFile;
+
+    std::unordered_map<CornerKey, uint16_t, CornerKeyHash> cache;
+    // Source position of each output vertex and whether it still needs a normal.
+    std::vector<int> vertexPos;
+    bool missingNormals = false;
+
+    std::string groupName = root.Name;
+    uint32_t materialSlot = 0;
+    bool subsetOpen = false;
+    // Set by usemtl/o/g until the next face opens a subset, possibly in a later chunk.
+    bool changed = false;
+
+    auto openSubset = [&]() {
+        if (subsetOpen) {
+            MeshSubset& last = out.subsets.back();
+            last.IndexCount = (uint32_t)out.indices.size() - last.StartIndexLocation;
+            if (last.IndexCount == 0) {
+                out.subsets.pop_back();
+                root.subsets.pop_back();
+            }
+        }
+        MeshSubset subset;
+        subset.Name = groupName;
+        subset.MaterialSlot = materialSlot;
+        subset.StartIndexLocation = (uint32_t)out.indices.size();
+        subset.BaseVertexLocation = (int32_t)out.vertices.size();
+        root.subsets.push_back((uint32_t)out.subsets.size());
+        out.subsets.push_back(subset);
+        cache.clear();
+        subsetOpen = true;
+    };
+
+    for (size_t ci = 0; ci < chunkCount; ++ci) {
+        const ObjChunk& chunk = chunks[ci];
+        size_t nextEvent = 0;
+
+        for (size_t k = 0; k <= chunk.corners.size(); k += 3) {
+            for (; nextEvent < chunk.events.size() && chunk.events[nextEvent].First <= k; ++nextEvent) {
+                const ObjEvent& e = chunk.events[nextEvent];
+                if (e.IsMaterial) {
+                    auto it = std::find(out.materials.begin(), out.materials.end(), e.Name);
+                    materialSlot = (uint32_t)(it - out.materials.begin());
+                    if (it == out.materials.end())
+                        out.materials.push_back(e.Name);
+                }
+                else {
+                    groupName = e.Name;
+                }
+                changed = true;
+            }
+            if (k == chunk.corners.size())
+                break;
+
+            // A fresh subset per material/group run and whenever the 16-bit local
+            // index range would overflow.
+            if (!subsetOpen || changed ||
+                out.vertices.size() - out.subsets.back().BaseVertexLocation > 0xFFFF - 3) {
+                openSubset();
+                changed = false;
+            }
+
+            const int base = out.subsets.back().BaseVertexLocation;
+            for (size_t j = k; j < k + 3; ++j) {
+                const ObjCorner& c = chunk.corners[j];
+                CornerKey key;
+                key.v = c.v + ((c.rel & RelPos) ? (int)posBase[ci] : 0);
+                key.vt = c.vt + ((c.rel & RelTex) ? (int)texBase[ci] : 0);
+                key.vn = c.vn + ((c.rel & RelNorm) ? (int)normBase[ci] : 0);
+
+                if (key.v < 0 || key.v >= (int)positions.size()) {
+                    m_err = pFile + " references a missing vertex";
+                    return false;
+                }
+                if (key.vt < 0 || key.vt >= (int)texcoords.size())
+                    key.vt = -1;
+                if (key.vn < 0 || key.vn >= (int)normals.size())
+                    key.vn = -1;
+
+                auto found = cache.find(key);
+                if (found != cache.end()) {
+                    out.indices.push_back(found->second);
+                    continue;
+                }
+
+                Vertex vertex = {};
+                vertex.Pos = positions[key.v];
+                if (key.vt >= 0)
+                    vertex.TexC = texcoords[key.vt];
+                if (key.vn >= 0)
+                    vertex.Normal = normals[key.vn];
+                else
+                    missingNormals = true;
+
+                uint16_t index = (uint16_t)(out.vertices.size() - base);
+                cache.emplace(key, index);
+                out.vertices.push_back(vertex);
+                vertexPos.push_back(key.vn >= 0 ? -1 : key.v);
+                out.indices.push_back(index);
+            }
+        }
+    }
+
+    if (subsetOpen) {
+        MeshSubset& last = out.subsets.back();
+        last.IndexCount = (uint32_t)out.indices.size() - last.StartIndexLocation;
+    }
+
+    if (out.indices.empty()) {
+        m_err = pFile + " has no faces";
+        return false;
+    }
+
+    // Files without vn get area weighted smooth normals shared per position,
+    // matching aiProcess_GenSmoothNormals.
+    if (missingNormals) {
+        std::vector<XMFLOAT3> accum(positions.size(), XMFLOAT3(0.0f, 0.0f, 0.0f));
+        for (const MeshSubset& subset : out.subsets) {
+            for (uint32_t t = 0; t + 2 < subset.IndexCount; t += 3) {
+                const uint32_t i0 = subset.BaseVertexLocation + out.indices[subset.StartIndexLocation + t];
+                const uint32_t i1 = subset.BaseVertexLocation + out.indices[subset.StartIndexLocation + t + 1];
+                const uint32_t i2 = subset.BaseVertexLocation + out.indices[subset.StartIndexLocation + t + 2];
+                XMVECTOR p0 = XMLoadFloat3(&out.vertices[i0].Pos);
+                XMVECTOR e0 = XMVectorSubtract(XMLoadFloat3(&out.vertices[i1].Pos), p0);
+                XMVECTOR e1 = XMVectorSubtract(XMLoadFloat3(&out.vertices[i2].Pos), p0);
+                XMVECTOR n = XMVector3Cross(e0, e1);
+                for (uint32_t i : { i0, i1, i2 }) {
+                    if (vertexPos[i] >= 0) {
+                        XMFLOAT3& a = accum[vertexPos[i]];
+                        XMStoreFloat3(&a, XMVectorAdd(XMLoadFloat3(&a), n));
+                    }
+                }
+            }
+        }
+        for (size_t i = 0; i < out.vertices.size(); ++i) {
+            if (vertexPos[i] >= 0)
+                XMStoreFloat3(&out.vertices[i].Normal, XMVector3Normalize(XMLoadFloat3(&accum[vertexPos[i]])));
+        }
+    }
+
+    for (MeshSubset& subset : out.subsets) {
+        uint32_t first = subset.BaseVertexLocation;
+        uint32_t last = first;
+        for (uint32_t t = 0; t < subset.IndexCount; ++t)
+            last = MathHelper::Max<uint32_t>(last, first + out.indices[subset.StartIndexLocation + t]);
+        BoundingBox::CreateFromPoints(subset.Bounds, last - first + 1, &out.vertices[first].Pos, sizeof(Vertex));
+    }
+    BoundingBox::CreateFromPoints(out.Bounds, out.vertices.size(), &out.vertices[0].Pos, sizeof(Vertex));
+
+    out.nodes.push_back(root);
+    return true;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include "Mesh.h"
+
+// Native Wavefront OBJ reader used by ObjLoader before falling back to Assimp.
+// The file is memory mapped, split into line-aligned chunks that are parsed
+// on worker threads, and the per-chunk v/vt/vn/f tables are then merged and
+// deduplicated into indexed vertices.  Every usemtl run becomes a MeshSubset;
+// subsets are also split so their local indices fit in 16 bits.
+class ObjParser {
+public:
+    // Returns false when the file could not be read, get_error() tells why.
+    bool Parse(const std::string& pFile, Mesh& out);
+    std::string get_error() {
+        return m_err;
+    }
+
+    // 0 uses one thread per hardware thread.
+    void set_thread_count(unsigned int count) {
+        m_thread_count = count;
+    }
+
+private:
+    std::string m_err = "";
+    unsigned int m_thread_count = 0;
+};
@@ -0,0 +1,357 @@
+#include "ObjectConstants.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define OBJECT_CONSTANTS_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AVX_FUNCTION
+#else
+#include <cpuid.h>
+#define AVX_FUNCTION __attribute__((target("avx")))
+#endif
+#endif
+
+using namespace DirectX;
+
+void PackObjectConstants(const XMFLOAT4X4& world, const XMFLOAT4X4& texTransform, ObjectConstants& out)
+{
+    XMStoreFloat4x4(&out.World, XMMatrixTranspose(XMLoadFloat4x4(&world)));
+    XMStoreFloat4x4(&out.TexTransform, XMMatrixTranspose(XMLoadFloat4x4(&texTransform)));
+}
+
+namespace
+{
+    void PackObjectConstantsScalar(const XMFLOAT4X4* worlds, const XMFLOAT4X4* texTransforms,
+        size_t count, uint8_t* dst, size_t dstStride)
+    {
+        for (size_t i = 0; i < count; ++i, dst += dstStride)
+        {
+            ObjectConstants* out = reinterpret_cast<ObjectConstants*>(dst);
+            XMStoreFloat4x4(&out->World, XMMatrixTranspose(XMLoadFloat4x4(&worlds[i])));
+            XMStoreFloat4x4(&out->TexTransform, XMMatrixTranspose(XMLoadFloat4x4(&texTransforms[i])));
+        }
+    }
+
+#ifdef OBJECT_CONSTANTS_X86
+    // The CPU and the OS both support AVX.
+    bool HasAvx()
+    {
+        unsigned int info[4] = {};
+#ifdef _MSC_VER
+        __cpuid(reinterpret_cast<int*>(info), 1);
+#else
+        if (!__get_cpuid(1, &info[0], &info[1], &info[2], &info[3]))
+            return false;
+#endif
+        const unsigned int osxsave = 1u << 27;
+        const unsigned int avx = 1u << 28;
+        if ((info[2] & (osxsave | avx)) != (osxsave | avx))
+            return false;
+
+        // The OS saves the YMM registers.
+        uint32_t xcr0;
+#ifdef _MSC_VER
+        xcr0 = (uint32_t)_xgetbv(0);
+#else
+        uint32_t high;
+        __asm__("xgetbv" : "=a"(xcr0), "=d"(high) : "c"(0));
+#endif
+        return (xcr0 & 0x6) == 0x6;
+    }
+
+    // Transposes the world and texture transform of one object together:
+    // row k of both goes in one register, the world's in the low half.
+    template<bool Stream>
+    AVX_FUNCTION void PackOne(const XMFLOAT4X4& world, const XMFLOAT4X4& texTransform, float* out)
+    {
+        const float* w = &world._11;
+        const float* t = &texTransform._11;
+        const __m256 w01 = _mm256_loadu_ps(w);
+        const __m256 w23 = _mm256_loadu_ps(w + 8);
+        const __m256 t01 = _mm256_loadu_ps(t);
+        const __m256 t23 = _mm256_loadu_ps(t + 8);
+
+        const __m256 r0 = _mm256_permute2f128_ps(w01, t01, 0x20);
+        const __m256 r1 = _mm256_permute2f128_ps(w01, t01, 0x31);
+        const __m256 r2 = _mm256_permute2f128_ps(w23, t23, 0x20);
+        const __m256 r3 = _mm256_permute2f128_ps(w23, t23, 0x31);
+
+        const __m256 a = _mm256_unpacklo_ps(r0, r1);
+        const __m256 b = _mm256_unpackhi_ps(r0, r1);
+        const __m256 c = _mm256_unpacklo_ps(r2, r3);
+        const __m256 d = _mm256_unpackhi_ps(r2, r3);
+        const __m256 c0 = _mm256_shuffle_ps(a, c, _MM_SHUFFLE(1, 0, 1, 0));
+        const __m256 c1 = _mm256_shuffle_ps(a, c, _MM_SHUFFLE(3, 2, 3, 2));
+        const __m256 c2 = _mm256_shuffle_ps(b, d, _MM_SHUFFLE(1, 0, 1, 0));
+        const __m256 c3 = _mm256_shuffle_ps(b, d, _MM_SHUFFLE(3, 2, 3, 2));
+
+        // ObjectConstants is World then TexTransform, 16 floats each.
+        const __m256 out0 = _mm256_permute2f128_ps(c0, c1, 0x20);
+        const __m256 out1 = _mm256_permute2f128_ps(c2, c3, 0x20);
+        const __m256 out2 = _mm256_permute2f128_ps(c0, c1, 0x31);
+        const __m256 out3 = _mm256_permute2f128_ps(c2, c3, 0x31);
+        if (Stream)
+        {
+            _mm256_stream_ps(out, out0);
+            _mm256_stream_ps(out + 8, out1);
+            _mm256_stream_ps(out + 16, out2);
+            _mm256_stream_ps(out + 24, out3);
+        }
+        else
+        {
+            _mm256_storeu_ps(out, out0);
+            _mm256_storeu_ps(out + 8, out1);
+            _mm256_storeu_ps(out + 16, out2);
+            _mm256_storeu_ps(out + 24, out3);
+        }
+    }
+
+    template<bool Stream>
+    AVX_FUNCTION void PackObjectConstantsAvx(const XMFLOAT4X4* worlds, const XMFLOAT4X4* texTransforms,
+        size_t count, uint8_t* dst, size_t dstStride)
+    {
+        // Two objects, four matrices, per iteration.
+        size_t i = 0;
+        for (; i + 2 <= count; i += 2, dst += 2 * dstStride)
+        {
+            PackOne<Stream>(worlds[i], texTransforms[i], reinterpret_cast<float*>(dst));
+            PackOne<Stream>(worlds[i + 1], texTransforms[i + 1], reinterpret_cast<float*>(dst + dstStride));
+        }
+        if (i < count)
+            PackOne<Stream>(worlds[i], texTransforms[i], reinterpret_cast<float*>(dst));
+
+        // Non-temporal stores must be visible before the GPU reads the buffer.
+        if (Stream)
+            _mm_sfence();
+        _mm256_zeroupper();
+    }
+#endif
+}
+
+void PackObjectConstantsBatch(const XMFLOAT4X4* worlds, const XMFLOAT4X4* texTransforms,
+    size_t count, void* dst, size_t dstStride)
+{
+    uint8_t* out = static_cast<uint8_t*>(dst);
+#ifdef OBJECT_CONSTANTS_X86
+    static const bool avx = HasAvx();
+    if (avx)
+    {
+        if (((uintptr_t)out % 32) == 0 && (dstStride % 32) == 0)
+            PackObjectConstantsAvx<true>(worlds, texTransforms, count, out, dstStride);
+        else
+            PackObjectConstantsAvx<false>(worlds, texTransforms, count, out, dstStride);
+        return;
+    }
+#endif
+    PackObjectConstantsScalar(worlds, texTransforms, count, out, dstStride);
+}
+
+bool DecomposeTransform(FXMMATRIX m, ObjectTransform& out)
+{
+    XMVECTOR scale, rotation, translation;
+    if (!XMMatrixDecompose(&scale, &rotation, &translation, m))
+        return false;
+    ObjectTransform t;
+    XMStoreFloat4(&t.Rotation, rotation);
+    XMStoreFloat3(&t.Translation, translation);
+    XMStoreFloat3(&t.Scale, scale);
+
+    // XMMatrixDecompose orthonormalizes the basis and succeeds for sheared
+    // matrices, or ones with a projective last column, too; only accept the
+    // parts when they build m again.
+    XMFLOAT4X4 expected, rebuilt;
+    XMStoreFloat4x4(&expected, m);
+    XMStoreFloat4x4(&rebuilt, ComposeTransform(t));
+    // The basis and the translation are compared relative to their own size,
+    // so neither a far away object nor a tiny one hides a shear.
+    auto nearEqual = [&](int first, int count, float largest)
+    {
+        const float* a = &expected._11 + first;
+        const float* b = &rebuilt._11 + first;
+        for (int i = 0; i < count; ++i)
+            largest = std::max(largest, std::fabs(a[i]));
+        for (int i = 0; i < count; ++i)
+        {
+            if (!(std::fabs(a[i] - b[i]) <= 1e-4f * largest))
+                return false;
+        }
+        return true;
+    };
+    if (!nearEqual(0, 12, 0.0f) || !nearEqual(12, 4, 1.0f))
+        return false;
+    out = t;
+    return true;
+}
+
+XMMATRIX ComposeTransform(const ObjectTransform& transform)
+{
+    XMMATRIX m = XMMatrixRotationQuaternion(XMLoadFloat4(&transform.Rotation));
+    m.r[0] = XMVectorScale(m.r[0], transform.Scale.x);
+    m.r[1] = XMVectorScale(m.r[1], transform.Scale.y);
+    m.r[2] = XMVectorScale(m.r[2], transform.Scale.z);
+    m.r[3] = XMVectorSet(transform.Translation.x, transform.Translation.y, transform.Translation.z, 1.0f);
+    return m;
+}
+
+namespace
+{
+    void PackTransform(const ObjectTransform& t, bool identityTexTransform, ObjectConstants* out)
+    {
+        const float x = t.Rotation.x, y = t.Rotation.y, z = t.Rotation.z, w = t.Rotation.w;
+        const float xx = x * x, yy = y * y, zz = z * z;
+        const float xy = x * y, xz = x * z, yz = y * z;
+        const float xw = x * w, yw = y * w, zw = z * w;
+        const float sx = t.Scale.x, sy = t.Scale.y, sz = t.Scale.z;
+
+        // Row k of the transposed world is column k of the rotation rows,
+        // each row scaled by its axis, then the translation.
+        XMFLOAT4X4& world = out->World;
+        world._11 = sx * (1.0f - 2.0f * (yy + zz));
+        world._12 = sy * 2.0f * (xy - zw);
+        world._13 = sz * 2.0f * (xz + yw);
+        world._14 = t.Translation.x;
+        world._21 = sx * 2.0f * (xy + zw);
+        world._22 = sy * (1.0f - 2.0f * (xx + zz));
+        world._23 = sz * 2.0f * (yz - xw);
+        world._24 = t.Translation.y;
+        world._31 = sx * 2.0f * (xz - yw);
+        world._32 = sy * 2.0f * (yz + xw);
+        world._33 = sz * (1.0f - 2.0f * (xx + yy));
+        world._34 = t.Translation.z;
+        world._41 = 0.0f;
+        world._42 = 0.0f;
+        world._43 = 0.0f;
+        world._44 = 1.0f;
+
+        if (identityTexTransform)
+            out->TexTransform = MathHelper::Identity4x4();
+    }
+
+#ifdef OBJECT_CONSTANTS_X86
+    // PackTransform for four objects at once, one in each lane.
+    template<bool Stream>
+    void PackTransforms4(const ObjectTransform* t, bool identityTexTransforms, uint8_t* dst, size_t dstStride)
+    {
+        __m128 x = _mm_loadu_ps(&t[0].Rotation.x);
+        __m128 y = _mm_loadu_ps(&t[1].Rotation.x);
+        __m128 z = _mm_loadu_ps(&t[2].Rotation.x);
+        __m128 w = _mm_loadu_ps(&t[3].Rotation.x);
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+
+        __m128 tx = _mm_loadu_ps(&t[0].Translation.x);
+        __m128 ty = _mm_loadu_ps(&t[1].Translation.x);
+        __m128 tz = _mm_loadu_ps(&t[2].Translation.x);
+        __m128 sx = _mm_loadu_ps(&t[3].Translation.x);
+        _MM_TRANSPOSE4_PS(tx, ty, tz, sx);
+
+        // Only two floats are left in each transform.
+        const __m128 s01 = _mm_unpacklo_ps(
+            _mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(&t[0].Scale.y))),
+            _mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(&t[1].Scale.y))));
+        const __m128 s23 = _mm_unpacklo_ps(
+            _mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(&t[2].Scale.y))),
+            _mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(&t[3].Scale.y))));
+        const __m128 sy = _mm_movelh_ps(s01, s23);
+        const __m128 sz = _mm_movehl_ps(s23, s01);
+
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 two = _mm_set1_ps(2.0f);
+        const __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+        const __m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+        const __m128 xw = _mm_mul_ps(x, w), yw = _mm_mul_ps(y, w), zw = _mm_mul_ps(z, w);
+        const __m128 sx2 = _mm_mul_ps(sx, two), sy2 = _mm_mul_ps(sy, two), sz2 = _mm_mul_ps(sz, two);
+
+        __m128 m11 = _mm_mul_ps(sx, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))));
+        __m128 m12 = _mm_mul_ps(sy2, _mm_sub_ps(xy, zw));
+        __m128 m13 = _mm_mul_ps(sz2, _mm_add_ps(xz, yw));
+        __m128 m14 = tx;
+        __m128 m21 = _mm_mul_ps(sx2, _mm_add_ps(xy, zw));
+        __m128 m22 = _mm_mul_ps(sy, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))));
+        __m128 m23 = _mm_mul_ps(sz2, _mm_sub_ps(yz, xw));
+        __m128 m24 = ty;
+        __m128 m31 = _mm_mul_ps(sx2, _mm_sub_ps(xz, yw));
+        __m128 m32 = _mm_mul_ps(sy2, _mm_add_ps(yz, xw));
+        __m128 m33 = _mm_mul_ps(sz, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))));
+        __m128 m34 = tz;
+
+        // Back to one object per register.
+        _MM_TRANSPOSE4_PS(m11, m12, m13, m14);
+        _MM_TRANSPOSE4_PS(m21, m22, m23, m24);
+        _MM_TRANSPOSE4_PS(m31, m32, m33, m34);
+        const __m128 rows[4][3] = {
+            { m11, m21, m31 },
+            { m12, m22, m32 },
+            { m13, m23, m33 },
+            { m14, m24, m34 } };
+
+        const __m128 r3 = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+        const __m128 i0 = _mm_setr_ps(1.0f, 0.0f, 0.0f, 0.0f);
+        const __m128 i1 = _mm_setr_ps(0.0f, 1.0f, 0.0f, 0.0f);
+        const __m128 i2 = _mm_setr_ps(0.0f, 0.0f, 1.0f, 0.0f);
+        for (int k = 0; k < 4; ++k, dst += dstStride)
+        {
+            float* out = reinterpret_cast<float*>(dst);
+            if (Stream)
+            {
+                _mm_stream_ps(out, rows[k][0]);
+                _mm_stream_ps(out + 4, rows[k][1]);
+                _mm_stream_ps(out + 8, rows[k][2]);
+                _mm_stream_ps(out + 12, r3);
+                if (identityTexTransforms)
+                {
+                    _mm_stream_ps(out + 16, i0);
+                    _mm_stream_ps(out + 20, i1);
+                    _mm_stream_ps(out + 24, i2);
+                    _mm_stream_ps(out + 28, r3);
+                }
+            }
+            else
+            {
+                _mm_storeu_ps(out, rows[k][0]);
+                _mm_storeu_ps(out + 4, rows[k][1]);
+                _mm_storeu_ps(out + 8, rows[k][2]);
+                _mm_storeu_ps(out + 12, r3);
+                if (identityTexTransforms)
+                {
+                    _mm_storeu_ps(out + 16, i0);
+                    _mm_storeu_ps(out + 20, i1);
+                    _mm_storeu_ps(out + 24, i2);
+                    _mm_storeu_ps(out + 28, r3);
+                }
+            }
+        }
+    }
+
+    template<bool Stream>
+    void PackTransformsSse(const ObjectTransform* transforms, size_t count, bool identityTexTransforms,
+        uint8_t* dst, size_t dstStride)
+    {
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4, dst += 4 * dstStride)
+            PackTransforms4<Stream>(transforms + i, identityTexTransforms, dst, dstStride);
+        for (; i < count; ++i, dst += dstStride)
+            PackTransform(transforms[i], identityTexTransforms, reinterpret_cast<ObjectConstants*>(dst));
+        if (Stream)
+            _mm_sfence();
+    }
+#endif
+}
+
+void PackObjectTransformsBatch(const ObjectTransform* transforms, size_t count, bool identityTexTransforms,
+    void* dst, size_t dstStride)
+{
+    uint8_t* out = static_cast<uint8_t*>(dst);
+#ifdef OBJECT_CONSTANTS_X86
+    if (((uintptr_t)out % 16) == 0 && (dstStride % 16) == 0)
+        PackTransformsSse<true>(transforms, count, identityTexTransforms, out, dstStride);
+    else
+        PackTransformsSse<false>(transforms, count, identityTexTransforms, out, dstStride);
+#else
+    for (size_t i = 0; i < count; ++i, out += dstStride)
+        PackTransform(transforms[i], identityTexTransforms, reinterpret_cast<ObjectConstants*>(out));
+#endif
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "../../Common/MathHelper.h"
+
+struct ObjectConstants
+{
+    DirectX::XMFLOAT4X4 World = MathHelper::Identity4x4();
+    DirectX::XMFLOAT4X4 TexTransform = MathHelper::Identity4x4();
+};
+
+// Fills the constant buffer entry of an object.  The shaders read matrices
+// column major, so both are stored transposed.
+void PackObjectConstants(const DirectX::XMFLOAT4X4& world, const DirectX::XMFLOAT4X4& texTransform,
+    ObjectConstants& out);
+
+// PackObjectConstants for count objects, whose transforms are contiguous,
+// straight into a mapped constant buffer: object i goes dstStride bytes after
+// object i - 1.  With AVX the matrices are transposed two at a time, and a
+// 32 byte aligned dst is written with non-temporal stores, which suit the
+// write-combined memory of upload heaps.
+void PackObjectConstantsBatch(const DirectX::XMFLOAT4X4* worlds, const DirectX::XMFLOAT4X4* texTransforms,
+    size_t count, void* dst, size_t dstStride);
+
+// World transform of an object in 40 bytes rather than a 64 byte matrix: the
+// matrix is Scaling(Scale) * RotationQuaternion(Rotation) * Translation.
+struct ObjectTransform
+{
+    DirectX::XMFLOAT4 Rotation = { 0.0f, 0.0f, 0.0f, 1.0f };
+    DirectX::XMFLOAT3 Translation = { 0.0f, 0.0f, 0.0f };
+    DirectX::XMFLOAT3 Scale = { 1.0f, 1.0f, 1.0f };
+};
+
+// Splits a matrix built from scale, rotation and translation back into them.
+// False, leaving out alone, when the parts found do not compose back into m
+// within a small relative tolerance, as for sheared or projective matrices;
+// those have to be kept as full matrices.
+bool DecomposeTransform(DirectX::FXMMATRIX m, ObjectTransform& out);
+DirectX::XMMATRIX ComposeTransform(const ObjectTransform& transform);
+
+// Composes the world matrices of count objects straight into the World of
+// their constant buffer entries, already transposed, dstStride bytes apart.
+// TexTransform is left alone unless identityTexTransforms, which sets it.
+void PackObjectTransformsBatch(const ObjectTransform* transforms, size_t count, bool identityTexTransforms,
+    void* dst, size_t dstStride);
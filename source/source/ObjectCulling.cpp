@@ -0,0 +1,44 @@
+#include "ObjectCulling.h"
+#include "../../Common/MathHelper.h"
+#include <cmath>
+
+using namespace DirectX;
+
+void CullCamera::Set(FXMMATRIX view, const BoundingFrustum& frustum, float fovY, float viewportHeight,
+    float minScreenSize)
+{
+    XMVECTOR det = XMMatrixDeterminant(view);
+    InvView = XMMatrixInverse(&det, view);
+    Eye = InvView.r[3];
+    Frustum = frustum;
+    PixelsPerRadius = viewportHeight / tanf(0.5f * fovY);
+    MinScreenSize = minScreenSize;
+}
+
+CullResult CullObject(FXMMATRIX world, const BoundingBox& bounds, float maxDrawDistance,
+    const CullCamera& camera, CulledObject& out)
+{
+    bounds.Transform(out.WorldBounds, world);
+
+    // Distance and size first, they are cheaper than the frustum test.
+    const float radius = XMVectorGetX(XMVector3Length(XMLoadFloat3(&out.WorldBounds.Extents)));
+    const float distance = XMVectorGetX(XMVector3Length(XMVectorSubtract(XMLoadFloat3(&out.WorldBounds.Center), camera.Eye)));
+    if (maxDrawDistance > 0.0f && distance - radius > maxDrawDistance)
+        return CullResult::Distance;
+
+    out.ScreenSize = distance > radius ? radius * camera.PixelsPerRadius / distance : MathHelper::Infinity;
+    if (out.ScreenSize < camera.MinScreenSize)
+        return CullResult::Size;
+
+    XMVECTOR det = XMMatrixDeterminant(world);
+    XMMATRIX invWorld = XMMatrixInverse(&det, world);
+
+    // View space to the object's local space.
+    XMMATRIX viewToLocal = XMMatrixMultiply(camera.InvView, invWorld);
+
+    // Transform the camera frustum from view space to the object's local space.
+    camera.Frustum.Transform(out.LocalFrustum, viewToLocal);
+    if (out.LocalFrustum.Contains(bounds) == DirectX::DISJOINT)
+        return CullResult::Frustum;
+    return CullResult::Visible;
+}
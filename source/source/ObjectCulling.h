@@ -0,0 +1,42 @@
+#pragma once
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+
+// Camera terms of CullObject, set once per frame.
+struct CullCamera
+{
+    DirectX::XMMATRIX InvView;
+    DirectX::XMVECTOR Eye;
+    // The camera frustum in view space.
+    DirectX::BoundingFrustum Frustum;
+    // Bounding sphere diameter in pixels is radius * PixelsPerRadius / distance.
+    float PixelsPerRadius = 0.0f;
+    float MinScreenSize = 0.0f;
+
+    void Set(DirectX::FXMMATRIX view, const DirectX::BoundingFrustum& frustum, float fovY, float viewportHeight,
+        float minScreenSize);
+};
+
+enum class CullResult
+{
+    Visible,
+    Distance,
+    Size,
+    Frustum
+};
+
+// What CullObject learned about an object on the way.
+struct CulledObject
+{
+    DirectX::BoundingBox WorldBounds;
+    // The camera frustum in the object's local space, for its submeshes.
+    DirectX::BoundingFrustum LocalFrustum;
+    // Bounding sphere diameter in pixels.
+    float ScreenSize = 0.0f;
+};
+
+// The per object tests of a frame's culling: draw distance, screen size and
+// frustum, cheapest first.  bounds are in the object's local space and
+// maxDrawDistance 0 means no limit.  out is complete only for Visible.
+CullResult CullObject(DirectX::FXMMATRIX world, const DirectX::BoundingBox& bounds, float maxDrawDistance,
+    const CullCamera& camera, CulledObject& out);
@@ -0,0 +1,392 @@
+#include "OcclusionCuller.h"
+#include "../../Common/Profiler.h"
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+
+using namespace DirectX;
+
+namespace
+{
+    const uint16_t BoxIndices[36] =
+    {
+        0, 1, 3, 0, 3, 2,
+        4, 6, 7, 4, 7, 5,
+        0, 4, 5, 0, 5, 1,
+        2, 3, 7, 2, 7, 6,
+        0, 2, 6, 0, 6, 4,
+        1, 5, 7, 1, 7, 3,
+    };
+
+    void BoxCorners(const BoundingBox& box, XMFLOAT3* corners)
+    {
+        for (int i = 0; i < 8; ++i)
+        {
+            corners[i].x = box.Center.x + ((i & 1) ? box.Extents.x : -box.Extents.x);
+            corners[i].y = box.Center.y + ((i & 2) ? box.Extents.y : -box.Extents.y);
+            corners[i].z = box.Center.z + ((i & 4) ? box.Extents.z : -box.Extents.z);
+        }
+    }
+
+    XMFLOAT4 Lerp(const XMFLOAT4& a, const XMFLOAT4& b, float t)
+    {
+        XMFLOAT4 r;
+        XMStoreFloat4(&r, XMVectorLerp(XMLoadFloat4(&a), XMLoadFloat4(&b), t));
+        return r;
+    }
+}
+
+OcclusionCuller::OcclusionCuller(uint32_t width, uint32_t height, unsigned threads)
+    : mNextBand(0)
+{
+    const uint32_t block = BlockSize;
+    const uint32_t band = BandHeight;
+    mWidth = std::max((width + block - 1) / block * block, block);
+    mHeight = std::max((height + band - 1) / band * band, band);
+    mBlocksX = mWidth / BlockSize;
+    mBands = mHeight / BandHeight;
+    mDepth.assign(mWidth * mHeight, 1.0f);
+    mBlockMax.assign(mBlocksX * (mHeight / BlockSize), 1.0f);
+    XMStoreFloat4x4(&mViewProj, XMMatrixIdentity());
+
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, mBands);
+    // The calling thread rasterizes too.
+    for (unsigned i = 1; i < threads; ++i)
+        mWorkers.emplace_back(&OcclusionCuller::WorkerMain, this);
+}
+
+OcclusionCuller::~OcclusionCuller()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mQuit = true;
+    }
+    mWake.notify_all();
+    for (auto& t : mWorkers)
+        t.join();
+}
+
+void OcclusionCuller::BeginFrame(FXMMATRIX viewProj)
+{
+    XMStoreFloat4x4(&mViewProj, viewProj);
+    mTriangles.clear();
+    mStats = OcclusionStats();
+}
+
+void OcclusionCuller::AddOccluder(const void* positions, uint32_t stride, const uint16_t* indices, uint32_t indexCount,
+    int32_t baseVertex, FXMMATRIX world)
+{
+    if (indexCount < 3)
+        return;
+    const XMMATRIX worldViewProj = XMMatrixMultiply(world, XMLoadFloat4x4(&mViewProj));
+
+    // Transform each vertex the triangles use once.
+    uint32_t first = indices[0], last = indices[0];
+    for (uint32_t i = 1; i < indexCount; ++i)
+    {
+        first = std::min<uint32_t>(first, indices[i]);
+        last = std::max<uint32_t>(last, indices[i]);
+    }
+    mClip.resize(last - first + 1);
+    const char* base = static_cast<const char*>(positions) + (int64_t)(baseVertex + (int32_t)first) * stride;
+    for (uint32_t v = 0; v <= last - first; ++v)
+    {
+        const XMFLOAT3* p = reinterpret_cast<const XMFLOAT3*>(base + (size_t)v * stride);
+        XMStoreFloat4(&mClip[v], XMVector3Transform(XMLoadFloat3(p), worldViewProj));
+    }
+
+    for (uint32_t i = 0; i + 2 < indexCount; i += 3)
+    {
+        const XMFLOAT4* tri[3] =
+        {
+            &mClip[indices[i] - first],
+            &mClip[indices[i + 1] - first],
+            &mClip[indices[i + 2] - first]
+        };
+        const bool inside[3] = { tri[0]->z >= 0.0f, tri[1]->z >= 0.0f, tri[2]->z >= 0.0f };
+        if (inside[0] && inside[1] && inside[2])
+        {
+            SetupTriangle(*tri[0], *tri[1], *tri[2]);
+            continue;
+        }
+        if (!inside[0] && !inside[1] && !inside[2])
+            continue;
+
+        // Clip against the near plane (z = 0 in D3D clip space); leaves a
+        // triangle or a quad.
+        XMFLOAT4 poly[4];
+        int count = 0;
+        for (int e = 0; e < 3; ++e)
+        {
+            const int n = (e + 1) % 3;
+            if (inside[e])
+                poly[count++] = *tri[e];
+            if (inside[e] != inside[n])
+                poly[count++] = Lerp(*tri[e], *tri[n], tri[e]->z / (tri[e]->z - tri[n]->z));
+        }
+        for (int k = 2; k < count; ++k)
+            SetupTriangle(poly[0], poly[k - 1], poly[k]);
+    }
+    ++mStats.Occluders;
+}
+
+void OcclusionCuller::AddOccluderBox(const BoundingBox& box, FXMMATRIX world)
+{
+    XMFLOAT3 corners[8];
+    BoxCorners(box, corners);
+    AddOccluder(corners, sizeof(XMFLOAT3), BoxIndices, 36, 0, world);
+}
+
+void OcclusionCuller::SetupTriangle(const XMFLOAT4& c0, const XMFLOAT4& c1, const XMFLOAT4& c2)
+{
+    // To pixels; y grows down the screen.
+    float x[3], y[3], z[3];
+    const XMFLOAT4* c[3] = { &c0, &c1, &c2 };
+    for (int i = 0; i < 3; ++i)
+    {
+        const float invW = 1.0f / c[i]->w;
+        x[i] = (c[i]->x * invW * 0.5f + 0.5f) * mWidth;
+        y[i] = (0.5f - c[i]->y * invW * 0.5f) * mHeight;
+        z[i] = c[i]->z * invW;
+    }
+
+    float area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+    if (std::fabs(area) < 1e-6f)
+        return;
+    // Occluders are two sided: wind every triangle the same way.
+    if (area < 0.0f)
+    {
+        std::swap(x[1], x[2]);
+        std::swap(y[1], y[2]);
+        std::swap(z[1], z[2]);
+        area = -area;
+    }
+
+    Triangle t;
+    t.MinX = std::max((int)std::floor(std::min(std::min(x[0], x[1]), x[2])), 0);
+    t.MaxX = std::min((int)std::floor(std::max(std::max(x[0], x[1]), x[2])), (int)mWidth - 1);
+    t.MinY = std::max((int)std::floor(std::min(std::min(y[0], y[1]), y[2])), 0);
+    t.MaxY = std::min((int)std::floor(std::max(std::max(y[0], y[1]), y[2])), (int)mHeight - 1);
+    if (t.MinX > t.MaxX || t.MinY > t.MaxY)
+        return;
+
+    for (int e = 0; e < 3; ++e)
+    {
+        const int n = (e + 1) % 3;
+        t.A[e] = y[e] - y[n];
+        t.B[e] = x[n] - x[e];
+        t.C[e] = -(t.A[e] * x[e] + t.B[e] * y[e]);
+    }
+
+    const float invArea = 1.0f / area;
+    t.ZA = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) * invArea;
+    t.ZB = ((z[2] - z[0]) * (x[1] - x[0]) - (z[1] - z[0]) * (x[2] - x[0])) * invArea;
+    t.ZC = z[0] - t.ZA * x[0] - t.ZB * y[0];
+
+    mTriangles.push_back(t);
+    ++mStats.Triangles;
+}
+
+void OcclusionCuller::Rasterize()
+{
+    PROFILE_FUNCTION();
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    if (mWorkers.empty())
+    {
+        mNextBand = 0;
+        RunBands();
+    }
+    else
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mNextBand = 0;
+            mActive = (uint32_t)mWorkers.size();
+            ++mJob;
+        }
+        mWake.notify_all();
+        RunBands();
+
+        std::unique_lock<std::mutex> lock(mMutex);
+        mDone.wait(lock, [this]() { return mActive == 0; });
+    }
+
+    const std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+    mStats.RasterMilliseconds = elapsed.count();
+}
+
+void OcclusionCuller::WorkerMain()
+{
+    PROFILE_THREAD("Occlusion worker");
+    uint64_t seen = 0;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mWake.wait(lock, [&]() { return mQuit || mJob != seen; });
+            if (mQuit)
+                return;
+            seen = mJob;
+        }
+
+        RunBands();
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (--mActive == 0)
+            mDone.notify_all();
+    }
+}
+
+void OcclusionCuller::RunBands()
+{
+    for (uint32_t band = mNextBand++; band < mBands; band = mNextBand++)
+        RasterizeBand(band);
+}
+
+void OcclusionCuller::RasterizeBand(uint32_t band)
+{
+    PROFILE_FUNCTION();
+    const int bandTop = (int)(band * BandHeight);
+    const int bandBottom = bandTop + (int)BandHeight - 1;
+    std::fill(mDepth.begin() + bandTop * mWidth, mDepth.begin() + (bandBottom + 1) * mWidth, 1.0f);
+
+    const XMVECTOR offsets = XMVectorSet(0.5f, 1.5f, 2.5f, 3.5f);
+    const XMVECTOR zero = XMVectorZero();
+    for (const Triangle& t : mTriangles)
+    {
+        if (t.MaxY < bandTop || t.MinY > bandBottom)
+            continue;
+        const int top = std::max(t.MinY, bandTop);
+        const int bottom = std::min(t.MaxY, bandBottom);
+        const int left = t.MinX & ~3;
+
+        const XMVECTOR a0 = XMVectorReplicate(t.A[0]);
+        const XMVECTOR a1 = XMVectorReplicate(t.A[1]);
+        const XMVECTOR a2 = XMVectorReplicate(t.A[2]);
+        const XMVECTOR za = XMVectorReplicate(t.ZA);
+        for (int y = top; y <= bottom; ++y)
+        {
+            const float py = y + 0.5f;
+            const XMVECTOR row0 = XMVectorReplicate(t.B[0] * py + t.C[0]);
+            const XMVECTOR row1 = XMVectorReplicate(t.B[1] * py + t.C[1]);
+            const XMVECTOR row2 = XMVectorReplicate(t.B[2] * py + t.C[2]);
+            const XMVECTOR rowZ = XMVectorReplicate(t.ZB * py + t.ZC);
+            float* depthRow = &mDepth[y * mWidth];
+
+            // Four pixels at a time; the edge tests mask off the ones outside.
+            for (int x = left; x <= t.MaxX; x += 4)
+            {
+                const XMVECTOR px = XMVectorAdd(offsets, XMVectorReplicate((float)x));
+                XMVECTOR inside = XMVectorGreaterOrEqual(XMVectorMultiplyAdd(a0, px, row0), zero);
+                inside = XMVectorAndInt(inside, XMVectorGreaterOrEqual(XMVectorMultiplyAdd(a1, px, row1), zero));
+                inside = XMVectorAndInt(inside, XMVectorGreaterOrEqual(XMVectorMultiplyAdd(a2, px, row2), zero));
+                if (XMVector4EqualInt(inside, zero))
+                    continue;
+
+                XMFLOAT4* dst = reinterpret_cast<XMFLOAT4*>(depthRow + x);
+                const XMVECTOR depth = XMLoadFloat4(dst);
+                const XMVECTOR z = XMVectorMultiplyAdd(za, px, rowZ);
+                XMStoreFloat4(dst, XMVectorSelect(depth, XMVectorMin(depth, z), inside));
+            }
+        }
+    }
+
+    // Farthest depth per block, for the early out in IsOccluded.
+    for (int by = bandTop / (int)BlockSize; by <= bandBottom / (int)BlockSize; ++by)
+    {
+        for (uint32_t bx = 0; bx < mBlocksX; ++bx)
+        {
+            XMVECTOR farthest = zero;
+            for (uint32_t y = 0; y < BlockSize; ++y)
+            {
+                const float* src = &mDepth[(by * BlockSize + y) * mWidth + bx * BlockSize];
+                farthest = XMVectorMax(farthest, XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(src)));
+                farthest = XMVectorMax(farthest, XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(src + 4)));
+            }
+            XMFLOAT4 f;
+            XMStoreFloat4(&f, farthest);
+            mBlockMax[by * mBlocksX + bx] = std::max(std::max(f.x, f.y), std::max(f.z, f.w));
+        }
+    }
+}
+
+bool OcclusionCuller::IsOccluded(const BoundingBox& box, FXMMATRIX world)
+{
+    ++mStats.Tested;
+    const XMMATRIX worldViewProj = XMMatrixMultiply(world, XMLoadFloat4x4(&mViewProj));
+
+    XMFLOAT3 corners[8];
+    BoxCorners(box, corners);
+    float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, minZ = FLT_MAX;
+    for (int i = 0; i < 8; ++i)
+    {
+        XMFLOAT4 c;
+        XMStoreFloat4(&c, XMVector3Transform(XMLoadFloat3(&corners[i]), worldViewProj));
+        if (c.z < 0.0f)
+            return false;
+        const float invW = 1.0f / c.w;
+        const float x = (c.x * invW * 0.5f + 0.5f) * mWidth;
+        const float y = (0.5f - c.y * invW * 0.5f) * mHeight;
+        minX = std::min(minX, x);
+        maxX = std::max(maxX, x);
+        minY = std::min(minY, y);
+        maxY = std::max(maxY, y);
+        minZ = std::min(minZ, c.z * invW);
+    }
+    if (maxX < 0.0f || maxY < 0.0f || minX >= (float)mWidth || minY >= (float)mHeight)
+        return false;
+
+    const int x0 = std::max((int)std::floor(minX), 0);
+    const int x1 = std::min((int)std::floor(maxX), (int)mWidth - 1);
+    const int y0 = std::max((int)std::floor(minY), 0);
+    const int y1 = std::min((int)std::floor(maxY), (int)mHeight - 1);
+    for (int by = y0 / (int)BlockSize; by <= y1 / (int)BlockSize; ++by)
+    {
+        for (int bx = x0 / (int)BlockSize; bx <= x1 / (int)BlockSize; ++bx)
+        {
+            // Every occluder pixel in the block is nearer than the box.
+            if (minZ > mBlockMax[by * mBlocksX + bx])
+                continue;
+
+            const int top = std::max(y0, by * (int)BlockSize);
+            const int bottom = std::min(y1, by * (int)BlockSize + (int)BlockSize - 1);
+            const int left = std::max(x0, bx * (int)BlockSize);
+            const int right = std::min(x1, bx * (int)BlockSize + (int)BlockSize - 1);
+            for (int y = top; y <= bottom; ++y)
+            {
+                for (int x = left; x <= right; ++x)
+                {
+                    if (mDepth[y * mWidth + x] >= minZ)
+                        return false;
+                }
+            }
+        }
+    }
+
+    ++mStats.Occluded;
+    return true;
+}
+
+uint32_t OcclusionCuller::Width()const
+{
+    return mWidth;
+}
+
+uint32_t OcclusionCuller::Height()const
+{
+    return mHeight;
+}
+
+const float* OcclusionCuller::Depth()const
+{
+    return mDepth.data();
+}
+
+const OcclusionStats& OcclusionCuller::Stats()const
+{
+    return mStats;
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// How an object is drawn into the occlusion buffer, if at all.
+enum OccluderShape : uint32_t
+{
+    OccluderNone = 0,
+    OccluderMesh = 1,       // its own triangles
+    OccluderBounds = 2      // its bounding box; only for objects that fill it, like buildings
+};
+
+struct OcclusionStats
+{
+    uint32_t Occluders = 0;
+    // Triangles left after near plane clipping and degenerate rejection.
+    uint32_t Triangles = 0;
+    uint32_t Tested = 0;
+    uint32_t Occluded = 0;
+    float RasterMilliseconds = 0.0f;
+};
+
+// Software occlusion culling.  Occluders are rasterized into a small depth
+// buffer, four pixels at a time with masked writes, by a pool of threads that
+// each own a band of rows.  An 8x8 block level keeps each block's farthest
+// depth, so most tests against the buffer read one value per block.
+// Depth is D3D style: 0 at the near plane, 1 at the far plane.
+class OcclusionCuller
+{
+public:
+    // width is rounded up to a multiple of 8 and height of 16; threads = 0 uses
+    // one per core, 1 rasterizes on the calling thread only.
+    explicit OcclusionCuller(uint32_t width = 320, uint32_t height = 192, unsigned threads = 0);
+    ~OcclusionCuller();
+    OcclusionCuller(const OcclusionCuller& rhs) = delete;
+    OcclusionCuller& operator=(const OcclusionCuller& rhs) = delete;
+
+    // Starts a frame seen through viewProj and forgets the last occluders.
+    void BeginFrame(DirectX::FXMMATRIX viewProj);
+
+    // Transforms, clips and sets up an occluder's triangles.  positions point
+    // at the first vertex's float3 position; stride is the vertex size.
+    void AddOccluder(const void* positions, uint32_t stride, const uint16_t* indices, uint32_t indexCount,
+        int32_t baseVertex, DirectX::FXMMATRIX world);
+    void AddOccluderBox(const DirectX::BoundingBox& box, DirectX::FXMMATRIX world);
+
+    // Fills the depth buffer with the occluders added since BeginFrame.
+    void Rasterize();
+
+    // True when the box, in the space world maps to world space, is behind
+    // the rasterized occluders everywhere it covers.  Boxes crossing the
+    // near plane are never occluded.
+    bool IsOccluded(const DirectX::BoundingBox& box, DirectX::FXMMATRIX world);
+
+    uint32_t Width()const;
+    uint32_t Height()const;
+    const float* Depth()const;
+    const OcclusionStats& Stats()const;
+
+private:
+    struct Triangle
+    {
+        // Edge functions A*x + B*y + C, positive inside.
+        float A[3];
+        float B[3];
+        float C[3];
+        // Depth plane z = ZA*x + ZB*y + ZC.
+        float ZA, ZB, ZC;
+        int MinX, MaxX, MinY, MaxY;
+    };
+
+    void SetupTriangle(const DirectX::XMFLOAT4& c0, const DirectX::XMFLOAT4& c1, const DirectX::XMFLOAT4& c2);
+    void RasterizeBand(uint32_t band);
+    void RunBands();
+    void WorkerMain();
+
+    static const uint32_t BlockSize = 8;
+    static const uint32_t BandHeight = 16;
+
+    uint32_t mWidth;
+    uint32_t mHeight;
+    uint32_t mBlocksX;
+    uint32_t mBands;
+    DirectX::XMFLOAT4X4 mViewProj;
+
+    std::vector<float> mDepth;
+    // Farthest depth of each 8x8 block.
+    std::vector<float> mBlockMax;
+    std::vector<Triangle> mTriangles;
+    std::vector<DirectX::XMFLOAT4> mClip;
+    OcclusionStats mStats;
+
+    std::vector<std::thread> mWorkers;
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    std::condition_variable mDone;
+    uint64_t mJob = 0;
+    uint32_t mActive = 0;
+    bool mQuit = false;
+    std::atomic<uint32_t> mNextBand;
+};
@@ -0,0 +1,415 @@
+#include "PipelineCache.h"
+#include "../../Common/Hash.h"
+#include "../../Common/Profiler.h"
+
+namespace
+{
+    // Collects the fields of a description one by one, so struct padding and
+    // pointer values never reach the hash.
+    class DescHasher
+    {
+    public:
+        void Bytes(const void* data, size_t size)
+        {
+            const uint8_t* p = static_cast<const uint8_t*>(data);
+            mBytes.insert(mBytes.end(), p, p + size);
+        }
+        template<typename T> void Pod(const T& v) { Bytes(&v, sizeof(T)); }
+        void String(const char* s)
+        {
+            const size_t size = s ? strlen(s) : 0;
+            Pod((uint32_t)size);
+            Bytes(s, size);
+        }
+        void Shader(const D3D12_SHADER_BYTECODE& code)
+        {
+            Pod((uint64_t)code.BytecodeLength);
+            Bytes(code.pShaderBytecode, code.pShaderBytecode ? code.BytecodeLength : 0);
+        }
+        UINT64 Finish(UINT64 seed)const { return Hash64(mBytes.data(), mBytes.size(), seed); }
+    private:
+        std::vector<uint8_t> mBytes;
+    };
+
+    void HashStencilOp(DescHasher& h, const D3D12_DEPTH_STENCILOP_DESC& op)
+    {
+        h.Pod(op.StencilFailOp);
+        h.Pod(op.StencilDepthFailOp);
+        h.Pod(op.StencilPassOp);
+        h.Pod(op.StencilFunc);
+    }
+
+    // Bump when HashPipelineDesc changes, so old library entries are not matched.
+    const UINT64 PipelineKeyVersion = 1;
+}
+
+UINT64 HashPipelineDesc(const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc, UINT64 rootSignatureHash)
+{
+    DescHasher h;
+    h.Pod(rootSignatureHash);
+
+    h.Shader(desc.VS);
+    h.Shader(desc.PS);
+    h.Shader(desc.DS);
+    h.Shader(desc.HS);
+    h.Shader(desc.GS);
+
+    const D3D12_STREAM_OUTPUT_DESC& so = desc.StreamOutput;
+    h.Pod(so.NumEntries);
+    for (UINT i = 0; i < so.NumEntries; ++i)
+    {
+        const D3D12_SO_DECLARATION_ENTRY& e = so.pSODeclaration[i];
+        h.Pod(e.Stream);
+        h.String(e.SemanticName);
+        h.Pod(e.SemanticIndex);
+        h.Pod(e.StartComponent);
+        h.Pod(e.ComponentCount);
+        h.Pod(e.OutputSlot);
+    }
+    h.Pod(so.NumStrides);
+    h.Bytes(so.pBufferStrides, so.pBufferStrides ? so.NumStrides * sizeof(UINT) : 0);
+    h.Pod(so.RasterizedStream);
+
+    const D3D12_BLEND_DESC& blend = desc.BlendState;
+    h.Pod(blend.AlphaToCoverageEnable);
+    h.Pod(blend.IndependentBlendEnable);
+    for (const D3D12_RENDER_TARGET_BLEND_DESC& rt : blend.RenderTarget)
+    {
+        h.Pod(rt.BlendEnable);
+        h.Pod(rt.LogicOpEnable);
+        h.Pod(rt.SrcBlend);
+        h.Pod(rt.DestBlend);
+        h.Pod(rt.BlendOp);
+        h.Pod(rt.SrcBlendAlpha);
+        h.Pod(rt.DestBlendAlpha);
+        h.Pod(rt.BlendOpAlpha);
+        h.Pod(rt.LogicOp);
+        h.Pod(rt.RenderTargetWriteMask);
+    }
+    h.Pod(desc.SampleMask);
+
+    const D3D12_RASTERIZER_DESC& rs = desc.RasterizerState;
+    h.Pod(rs.FillMode);
+    h.Pod(rs.CullMode);
+    h.Pod(rs.FrontCounterClockwise);
+    h.Pod(rs.DepthBias);
+    h.Pod(rs.DepthBiasClamp);
+    h.Pod(rs.SlopeScaledDepthBias);
+    h.Pod(rs.DepthClipEnable);
+    h.Pod(rs.MultisampleEnable);
+    h.Pod(rs.AntialiasedLineEnable);
+    h.Pod(rs.ForcedSampleCount);
+    h.Pod(rs.ConservativeRaster);
+
+    const D3D12_DEPTH_STENCIL_DESC& ds = desc.DepthStencilState;
+    h.Pod(ds.DepthEnable);
+    h.Pod(ds.DepthWriteMask);
+    h.Pod(ds.DepthFunc);
+    h.Pod(ds.StencilEnable);
+    h.Pod(ds.StencilReadMask);
+    h.Pod(ds.StencilWriteMask);
+    HashStencilOp(h, ds.FrontFace);
+    HashStencilOp(h, ds.BackFace);
+
+    h.Pod(desc.InputLayout.NumElements);
+    for (UINT i = 0; i < desc.InputLayout.NumElements; ++i)
+    {
+        const D3D12_INPUT_ELEMENT_DESC& e = desc.InputLayout.pInputElementDescs[i];
+        h.String(e.SemanticName);
+        h.Pod(e.SemanticIndex);
+        h.Pod(e.Format);
+        h.Pod(e.InputSlot);
+        h.Pod(e.AlignedByteOffset);
+        h.Pod(e.InputSlotClass);
+        h.Pod(e.InstanceDataStepRate);
+    }
+
+    h.Pod(desc.IBStripCutValue);
+    h.Pod(desc.PrimitiveTopologyType);
+    h.Pod(desc.NumRenderTargets);
+    for (UINT i = 0; i < desc.NumRenderTargets && i < 8; ++i)
+        h.Pod(desc.RTVFormats[i]);
+    h.Pod(desc.DSVFormat);
+    h.Pod(desc.SampleDesc.Count);
+    h.Pod(desc.SampleDesc.Quality);
+    h.Pod(desc.NodeMask);
+    h.Pod(desc.Flags);
+
+    return h.Finish(PipelineKeyVersion);
+}
+
+//
+// PipelineLibraryBackend
+//
+
+void PipelineLibraryBackend::Open(ID3D12Device* device, const std::wstring& filename)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mDevice = device;
+    mFilename = filename;
+    mLibrary = nullptr;
+    mBlob.clear();
+    mDirty = false;
+
+    Microsoft::WRL::ComPtr<ID3D12Device1> device1;
+    if (FAILED(mDevice.As(&device1)))
+        return;
+
+    std::ifstream fin(filename, std::ios::binary);
+    if (fin)
+        mBlob.assign(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+
+    // A library from another driver or adapter is rejected; start over empty.
+    HRESULT hr = mBlob.empty() ? E_FAIL :
+        device1->CreatePipelineLibrary(mBlob.data(), mBlob.size(), IID_PPV_ARGS(&mLibrary));
+    if (FAILED(hr))
+    {
+        mBlob.clear();
+        mLibrary = nullptr;
+        if (SUCCEEDED(device1->CreatePipelineLibrary(nullptr, 0, IID_PPV_ARGS(&mLibrary))))
+            mDirty = true;
+    }
+}
+
+void PipelineLibraryBackend::Save()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!mLibrary || !mDirty || mFilename.empty())
+        return;
+
+    std::vector<char> data(mLibrary->GetSerializedSize());
+    if (FAILED(mLibrary->Serialize(data.data(), data.size())))
+        return;
+
+    // Write next to the target and rename, so a crash never leaves a torn library.
+    const std::wstring temp = mFilename + L".tmp";
+    {
+        std::ofstream fout(temp, std::ios::binary | std::ios::trunc);
+        if (!fout)
+            return;
+        fout.write(data.data(), data.size());
+        if (!fout)
+            return;
+    }
+    if (MoveFileExW(temp.c_str(), mFilename.c_str(), MOVEFILE_REPLACE_EXISTING))
+        mDirty = false;
+}
+
+HRESULT PipelineLibraryBackend::Load(const std::wstring& name, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc,
+    Microsoft::WRL::ComPtr<ID3D12PipelineState>& pso)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!mLibrary)
+        return E_NOTIMPL;
+    return mLibrary->LoadGraphicsPipeline(name.c_str(), &desc, IID_PPV_ARGS(&pso));
+}
+
+HRESULT PipelineLibraryBackend::Create(const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc,
+    Microsoft::WRL::ComPtr<ID3D12PipelineState>& pso)
+{
+    // The device is free threaded; pipelines compile in parallel without the lock.
+    return mDevice->CreateGraphicsPipelineState(&desc, IID_PPV_ARGS(&pso));
+}
+
+void PipelineLibraryBackend::Store(const std::wstring& name, ID3D12PipelineState* pso)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mLibrary && SUCCEEDED(mLibrary->StorePipeline(name.c_str(), pso)))
+        mDirty = true;
+}
+
+//
+// PipelineCache
+//
+
+PipelineCache::PipelineCache(PipelineBackend* backend, unsigned threads)
+    : mBackend(backend)
+{
+    for (unsigned i = 0; i < threads; ++i)
+        mWorkers.emplace_back(&PipelineCache::WorkerMain, this);
+}
+
+PipelineCache::~PipelineCache()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mQuit = true;
+        // Queued builds will never run; fail them so Get calls waiting on
+        // them wake up instead of waiting forever.
+        for (const Job& job : mJobs)
+            mEntries[job.Key].State = EntryState::Failed;
+        mJobs.clear();
+    }
+    mWake.notify_all();
+    mIdle.notify_all();
+    // Workers finish the build they are on before they see mQuit.
+    for (auto& t : mWorkers)
+        t.join();
+
+    // Builds running inside Get, and Get calls still waiting, touch the map.
+    std::unique_lock<std::mutex> lock(mMutex);
+    mIdle.wait(lock, [&]() { return mBusy == 0 && mWaiters == 0; });
+}
+
+HRESULT PipelineCache::Build(UINT64 key, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc,
+    Microsoft::WRL::ComPtr<ID3D12PipelineState>& pso)
+{
+    PROFILE_FUNCTION();
+    const std::wstring name = AnsiToWString(HashToString(key));
+    if (SUCCEEDED(mBackend->Load(name, desc, pso)))
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        ++mStats.LibraryHits;
+        return S_OK;
+    }
+
+    HRESULT hr = mBackend->Create(desc, pso);
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (SUCCEEDED(hr))
+            ++mStats.Compiles;
+        else
+            ++mStats.Failures;
+    }
+    if (SUCCEEDED(hr))
+        mBackend->Store(name, pso.Get());
+    return hr;
+}
+
+ID3D12PipelineState* PipelineCache::Get(UINT64 key, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc)
+{
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        if (mQuit)
+            ThrowIfFailed(E_ABORT);
+        if (mEntries.count(key))
+        {
+            // Already queued by Request; wait for the worker rather than compiling twice.
+            // Look the entry up again after waiting, other threads may have rehashed the map.
+            ++mWaiters;
+            mIdle.wait(lock, [&]() { return mEntries[key].State != EntryState::Pending; });
+            // The destructor waits for the last waiter to leave.
+            if (--mWaiters == 0 && mQuit)
+                mIdle.notify_all();
+            Entry& entry = mEntries[key];
+            if (entry.State == EntryState::Ready)
+            {
+                ++mStats.MemoryHits;
+                return entry.Pso.Get();
+            }
+            // The destructor failed it; do not start a build now.
+            if (mQuit)
+                ThrowIfFailed(E_ABORT);
+        }
+        mEntries[key].State = EntryState::Pending;
+        ++mBusy;
+    }
+
+    Microsoft::WRL::ComPtr<ID3D12PipelineState> pso;
+    HRESULT hr = Build(key, desc, pso);
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    Entry& entry = mEntries[key];
+    entry.State = SUCCEEDED(hr) ? EntryState::Ready : EntryState::Failed;
+    entry.Pso = pso;
+    --mBusy;
+    mIdle.notify_all();
+    ThrowIfFailed(hr);
+    return entry.Pso.Get();
+}
+
+ID3D12PipelineState* PipelineCache::Request(UINT64 key, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc,
+    ID3D12PipelineState* fallback)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    auto it = mEntries.find(key);
+    if (it != mEntries.end())
+    {
+        if (it->second.State == EntryState::Ready)
+        {
+            ++mStats.MemoryHits;
+            return it->second.Pso.Get();
+        }
+        ++mStats.Fallbacks;
+        return fallback;
+    }
+    if (mQuit)
+        return fallback;
+
+    mEntries[key].State = EntryState::Pending;
+    ++mStats.Fallbacks;
+    if (mWorkers.empty())
+    {
+        // No workers to hand it to; build now and still answer with the fallback
+        // this once, so callers see the same behavior either way.
+        ++mBusy;
+        lock.unlock();
+        Microsoft::WRL::ComPtr<ID3D12PipelineState> pso;
+        HRESULT hr = Build(key, desc, pso);
+        lock.lock();
+        mEntries[key].State = SUCCEEDED(hr) ? EntryState::Ready : EntryState::Failed;
+        mEntries[key].Pso = pso;
+        --mBusy;
+        mIdle.notify_all();
+        return fallback;
+    }
+
+    Job job;
+    job.Key = key;
+    job.Desc = desc;
+    mJobs.push_back(job);
+    mWake.notify_one();
+    return fallback;
+}
+
+bool PipelineCache::IsReady(UINT64 key)const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mEntries.find(key);
+    return it != mEntries.end() && it->second.State == EntryState::Ready;
+}
+
+size_t PipelineCache::PendingCount()const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mJobs.size() + mBusy;
+}
+
+void PipelineCache::WaitIdle()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    mIdle.wait(lock, [&]() { return mJobs.empty() && mBusy == 0; });
+}
+
+PipelineCacheStats PipelineCache::Stats()const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mStats;
+}
+
+void PipelineCache::WorkerMain()
+{
+    PROFILE_THREAD("Pipeline compiler");
+    std::unique_lock<std::mutex> lock(mMutex);
+    for (;;)
+    {
+        mWake.wait(lock, [&]() { return mQuit || !mJobs.empty(); });
+        if (mQuit)
+            return;
+
+        Job job = mJobs.front();
+        mJobs.pop_front();
+        ++mBusy;
+        lock.unlock();
+
+        Microsoft::WRL::ComPtr<ID3D12PipelineState> pso;
+        HRESULT hr = Build(job.Key, job.Desc, pso);
+
+        lock.lock();
+        Entry& entry = mEntries[job.Key];
+        entry.State = SUCCEEDED(hr) ? EntryState::Ready : EntryState::Failed;
+        entry.Pso = pso;
+        --mBusy;
+        mIdle.notify_all();
+    }
+}
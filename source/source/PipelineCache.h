@@ -0,0 +1,136 @@
+#pragma once
+#include "../../Common/d3dUtil.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// Hash of everything in desc that changes the compiled pipeline.  Pointed to
+// data (shader bytecode, input layout, stream output) is hashed by value and
+// pRootSignature is replaced by rootSignatureHash, so the same description
+// gives the same key on every run.  CachedPSO is ignored.
+UINT64 HashPipelineDesc(const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc, UINT64 rootSignatureHash);
+
+// Where PipelineCache gets its pipelines from.  PipelineLibraryBackend talks
+// to the device; anything else (a test fake, say) only has to implement these.
+// Calls may come from the cache's worker threads.
+class PipelineBackend
+{
+public:
+    virtual ~PipelineBackend() = default;
+
+    // A pipeline stored under name by an earlier run, or a failure code.
+    virtual HRESULT Load(const std::wstring& name, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc,
+        Microsoft::WRL::ComPtr<ID3D12PipelineState>& pso) = 0;
+    virtual HRESULT Create(const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc,
+        Microsoft::WRL::ComPtr<ID3D12PipelineState>& pso) = 0;
+    // Remembers a freshly created pipeline for the next run.
+    virtual void Store(const std::wstring& name, ID3D12PipelineState* pso) = 0;
+};
+
+// Backend over an ID3D12PipelineLibrary serialized to one file.  Without
+// ID3D12Device1, or when the driver rejects the saved library, it compiles
+// everything and saves nothing.
+class PipelineLibraryBackend : public PipelineBackend
+{
+public:
+    // Reads filename if it exists; the library is written back by Save.
+    void Open(ID3D12Device* device, const std::wstring& filename);
+    // Writes the library if pipelines were added since it was read.
+    void Save();
+
+    HRESULT Load(const std::wstring& name, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc,
+        Microsoft::WRL::ComPtr<ID3D12PipelineState>& pso)override;
+    HRESULT Create(const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc,
+        Microsoft::WRL::ComPtr<ID3D12PipelineState>& pso)override;
+    void Store(const std::wstring& name, ID3D12PipelineState* pso)override;
+
+private:
+    std::mutex mMutex;
+    Microsoft::WRL::ComPtr<ID3D12Device> mDevice;
+    Microsoft::WRL::ComPtr<ID3D12PipelineLibrary> mLibrary;
+    // The library reads from this memory for as long as it lives.
+    std::vector<char> mBlob;
+    std::wstring mFilename;
+    bool mDirty = false;
+};
+
+struct PipelineCacheStats
+{
+    // Found in the cache or in the backend's library.
+    UINT64 MemoryHits = 0;
+    UINT64 LibraryHits = 0;
+    // Compiled from scratch.
+    UINT64 Compiles = 0;
+    UINT64 Failures = 0;
+    // Request calls answered with the fallback while the pipeline compiled.
+    UINT64 Fallbacks = 0;
+};
+
+// Pipeline states keyed by HashPipelineDesc, which callers compute once per
+// description rather than per lookup.  Get builds synchronously; Request
+// never blocks the caller, it queues the build on a worker thread and hands
+// back the fallback until the pipeline is ready.  Descriptions queued by
+// Request are copied, but the shaders and input layout they point to must
+// stay alive until the build finishes.
+class PipelineCache
+{
+public:
+    explicit PipelineCache(PipelineBackend* backend, unsigned threads = 1);
+    PipelineCache(const PipelineCache& rhs) = delete;
+    PipelineCache& operator=(const PipelineCache& rhs) = delete;
+    ~PipelineCache();
+
+    // Throws if the pipeline cannot be created.
+    ID3D12PipelineState* Get(UINT64 key, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc);
+    // fallback is returned while pending and if the build failed.
+    ID3D12PipelineState* Request(UINT64 key, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc,
+        ID3D12PipelineState* fallback);
+
+    bool IsReady(UINT64 key)const;
+    size_t PendingCount()const;
+    // Blocks until every queued build has finished.
+    void WaitIdle();
+
+    PipelineCacheStats Stats()const;
+
+private:
+    enum class EntryState
+    {
+        Pending,
+        Ready,
+        Failed
+    };
+
+    struct Entry
+    {
+        EntryState State = EntryState::Pending;
+        Microsoft::WRL::ComPtr<ID3D12PipelineState> Pso;
+    };
+
+    struct Job
+    {
+        UINT64 Key = 0;
+        D3D12_GRAPHICS_PIPELINE_STATE_DESC Desc;
+    };
+
+    // Library first, then compile and store.  Runs without the lock held.
+    HRESULT Build(UINT64 key, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc,
+        Microsoft::WRL::ComPtr<ID3D12PipelineState>& pso);
+    void WorkerMain();
+
+    PipelineBackend* mBackend;
+
+    mutable std::mutex mMutex;
+    std::condition_variable mWake;
+    std::condition_variable mIdle;
+    std::unordered_map<UINT64, Entry> mEntries;
+    std::deque<Job> mJobs;
+    // Builds running outside the lock, and Get calls waiting on one.
+    size_t mBusy = 0;
+    size_t mWaiters = 0;
+    bool mQuit = false;
+    std::vector<std::thread> mWorkers;
+
+    PipelineCacheStats mStats;
+};
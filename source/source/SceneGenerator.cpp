@@ -0,0 +1,405 @@
+#include "SceneGenerator.h"
+#include "Game_engine_core.h"
+#include "ApiTrace.h"
+#include "../../Common/GeometryGenerator.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+using namespace DirectX;
+
+namespace
+{
+    // mt19937's output is the same everywhere, the standard distributions are
+    // not; these keep a seed's scene the same across compilers.
+    class Random
+    {
+    public:
+        explicit Random(uint32_t seed)
+            : mEngine(seed)
+        {
+        }
+
+        // In [0, 1).
+        float Next()
+        {
+            return (float)(mEngine() >> 8) * (1.0f / 16777216.0f);
+        }
+
+        float Range(float lo, float hi)
+        {
+            return lo + (hi - lo) * Next();
+        }
+
+        // In [0, n).
+        uint32_t Below(uint32_t n)
+        {
+            return (uint32_t)(((uint64_t)mEngine() * n) >> 32);
+        }
+
+        // Standard normal.
+        float Normal()
+        {
+            const float u = 1.0f - Next();
+            const float v = Next();
+            return sqrtf(-2.0f * logf(u)) * cosf(XM_2PI * v);
+        }
+
+    private:
+        std::mt19937 mEngine;
+    };
+
+    // Makes the calls of a scene into a trace, encoded as Game_engine records
+    // them, so it replays as if the scene had been built live.
+    class SceneTrace
+    {
+    public:
+        explicit SceneTrace(ApiTraceWriter& out)
+            : mOut(out)
+        {
+        }
+
+        void CreateMaterial(const std::string& name, XMFLOAT4 albedo, XMFLOAT3 fresnel, float roughness,
+            const std::string& texture, XMFLOAT3 matTransform = XMFLOAT3(1, 1, 1))
+        {
+            mOut.Call(ApiCall::CreateMaterial).String(name).Pod(albedo).Pod(fresnel)
+                .Pod(roughness).String(texture).Pod(matTransform);
+        }
+
+        void CreateGeometry(const Mesh& mesh, XMFLOAT3 pos, const std::string& material, const std::string& name)
+        {
+            mOut.Call(ApiCall::CreateGeometry).Geometry(mesh).Pod(pos).String(material).String(name);
+        }
+
+        void CreateWorld()
+        {
+            mOut.Call(ApiCall::CreateWorld);
+        }
+
+        void MoveObject(const std::string& name, FXMMATRIX world)
+        {
+            XMFLOAT4X4 w;
+            XMStoreFloat4x4(&w, world);
+            mOut.Call(ApiCall::MoveObject).String(name).Pod(w);
+        }
+
+        void SetAmbient(XMFLOAT4 ambient)
+        {
+            mOut.Call(ApiCall::SetAmbient).Pod(ambient);
+        }
+
+        void SetLight(XMFLOAT3 direction, XMFLOAT3 strength)
+        {
+            mOut.Call(ApiCall::SetLight).Pod(direction).Pod(strength);
+        }
+
+    private:
+        ApiTraceWriter& mOut;
+    };
+
+    // As Game_engine::CreateGeometry converts it.
+    Mesh ToMesh(GeometryGenerator::MeshData data)
+    {
+        Mesh mesh;
+        mesh.vertices.resize(data.Vertices.size());
+        for (size_t i = 0; i < data.Vertices.size(); ++i)
+        {
+            mesh.vertices[i].Pos = data.Vertices[i].Position;
+            mesh.vertices[i].Normal = data.Vertices[i].Normal;
+            mesh.vertices[i].TexC = data.Vertices[i].TexC;
+        }
+        mesh.indices = data.GetIndices16();
+        return mesh;
+    }
+
+    // One over the largest side of the mesh's bounds.
+    float NormalizeScale(const Mesh& mesh)
+    {
+        if (mesh.vertices.empty())
+            return 1.0f;
+
+        XMVECTOR vMin = XMLoadFloat3(&mesh.vertices[0].Pos);
+        XMVECTOR vMax = vMin;
+        for (const Vertex& v : mesh.vertices)
+        {
+            const XMVECTOR p = XMLoadFloat3(&v.Pos);
+            vMin = XMVectorMin(vMin, p);
+            vMax = XMVectorMax(vMax, p);
+        }
+
+        XMFLOAT3 size;
+        XMStoreFloat3(&size, vMax - vMin);
+        const float largest = std::max(size.x, std::max(size.y, size.z));
+        return largest > 0.0f ? 1.0f / largest : 1.0f;
+    }
+
+    std::string MaterialName(uint32_t i)
+    {
+        return "stress_mat" + std::to_string(i);
+    }
+
+    // Evenly spread hues, so neighbouring objects are told apart.
+    XMFLOAT4 MaterialAlbedo(uint32_t i, uint32_t count)
+    {
+        const float h = 6.0f * (float)i / (float)count;
+        const float s = 0.6f;
+        const float v = 0.9f;
+        const float x = 1.0f - fabsf(fmodf(h, 2.0f) - 1.0f);
+
+        float r = 1.0f, g = 1.0f, b = 1.0f;
+        switch ((int)h)
+        {
+        case 0: r = 1.0f; g = x; b = 0.0f; break;
+        case 1: r = x; g = 1.0f; b = 0.0f; break;
+        case 2: r = 0.0f; g = 1.0f; b = x; break;
+        case 3: r = 0.0f; g = x; b = 1.0f; break;
+        case 4: r = x; g = 0.0f; b = 1.0f; break;
+        default: r = 1.0f; g = 0.0f; b = x; break;
+        }
+
+        const float grey = 1.0f - s;
+        return XMFLOAT4(v * (grey + s * r), v * (grey + s * g), v * (grey + s * b), 1.0f);
+    }
+}
+
+SceneGenerator::SceneGenerator()
+{
+    GeometryGenerator geoGen;
+    AddMesh("box", ToMesh(geoGen.CreateBox(1.0f, 1.0f, 1.0f, 0)));
+    AddMesh("sphere", ToMesh(geoGen.CreateSphere(0.5f, 12, 8)));
+    AddMesh("geosphere", ToMesh(geoGen.CreateGeosphere(0.5f, 1)));
+    AddMesh("cylinder", ToMesh(geoGen.CreateCylinder(0.5f, 0.5f, 1.0f, 12, 1)));
+}
+
+void SceneGenerator::AddMesh(const std::string& name, const Mesh& mesh)
+{
+    Shape shape;
+    shape.Name = name;
+    shape.Geometry = mesh;
+    shape.Normalize = NormalizeScale(mesh);
+    mShapes.push_back(std::move(shape));
+}
+
+void SceneGenerator::Generate(const SceneSettings& settings)
+{
+    mSettings = settings;
+    mSettings.MaterialCount = std::max(mSettings.MaterialCount, 1u);
+    mSettings.Clusters = std::max(mSettings.Clusters, 1u);
+    mSettings.LotsPerBlockSide = std::max(mSettings.LotsPerBlockSide, 1u);
+
+    mObjects.clear();
+    mMoving.clear();
+    mRadius = 0.0f;
+    mObjects.reserve(mSettings.ObjectCount);
+
+    // Apart, so that changing how objects look or move leaves them in place.
+    Random place(mSettings.Seed);
+    Random looks(mSettings.Seed + 1);
+    Random motion(mSettings.Seed + 2);
+    Random paint(mSettings.Seed + 3);
+
+    std::vector<XMFLOAT2> centers;
+    if (mSettings.Layout == SceneLayout::Clustered)
+    {
+        centers.resize(mSettings.Clusters);
+        for (XMFLOAT2& c : centers)
+        {
+            c.x = place.Range(-mSettings.Extent, mSettings.Extent);
+            c.y = place.Range(-mSettings.Extent, mSettings.Extent);
+        }
+    }
+
+    // Lots along x of the whole city, in whole blocks; the rows along z stop
+    // at the last one used.
+    const uint32_t lotsPerBlock = mSettings.LotsPerBlockSide;
+    uint32_t lotsPerSide = (uint32_t)ceilf(sqrtf((float)mSettings.ObjectCount));
+    lotsPerSide = std::max((lotsPerSide + lotsPerBlock - 1) / lotsPerBlock * lotsPerBlock, lotsPerBlock);
+    const uint32_t rows = (mSettings.ObjectCount + lotsPerSide - 1) / lotsPerSide;
+    const uint32_t blocksX = lotsPerSide / lotsPerBlock;
+    const uint32_t blocksZ = (rows + lotsPerBlock - 1) / lotsPerBlock;
+    const float pitch = mSettings.BlockSize + mSettings.StreetWidth;
+    const float lotSize = mSettings.BlockSize / (float)lotsPerBlock;
+    const float originX = -0.5f * ((float)blocksX * pitch - mSettings.StreetWidth);
+    const float originZ = -0.5f * ((float)blocksZ * pitch - mSettings.StreetWidth);
+
+    for (uint32_t i = 0; i < mSettings.ObjectCount; ++i)
+    {
+        SceneObject o;
+        o.Name = "stress" + std::to_string(i);
+        o.Shape = looks.Below((uint32_t)mShapes.size());
+        o.Material = paint.Below(mSettings.MaterialCount);
+
+        if (mSettings.Layout == SceneLayout::CityGrid)
+        {
+            const uint32_t lx = i % lotsPerSide;
+            const uint32_t lz = i / lotsPerSide;
+            const float footprint = lotSize * looks.Range(0.5f, 0.9f);
+            const float height = looks.Range(mSettings.MinSize, std::max(mSettings.Height, mSettings.MinSize));
+
+            o.Scale = XMFLOAT3(footprint, height, footprint);
+            o.Yaw = (float)looks.Below(4) * XM_PIDIV2;
+            o.Position.x = originX + (float)(lx / lotsPerBlock) * pitch + ((float)(lx % lotsPerBlock) + 0.5f) * lotSize;
+            o.Position.y = 0.5f * height;
+            o.Position.z = originZ + (float)(lz / lotsPerBlock) * pitch + ((float)(lz % lotsPerBlock) + 0.5f) * lotSize;
+        }
+        else
+        {
+            const float size = looks.Range(mSettings.MinSize, mSettings.MaxSize);
+            o.Scale = XMFLOAT3(size, size, size);
+            o.Yaw = looks.Range(0.0f, XM_2PI);
+
+            if (mSettings.Layout == SceneLayout::Clustered)
+            {
+                const XMFLOAT2& c = centers[place.Below(mSettings.Clusters)];
+                o.Position.x = c.x + place.Normal() * mSettings.ClusterRadius;
+                o.Position.z = c.y + place.Normal() * mSettings.ClusterRadius;
+            }
+            else
+            {
+                o.Position.x = place.Range(-mSettings.Extent, mSettings.Extent);
+                o.Position.z = place.Range(-mSettings.Extent, mSettings.Extent);
+            }
+            o.Position.y = place.Range(0.0f, mSettings.Height);
+        }
+
+        if (mSettings.Motion != SceneMotion::Static && motion.Next() < mSettings.MovingFraction)
+        {
+            o.Motion = mSettings.Motion;
+            if (o.Motion == SceneMotion::Mixed)
+                o.Motion = (SceneMotion)((uint32_t)SceneMotion::Spin + motion.Below(3));
+            o.Phase = motion.Range(0.0f, XM_2PI);
+
+            switch (o.Motion)
+            {
+            case SceneMotion::Spin:
+                o.Speed = motion.Range(0.5f, 2.0f);
+                break;
+            case SceneMotion::Orbit:
+                o.Speed = motion.Range(0.2f, 1.0f);
+                o.Amplitude = motion.Range(1.0f, 5.0f);
+                break;
+            default:
+                o.Speed = motion.Range(0.2f, 1.0f);
+                o.Amplitude = motion.Range(0.5f, 2.0f);
+                break;
+            }
+            mMoving.push_back(i);
+        }
+
+        const float reach = sqrtf(o.Position.x * o.Position.x + o.Position.z * o.Position.z)
+            + std::max(o.Scale.x, o.Scale.z) + o.Amplitude;
+        mRadius = std::max(mRadius, reach);
+        mObjects.push_back(std::move(o));
+    }
+}
+
+const std::vector<SceneObject>& SceneGenerator::Objects()const
+{
+    return mObjects;
+}
+
+XMMATRIX SceneGenerator::World(const SceneObject& object, float time)const
+{
+    float yaw = object.Yaw;
+    XMFLOAT3 offset(0.0f, 0.0f, 0.0f);
+    switch (object.Motion)
+    {
+    case SceneMotion::Spin:
+        yaw += object.Speed * time;
+        break;
+    case SceneMotion::Orbit:
+    {
+        const float angle = object.Phase + object.Speed * time;
+        offset.x = object.Amplitude * cosf(angle);
+        offset.z = object.Amplitude * sinf(angle);
+        break;
+    }
+    case SceneMotion::Bob:
+        offset.y = object.Amplitude * sinf(object.Phase + XM_2PI * object.Speed * time);
+        break;
+    default:
+        break;
+    }
+
+    const float n = mShapes[object.Shape].Normalize;
+    return XMMatrixScaling(object.Scale.x * n, object.Scale.y * n, object.Scale.z * n) *
+        XMMatrixRotationY(yaw) *
+        XMMatrixTranslation(object.Position.x + offset.x, object.Position.y + offset.y, object.Position.z + offset.z);
+}
+
+XMFLOAT3 SceneGenerator::CameraPosition(float angle)const
+{
+    const float radius = mRadius * 1.1f + 10.0f;
+    const float height = mRadius * 0.4f + 10.0f;
+    return XMFLOAT3(radius * sinf(angle), height, -radius * cosf(angle));
+}
+
+template<typename Target>
+void SceneGenerator::BuildOn(Target& target)const
+{
+    for (uint32_t i = 0; i < mSettings.MaterialCount; ++i)
+    {
+        const float roughness = 0.2f + 0.2f * (float)(i % 4);
+        target.CreateMaterial(MaterialName(i), MaterialAlbedo(i, mSettings.MaterialCount),
+            XMFLOAT3(0.05f, 0.05f, 0.05f), roughness, mSettings.Texture);
+    }
+
+    for (const SceneObject& o : mObjects)
+        target.CreateGeometry(mShapes[o.Shape].Geometry, o.Position, MaterialName(o.Material), o.Name);
+    target.CreateWorld();
+
+    // Objects are only created at their position; the rest of their
+    // transform needs the world.
+    for (const SceneObject& o : mObjects)
+        target.MoveObject(o.Name, World(o, 0.0f));
+
+    target.SetAmbient(XMFLOAT4(0.4f, 0.4f, 0.6f, 1.0f));
+    target.SetLight(XMFLOAT3(0.7f, -0.5f, 0.4f), XMFLOAT3(0.6f, 0.5f, 0.5f));
+}
+
+void SceneGenerator::Build(Game_engine& engine)const
+{
+    BuildOn(engine);
+}
+
+void SceneGenerator::Animate(Game_engine& engine, float time)const
+{
+    for (uint32_t i : mMoving)
+        engine.MoveObject(mObjects[i].Name, World(mObjects[i], time));
+}
+
+bool SceneGenerator::WriteTrace(const std::string& file, const SceneTraceSettings& trace)const
+{
+    ApiTraceWriter out;
+    if (!out.Open(file))
+        return false;
+
+    SceneTrace target(out);
+    out.Call(ApiCall::LoadTexture).WString(trace.TexturePath).String(mSettings.Texture);
+    out.Call(ApiCall::Initialize);
+    BuildOn(target);
+
+    const XMVECTOR worldUp = XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
+
+    for (uint32_t f = 0; f < trace.Frames; ++f)
+    {
+        const float time = (float)(f + 1) * trace.FrameTime;
+        for (uint32_t i : mMoving)
+            target.MoveObject(mObjects[i].Name, World(mObjects[i], time));
+
+        const float angle = trace.CameraOrbitSeconds > 0.0f ? XM_2PI * time / trace.CameraOrbitSeconds : 0.0f;
+        const XMFLOAT3 pos = CameraPosition(angle);
+
+        // As Camera::LookAt builds its basis.
+        const XMVECTOR L = XMVector3Normalize(-XMLoadFloat3(&pos));
+        const XMVECTOR R = XMVector3Normalize(XMVector3Cross(worldUp, L));
+        const XMVECTOR U = XMVector3Cross(L, R);
+        XMFLOAT3 look, up;
+        XMStoreFloat3(&look, L);
+        XMStoreFloat3(&up, U);
+
+        out.Call(ApiCall::Update).Pod(time).Pod(trace.FrameTime).Pod(false).Pod(pos).Pod(look).Pod(up);
+        out.Call(ApiCall::Draw);
+    }
+    return out.Close();
+}
@@ -0,0 +1,145 @@
+#pragma once
+#include "Mesh.h"
+#include <DirectXMath.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Game_engine;
+
+enum class SceneLayout
+{
+    // Anywhere on the ground square.
+    Uniform,
+    // Around Clusters centers, normally distributed.
+    Clustered,
+    // Axis aligned on the lots of square blocks between streets; the city
+    // grows with the object count rather than with Extent.
+    CityGrid
+};
+
+enum class SceneMotion
+{
+    Static,
+    // Turns in place.
+    Spin,
+    // Circles its spawn point.
+    Orbit,
+    // Moves up and down.
+    Bob,
+    // Each moving object picks one of the above.
+    Mixed
+};
+
+struct SceneSettings
+{
+    uint32_t Seed = 1;
+    uint32_t ObjectCount = 1000;
+    SceneLayout Layout = SceneLayout::Uniform;
+
+    // Half the side of the ground square, and how high above it objects go.
+    float Extent = 500.0f;
+    float Height = 20.0f;
+    uint32_t Clusters = 16;
+    // Standard deviation of the distance to a cluster's center.
+    float ClusterRadius = 40.0f;
+    float BlockSize = 60.0f;
+    float StreetWidth = 15.0f;
+    uint32_t LotsPerBlockSide = 4;
+
+    // Largest side of an object, shapes are normalized to 1 first.
+    float MinSize = 0.5f;
+    float MaxSize = 4.0f;
+
+    uint32_t MaterialCount = 8;
+    // Loaded by the caller, or by a trace from TexturePath.
+    std::string Texture = "white";
+
+    SceneMotion Motion = SceneMotion::Static;
+    // Of the objects, how many move.
+    float MovingFraction = 0.1f;
+};
+
+// Where objects are and how they move.  World() turns it into a matrix.
+struct SceneObject
+{
+    std::string Name;
+    // Into the generator's shapes; the built-in primitives come first.
+    uint32_t Shape = 0;
+    uint32_t Material = 0;
+    DirectX::XMFLOAT3 Position = { 0.0f, 0.0f, 0.0f };
+    DirectX::XMFLOAT3 Scale = { 1.0f, 1.0f, 1.0f };
+    float Yaw = 0.0f;
+
+    SceneMotion Motion = SceneMotion::Static;
+    // Radians per second for Spin and Orbit, cycles per second for Bob.
+    float Speed = 0.0f;
+    float Phase = 0.0f;
+    // Of the orbit, or half the bob.
+    float Amplitude = 0.0f;
+};
+
+// How WriteTrace plays the scene.
+struct SceneTraceSettings
+{
+    std::wstring TexturePath = L"../../Textures/white.dds";
+    uint32_t Frames = 600;
+    float FrameTime = 1.0f / 60.0f;
+    // The camera circles the scene once in this time; 0 keeps it still.
+    float CameraOrbitSeconds = 60.0f;
+};
+
+// Builds large scenes for scaling tests: GeometryGenerator primitives and
+// imported meshes, placed, sized, colored and set in motion from a seed.
+// The same settings and meshes give the same scene, call for call, so the
+// engine can be measured live or through a trace ApiTracePlayer replays.
+class SceneGenerator
+{
+public:
+    // Starts with a box, a sphere, a geosphere and a cylinder as shapes.
+    SceneGenerator();
+
+    // Adds an imported mesh to the shapes; call before Generate.
+    void AddMesh(const std::string& name, const Mesh& mesh);
+    // Places settings.ObjectCount objects, replacing the last scene.
+    void Generate(const SceneSettings& settings);
+
+    const std::vector<SceneObject>& Objects()const;
+    DirectX::XMMATRIX World(const SceneObject& object, float time)const;
+    // On the circle WriteTrace's camera goes round, looking at the origin from
+    // -z at angle 0, high enough to see the whole scene.
+    DirectX::XMFLOAT3 CameraPosition(float angle)const;
+
+    // Creates the materials, lights and objects in an initialized engine,
+    // then its world.  The settings' texture must be loaded.
+    void Build(Game_engine& engine)const;
+    // Moves the moving objects to where they are at time.
+    void Animate(Game_engine& engine, float time)const;
+
+    // Writes the whole session, from loading the texture to the last frame,
+    // as a trace; no engine or device is needed.  Every object's mesh is
+    // stored with it, so large scenes make large traces.  False if the file
+    // can't be written.
+    bool WriteTrace(const std::string& file, const SceneTraceSettings& trace)const;
+
+private:
+    struct Shape
+    {
+        std::string Name;
+        Mesh Geometry;
+        // Makes the largest side 1.
+        float Normalize = 1.0f;
+    };
+
+    // Makes the calls of Build on an engine or a trace.
+    template<typename Target>
+    void BuildOn(Target& target)const;
+
+    std::vector<Shape> mShapes;
+    SceneSettings mSettings;
+    std::vector<SceneObject> mObjects;
+    // Indices of the objects that move.
+    std::vector<uint32_t> mMoving;
+    // Of the circle around the origin the objects are in.
+    float mRadius = 0.0f;
+};
@@ -0,0 +1,245 @@
+#include "ShaderCache.h"
+#include "../../Common/Hash.h"
+#include <atomic>
+#include <exception>
+#include <thread>
+
+namespace
+{
+    // Bump when the key layout changes.
+    const UINT64 ShaderKeyVersion = 1;
+
+#if defined(DEBUG) || defined(_DEBUG)
+    // d3dUtil::CompileShader builds debug bytecode in debug builds.
+    const uint32_t ShaderCompileFlags = 1;
+#else
+    const uint32_t ShaderCompileFlags = 0;
+#endif
+
+    bool ReadFile(const std::wstring& filename, std::string& data)
+    {
+        std::ifstream fin(filename, std::ios::binary);
+        if (!fin)
+            return false;
+        data.assign(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+        return true;
+    }
+
+    std::wstring DirectoryOf(const std::wstring& filename)
+    {
+        const size_t slash = filename.find_last_of(L"\\/");
+        return slash == std::wstring::npos ? std::wstring() : filename.substr(0, slash + 1);
+    }
+
+    // Hashes filename and, depth first, every file it pulls in with
+    // #include "name".  Quoted includes resolve against the including file,
+    // the same as D3D_COMPILE_STANDARD_FILE_INCLUDE.  Each file counts once.
+    // An include that cannot be read (one inside a comment, say) hashes its
+    // name; only a missing root file fails.
+    bool HashSourceTree(const std::wstring& filename, std::vector<std::wstring>& visited, UINT64& hash)
+    {
+        const bool root = visited.empty();
+        for (const std::wstring& v : visited)
+        {
+            if (v == filename)
+                return true;
+        }
+        visited.push_back(filename);
+
+        std::string source;
+        if (!ReadFile(filename, source))
+        {
+            hash = Hash64(filename, hash);
+            return !root;
+        }
+        hash = Hash64(source, hash);
+
+        const std::wstring dir = DirectoryOf(filename);
+        size_t pos = 0;
+        while ((pos = source.find("#include", pos)) != std::string::npos)
+        {
+            pos += 8;
+            const size_t open = source.find_first_of("\"\n", pos);
+            if (open == std::string::npos || source[open] != '"')
+                continue;
+            const size_t close = source.find_first_of("\"\n", open + 1);
+            if (close == std::string::npos || source[close] != '"')
+                continue;
+            const std::string include = source.substr(open + 1, close - open - 1);
+            HashSourceTree(dir + AnsiToWString(include), visited, hash);
+            pos = close + 1;
+        }
+        return true;
+    }
+
+    bool FileExists(const std::wstring& filename)
+    {
+        const DWORD attributes = GetFileAttributesW(filename.c_str());
+        return attributes != INVALID_FILE_ATTRIBUTES && !(attributes & FILE_ATTRIBUTE_DIRECTORY);
+    }
+}
+
+ShaderDesc::ShaderDesc(const std::wstring& filename, const D3D_SHADER_MACRO* defines,
+    const std::string& entrypoint, const std::string& target)
+    : Filename(filename), EntryPoint(entrypoint), Target(target)
+{
+    for (const D3D_SHADER_MACRO* d = defines; d && d->Name; ++d)
+        Defines.emplace_back(d->Name, d->Definition ? d->Definition : "");
+}
+
+ShaderCache::ShaderCache()
+{
+    SetCacheDirectory(L"AssetCache\\Shaders");
+}
+
+void ShaderCache::SetCacheDirectory(const std::wstring& dir)
+{
+    mCacheDir = dir;
+    if (!mCacheDir.empty())
+    {
+        // Create every level, the default lives inside the asset cache directory.
+        for (size_t slash = mCacheDir.find_first_of(L"\\/"); slash != std::wstring::npos;
+            slash = mCacheDir.find_first_of(L"\\/", slash + 1))
+        {
+            CreateDirectoryW(mCacheDir.substr(0, slash).c_str(), nullptr);
+        }
+        CreateDirectoryW(mCacheDir.c_str(), nullptr);
+        if (mCacheDir.back() != L'\\' && mCacheDir.back() != L'/')
+            mCacheDir += L'\\';
+    }
+}
+
+UINT64 ShaderCache::ShaderKey(const ShaderDesc& desc)
+{
+    UINT64 hash = ShaderKeyVersion;
+    std::vector<std::wstring> visited;
+    if (!HashSourceTree(desc.Filename, visited, hash))
+        return 0;
+
+    for (const auto& d : desc.Defines)
+        hash = Hash64(d.first + "=" + d.second, hash);
+    hash = Hash64(desc.EntryPoint, hash);
+    hash = Hash64(desc.Target, hash);
+    hash = Hash64(&ShaderCompileFlags, sizeof(ShaderCompileFlags), hash);
+    return hash == 0 ? 1 : hash;
+}
+
+std::wstring ShaderCache::CachePath(UINT64 key)const
+{
+    if (mCacheDir.empty())
+        return std::wstring();
+    return mCacheDir + AnsiToWString(HashToString(key)) + L".cso";
+}
+
+Microsoft::WRL::ComPtr<ID3DBlob> ShaderCache::Get(const std::wstring& filename, const D3D_SHADER_MACRO* defines,
+    const std::string& entrypoint, const std::string& target)
+{
+    return Get(ShaderDesc(filename, defines, entrypoint, target));
+}
+
+Microsoft::WRL::ComPtr<ID3DBlob> ShaderCache::Get(const ShaderDesc& desc)
+{
+    const UINT64 key = ShaderKey(desc);
+    if (key != 0)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto it = mShaders.find(key);
+        if (it != mShaders.end())
+        {
+            ++mStats.MemoryHits;
+            return it->second;
+        }
+    }
+
+    std::vector<D3D_SHADER_MACRO> macros;
+    for (const auto& d : desc.Defines)
+        macros.push_back({ d.first.c_str(), d.second.c_str() });
+    macros.push_back({ nullptr, nullptr });
+
+    // Unreadable source: let the compiler report the error, and remember nothing.
+    if (key == 0)
+        return d3dUtil::CompileShader(desc.Filename, macros.data(), desc.EntryPoint, desc.Target);
+
+    Microsoft::WRL::ComPtr<ID3DBlob> byteCode;
+    bool fromDisk = false;
+    const std::wstring cached = CachePath(key);
+    if (!cached.empty() && FileExists(cached))
+    {
+        byteCode = d3dUtil::LoadBinary(cached);
+        fromDisk = byteCode != nullptr && byteCode->GetBufferSize() > 0;
+    }
+    if (!fromDisk)
+    {
+        byteCode = d3dUtil::CompileShader(desc.Filename, macros.data(), desc.EntryPoint, desc.Target);
+        if (!cached.empty())
+            WriteBytecode(cached, byteCode.Get());
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (fromDisk)
+        ++mStats.DiskHits;
+    else
+        ++mStats.Misses;
+    // Another thread may have got here first; keep one blob per key.
+    auto inserted = mShaders.emplace(key, byteCode);
+    return inserted.first->second;
+}
+
+void ShaderCache::WriteBytecode(const std::wstring& file, ID3DBlob* blob)const
+{
+    // Write next to the target and rename, so a crash never leaves a torn file.
+    // The thread id keeps two threads compiling the same shader apart.
+    const std::wstring temp = file + L"." + std::to_wstring(GetCurrentThreadId()) + L".tmp";
+    {
+        std::ofstream fout(temp, std::ios::binary | std::ios::trunc);
+        if (!fout)
+            return;
+        fout.write(static_cast<const char*>(blob->GetBufferPointer()), blob->GetBufferSize());
+        if (!fout)
+            return;
+    }
+    MoveFileExW(temp.c_str(), file.c_str(), MOVEFILE_REPLACE_EXISTING);
+}
+
+void ShaderCache::Prewarm(const std::vector<ShaderDesc>& descs, unsigned threads)
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min<unsigned>(threads, (unsigned)descs.size());
+
+    std::atomic<size_t> next(0);
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    auto worker = [&]()
+    {
+        for (size_t i = next++; i < descs.size(); i = next++)
+        {
+            try
+            {
+                Get(descs[i]);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error)
+                    error = std::current_exception();
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; ++i)
+        pool.emplace_back(worker);
+    worker();
+    for (auto& t : pool)
+        t.join();
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+ShaderCacheStats ShaderCache::Stats()const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mStats;
+}
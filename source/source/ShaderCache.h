@@ -0,0 +1,66 @@
+#pragma once
+#include "../../Common/d3dUtil.h"
+#include <mutex>
+
+// One compilation: a source file, its macros, entry point and target profile.
+struct ShaderDesc
+{
+    std::wstring Filename;
+    std::vector<std::pair<std::string, std::string>> Defines;
+    std::string EntryPoint;
+    std::string Target;
+
+    ShaderDesc() = default;
+    // defines is a null terminated array as taken by d3dUtil::CompileShader, or null.
+    ShaderDesc(const std::wstring& filename, const D3D_SHADER_MACRO* defines,
+        const std::string& entrypoint, const std::string& target);
+};
+
+struct ShaderCacheStats
+{
+    // Bytecode already in memory.
+    UINT64 MemoryHits = 0;
+    // Loaded from a .cso in the cache directory.
+    UINT64 DiskHits = 0;
+    // Compiled from source.
+    UINT64 Misses = 0;
+};
+
+// Compiled shader bytecode keyed by the contents of the source and every file
+// it includes, the defines, entry point, target and compile flags.  Editing a
+// shader or anything it includes changes the key, so stale bytecode is never
+// used; unchanged shaders load from disk instead of compiling.  Safe to call
+// from several threads.
+class ShaderCache
+{
+public:
+    ShaderCache();
+
+    // Empty string disables the on-disk cache.
+    void SetCacheDirectory(const std::wstring& dir);
+
+    // Throws like d3dUtil::CompileShader if compilation fails.
+    Microsoft::WRL::ComPtr<ID3DBlob> Get(const ShaderDesc& desc);
+    Microsoft::WRL::ComPtr<ID3DBlob> Get(const std::wstring& filename, const D3D_SHADER_MACRO* defines,
+        const std::string& entrypoint, const std::string& target);
+
+    // Loads or compiles every shader in descs on up to threads threads, so the
+    // Get calls that follow are memory hits.  threads == 0 uses every hardware
+    // thread.  Rethrows the first compile error once all threads are done.
+    void Prewarm(const std::vector<ShaderDesc>& descs, unsigned threads = 0);
+
+    // Key of desc; 0 if its source file cannot be read.
+    static UINT64 ShaderKey(const ShaderDesc& desc);
+
+    ShaderCacheStats Stats()const;
+
+private:
+    std::wstring CachePath(UINT64 key)const;
+    void WriteBytecode(const std::wstring& file, ID3DBlob* blob)const;
+
+    std::wstring mCacheDir;
+
+    mutable std::mutex mMutex;
+    std::unordered_map<UINT64, Microsoft::WRL::ComPtr<ID3DBlob>> mShaders;
+    ShaderCacheStats mStats;
+};
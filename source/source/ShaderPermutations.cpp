@@ -0,0 +1,162 @@
+#include "ShaderPermutations.h"
+
+namespace
+{
+    const UINT LightCountBits = 5;
+    const UINT LightCountMask = (1u << LightCountBits) - 1;
+
+    const char* const FeatureDefines[ShaderFeatureCount] =
+    {
+        "ALPHA_TEST",
+        "NORMAL_MAP",
+        "FOG",
+        "CLUSTERED_LIGHTS",
+    };
+}
+
+UINT ShaderPermutationKey::Packed()const
+{
+    return (DirLights & LightCountMask) |
+        ((PointLights & LightCountMask) << LightCountBits) |
+        ((SpotLights & LightCountMask) << (2 * LightCountBits)) |
+        (Features << (3 * LightCountBits));
+}
+
+ShaderPermutationKey ShaderPermutationKey::Unpack(UINT packed)
+{
+    ShaderPermutationKey key;
+    key.DirLights = packed & LightCountMask;
+    key.PointLights = (packed >> LightCountBits) & LightCountMask;
+    key.SpotLights = (packed >> (2 * LightCountBits)) & LightCountMask;
+    key.Features = packed >> (3 * LightCountBits);
+    return key;
+}
+
+std::vector<std::pair<std::string, std::string>> ShaderPermutationKey::Defines()const
+{
+    std::vector<std::pair<std::string, std::string>> defines =
+    {
+        { "NUM_DIR_LIGHTS", std::to_string(DirLights) },
+        { "NUM_POINT_LIGHTS", std::to_string(PointLights) },
+        { "NUM_SPOT_LIGHTS", std::to_string(SpotLights) },
+    };
+    for (UINT i = 0; i < ShaderFeatureCount; ++i)
+    {
+        if (Features & (1u << i))
+            defines.emplace_back(FeatureDefines[i], "1");
+    }
+    return defines;
+}
+
+ShaderPermutationKey ShaderPermutationKey::Select(UINT dirLights, UINT pointLights, UINT spotLights, UINT features)
+{
+    ShaderPermutationKey key;
+    UINT left = MaxLights;
+    key.DirLights = std::min(dirLights, left);
+    left -= key.DirLights;
+    key.PointLights = std::min(pointLights, left);
+    left -= key.PointLights;
+    key.SpotLights = std::min(spotLights, left);
+    key.Features = features & ((1u << ShaderFeatureCount) - 1);
+    return key;
+}
+
+ShaderPermutations::ShaderPermutations(ShaderCache* cache)
+    : mCache(cache)
+{
+}
+
+ShaderPermutations::~ShaderPermutations()
+{
+    // Background compiles use mCache and mPixel; let them finish first.
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto& e : mVariants)
+        e.second.wait();
+}
+
+void ShaderPermutations::SetSource(const std::wstring& filename, const std::vector<std::pair<std::string, std::string>>& defines,
+    const std::string& vsEntry, const std::string& vsTarget,
+    const std::string& psEntry, const std::string& psTarget)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto& e : mVariants)
+        e.second.wait();
+    mVariants.clear();
+
+    mVertex.Filename = filename;
+    mVertex.Defines = defines;
+    mVertex.EntryPoint = vsEntry;
+    mVertex.Target = vsTarget;
+    mPixel = mVertex;
+    mPixel.EntryPoint = psEntry;
+    mPixel.Target = psTarget;
+    mVertexShader = nullptr;
+}
+
+ID3DBlob* ShaderPermutations::VertexShader()
+{
+    if (mVertexShader == nullptr)
+        mVertexShader = mCache->Get(mVertex);
+    return mVertexShader.Get();
+}
+
+ShaderDesc ShaderPermutations::PixelDesc(const ShaderPermutationKey& key)const
+{
+    ShaderDesc desc = mPixel;
+    for (auto& d : key.Defines())
+        desc.Defines.push_back(d);
+    return desc;
+}
+
+std::shared_future<ShaderPermutations::Blob> ShaderPermutations::Find(UINT packed)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mVariants.find(packed);
+    if (it != mVariants.end())
+        return it->second;
+
+    const ShaderDesc desc = PixelDesc(ShaderPermutationKey::Unpack(packed));
+    ShaderCache* cache = mCache;
+    std::shared_future<Blob> variant = std::async(std::launch::async, [cache, desc]()
+    {
+        return cache->Get(desc);
+    }).share();
+    mVariants[packed] = variant;
+    return variant;
+}
+
+ID3DBlob* ShaderPermutations::Request(const ShaderPermutationKey& key)
+{
+    std::shared_future<Blob> variant = Find(key.Packed());
+    if (variant.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return nullptr;
+    try
+    {
+        return variant.get().Get();
+    }
+    catch (...)
+    {
+        // The failure is reported by Get; draws keep using the fallback.
+        return nullptr;
+    }
+}
+
+ID3DBlob* ShaderPermutations::Get(const ShaderPermutationKey& key)
+{
+    return Find(key.Packed()).get().Get();
+}
+
+void ShaderPermutations::Prewarm(const std::vector<ShaderPermutationKey>& keys)
+{
+    std::vector<std::shared_future<Blob>> pending;
+    for (const ShaderPermutationKey& key : keys)
+        pending.push_back(Find(key.Packed()));
+    for (auto& p : pending)
+        p.get();
+}
+
+size_t ShaderPermutations::Count()const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mVariants.size();
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include "ShaderCache.h"
+#include <future>
+
+// Optional pixel shader features, OR'd into ShaderPermutationKey::Features.
+enum ShaderFeature : UINT
+{
+    ShaderFeatureAlphaTest = 1 << 0,    // clip texels with alpha below 0.1
+    ShaderFeatureNormalMap = 1 << 1,    // perturb the normal by the material's normal map
+    ShaderFeatureFog       = 1 << 2,    // blend towards the pass fog color with distance
+    ShaderFeatureClustered = 1 << 3,    // add the point and spot lights of the pixel's froxel
+    ShaderFeatureCount     = 4
+};
+
+// Light counts and features a pixel shader variant is compiled for.
+struct ShaderPermutationKey
+{
+    UINT DirLights = 1;
+    UINT PointLights = 0;
+    UINT SpotLights = 0;
+    UINT Features = 0;
+
+    // 5 bits per light count (MaxLights is 16), the feature bits above them.
+    UINT Packed()const;
+    static ShaderPermutationKey Unpack(UINT packed);
+
+    // NUM_DIR_LIGHTS, NUM_POINT_LIGHTS, NUM_SPOT_LIGHTS and one define per feature.
+    std::vector<std::pair<std::string, std::string>> Defines()const;
+
+    // Key for a draw: the scene's light counts, trimmed to MaxLights in the
+    // order directional, point, spot, plus the material's features.
+    static ShaderPermutationKey Select(UINT dirLights, UINT pointLights, UINT spotLights, UINT features);
+};
+
+// Pixel shader variants of one source file, compiled through a ShaderCache the
+// first time a key is asked for.  The vertex shader does not depend on the
+// key and is shared by every permutation.
+class ShaderPermutations
+{
+public:
+    explicit ShaderPermutations(ShaderCache* cache);
+    ~ShaderPermutations();
+
+    // defines are added to every variant, before the permutation's own.
+    void SetSource(const std::wstring& filename, const std::vector<std::pair<std::string, std::string>>& defines,
+        const std::string& vsEntry, const std::string& vsTarget,
+        const std::string& psEntry, const std::string& psTarget);
+
+    ID3DBlob* VertexShader();
+
+    // Never blocks: nullptr while the variant compiles on a background thread
+    // and if it failed to compile.  Blobs stay valid for the registry's lifetime.
+    ID3DBlob* Request(const ShaderPermutationKey& key);
+    // Blocks until the variant is compiled; throws on compile errors.
+    ID3DBlob* Get(const ShaderPermutationKey& key);
+    // Compiles every key in parallel and waits for them.
+    void Prewarm(const std::vector<ShaderPermutationKey>& keys);
+
+    size_t Count()const;
+
+private:
+    typedef Microsoft::WRL::ComPtr<ID3DBlob> Blob;
+
+    ShaderDesc PixelDesc(const ShaderPermutationKey& key)const;
+    // The variant's compile, started on first use.
+    std::shared_future<Blob> Find(UINT packed);
+
+    ShaderCache* mCache;
+    ShaderDesc mVertex;
+    ShaderDesc mPixel;
+    Blob mVertexShader;
+
+    mutable std::mutex mMutex;
+    std::unordered_map<UINT, std::shared_future<Blob>> mVariants;
+};
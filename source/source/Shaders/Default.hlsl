@@ -15,7 +15,12 @@
 // Include structures and functions for lighting.
 #include "LightingUtil.hlsl"
 
-Texture2D    gDiffuseMap : register(t0);
+#ifndef TEXTURE_TABLE_SIZE
+    #define TEXTURE_TABLE_SIZE 128
+#endif
+
+// Every loaded texture, indexed by the material's gDiffuseMapIndex.
+Texture2D    gTextureMaps[TEXTURE_TABLE_SIZE] : register(t0);
 
 
 SamplerState gsamPointWrap        : register(s0);
@@ -51,6 +56,17 @@ cbuffer cbPass : register(b1)
     float gDeltaTime;
     float4 gAmbientLight;
 
+    // Used by the FOG permutation.
+    float4 gFogColor;
+    float gFogStart;
+    float gFogRange;
+    float2 cbPerObjectPad2;
+
+    // Used by the CLUSTERED_LIGHTS permutation: froxel grid size, then log
+    // depth scale and bias and the froxels per pixel in x and y.
+    uint4 gClusterDims;
+    float4 gClusterParams;
+
     // Indices [0, NUM_DIR_LIGHTS) are directional lights;
     // indices [NUM_DIR_LIGHTS, NUM_DIR_LIGHTS+NUM_POINT_LIGHTS) are point lights;
     // indices [NUM_DIR_LIGHTS+NUM_POINT_LIGHTS, NUM_DIR_LIGHTS+NUM_POINT_LIGHT+NUM_SPOT_LIGHTS)
@@ -64,8 +80,30 @@ cbuffer cbMaterial : register(b2)
     float3   gFresnelR0;
     float    gRoughness;
 	float4x4 gMatTransform;
+    uint     gDiffuseMapIndex;
+    uint     gNormalMapIndex;
+    uint     gMatPad1;
+    uint     gMatPad2;
+};
+
+#ifdef CLUSTERED_LIGHTS
+#define CLUSTER_LIGHT_POINT 0
+#define CLUSTER_LIGHT_SPOT 1
+
+struct ClusterLight
+{
+    Light L;
+    uint Type;
+    float3 Pad;
 };
 
+// Point and spot lights binned per froxel on the CPU (LightClusterBuilder).
+StructuredBuffer<ClusterLight> gClusterLights  : register(t0, space1);
+// Offset and count of each froxel's run in gClusterIndices.
+StructuredBuffer<uint2>        gClusterRanges  : register(t1, space1);
+StructuredBuffer<uint>         gClusterIndices : register(t2, space1);
+#endif
+
 struct VertexIn
 {
 	float3 PosL    : POSITION;
@@ -107,14 +145,68 @@ VertexOut VS(VertexIn vin)
     return vout;
 }
 
+#ifdef NORMAL_MAP
+// Tangent frame from screen space derivatives, so normal mapping works on
+// meshes without tangent vectors.
+float3 NormalMapToWorld(float3 normalW, float3 posW, float2 texC)
+{
+    float3 dp1 = ddx(posW);
+    float3 dp2 = ddy(posW);
+    float2 duv1 = ddx(texC);
+    float2 duv2 = ddy(texC);
+
+    float3 dp2perp = cross(dp2, normalW);
+    float3 dp1perp = cross(normalW, dp1);
+    float3 T = dp2perp * duv1.x + dp1perp * duv2.x;
+    float3 B = dp2perp * duv1.y + dp1perp * duv2.y;
+    float invMax = rsqrt(max(max(dot(T, T), dot(B, B)), 1e-12f));
+    float3x3 TBN = float3x3(T * invMax, B * invMax, normalW);
+
+    float3 normalT = 2.0f * gTextureMaps[gNormalMapIndex].Sample(gsamAnisotropicWrap, texC).rgb - 1.0f;
+    return normalize(mul(normalT, TBN));
+}
+#endif
+
+#ifdef CLUSTERED_LIGHTS
+// Sums the point and spot lights of the froxel holding this pixel.
+// posH is SV_Position: pixel coordinates and, in w, view space depth.
+float3 ComputeClusteredLighting(float4 posH, Material mat, float3 pos, float3 normal, float3 toEye)
+{
+    uint3 cell;
+    cell.xy = min(uint2(posH.xy * gClusterParams.zw), gClusterDims.xy - 1);
+    cell.z = (uint)clamp(log(posH.w) * gClusterParams.x + gClusterParams.y, 0.0f, gClusterDims.z - 1.0f);
+    uint2 range = gClusterRanges[(cell.z * gClusterDims.y + cell.y) * gClusterDims.x + cell.x];
+
+    float3 result = 0.0f;
+    for (uint i = 0; i < range.y; ++i)
+    {
+        ClusterLight light = gClusterLights[gClusterIndices[range.x + i]];
+        if (light.Type == CLUSTER_LIGHT_SPOT)
+            result += ComputeSpotLight(light.L, mat, pos, normal, toEye);
+        else
+            result += ComputePointLight(light.L, mat, pos, normal, toEye);
+    }
+    return result;
+}
+#endif
+
 float4 PS(VertexOut pin) : SV_Target
 {
+    float4 texColor = gTextureMaps[gDiffuseMapIndex].Sample(gsamAnisotropicWrap, pin.TexC);
+#ifdef ALPHA_TEST
+    // Discard early so cut out texels skip the lighting.
+    clip(texColor.a * gDiffuseAlbedo.a - 0.1f);
+#endif
+
     if (gRoughness != 10)
     {
-        float4 diffuseAlbedo = gDiffuseMap.Sample(gsamAnisotropicWrap, pin.TexC) * gDiffuseAlbedo;
+        float4 diffuseAlbedo = texColor * gDiffuseAlbedo;
 	
     // Interpolating normal can unnormalize it, so renormalize it.
         pin.NormalW = normalize(pin.NormalW);
+#ifdef NORMAL_MAP
+        pin.NormalW = NormalMapToWorld(pin.NormalW, pin.PosW, pin.TexC);
+#endif
 
     // Vector from point being lit to eye. 
         float3 toEyeW = normalize(gEyePosW - pin.PosW);
@@ -127,16 +219,24 @@ float4 PS(VertexOut pin) : SV_Target
         float3 shadowFactor = 1.0f;
         float4 directLight = ComputeLighting(gLights, mat, pin.PosW,
         pin.NormalW, toEyeW, shadowFactor);
+#ifdef CLUSTERED_LIGHTS
+        directLight.rgb += ComputeClusteredLighting(pin.PosH, mat, pin.PosW, pin.NormalW, toEyeW);
+#endif
 
         float4 litColor = ambient + directLight;
 
+#ifdef FOG
+        float fogAmount = saturate((distance(gEyePosW, pin.PosW) - gFogStart) / gFogRange);
+        litColor = lerp(litColor, gFogColor, fogAmount);
+#endif
+
     // Common convention to take alpha from diffuse albedo.
         litColor.a = diffuseAlbedo.a;
         return litColor;
     }
     else
     {
-        return gDiffuseMap.Sample(gsamAnisotropicWrap, pin.TexC) * gDiffuseAlbedo;
+        return texColor * gDiffuseAlbedo;
     }
 }
 
@@ -0,0 +1,188 @@
+#include "ShadowCascades.h"
+#include "../../Common/Profiler.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace DirectX;
+
+ShadowCascades::ShadowCascades(const CascadeSettings& settings)
+{
+    XMStoreFloat4x4(&mLightView, XMMatrixIdentity());
+    SetSettings(settings);
+}
+
+void ShadowCascades::SetSettings(const CascadeSettings& settings)
+{
+    const uint32_t maxCount = MaxCascades;
+    mSettings = settings;
+    mSettings.Count = std::min(std::max(mSettings.Count, 1u), maxCount);
+    mSettings.Resolution = std::max(mSettings.Resolution, 1u);
+    mCascades.assign(mSettings.Count, ShadowCascade());
+    mCasters.assign(mSettings.Count, std::vector<uint32_t>());
+}
+
+const CascadeSettings& ShadowCascades::Settings()const
+{
+    return mSettings;
+}
+
+void ShadowCascades::SplitDistances(uint32_t count, float lambda, float nearZ, float farZ, float* splits)
+{
+    // Logarithmic splits match the perspective's texel density but starve
+    // the far cascades; uniform splits waste the near ones.  Blend the two.
+    for (uint32_t i = 0; i <= count; ++i)
+    {
+        const float t = (float)i / count;
+        const float logSplit = nearZ * std::pow(farZ / nearZ, t);
+        const float uniformSplit = nearZ + (farZ - nearZ) * t;
+        splits[i] = lambda * logSplit + (1.0f - lambda) * uniformSplit;
+    }
+    splits[0] = nearZ;
+    splits[count] = farZ;
+}
+
+void ShadowCascades::Fit(FXMMATRIX view, float fovY, float aspect, float nearZ, float farZ,
+    const XMFLOAT3& lightDir)
+{
+    PROFILE_FUNCTION();
+    const uint32_t count = mSettings.Count;
+    const float shadowFar = mSettings.MaxDistance > 0.0f ? std::min(mSettings.MaxDistance, farZ) : farZ;
+    float splits[MaxCascades + 1];
+    SplitDistances(count, mSettings.Lambda, nearZ, std::max(shadowFar, nearZ * 1.001f), splits);
+
+    // The light view has no translation, so moving the camera only slides the
+    // cascades across the shadow map and snapping can keep them on the grid.
+    const XMVECTOR dir = XMVector3Normalize(XMLoadFloat3(&lightDir));
+    const XMVECTOR up = std::fabs(XMVectorGetY(dir)) > 0.99f ? XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f) : XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
+    const XMMATRIX lightView = XMMatrixLookToLH(XMVectorZero(), dir, up);
+    XMStoreFloat4x4(&mLightView, lightView);
+
+    XMVECTOR det = XMMatrixDeterminant(view);
+    const XMMATRIX invView = XMMatrixInverse(&det, view);
+    const float tanY = std::tan(0.5f * fovY);
+    const float tanX = tanY * aspect;
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        ShadowCascade& cascade = mCascades[i];
+        cascade.SplitNear = splits[i];
+        cascade.SplitFar = splits[i + 1];
+
+        XMVECTOR corners[8];
+        XMVECTOR center = XMVectorZero();
+        for (int c = 0; c < 8; ++c)
+        {
+            const float z = (c & 4) ? cascade.SplitFar : cascade.SplitNear;
+            const float x = (c & 1) ? z * tanX : -z * tanX;
+            const float y = (c & 2) ? z * tanY : -z * tanY;
+            corners[c] = XMVector3TransformCoord(XMVectorSet(x, y, z, 1.0f), invView);
+            center = XMVectorAdd(center, corners[c]);
+        }
+        center = XMVectorScale(center, 1.0f / 8.0f);
+
+        // A sphere keeps the projection's size fixed while the camera turns;
+        // rounding keeps float noise from changing it between frames.
+        float radius = 0.0f;
+        for (int c = 0; c < 8; ++c)
+            radius = std::max(radius, XMVectorGetX(XMVector3Length(XMVectorSubtract(corners[c], center))));
+        radius = std::ceil(radius * 16.0f) / 16.0f;
+
+        XMFLOAT3 lightCenter;
+        XMStoreFloat3(&lightCenter, XMVector3TransformCoord(center, lightView));
+
+        const float texel = 2.0f * radius / mSettings.Resolution;
+        cascade.Min.x = std::floor((lightCenter.x - radius) / texel) * texel;
+        cascade.Min.y = std::floor((lightCenter.y - radius) / texel) * texel;
+        cascade.Min.z = lightCenter.z - radius;
+        cascade.Max.x = cascade.Min.x + 2.0f * radius;
+        cascade.Max.y = cascade.Min.y + 2.0f * radius;
+        cascade.Max.z = lightCenter.z + radius;
+        cascade.NearZ = cascade.Min.z;
+        UpdateMatrices(cascade);
+        mCasters[i].clear();
+    }
+}
+
+void ShadowCascades::CullCasters(const BoundingBox* bounds, size_t count)
+{
+    PROFILE_FUNCTION();
+    // Every cascade shares the light view, so each box goes to light space once.
+    const XMMATRIX lightView = XMLoadFloat4x4(&mLightView);
+    const XMVECTOR absX = XMVectorAbs(lightView.r[0]);
+    const XMVECTOR absY = XMVectorAbs(lightView.r[1]);
+    const XMVECTOR absZ = XMVectorAbs(lightView.r[2]);
+
+    mCasterMin.resize(count);
+    mCasterMax.resize(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        const XMVECTOR center = XMVector3TransformCoord(XMLoadFloat3(&bounds[i].Center), lightView);
+        const XMFLOAT3& e = bounds[i].Extents;
+        XMVECTOR extents = XMVectorScale(absX, e.x);
+        extents = XMVectorMultiplyAdd(absY, XMVectorReplicate(e.y), extents);
+        extents = XMVectorMultiplyAdd(absZ, XMVectorReplicate(e.z), extents);
+        XMStoreFloat3(&mCasterMin[i], XMVectorSubtract(center, extents));
+        XMStoreFloat3(&mCasterMax[i], XMVectorAdd(center, extents));
+    }
+
+    for (uint32_t c = 0; c < mSettings.Count; ++c)
+    {
+        ShadowCascade& cascade = mCascades[c];
+        std::vector<uint32_t>& casters = mCasters[c];
+        casters.clear();
+
+        float nearest = cascade.Min.z;
+        for (size_t i = 0; i < count; ++i)
+        {
+            const XMFLOAT3& lo = mCasterMin[i];
+            const XMFLOAT3& hi = mCasterMax[i];
+            if (hi.x < cascade.Min.x || lo.x > cascade.Max.x ||
+                hi.y < cascade.Min.y || lo.y > cascade.Max.y ||
+                lo.z > cascade.Max.z)
+                continue;
+            casters.push_back((uint32_t)i);
+            nearest = std::min(nearest, lo.z);
+        }
+
+        cascade.NearZ = nearest;
+        UpdateMatrices(cascade);
+    }
+}
+
+void ShadowCascades::UpdateMatrices(ShadowCascade& cascade)
+{
+    const XMMATRIX proj = XMMatrixOrthographicOffCenterLH(cascade.Min.x, cascade.Max.x,
+        cascade.Min.y, cascade.Max.y, cascade.NearZ, cascade.Max.z);
+    const XMMATRIX viewProj = XMMatrixMultiply(XMLoadFloat4x4(&mLightView), proj);
+
+    // Transform NDC space [-1,+1]^2 to texture space [0,1]^2
+    const XMMATRIX T(
+        0.5f, 0.0f, 0.0f, 0.0f,
+        0.0f, -0.5f, 0.0f, 0.0f,
+        0.0f, 0.0f, 1.0f, 0.0f,
+        0.5f, 0.5f, 0.0f, 1.0f);
+
+    XMStoreFloat4x4(&cascade.Proj, proj);
+    XMStoreFloat4x4(&cascade.ViewProj, viewProj);
+    XMStoreFloat4x4(&cascade.ShadowTransform, XMMatrixMultiply(viewProj, T));
+}
+
+uint32_t ShadowCascades::Count()const
+{
+    return mSettings.Count;
+}
+
+const ShadowCascade& ShadowCascades::Cascade(uint32_t i)const
+{
+    return mCascades[i];
+}
+
+const std::vector<uint32_t>& ShadowCascades::Casters(uint32_t i)const
+{
+    return mCasters[i];
+}
+
+const XMFLOAT4X4& ShadowCascades::LightView()const
+{
+    return mLightView;
+}
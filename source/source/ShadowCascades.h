@@ -0,0 +1,85 @@
+#pragma once
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+#include <cstdint>
+#include <vector>
+
+// Cascaded shadow maps for one directional light, CPU side.  The view frustum
+// is split into depth ranges; each range gets an orthographic light
+// projection that only moves in whole shadow map texels, so shadows do not
+// shimmer as the camera moves, and the list of objects that can cast into it.
+// Nothing here touches D3D, so fitting and culling run without a device.
+
+struct CascadeSettings
+{
+    uint32_t Count = 4;
+    // Shadow map size in texels, used for snapping.
+    uint32_t Resolution = 2048;
+    // Blend between uniform (0) and logarithmic (1) split distances.
+    float Lambda = 0.75f;
+    // Shadows end here; 0 uses the camera's far plane.
+    float MaxDistance = 200.0f;
+};
+
+struct ShadowCascade
+{
+    // View space depth range the cascade covers.
+    float SplitNear = 0.0f;
+    float SplitFar = 0.0f;
+
+    DirectX::XMFLOAT4X4 Proj;
+    DirectX::XMFLOAT4X4 ViewProj;
+    // World space to shadow map uv and depth.
+    DirectX::XMFLOAT4X4 ShadowTransform;
+
+    // Light space box of the receivers: x and y are the texel snapped
+    // projection bounds, z the depth of the split's bounding sphere.
+    DirectX::XMFLOAT3 Min;
+    DirectX::XMFLOAT3 Max;
+    // Depth the projection starts at; pulled toward the light to the
+    // nearest caster by CullCasters.
+    float NearZ = 0.0f;
+};
+
+class ShadowCascades
+{
+public:
+    static const uint32_t MaxCascades = 8;
+
+    explicit ShadowCascades(const CascadeSettings& settings = CascadeSettings());
+
+    void SetSettings(const CascadeSettings& settings);
+    const CascadeSettings& Settings()const;
+
+    // Split distances of the practical split scheme for the given planes:
+    // Count + 1 values from nearZ to farZ.
+    static void SplitDistances(uint32_t count, float lambda, float nearZ, float farZ, float* splits);
+
+    // Fits the cascades to the camera and a light shining along lightDir.
+    void Fit(DirectX::FXMMATRIX view, float fovY, float aspect, float nearZ, float farZ,
+        const DirectX::XMFLOAT3& lightDir);
+
+    // Sorts world space caster bounds into the cascades they can shadow and
+    // moves each cascade's near plane back to its nearest caster.  A caster
+    // counts when it overlaps the cascade across the light and is not wholly
+    // behind its receivers: the cascade's culling volume reaches all the way
+    // to the light.
+    void CullCasters(const DirectX::BoundingBox* bounds, size_t count);
+
+    uint32_t Count()const;
+    const ShadowCascade& Cascade(uint32_t i)const;
+    // Indices into the bounds passed to CullCasters.
+    const std::vector<uint32_t>& Casters(uint32_t i)const;
+    const DirectX::XMFLOAT4X4& LightView()const;
+
+private:
+    void UpdateMatrices(ShadowCascade& cascade);
+
+    CascadeSettings mSettings;
+    DirectX::XMFLOAT4X4 mLightView;
+    std::vector<ShadowCascade> mCascades;
+    std::vector<std::vector<uint32_t>> mCasters;
+    // Light space boxes of the last CullCasters call.
+    std::vector<DirectX::XMFLOAT3> mCasterMin;
+    std::vector<DirectX::XMFLOAT3> mCasterMax;
+};
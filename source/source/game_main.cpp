@@ -1,9 +1,119 @@
 #include "Game_engine_core.h"
 #include "Collider.h"
 #include "ObjLoader.h"
+#include "ApiTracePlayer.h"
+#include "SceneGenerator.h"
+#include <sstream>
 
 GameTimer mTimer;
 
+// -capture <file> records the session into an API trace.  -replay <file>
+// plays a trace back without a window and writes the CPU time of every
+// frame to the -timings file.
+//
+// -stress <count> replaces the demo with a generated scene, shaped by
+// -layout uniform|clustered|city, -seed, -materials, -motion
+// static|spin|orbit|bob|mixed and -moving <fraction>.  With -stress-trace
+// <file> the scene is written as a trace of -frames frames for -replay
+// instead of being shown.
+struct Options {
+    std::string capture;
+    std::string replay;
+    std::string timings = "replay_timings.csv";
+
+    bool stress = false;
+    SceneSettings scene;
+    std::string stressTrace;
+    SceneTraceSettings trace;
+};
+
+SceneLayout parse_layout(const std::string& name) {
+    if (name == "clustered")
+        return SceneLayout::Clustered;
+    if (name == "city")
+        return SceneLayout::CityGrid;
+    return SceneLayout::Uniform;
+}
+
+SceneMotion parse_motion(const std::string& name) {
+    if (name == "spin")
+        return SceneMotion::Spin;
+    if (name == "orbit")
+        return SceneMotion::Orbit;
+    if (name == "bob")
+        return SceneMotion::Bob;
+    if (name == "mixed")
+        return SceneMotion::Mixed;
+    return SceneMotion::Static;
+}
+
+Options parse_options(PSTR cmdLine) {
+    Options options;
+    std::istringstream in(cmdLine);
+    std::string arg;
+    while (in >> arg) {
+        if (arg == "-capture")
+            in >> options.capture;
+        else if (arg == "-replay")
+            in >> options.replay;
+        else if (arg == "-timings")
+            in >> options.timings;
+        else if (arg == "-stress") {
+            options.stress = true;
+            in >> options.scene.ObjectCount;
+        }
+        else if (arg == "-layout" && in >> arg)
+            options.scene.Layout = parse_layout(arg);
+        else if (arg == "-seed")
+            in >> options.scene.Seed;
+        else if (arg == "-materials")
+            in >> options.scene.MaterialCount;
+        else if (arg == "-motion" && in >> arg)
+            options.scene.Motion = parse_motion(arg);
+        else if (arg == "-moving")
+            in >> options.scene.MovingFraction;
+        else if (arg == "-stress-trace")
+            in >> options.stressTrace;
+        else if (arg == "-frames")
+            in >> options.trace.Frames;
+    }
+    return options;
+}
+
+int replay(HINSTANCE hInstance, const Options& options) {
+    Game_engine Game(hInstance, true);
+    ApiTracePlayer player(&Game);
+    const bool ok = player.Open(AnsiToWString(options.replay)) && player.Run();
+    player.SaveTimings(options.timings);
+
+    std::ostringstream summary;
+    summary << player.Timings().size() << " frames, cpu ms p50 " << player.CpuTimes().Percentile(50.0f)
+        << " p95 " << player.CpuTimes().Percentile(95.0f) << " p99 " << player.CpuTimes().Percentile(99.0f) << "\n";
+    if (!ok)
+        summary << "replay failed: " << player.Error() << "\n";
+    OutputDebugStringA(summary.str().c_str());
+    return ok ? 0 : 1;
+}
+
+// The built-in shapes and the demo's models, in every layout.
+void add_models(SceneGenerator& generator, ObjLoader& loader) {
+    generator.AddMesh("cat", loader.LoadObj("../../Models/cat.obj"));
+    generator.AddMesh("monkey", loader.LoadObj("../../Models/monkey.obj"));
+    loader.get_error();
+}
+
+int write_stress_trace(const Options& options) {
+    ObjLoader loader;
+    SceneGenerator generator;
+    add_models(generator, loader);
+    generator.Generate(options.scene);
+    if (!generator.WriteTrace(options.stressTrace, options.trace)) {
+        OutputDebugStringA(("can't write " + options.stressTrace + "\n").c_str());
+        return 1;
+    }
+    return 0;
+}
+
 void update(Game_engine& gm) {
     mTimer.Tick();
     gm.Update(mTimer);
@@ -20,28 +130,46 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE prevInstance,
 #endif
     try
     {
+        const Options options = parse_options(cmdLine);
+        if (!options.replay.empty())
+            return replay(hInstance, options);
+        if (options.stress && !options.stressTrace.empty())
+            return write_stress_trace(options);
+
         Game_engine Game(hInstance);
+        if (!options.capture.empty())
+            Game.StartApiCapture(options.capture);
         Game.LoadTexture(L"../../Textures/white.dds", "white");
         Game.LoadTexture(L"../../Textures/stone.dds", "stone");
         if (!Game.Initialize())
             return 0;
 
-        ObjLoader loader;
-        Mesh msh = loader.LoadObj("../../Models/cat.obj");
-        Mesh msh2 = loader.LoadObj("../../Models/monkey.obj");
-        loader.get_error();
-        Game.CreateMaterial("mat", (XMFLOAT4)Colors::Gold, (XMFLOAT3)Colors::White, 0.02f, "white");
-        Game.CreateMaterial("mat2", (XMFLOAT4)Colors::White, (XMFLOAT3)Colors::White, 0.02f, "stone");
+        ObjLoader loader(&Game.GetAssetCache());
+        SceneGenerator generator;
+        if (options.stress) {
+            add_models(generator, loader);
+            generator.Generate(options.scene);
+            generator.Build(Game);
+            Game.CameraLookAt(generator.CameraPosition(0.0f), XMFLOAT3(0, 0, 0), XMFLOAT3(0, 1, 0));
+        }
+        else {
+            Mesh msh = loader.LoadObj("../../Models/cat.obj");
+            Mesh msh2 = loader.LoadObj("../../Models/monkey.obj");
+            loader.get_error();
+            Game.CreateMaterial("mat", (XMFLOAT4)Colors::Gold, (XMFLOAT3)Colors::White, 0.02f, "white");
+            Game.CreateMaterial("mat2", (XMFLOAT4)Colors::White, (XMFLOAT3)Colors::White, 0.02f, "stone");
 
-        Game.CreateGeometry(msh, XMFLOAT3(0, 0, 0), "mat", "cat");
-        Game.CreateGeometry(msh2, XMFLOAT3(3, 0, 0), "mat2", "monkey");
-        Game.CreateWorld();
+            Game.CreateGeometry(msh, XMFLOAT3(0, 0, 0), "mat", "cat");
+            Game.CreateGeometry(msh2, XMFLOAT3(3, 0, 0), "mat2", "monkey");
+            Game.CreateWorld();
+
+            Game.CameraWalk(-4);
+            Game.SetAmbient(XMFLOAT4(0.4f,0.4f,0.6f,1.f));
+            Game.SetLight(XMFLOAT3(0.7f, -0.5f, 0.4f), XMFLOAT3(0.6f,0.5f,0.5f));
+        }
         MSG msg = { 0 };
         mTimer.Reset();
 
-        Game.CameraWalk(-4);
-        Game.SetAmbient(XMFLOAT4(0.4f,0.4f,0.6f,1.f));
-        Game.SetLight(XMFLOAT3(0.7f, -0.5f, 0.4f), XMFLOAT3(0.6f,0.5f,0.5f));
         //Game.DoNotDrawObject("monkey");
         while (msg.message != WM_QUIT)
         {
@@ -55,7 +183,10 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE prevInstance,
             else
             {
                 //chip
-                Game.MoveObject("cat", XMMatrixRotationY(mTimer.TotalTime()));
+                if (options.stress)
+                    generator.Animate(Game, mTimer.TotalTime());
+                else
+                    Game.MoveObject("cat", XMMatrixRotationY(mTimer.TotalTime()));
                 update(Game);
             }
         }
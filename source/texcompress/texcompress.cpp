@@ -0,0 +1,633 @@
+// Offline texture compressor.
+//
+//   texcompress [options] input output.dds    compress a TGA or uncompressed DDS
+//   texcompress -d input.dds output.tga       decode a BC1/BC3/BC5/BC7 DDS for inspection
+//   texcompress -bench input [options]        PSNR and throughput for every format/quality
+//
+// Options:
+//   -f bc1|bc3|bc5|bc7    output format (default bc7)
+//   -q fast|normal|high   encoder quality (default normal)
+//   -t N                  encoder threads, 0 = all hardware threads (default 0)
+//   -srgb                 tag the output as sRGB (not available for bc5); mips are
+//                         then filtered in linear space
+//   -mips none|box|kaiser mip chain filter (default box, full chain down to 1x1)
+//   -verify               decode the result and print its PSNR
+//
+// Only the standard library is used, so the tool also builds on build machines
+// without the Windows SDK.
+
+#include "../../Common/BCnCodec.h"
+#include "../../Common/MipGenerator.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace
+{
+    struct Image
+    {
+        uint32_t Width = 0;
+        uint32_t Height = 0;
+        std::vector<uint8_t> Pixels;    // RGBA8
+    };
+
+    const uint32_t DDS_MAGIC = 0x20534444; // "DDS "
+    const uint32_t DDS_FOURCC = 0x00000004;
+    const uint32_t DDS_RGB = 0x00000040;
+    const uint32_t DDS_HEADER_FLAGS_TEXTURE = 0x00001007; // DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT
+    const uint32_t DDS_HEADER_FLAGS_MIPMAP = 0x00020000;
+    const uint32_t DDS_HEADER_FLAGS_LINEARSIZE = 0x00080000;
+    const uint32_t DDS_SURFACE_FLAGS_TEXTURE = 0x00001000;
+    const uint32_t DDS_SURFACE_FLAGS_MIPMAP = 0x00400008; // DDSCAPS_COMPLEX | DDSCAPS_MIPMAP
+    const uint32_t DDS_DIMENSION_TEXTURE2D = 3;
+
+    constexpr uint32_t MakeFourCC(char a, char b, char c, char d)
+    {
+        return (uint32_t)(uint8_t)a | ((uint32_t)(uint8_t)b << 8) |
+            ((uint32_t)(uint8_t)c << 16) | ((uint32_t)(uint8_t)d << 24);
+    }
+
+#pragma pack(push, 1)
+    struct DDS_PIXELFORMAT
+    {
+        uint32_t size;
+        uint32_t flags;
+        uint32_t fourCC;
+        uint32_t RGBBitCount;
+        uint32_t RBitMask;
+        uint32_t GBitMask;
+        uint32_t BBitMask;
+        uint32_t ABitMask;
+    };
+
+    struct DDS_HEADER
+    {
+        uint32_t size;
+        uint32_t flags;
+        uint32_t height;
+        uint32_t width;
+        uint32_t pitchOrLinearSize;
+        uint32_t depth;
+        uint32_t mipMapCount;
+        uint32_t reserved1[11];
+        DDS_PIXELFORMAT ddspf;
+        uint32_t caps;
+        uint32_t caps2;
+        uint32_t caps3;
+        uint32_t caps4;
+        uint32_t reserved2;
+    };
+
+    struct DDS_HEADER_DXT10
+    {
+        uint32_t dxgiFormat;
+        uint32_t resourceDimension;
+        uint32_t miscFlag;
+        uint32_t arraySize;
+        uint32_t miscFlags2;
+    };
+#pragma pack(pop)
+
+    bool ReadFile(const std::string& path, std::vector<uint8_t>& data)
+    {
+        FILE* f = fopen(path.c_str(), "rb");
+        if (!f)
+            return false;
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        data.resize(size > 0 ? (size_t)size : 0);
+        bool ok = size > 0 && fread(data.data(), 1, data.size(), f) == data.size();
+        fclose(f);
+        return ok;
+    }
+
+    bool WriteFile(const std::string& path, const std::vector<uint8_t>& data)
+    {
+        FILE* f = fopen(path.c_str(), "wb");
+        if (!f)
+            return false;
+        bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+        return fclose(f) == 0 && ok;
+    }
+
+    bool HasExtension(const std::string& path, const char* ext)
+    {
+        size_t n = strlen(ext);
+        if (path.size() < n)
+            return false;
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (tolower((unsigned char)path[path.size() - n + i]) != ext[i])
+                return false;
+        }
+        return true;
+    }
+
+    // Uncompressed and RLE true color TGA, 24 or 32 bits per pixel.
+    bool LoadTga(const std::vector<uint8_t>& file, Image& img)
+    {
+        if (file.size() < 18)
+            return false;
+        const uint8_t idLength = file[0];
+        const uint8_t type = file[2];
+        const uint32_t width = file[12] | (file[13] << 8);
+        const uint32_t height = file[14] | (file[15] << 8);
+        const uint32_t bpp = file[16];
+        const bool topDown = (file[17] & 0x20) != 0;
+        if ((type != 2 && type != 10) || (bpp != 24 && bpp != 32) || width == 0 || height == 0 || file[1] != 0)
+            return false;
+
+        const size_t bytesPerPixel = bpp / 8;
+        const size_t count = (size_t)width * height;
+        std::vector<uint8_t> bgra(count * 4, 255);
+        size_t pos = 18 + idLength;
+        size_t pixel = 0;
+        auto readPixel = [&](size_t dst)
+        {
+            memcpy(&bgra[dst * 4], &file[pos], bytesPerPixel);
+            pos += bytesPerPixel;
+        };
+        while (pixel < count)
+        {
+            if (type == 2)
+            {
+                if (pos + bytesPerPixel > file.size())
+                    return false;
+                readPixel(pixel++);
+                continue;
+            }
+            if (pos >= file.size())
+                return false;
+            const uint8_t packet = file[pos++];
+            const size_t run = (packet & 0x7F) + 1;
+            if (pixel + run > count)
+                return false;
+            if (packet & 0x80)
+            {
+                if (pos + bytesPerPixel > file.size())
+                    return false;
+                readPixel(pixel);
+                for (size_t i = 1; i < run; ++i)
+                    memcpy(&bgra[(pixel + i) * 4], &bgra[pixel * 4], 4);
+                pixel += run;
+            }
+            else
+            {
+                if (pos + run * bytesPerPixel > file.size())
+                    return false;
+                for (size_t i = 0; i < run; ++i)
+                    readPixel(pixel++);
+            }
+        }
+
+        img.Width = width;
+        img.Height = height;
+        img.Pixels.resize(count * 4);
+        for (uint32_t y = 0; y < height; ++y)
+        {
+            const uint32_t srcRow = topDown ? y : height - 1 - y;
+            for (uint32_t x = 0; x < width; ++x)
+            {
+                const uint8_t* s = &bgra[((size_t)srcRow * width + x) * 4];
+                uint8_t* d = &img.Pixels[((size_t)y * width + x) * 4];
+                d[0] = s[2];
+                d[1] = s[1];
+                d[2] = s[0];
+                d[3] = s[3];
+            }
+        }
+        return true;
+    }
+
+    bool WriteTga(const std::string& path, const Image& img)
+    {
+        std::vector<uint8_t> file(18 + img.Pixels.size());
+        file[2] = 2;
+        file[12] = (uint8_t)(img.Width & 0xFF);
+        file[13] = (uint8_t)(img.Width >> 8);
+        file[14] = (uint8_t)(img.Height & 0xFF);
+        file[15] = (uint8_t)(img.Height >> 8);
+        file[16] = 32;
+        file[17] = 0x28; // top-down, 8 alpha bits
+        for (size_t i = 0; i < img.Pixels.size(); i += 4)
+        {
+            file[18 + i + 0] = img.Pixels[i + 2];
+            file[18 + i + 1] = img.Pixels[i + 1];
+            file[18 + i + 2] = img.Pixels[i + 0];
+            file[18 + i + 3] = img.Pixels[i + 3];
+        }
+        return WriteFile(path, file);
+    }
+
+    // Locates header, optional DX10 header and the first surface of a DDS file.
+    bool ParseDds(const std::vector<uint8_t>& file, const DDS_HEADER*& header,
+        const DDS_HEADER_DXT10*& dx10, const uint8_t*& bits, size_t& bitSize)
+    {
+        if (file.size() < sizeof(uint32_t) + sizeof(DDS_HEADER))
+            return false;
+        uint32_t magic;
+        memcpy(&magic, file.data(), sizeof(magic));
+        header = reinterpret_cast<const DDS_HEADER*>(file.data() + sizeof(uint32_t));
+        if (magic != DDS_MAGIC || header->size != sizeof(DDS_HEADER) ||
+            header->ddspf.size != sizeof(DDS_PIXELFORMAT))
+            return false;
+
+        size_t offset = sizeof(uint32_t) + sizeof(DDS_HEADER);
+        dx10 = nullptr;
+        if ((header->ddspf.flags & DDS_FOURCC) && header->ddspf.fourCC == MakeFourCC('D', 'X', '1', '0'))
+        {
+            if (file.size() < offset + sizeof(DDS_HEADER_DXT10))
+                return false;
+            dx10 = reinterpret_cast<const DDS_HEADER_DXT10*>(file.data() + offset);
+            offset += sizeof(DDS_HEADER_DXT10);
+        }
+        bits = file.data() + offset;
+        bitSize = file.size() - offset;
+        return true;
+    }
+
+    // 32 bit RGBA or BGRA DDS, top mip only.
+    bool LoadUncompressedDds(const std::vector<uint8_t>& file, Image& img)
+    {
+        const DDS_HEADER* header;
+        const DDS_HEADER_DXT10* dx10;
+        const uint8_t* bits;
+        size_t bitSize;
+        if (!ParseDds(file, header, dx10, bits, bitSize))
+            return false;
+
+        bool bgra;
+        if (dx10)
+        {
+            // R8G8B8A8_UNORM(_SRGB) or B8G8R8A8_UNORM(_SRGB)
+            if (dx10->dxgiFormat == 28 || dx10->dxgiFormat == 29)
+                bgra = false;
+            else if (dx10->dxgiFormat == 87 || dx10->dxgiFormat == 91)
+                bgra = true;
+            else
+                return false;
+        }
+        else
+        {
+            const DDS_PIXELFORMAT& pf = header->ddspf;
+            if (!(pf.flags & DDS_RGB) || pf.RGBBitCount != 32)
+                return false;
+            if (pf.RBitMask == 0x000000FF && pf.GBitMask == 0x0000FF00 && pf.BBitMask == 0x00FF0000)
+                bgra = false;
+            else if (pf.RBitMask == 0x00FF0000 && pf.GBitMask == 0x0000FF00 && pf.BBitMask == 0x000000FF)
+                bgra = true;
+            else
+                return false;
+        }
+
+        const size_t count = (size_t)header->width * header->height;
+        if (count == 0 || bitSize < count * 4)
+            return false;
+        // Formats without an alpha mask read as opaque.
+        const bool hasAlpha = dx10 || header->ddspf.ABitMask != 0;
+
+        img.Width = header->width;
+        img.Height = header->height;
+        img.Pixels.assign(bits, bits + count * 4);
+        for (size_t i = 0; i < count; ++i)
+        {
+            uint8_t* p = &img.Pixels[i * 4];
+            if (bgra)
+                std::swap(p[0], p[2]);
+            if (!hasAlpha)
+                p[3] = 255;
+        }
+        return true;
+    }
+
+    bool LoadImage(const std::string& path, Image& img)
+    {
+        std::vector<uint8_t> file;
+        if (!ReadFile(path, file))
+            return false;
+        if (HasExtension(path, ".dds"))
+            return LoadUncompressedDds(file, img);
+        return LoadTga(file, img);
+    }
+
+    // blocks holds mipCount levels back to back, largest first.
+    bool WriteCompressedDds(const std::string& path, BCFormat format, bool srgb,
+        uint32_t width, uint32_t height, uint32_t mipCount, const std::vector<uint8_t>& blocks)
+    {
+        DDS_HEADER header = {};
+        header.size = sizeof(DDS_HEADER);
+        header.flags = DDS_HEADER_FLAGS_TEXTURE | DDS_HEADER_FLAGS_LINEARSIZE;
+        header.height = height;
+        header.width = width;
+        header.pitchOrLinearSize = (uint32_t)BCSurfaceSize(format, width, height);
+        header.mipMapCount = mipCount;
+        header.ddspf.size = sizeof(DDS_PIXELFORMAT);
+        header.ddspf.flags = DDS_FOURCC;
+        header.caps = DDS_SURFACE_FLAGS_TEXTURE;
+        if (mipCount > 1)
+        {
+            header.flags |= DDS_HEADER_FLAGS_MIPMAP;
+            header.caps |= DDS_SURFACE_FLAGS_MIPMAP;
+        }
+
+        // Legacy FourCCs where one exists, so older viewers can open the file.
+        bool needDx10 = srgb || format == BCFormat::BC7;
+        switch (format)
+        {
+        case BCFormat::BC1: header.ddspf.fourCC = MakeFourCC('D', 'X', 'T', '1'); break;
+        case BCFormat::BC3: header.ddspf.fourCC = MakeFourCC('D', 'X', 'T', '5'); break;
+        case BCFormat::BC5: header.ddspf.fourCC = MakeFourCC('A', 'T', 'I', '2'); break;
+        case BCFormat::BC7: break;
+        }
+
+        DDS_HEADER_DXT10 dx10 = {};
+        if (needDx10)
+        {
+            header.ddspf.fourCC = MakeFourCC('D', 'X', '1', '0');
+            dx10.dxgiFormat = BCDxgiFormat(format, srgb);
+            dx10.resourceDimension = DDS_DIMENSION_TEXTURE2D;
+            dx10.arraySize = 1;
+        }
+
+        std::vector<uint8_t> file;
+        auto append = [&file](const void* data, size_t size)
+        {
+            const uint8_t* p = static_cast<const uint8_t*>(data);
+            file.insert(file.end(), p, p + size);
+        };
+        append(&DDS_MAGIC, sizeof(DDS_MAGIC));
+        append(&header, sizeof(header));
+        if (needDx10)
+            append(&dx10, sizeof(dx10));
+        append(blocks.data(), blocks.size());
+        return WriteFile(path, file);
+    }
+
+    bool LoadCompressedDds(const std::string& path, BCFormat& format, Image& img, std::vector<uint8_t>& blocks)
+    {
+        std::vector<uint8_t> file;
+        const DDS_HEADER* header;
+        const DDS_HEADER_DXT10* dx10;
+        const uint8_t* bits;
+        size_t bitSize;
+        if (!ReadFile(path, file) || !ParseDds(file, header, dx10, bits, bitSize))
+            return false;
+
+        if (dx10)
+        {
+            switch (dx10->dxgiFormat)
+            {
+            case 71: case 72: format = BCFormat::BC1; break;
+            case 77: case 78: format = BCFormat::BC3; break;
+            case 83: format = BCFormat::BC5; break;
+            case 98: case 99: format = BCFormat::BC7; break;
+            default: return false;
+            }
+        }
+        else
+        {
+            const uint32_t fourCC = header->ddspf.fourCC;
+            if (fourCC == MakeFourCC('D', 'X', 'T', '1'))
+                format = BCFormat::BC1;
+            else if (fourCC == MakeFourCC('D', 'X', 'T', '5'))
+                format = BCFormat::BC3;
+            else if (fourCC == MakeFourCC('A', 'T', 'I', '2') || fourCC == MakeFourCC('B', 'C', '5', 'U'))
+                format = BCFormat::BC5;
+            else
+                return false;
+        }
+
+        img.Width = header->width;
+        img.Height = header->height;
+        const size_t size = BCSurfaceSize(format, img.Width, img.Height);
+        if (bitSize < size)
+            return false;
+        blocks.assign(bits, bits + size);
+        return true;
+    }
+
+    bool ParseFormat(const std::string& s, BCFormat& format)
+    {
+        if (s == "bc1") format = BCFormat::BC1;
+        else if (s == "bc3") format = BCFormat::BC3;
+        else if (s == "bc5") format = BCFormat::BC5;
+        else if (s == "bc7") format = BCFormat::BC7;
+        else return false;
+        return true;
+    }
+
+    bool ParseQuality(const std::string& s, BCQuality& quality)
+    {
+        if (s == "fast") quality = BCQuality::Fast;
+        else if (s == "normal") quality = BCQuality::Normal;
+        else if (s == "high") quality = BCQuality::High;
+        else return false;
+        return true;
+    }
+
+    const char* FormatName(BCFormat format)
+    {
+        switch (format)
+        {
+        case BCFormat::BC1: return "bc1";
+        case BCFormat::BC3: return "bc3";
+        case BCFormat::BC5: return "bc5";
+        case BCFormat::BC7: return "bc7";
+        }
+        return "?";
+    }
+
+    const char* QualityName(BCQuality quality)
+    {
+        switch (quality)
+        {
+        case BCQuality::Fast: return "fast";
+        case BCQuality::Normal: return "normal";
+        case BCQuality::High: return "high";
+        }
+        return "?";
+    }
+
+    int Usage()
+    {
+        fprintf(stderr,
+            "usage: texcompress [-f bc1|bc3|bc5|bc7] [-q fast|normal|high] [-t threads] [-srgb]\n"
+            "                   [-mips none|box|kaiser] [-verify] input output.dds\n"
+            "       texcompress -d input.dds output.tga\n"
+            "       texcompress -bench input [-t threads]\n");
+        return 1;
+    }
+
+    // One CSV row per format/quality pair.  Encoding is repeated until at least
+    // half a second has passed so small textures still give stable numbers.
+    int Bench(const Image& img, unsigned threads)
+    {
+        const BCFormat formats[] = { BCFormat::BC1, BCFormat::BC3, BCFormat::BC5, BCFormat::BC7 };
+        const BCQuality qualities[] = { BCQuality::Fast, BCQuality::Normal, BCQuality::High };
+
+        printf("format,quality,threads,width,height,runs,ms_per_run,mpix_per_s,psnr_db\n");
+        for (BCFormat format : formats)
+        {
+            for (BCQuality quality : qualities)
+            {
+                std::vector<uint8_t> blocks;
+                int runs = 0;
+                auto start = std::chrono::steady_clock::now();
+                double seconds = 0.0;
+                do
+                {
+                    blocks = CompressSurface(img.Pixels.data(), img.Width, img.Height, format, quality, threads);
+                    ++runs;
+                    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                } while (seconds < 0.5);
+
+                std::vector<uint8_t> decoded;
+                DecompressSurface(blocks.data(), img.Width, img.Height, format, decoded);
+                const double psnr = BCPsnr(format, img.Pixels.data(), decoded.data(), (size_t)img.Width * img.Height);
+                const double msPerRun = seconds * 1000.0 / runs;
+                const double mpix = (double)img.Width * img.Height * runs / seconds / 1.0e6;
+                printf("%s,%s,%u,%u,%u,%d,%.3f,%.2f,%.2f\n", FormatName(format), QualityName(quality),
+                    threads, img.Width, img.Height, runs, msPerRun, mpix, psnr);
+            }
+        }
+        return 0;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    BCFormat format = BCFormat::BC7;
+    BCQuality quality = BCQuality::Normal;
+    unsigned threads = 0;
+    bool srgb = false;
+    bool verify = false;
+    bool decode = false;
+    bool bench = false;
+    bool mips = true;
+    MipFilter mipFilter = MipFilter::Box;
+    std::vector<std::string> files;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "-f" && i + 1 < argc)
+        {
+            if (!ParseFormat(argv[++i], format))
+                return Usage();
+        }
+        else if (arg == "-q" && i + 1 < argc)
+        {
+            if (!ParseQuality(argv[++i], quality))
+                return Usage();
+        }
+        else if (arg == "-t" && i + 1 < argc)
+            threads = (unsigned)atoi(argv[++i]);
+        else if (arg == "-mips" && i + 1 < argc)
+        {
+            std::string filter = argv[++i];
+            if (filter == "none")
+                mips = false;
+            else if (filter == "box")
+                mipFilter = MipFilter::Box;
+            else if (filter == "kaiser")
+                mipFilter = MipFilter::Kaiser;
+            else
+                return Usage();
+        }
+        else if (arg == "-srgb")
+            srgb = true;
+        else if (arg == "-verify")
+            verify = true;
+        else if (arg == "-d")
+            decode = true;
+        else if (arg == "-bench")
+            bench = true;
+        else if (!arg.empty() && arg[0] == '-')
+            return Usage();
+        else
+            files.push_back(arg);
+    }
+
+    if (bench)
+    {
+        Image img;
+        if (files.size() != 1)
+            return Usage();
+        if (!LoadImage(files[0], img))
+        {
+            fprintf(stderr, "texcompress: cannot read %s\n", files[0].c_str());
+            return 1;
+        }
+        return Bench(img, threads);
+    }
+
+    if (files.size() != 2)
+        return Usage();
+
+    if (decode)
+    {
+        Image img;
+        std::vector<uint8_t> blocks;
+        if (!LoadCompressedDds(files[0], format, img, blocks))
+        {
+            fprintf(stderr, "texcompress: %s is not a BC1/BC3/BC5/BC7 DDS\n", files[0].c_str());
+            return 1;
+        }
+        if (!DecompressSurface(blocks.data(), img.Width, img.Height, format, img.Pixels))
+            fprintf(stderr, "texcompress: %s uses BC7 modes the decoder does not support\n", files[0].c_str());
+        if (!WriteTga(files[1], img))
+        {
+            fprintf(stderr, "texcompress: cannot write %s\n", files[1].c_str());
+            return 1;
+        }
+        return 0;
+    }
+
+    if (srgb && format == BCFormat::BC5)
+    {
+        fprintf(stderr, "texcompress: bc5 has no sRGB variant\n");
+        return 1;
+    }
+
+    Image img;
+    if (!LoadImage(files[0], img))
+    {
+        fprintf(stderr, "texcompress: cannot read %s (expected 24/32 bit TGA or 32 bit DDS)\n", files[0].c_str());
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<uint8_t> blocks = CompressSurface(img.Pixels.data(), img.Width, img.Height, format, quality, threads);
+    std::vector<MipLevel> levels;
+    if (mips)
+        levels = GenerateMips(img.Pixels.data(), img.Width, img.Height, mipFilter, srgb, threads);
+    for (const MipLevel& level : levels)
+    {
+        std::vector<uint8_t> mip = CompressSurface(level.Pixels.data(), level.Width, level.Height, format, quality, threads);
+        blocks.insert(blocks.end(), mip.begin(), mip.end());
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const uint32_t mipCount = (uint32_t)levels.size() + 1;
+    if (!WriteCompressedDds(files[1], format, srgb, img.Width, img.Height, mipCount, blocks))
+    {
+        fprintf(stderr, "texcompress: cannot write %s\n", files[1].c_str());
+        return 1;
+    }
+
+    printf("%s: %ux%u %u mips %s/%s %.1f ms\n", files[1].c_str(), img.Width, img.Height, mipCount,
+        FormatName(format), QualityName(quality), seconds * 1000.0);
+    if (verify)
+    {
+        std::vector<uint8_t> decoded;
+        DecompressSurface(blocks.data(), img.Width, img.Height, format, decoded);
+        printf("psnr %.2f dB\n", BCPsnr(format, img.Pixels.data(), decoded.data(), (size_t)img.Width * img.Height));
+    }
+    return 0;
+}